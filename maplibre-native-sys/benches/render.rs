@@ -0,0 +1,427 @@
+//! Render path benchmark for the C API
+//!
+//! Drives `mln_map_create`, `mln_map_load_style` and `mln_map_render_still`
+//! directly over a fixed tile set (several styles, zooms and scales 1-3) and
+//! reports map creation, style load, render, readback and copy times
+//! separately, followed by render throughput per thread count, one call per
+//! tile and batched with `mln_map_render_batch`.
+//!
+//! ```text
+//! cargo bench -p maplibre-native-sys --bench render -- \
+//!     [--iterations N] [--threads 1,2,4,8] [--style name=path/to/style.json]
+//! ```
+//!
+//! The built-in styles only use inline GeoJSON so no network access is
+//! needed. Styles passed with `--style` may fetch their resources over the
+//! network, which shows up in the render and resource wait times. Without a MapLibre Native
+//! build this runs against the stub, so the numbers only cover the wrapper.
+
+use std::ffi::{CStr, CString};
+use std::sync::{Arc, Barrier};
+use std::time::{Duration, Instant};
+
+use maplibre_native_sys::*;
+
+const TILE_SIZE: u32 = 512;
+const ZOOMS: [u8; 5] = [2, 6, 10, 13, 15];
+const SCALES: [f32; 3] = [1.0, 2.0, 3.0];
+/// Tiles per zoom level: a 2×2 block around the center
+const BLOCK: u32 = 2;
+/// Berlin
+const CENTER: (f64, f64) = (52.52, 13.405);
+
+struct Args {
+    iterations: usize,
+    threads: Vec<usize>,
+    styles: Vec<(String, String)>,
+}
+
+fn parse_args() -> Args {
+    let mut args = Args {
+        iterations: 5,
+        threads: vec![1, 2, 4, 8],
+        styles: builtin_styles(),
+    };
+
+    let mut argv = std::env::args().skip(1);
+    while let Some(arg) = argv.next() {
+        match arg.as_str() {
+            "--iterations" => {
+                args.iterations = argv
+                    .next()
+                    .and_then(|n| n.parse().ok())
+                    .expect("--iterations takes a number");
+            }
+            "--threads" => {
+                args.threads = argv
+                    .next()
+                    .map(|list| list.split(',').filter_map(|n| n.parse().ok()).collect())
+                    .expect("--threads takes a comma-separated list");
+            }
+            "--style" => {
+                let spec = argv.next().expect("--style takes name=path");
+                let (name, path) = spec.split_once('=').expect("--style takes name=path");
+                let json = std::fs::read_to_string(path)
+                    .unwrap_or_else(|e| panic!("Failed to read {}: {}", path, e));
+                args.styles.push((name.to_string(), json));
+            }
+            // Flags passed by `cargo bench` itself
+            _ => {}
+        }
+    }
+    args
+}
+
+/// Styles that render without network access, from trivial to busy
+fn builtin_styles() -> Vec<(String, String)> {
+    let background = r##"{"version":8,"sources":{},"layers":[
+        {"id":"background","type":"background","paint":{"background-color":"#f0ebe3"}}]}"##;
+
+    // A grid of polygons and lines around the center, dense enough to be
+    // visible at every benchmarked zoom
+    let (lat, lon) = CENTER;
+    let mut polygons = Vec::new();
+    let mut lines = Vec::new();
+    for i in -20i32..20 {
+        for j in -20..20 {
+            let x = lon + j as f64 * 0.05;
+            let y = lat + i as f64 * 0.03;
+            polygons.push(format!(
+                r#"{{"type":"Feature","properties":{{"rank":{}}},"geometry":{{"type":"Polygon","coordinates":[[[{x},{y}],[{x2},{y}],[{x2},{y2}],[{x},{y2}],[{x},{y}]]]}}}}"#,
+                (i + j).rem_euclid(5),
+                x2 = x + 0.04,
+                y2 = y + 0.02,
+            ));
+        }
+        let y = lat + i as f64 * 0.03;
+        let x = lon + i as f64 * 0.05;
+        lines.push(format!(
+            r#"{{"type":"Feature","properties":{{}},"geometry":{{"type":"LineString","coordinates":[[{},{y}],[{},{y}]]}}}}"#,
+            lon - 1.0,
+            lon + 1.0,
+        ));
+        lines.push(format!(
+            r#"{{"type":"Feature","properties":{{}},"geometry":{{"type":"LineString","coordinates":[[{x},{}],[{x},{}]]}}}}"#,
+            lat - 0.6,
+            lat + 0.6,
+        ));
+    }
+
+    let geojson = |features: &[String]| {
+        format!(
+            r#"{{"type":"geojson","data":{{"type":"FeatureCollection","features":[{}]}}}}"#,
+            features.join(",")
+        )
+    };
+
+    let fills = format!(
+        r##"{{"version":8,"sources":{{"blocks":{}}},"layers":[
+            {{"id":"background","type":"background","paint":{{"background-color":"#f0ebe3"}}}},
+            {{"id":"blocks","type":"fill","source":"blocks","paint":{{"fill-color":["interpolate",["linear"],["get","rank"],0,"#d9d0c1",4,"#b3a48c"]}}}},
+            {{"id":"outlines","type":"line","source":"blocks","paint":{{"line-color":"#8c7b63","line-width":1}}}}]}}"##,
+        geojson(&polygons)
+    );
+
+    let roads = format!(
+        r##"{{"version":8,"sources":{{"blocks":{},"roads":{}}},"layers":[
+            {{"id":"background","type":"background","paint":{{"background-color":"#f0ebe3"}}}},
+            {{"id":"blocks","type":"fill","source":"blocks","paint":{{"fill-color":"#d9d0c1","fill-opacity":0.6}}}},
+            {{"id":"casing","type":"line","source":"roads","paint":{{"line-color":"#a08f75","line-width":["interpolate",["exponential",1.5],["zoom"],5,1,15,14]}}}},
+            {{"id":"roads","type":"line","source":"roads","paint":{{"line-color":"#ffffff","line-width":["interpolate",["exponential",1.5],["zoom"],5,0.5,15,10]}}}},
+            {{"id":"corners","type":"circle","source":"blocks","paint":{{"circle-radius":3,"circle-color":"#6b5b45"}}}}]}}"##,
+        geojson(&polygons),
+        geojson(&lines)
+    );
+
+    vec![
+        ("background".to_string(), background.to_string()),
+        ("fills".to_string(), fills),
+        ("roads".to_string(), roads),
+    ]
+}
+
+/// Tile coordinates of the benchmark tile set
+fn tiles() -> Vec<(u8, u32, u32)> {
+    let (lat, lon) = CENTER;
+    ZOOMS
+        .iter()
+        .flat_map(|&z| {
+            let n = 2f64.powi(z as i32);
+            let x = ((lon + 180.0) / 360.0 * n) as u32;
+            let lat_rad = lat.to_radians();
+            let y = ((1.0 - lat_rad.tan().asinh() / std::f64::consts::PI) / 2.0 * n) as u32;
+            (0..BLOCK * BLOCK).map(move |i| (z, x + i % BLOCK, y + i / BLOCK))
+        })
+        .collect()
+}
+
+fn render_options(tile: (u8, u32, u32), pixel_ratio: f32) -> MLNRenderOptions {
+    let (z, x, y) = tile;
+    let n = 2f64.powi(z as i32);
+    let lon = (x as f64 + 0.5) / n * 360.0 - 180.0;
+    let lat = ((1.0 - 2.0 * (y as f64 + 0.5) / n) * std::f64::consts::PI)
+        .sinh()
+        .atan()
+        .to_degrees();
+
+    MLNRenderOptions {
+        size: MLNSize::new(TILE_SIZE, TILE_SIZE),
+        pixel_ratio,
+        camera: MLNCameraOptions::new(lat, lon, z as f64),
+        ..MLNRenderOptions::default()
+    }
+}
+
+fn last_error() -> String {
+    unsafe {
+        let error = mln_get_last_error();
+        if error.is_null() {
+            "unknown error".to_string()
+        } else {
+            CStr::from_ptr(error).to_string_lossy().into_owned()
+        }
+    }
+}
+
+fn check(code: MLNErrorCode, what: &str) {
+    if code != MLNErrorCode::MLN_OK {
+        panic!("{} failed ({:?}): {}", what, code, last_error());
+    }
+}
+
+/// A frontend and map bound to the current thread
+struct Map {
+    frontend: *mut MLNHeadlessFrontend,
+    map: *mut MLNMap,
+}
+
+impl Map {
+    fn new(pixel_ratio: f32) -> Self {
+        unsafe {
+            let frontend =
+                mln_headless_frontend_create(MLNSize::new(TILE_SIZE, TILE_SIZE), pixel_ratio);
+            assert!(!frontend.is_null(), "frontend: {}", last_error());
+            let map = mln_map_create(frontend, pixel_ratio, MLNMapMode::MLN_MAP_MODE_TILE);
+            assert!(!map.is_null(), "map: {}", last_error());
+            Self { frontend, map }
+        }
+    }
+
+    fn load_style(&self, style: &CStr) {
+        check(
+            unsafe { mln_map_load_style(self.map, style.as_ptr()) },
+            "mln_map_load_style",
+        );
+    }
+
+    fn render(&self, options: &MLNRenderOptions) -> MLNImageData {
+        let mut image = MLNImageData::default();
+        check(
+            unsafe { mln_map_render_still(self.map, options, &mut image) },
+            "mln_map_render_still",
+        );
+        image
+    }
+
+    fn render_batch(&self, options: &[MLNRenderOptions]) -> Vec<MLNImageData> {
+        let mut images: Vec<MLNImageData> =
+            options.iter().map(|_| MLNImageData::default()).collect();
+        check(
+            unsafe {
+                mln_map_render_batch(
+                    self.map,
+                    options.as_ptr(),
+                    options.len(),
+                    images.as_mut_ptr(),
+                    std::ptr::null_mut(),
+                )
+            },
+            "mln_map_render_batch",
+        );
+        images
+    }
+
+    fn stats(&self) -> MLNRenderStats {
+        unsafe { mln_map_get_render_stats(self.map) }
+    }
+}
+
+impl Drop for Map {
+    fn drop(&mut self) {
+        unsafe {
+            mln_map_destroy(self.map);
+            mln_headless_frontend_destroy(self.frontend);
+        }
+    }
+}
+
+/// Samples of one phase, in milliseconds
+#[derive(Default)]
+struct Samples(Vec<f64>);
+
+impl Samples {
+    fn push(&mut self, elapsed: Duration) {
+        self.0.push(elapsed.as_secs_f64() * 1e3);
+    }
+
+    fn push_ms(&mut self, ms: f64) {
+        self.0.push(ms);
+    }
+
+    fn row(&mut self, label: &str) {
+        if self.0.is_empty() {
+            return;
+        }
+        self.0.sort_by(f64::total_cmp);
+        let n = self.0.len();
+        let mean = self.0.iter().sum::<f64>() / n as f64;
+        let percentile = |p: f64| self.0[((n - 1) as f64 * p).round() as usize];
+        println!(
+            "  {:<12} {:>6} {:>10.3} {:>10.3} {:>10.3} {:>10.3}",
+            label,
+            n,
+            mean,
+            percentile(0.5),
+            percentile(0.95),
+            self.0[n - 1]
+        );
+    }
+}
+
+/// Time every phase of the render path on the current thread
+fn bench_phases(name: &str, style: &CStr, pixel_ratio: f32, iterations: usize) {
+    let mut create = Samples::default();
+    let mut style_load = Samples::default();
+    let mut render_still = Samples::default();
+    let mut render = Samples::default();
+    let mut resource_wait = Samples::default();
+    let mut readback = Samples::default();
+    let mut copy = Samples::default();
+
+    let tiles = tiles();
+    for _ in 0..iterations {
+        let started = Instant::now();
+        let map = Map::new(pixel_ratio);
+        create.push(started.elapsed());
+
+        let started = Instant::now();
+        map.load_style(style);
+        style_load.push(started.elapsed());
+
+        for &tile in &tiles {
+            let options = render_options(tile, pixel_ratio);
+
+            let started = Instant::now();
+            let mut image = map.render(&options);
+            render_still.push(started.elapsed());
+
+            let stats = map.stats();
+            render.push_ms(stats.render_ms);
+            resource_wait.push_ms(stats.resource_wait_ms);
+            readback.push_ms(stats.readback_ms);
+
+            // What handing the pixels over by copy would cost
+            let started = Instant::now();
+            let pixels = unsafe { std::slice::from_raw_parts(image.data, image.data_len) }.to_vec();
+            copy.push(started.elapsed());
+            std::hint::black_box(pixels);
+
+            unsafe { mln_image_free(&mut image) };
+        }
+    }
+
+    println!(
+        "\n{} @{}x ({} tiles/iteration)",
+        name,
+        pixel_ratio,
+        tiles.len()
+    );
+    println!(
+        "  {:<12} {:>6} {:>10} {:>10} {:>10} {:>10}",
+        "phase (ms)", "n", "mean", "p50", "p95", "max"
+    );
+    create.row("create");
+    style_load.row("style load");
+    render_still.row("render_still");
+    render.row("  render");
+    resource_wait.row("    resources");
+    readback.row("  readback");
+    copy.row("copy");
+}
+
+/// Renders per second with one map per thread, all rendering concurrently.
+/// With `batch`, each thread renders the whole tile set in one call.
+fn bench_throughput(style: &CStr, threads: usize, iterations: usize, batch: bool) -> f64 {
+    let barrier = Arc::new(Barrier::new(threads + 1));
+    let style = Arc::new(style.to_owned());
+
+    let workers: Vec<_> = (0..threads)
+        .map(|_| {
+            let barrier = barrier.clone();
+            let style = style.clone();
+            std::thread::spawn(move || {
+                let map = Map::new(1.0);
+                map.load_style(&style);
+                let options: Vec<_> = tiles()
+                    .into_iter()
+                    .map(|t| render_options(t, 1.0))
+                    .collect();
+                barrier.wait();
+
+                for _ in 0..iterations {
+                    let images = if batch {
+                        map.render_batch(&options)
+                    } else {
+                        options.iter().map(|o| map.render(o)).collect()
+                    };
+                    for mut image in images {
+                        unsafe { mln_image_free(&mut image) };
+                    }
+                }
+                iterations * options.len()
+            })
+        })
+        .collect();
+
+    barrier.wait();
+    let started = Instant::now();
+    let renders: usize = workers.into_iter().map(|w| w.join().unwrap()).sum();
+    renders as f64 / started.elapsed().as_secs_f64()
+}
+
+fn main() {
+    let args = parse_args();
+    check(unsafe { mln_init() }, "mln_init");
+
+    for (name, json) in &args.styles {
+        let style = CString::new(json.as_str()).expect("style contains a NUL byte");
+        for pixel_ratio in SCALES {
+            bench_phases(name, &style, pixel_ratio, args.iterations);
+        }
+    }
+
+    for (name, json) in &args.styles {
+        let style = CString::new(json.as_str()).expect("style contains a NUL byte");
+        println!("\n{} throughput @1x", name);
+        println!(
+            "  {:>7} {:>12} {:>10} {:>12}",
+            "threads", "renders/s", "scaling", "batched/s"
+        );
+        let mut single = None;
+        for &threads in &args.threads {
+            let threads = threads.max(1);
+            let rate = bench_throughput(&style, threads, args.iterations, false);
+            let batched = bench_throughput(&style, threads, args.iterations, true);
+            let baseline = *single.get_or_insert(rate / threads as f64);
+            println!(
+                "  {:>7} {:>12.1} {:>9.2}x {:>12.1}",
+                threads,
+                rate,
+                rate / baseline,
+                batched
+            );
+        }
+    }
+
+    unsafe { mln_cleanup() };
+}
@@ -104,6 +104,12 @@ fn build_with_maplibre_native(manifest_dir: &Path, out_dir: &Path, maplibre_buil
     #[cfg(target_os = "linux")]
     {
         build.include(maplibre_src.join("platform/linux/include"));
+        // OpenGL backend: read frames back into pooled buffers ourselves
+        build.define("MLN_GL_READBACK", None);
+        // EGL backend: open the display of the selected render device
+        build.define("MLN_EGL_DEVICES", None);
+        // OpenGL backend: keep linked shader program binaries
+        build.define("MLN_GL_PROGRAM_CACHE", None);
     }
 
     build.compile("maplibre_c");
@@ -187,6 +193,7 @@ fn build_with_maplibre_native(manifest_dir: &Path, out_dir: &Path, maplibre_buil
         println!("cargo:rustc-link-lib=jpeg");
         println!("cargo:rustc-link-lib=webp");
         println!("cargo:rustc-link-lib=uv");
+        println!("cargo:rustc-link-lib=dl");
 
         // OpenGL/X11
         println!("cargo:rustc-link-lib=GL");
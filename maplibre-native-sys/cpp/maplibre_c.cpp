@@ -10,18 +10,62 @@
 #include <mbgl/gfx/headless_frontend.hpp>
 #include <mbgl/map/map.hpp>
 #include <mbgl/map/map_options.hpp>
+#include <mbgl/storage/file_source.hpp>
+#include <mbgl/storage/file_source_manager.hpp>
+#include <mbgl/storage/resource.hpp>
 #include <mbgl/storage/resource_options.hpp>
+#include <mbgl/storage/response.hpp>
+#include <mbgl/util/async_request.hpp>
+#include <mbgl/util/client_options.hpp>
+#include <mbgl/style/conversion_impl.hpp>
+#include <mbgl/style/conversion/layer.hpp>
+#include <mbgl/style/conversion/source.hpp>
+#include <mbgl/style/image.hpp>
+#include <mbgl/style/layer.hpp>
+#include <mbgl/style/rapidjson_conversion.hpp>
+#include <mbgl/style/source.hpp>
+#include <mbgl/style/sources/geojson_source.hpp>
 #include <mbgl/style/style.hpp>
+#include <mbgl/style/types.hpp>
 #include <mbgl/util/image.hpp>
 #include <mbgl/util/run_loop.hpp>
+#include <mbgl/util/timer.hpp>
 #include <mbgl/util/premultiply.hpp>
+#include <mbgl/util/rapidjson.hpp>
 #include <mbgl/util/logging.hpp>
 
+#if defined(MLN_GL_READBACK) || defined(MLN_GL_PROGRAM_CACHE)
+#include <mbgl/gfx/backend_scope.hpp>
+#include <mbgl/gfx/renderer_backend.hpp>
+#endif
+#ifdef MLN_GL_READBACK
+#include <mbgl/gfx/renderable.hpp>
+#include <mbgl/platform/gl_functions.hpp>
+#endif
+
+#if defined(MLN_EGL_DEVICES) || defined(MLN_GL_PROGRAM_CACHE)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <dlfcn.h>
+#endif
+#ifdef MLN_GL_PROGRAM_CACHE
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
 #include <memory>
 #include <string>
 #include <thread>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 /* Thread-local error message */
 static thread_local char last_error[1024] = {0};
@@ -29,10 +73,360 @@ static thread_local char last_error[1024] = {0};
 /* Thread-local RunLoop - each thread gets its own */
 static thread_local std::unique_ptr<mbgl::util::RunLoop> threadRunLoop;
 
-/* Global initialization state */
-static bool initialized = false;
+/*
+ * Global initialization state.
+ *
+ * Everything process-wide lives here and is only written during mln_init
+ * (or under its own lock), so distinct maps on distinct threads never share
+ * mutable state and can be driven concurrently.
+ */
+static std::atomic<bool> initialized{false};
 static std::mutex initMutex;
 
+/*
+ * Render device of the process. mbgl opens the display lazily, on the first
+ * frontend's first render, and closes it with the last frontend, so the
+ * device may only change while no frontends exist.
+ */
+static std::mutex deviceMutex;
+static size_t liveFrontends = 0; /* Guarded by deviceMutex */
+
+#ifdef MLN_EGL_DEVICES
+static std::atomic<int64_t> renderDevice{-1}; /* -1 for the backend's default display */
+
+static std::vector<EGLDeviceEXT> eglDevices() {
+    auto queryDevices =
+        reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(eglGetProcAddress("eglQueryDevicesEXT"));
+    EGLint count = 0;
+    if (!queryDevices || !queryDevices(0, nullptr, &count) || count <= 0) {
+        return {};
+    }
+    std::vector<EGLDeviceEXT> devices(count);
+    if (!queryDevices(count, devices.data(), &count)) {
+        return {};
+    }
+    devices.resize(count);
+    return devices;
+}
+
+/*
+ * mbgl's EGL backend opens EGL_DEFAULT_DISPLAY and has no way to pick a
+ * device. The static link resolves its eglGetDisplay to this definition,
+ * which opens the selected device's display instead and passes everything
+ * else on to libEGL.
+ */
+extern "C" EGLDisplay eglGetDisplay(EGLNativeDisplayType native) {
+    using GetDisplay = EGLDisplay (*)(EGLNativeDisplayType);
+    static const auto next = reinterpret_cast<GetDisplay>(dlsym(RTLD_NEXT, "eglGetDisplay"));
+
+    const int64_t device = renderDevice.load(std::memory_order_acquire);
+    if (native != EGL_DEFAULT_DISPLAY || device < 0) {
+        return next ? next(native) : EGL_NO_DISPLAY;
+    }
+    auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+        eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    auto devices = eglDevices();
+    if (!getPlatformDisplay || static_cast<size_t>(device) >= devices.size()) {
+        return EGL_NO_DISPLAY;
+    }
+    return getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[static_cast<size_t>(device)], nullptr);
+}
+#endif
+
+/*
+ * Shader program binary cache.
+ *
+ * mbgl compiles and links every shader program from source on each new
+ * frontend's first renders. With a cache directory set, the wrapper keeps
+ * the linked binaries (glGetProgramBinary) in files named after a hash of
+ * the driver, the shader sources and the attribute bindings, and hands
+ * them to later links (glProgramBinary) instead of linking from source.
+ * Like eglGetDisplay above, the GL calls involved are defined here and
+ * resolved to by mbgl's static link; they record what a link needs and
+ * pass everything on to libGL. A binary the driver rejects is replaced.
+ */
+static std::atomic<uint64_t> programCacheHits{0};
+static std::atomic<uint64_t> programCacheMisses{0};
+static std::atomic<uint64_t> programCacheRejected{0};
+
+#ifdef MLN_GL_PROGRAM_CACHE
+namespace program_cache {
+
+using GLuint = unsigned int;
+using GLint = int;
+using GLenum = unsigned int;
+using GLsizei = int;
+
+constexpr GLenum kLinkStatus = 0x8B82;
+constexpr GLenum kProgramBinaryLength = 0x8741;
+constexpr GLenum kProgramBinaryRetrievableHint = 0x8257;
+constexpr GLenum kVendor = 0x1F00;
+constexpr GLenum kRenderer = 0x1F01;
+constexpr GLenum kVersion = 0x1F02;
+constexpr char kMagic[8] = {'M', 'L', 'N', 'P', 'R', 'O', 'G', '1'};
+
+/* GL objects are only unique within their context */
+using Object = std::pair<EGLContext, GLuint>;
+
+struct Program {
+    std::vector<std::string> sources;          /* Of the attached shaders, in order */
+    std::map<std::string, GLuint> attributes;  /* Bound attribute locations */
+};
+
+static std::mutex mutex;
+static std::string dir;                      /* Empty when disabled */
+static std::atomic<bool> enabled{false};
+static std::map<Object, std::string> shaders; /* Source of each shader */
+static std::map<Object, Program> programs;    /* Programs not linked yet */
+
+template <typename Fn>
+static Fn next(const char* name) {
+    return reinterpret_cast<Fn>(dlsym(RTLD_NEXT, name));
+}
+
+template <typename Fn>
+static Fn proc(const char* name) {
+    return reinterpret_cast<Fn>(eglGetProcAddress(name));
+}
+
+static Object current(GLuint object) {
+    return {eglGetCurrentContext(), object};
+}
+
+/* Drop what is recorded for the objects of `context`, which is going away */
+static void forget(EGLContext context) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto of = [context](const auto& entry) { return entry.first.first == context; };
+    for (auto it = shaders.begin(); it != shaders.end();) {
+        it = of(*it) ? shaders.erase(it) : std::next(it);
+    }
+    for (auto it = programs.begin(); it != programs.end();) {
+        it = of(*it) ? programs.erase(it) : std::next(it);
+    }
+}
+
+static uint64_t fnv1a(uint64_t hash, const std::string& bytes) {
+    for (unsigned char c : bytes) {
+        hash = (hash ^ c) * 0x100000001b3ull;
+    }
+    /* Separates consecutive strings */
+    return (hash ^ 0xff) * 0x100000001b3ull;
+}
+
+/* Where the binary of `program` is kept for the current driver */
+static std::string path(const Program& program) {
+    using GetString = const unsigned char* (*)(GLenum);
+    static const auto getString = proc<GetString>("glGetString");
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (GLenum name : {kVendor, kRenderer, kVersion}) {
+        const unsigned char* value = getString ? getString(name) : nullptr;
+        hash = fnv1a(hash, value ? reinterpret_cast<const char*>(value) : "");
+    }
+    for (const auto& source : program.sources) {
+        hash = fnv1a(hash, source);
+    }
+    for (const auto& [name, location] : program.attributes) {
+        hash = fnv1a(hash, name + "=" + std::to_string(location));
+    }
+
+    char file[32];
+    snprintf(file, sizeof(file), "/%016llx.bin", static_cast<unsigned long long>(hash));
+    return dir + file;
+}
+
+static bool linked(GLuint program) {
+    using GetProgramiv = void (*)(GLuint, GLenum, GLint*);
+    static const auto getProgramiv = proc<GetProgramiv>("glGetProgramiv");
+    GLint status = 0;
+    if (getProgramiv) {
+        getProgramiv(program, kLinkStatus, &status);
+    }
+    return status != 0;
+}
+
+/* Load the cached binary at `file` into `program`, if there is one */
+static bool load(GLuint program, const std::string& file) {
+    using ProgramBinary = void (*)(GLuint, GLenum, const void*, GLsizei);
+    static const auto programBinary = proc<ProgramBinary>("glProgramBinary");
+
+    FILE* in = fopen(file.c_str(), "rb");
+    if (!in) {
+        return false;
+    }
+    char magic[sizeof(kMagic)];
+    uint32_t format = 0;
+    std::vector<char> binary;
+    bool read = fread(magic, sizeof(magic), 1, in) == 1 && memcmp(magic, kMagic, sizeof(kMagic)) == 0 &&
+                fread(&format, sizeof(format), 1, in) == 1;
+    if (read) {
+        char chunk[16384];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+            binary.insert(binary.end(), chunk, chunk + n);
+        }
+    }
+    fclose(in);
+    if (!read || binary.empty() || !programBinary) {
+        return false;
+    }
+
+    programBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+    if (!linked(program)) {
+        /* Built by another driver; the link from source replaces it */
+        programCacheRejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+/* Write the binary of the linked `program` to `file` */
+static void store(GLuint program, const std::string& file) {
+    using GetProgramiv = void (*)(GLuint, GLenum, GLint*);
+    using GetProgramBinary = void (*)(GLuint, GLsizei, GLsizei*, GLenum*, void*);
+    static const auto getProgramiv = proc<GetProgramiv>("glGetProgramiv");
+    static const auto getProgramBinary = proc<GetProgramBinary>("glGetProgramBinary");
+
+    GLint length = 0;
+    if (getProgramiv) {
+        getProgramiv(program, kProgramBinaryLength, &length);
+    }
+    if (length <= 0 || !getProgramBinary) {
+        return;
+    }
+    std::vector<char> binary(static_cast<size_t>(length));
+    GLenum format = 0;
+    GLsizei written = 0;
+    getProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0) {
+        return;
+    }
+
+    /* Written aside and renamed, so other processes never read part of a file */
+    static std::atomic<uint64_t> nextTemp{0};
+    const std::string temp = file + "." + std::to_string(getpid()) + "." +
+                             std::to_string(nextTemp.fetch_add(1, std::memory_order_relaxed)) + ".tmp";
+    FILE* out = fopen(temp.c_str(), "wb");
+    if (!out) {
+        return;
+    }
+    const uint32_t format32 = format;
+    bool ok = fwrite(kMagic, sizeof(kMagic), 1, out) == 1 && fwrite(&format32, sizeof(format32), 1, out) == 1 &&
+              fwrite(binary.data(), static_cast<size_t>(written), 1, out) == 1;
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(temp.c_str(), file.c_str()) != 0) {
+        remove(temp.c_str());
+    }
+}
+
+} // namespace program_cache
+
+extern "C" void glShaderSource(program_cache::GLuint shader,
+                               program_cache::GLsizei count,
+                               const char* const* strings,
+                               const program_cache::GLint* lengths) {
+    using namespace program_cache;
+    using ShaderSource = void (*)(GLuint, GLsizei, const char* const*, const GLint*);
+    static const auto shaderSource = next<ShaderSource>("glShaderSource");
+
+    if (enabled.load(std::memory_order_acquire)) {
+        std::string source;
+        for (GLsizei i = 0; i < count; i++) {
+            if (lengths && lengths[i] >= 0) {
+                source.append(strings[i], static_cast<size_t>(lengths[i]));
+            } else {
+                source.append(strings[i]);
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        shaders[current(shader)] = std::move(source);
+    }
+    shaderSource(shader, count, strings, lengths);
+}
+
+extern "C" void glDeleteShader(program_cache::GLuint shader) {
+    using namespace program_cache;
+    using DeleteShader = void (*)(GLuint);
+    static const auto deleteShader = next<DeleteShader>("glDeleteShader");
+
+    if (enabled.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        shaders.erase(current(shader));
+    }
+    deleteShader(shader);
+}
+
+extern "C" void glAttachShader(program_cache::GLuint program, program_cache::GLuint shader) {
+    using namespace program_cache;
+    using AttachShader = void (*)(GLuint, GLuint);
+    static const auto attachShader = next<AttachShader>("glAttachShader");
+
+    if (enabled.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto source = shaders.find(current(shader));
+        programs[current(program)].sources.push_back(source != shaders.end() ? source->second : "");
+    }
+    attachShader(program, shader);
+}
+
+extern "C" void glBindAttribLocation(program_cache::GLuint program, program_cache::GLuint index, const char* name) {
+    using namespace program_cache;
+    using BindAttribLocation = void (*)(GLuint, GLuint, const char*);
+    static const auto bindAttribLocation = next<BindAttribLocation>("glBindAttribLocation");
+
+    if (enabled.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        programs[current(program)].attributes[name] = index;
+    }
+    bindAttribLocation(program, index, name);
+}
+
+extern "C" void glDeleteProgram(program_cache::GLuint program) {
+    using namespace program_cache;
+    using DeleteProgram = void (*)(GLuint);
+    static const auto deleteProgram = next<DeleteProgram>("glDeleteProgram");
+
+    if (enabled.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        programs.erase(current(program));
+    }
+    deleteProgram(program);
+}
+
+extern "C" void glLinkProgram(program_cache::GLuint program) {
+    using namespace program_cache;
+    using LinkProgram = void (*)(GLuint);
+    using ProgramParameteri = void (*)(GLuint, GLenum, GLint);
+    static const auto linkProgram = next<LinkProgram>("glLinkProgram");
+    static const auto programParameteri = proc<ProgramParameteri>("glProgramParameteri");
+
+    std::string file;
+    if (enabled.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto node = programs.extract(current(program));
+        if (!node.empty() && !dir.empty()) {
+            file = path(node.mapped());
+        }
+    }
+    if (file.empty()) {
+        return linkProgram(program);
+    }
+
+    if (load(program, file)) {
+        programCacheHits.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    programCacheMisses.fetch_add(1, std::memory_order_relaxed);
+    if (programParameteri) {
+        programParameteri(program, kProgramBinaryRetrievableHint, 1);
+    }
+    linkProgram(program);
+    if (linked(program)) {
+        store(program, file);
+    }
+}
+#endif
+
 /* Silent log observer that suppresses all MapLibre logs */
 class SilentLogObserver : public mbgl::Log::Observer {
 public:
@@ -41,8 +435,8 @@ public:
     }
 };
 
-/* Flag to track if logging is suppressed */
-static bool loggingSuppressed = false;
+/* The log observer and file source factory are process-wide, install them exactly once */
+static std::once_flag globalSetupOnce;
 
 /* Ensure the current thread has a RunLoop */
 static void ensureRunLoop() {
@@ -51,453 +445,2249 @@ static void ensureRunLoop() {
     }
 }
 
-/* Internal structures wrapping MapLibre Native objects */
-struct MLNHeadlessFrontend {
-    std::unique_ptr<mbgl::HeadlessFrontend> frontend;
-    float pixelRatio;
-    mbgl::Size size;
+/*
+ * Ends a thread's mln_run_loop_wait, from any thread. The wait runs the
+ * RunLoop until it is stopped, so resource answers and tile parsing results
+ * are handled as they come in rather than on the next poll.
+ */
+struct LoopWake {
+    std::mutex mutex;
+    mbgl::util::RunLoop* loop = nullptr; /* Cleared when the thread exits */
+    bool waiting = false;                /* The thread is in mln_run_loop_wait */
+    bool pending = false;                /* Woken while not waiting */
+
+    /* End the wait in progress, if any */
+    void stop() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (waiting) {
+            waiting = false;
+            loop->stop();
+        }
+    }
+
+    /* End the wait in progress, or else the next one */
+    void wake() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (waiting) {
+            waiting = false;
+            loop->stop();
+        } else if (loop) {
+            pending = true;
+        }
+    }
 };
 
-struct MLNMap {
-    MLNHeadlessFrontend* frontend;
-    std::unique_ptr<mbgl::Map> map;
-    float pixelRatio;
-    MLNMapMode mode;
-    bool styleLoaded;
+struct MLNRunLoopWaker {
+    std::shared_ptr<LoopWake> wake;
 };
 
-extern "C" {
+/* Set up after the thread's RunLoop, so it is torn down before it */
+struct ThreadWake {
+    std::shared_ptr<LoopWake> wake = std::make_shared<LoopWake>();
 
-MLNErrorCode mln_init(void) {
-    std::lock_guard<std::mutex> lock(initMutex);
+    ThreadWake() {
+        wake->loop = mbgl::util::RunLoop::Get();
+    }
+
+    ~ThreadWake() {
+        std::lock_guard<std::mutex> lock(wake->mutex);
+        wake->loop = nullptr;
+    }
+};
+
+static const std::shared_ptr<LoopWake>& threadLoopWake() {
+    ensureRunLoop();
+    static thread_local ThreadWake thread;
+    return thread.wake;
+}
+
+/*
+ * Resource loader attached to a map through ResourceOptions::platformContext.
+ * The magic value guards against platform contexts set by anyone else.
+ */
+static constexpr uint32_t kResourceLoaderMagic = 0x4d4c4e52; /* "MLNR" */
+
+/*
+ * Resource request counters of one map. Only touched on the map thread:
+ * requests are made there and their responses are delivered there.
+ */
+struct ResourceStats {
+    using Clock = std::chrono::steady_clock;
     
-    if (initialized) {
-        return MLN_OK;
+    uint32_t requests = 0;
+    uint32_t tileRequests = 0;
+    uint32_t failedRequests = 0;
+    uint64_t bytes = 0;
+    uint32_t outstanding = 0;
+    Clock::time_point busySince;
+    double busyMs = 0; /* Total time with at least one request outstanding */
+    
+    void started(mbgl::Resource::Kind kind) {
+        ++requests;
+        if (kind == mbgl::Resource::Kind::Tile) {
+            ++tileRequests;
+        }
+        if (outstanding++ == 0) {
+            busySince = Clock::now();
+        }
     }
     
-    try {
-        // Suppress MapLibre Native's verbose logging by default
-        if (!loggingSuppressed) {
-            mbgl::Log::setObserver(std::make_unique<SilentLogObserver>());
-            loggingSuppressed = true;
+    /* response is null for requests cancelled before they were answered */
+    void finished(const mbgl::Response* response) {
+        if (response && response->error) {
+            ++failedRequests;
+        } else if (response && response->data) {
+            bytes += response->data->size();
         }
-        
-        // Ensure the calling thread has a RunLoop
-        ensureRunLoop();
-        initialized = true;
-        return MLN_OK;
-    } catch (const std::exception& e) {
-        snprintf(last_error, sizeof(last_error), "Failed to initialize: %s", e.what());
-        return MLN_ERROR_UNKNOWN;
+        if (outstanding > 0 && --outstanding == 0) {
+            busyMs += std::chrono::duration<double, std::milli>(Clock::now() - busySince).count();
+        }
+    }
+    
+    double busyMsUntil(Clock::time_point now) const {
+        if (outstanding == 0) {
+            return busyMs;
+        }
+        return busyMs + std::chrono::duration<double, std::milli>(now - busySince).count();
+    }
+};
+
+/* Counts a request as finished once its callback has run or been dropped */
+class TrackedRequest {
+public:
+    TrackedRequest(std::shared_ptr<ResourceStats> stats_, mbgl::Resource::Kind kind) : stats(std::move(stats_)) {
+        stats->started(kind);
+    }
+    ~TrackedRequest() {
+        if (stats) {
+            stats->finished(nullptr);
+        }
+    }
+    
+    void complete(const mbgl::Response& response) {
+        if (stats) {
+            stats->finished(&response);
+            stats.reset();
+        }
+    }
+
+private:
+    std::shared_ptr<ResourceStats> stats;
+};
+
+struct PendingResource;
+
+/* Requests of one map still waiting for an answer, so a cancel can fail them */
+struct PendingRequests {
+    std::vector<std::weak_ptr<PendingResource>> requests;
+    
+    void add(const std::shared_ptr<PendingResource>& state) {
+        requests.erase(std::remove_if(requests.begin(), requests.end(),
+                                      [](const std::weak_ptr<PendingResource>& r) { return r.expired(); }),
+                       requests.end());
+        requests.push_back(state);
+    }
+};
+
+struct MLNResourceLoader {
+    uint32_t magic;
+    MLNResourceCallback callback;
+    void* userData;
+    std::shared_ptr<ResourceStats> stats;
+    std::shared_ptr<PendingRequests> pending;
+};
+
+class SharedResources;
+
+/*
+ * State shared between an in-flight resource request and its handle.
+ *
+ * The handle may be answered from any thread, so the response is posted to
+ * the RunLoop of the map thread that made the request. Cancellation (the map
+ * dropping the request) happens on the map thread and wins over late answers.
+ */
+struct PendingResource {
+    std::mutex mutex;
+    bool cancelled = false;
+    mbgl::util::RunLoop* loop = nullptr;
+    mbgl::Resource::Kind kind = mbgl::Resource::Kind::Unknown;
+    mbgl::FileSource::Callback callback;
+    std::unique_ptr<mbgl::AsyncRequest> fallback; /* Default file source load of a passed through request */
+    std::function<void(const std::shared_ptr<PendingResource>&)> passThrough; /* Starts fallback, on the map thread */
+    SharedResources* shared = nullptr; /* Where the answer is kept, if anywhere */
+    std::string url;
+};
+
+/* Post a response to the RunLoop of the map thread that made the request */
+static void deliverResponse(const std::shared_ptr<PendingResource>& state,
+                            std::shared_ptr<mbgl::Response> response) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->cancelled) {
+        return;
     }
+    state->loop->invoke([state, response]() {
+        mbgl::FileSource::Callback callback;
+        std::unique_ptr<mbgl::AsyncRequest> fallback;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->cancelled) {
+                return;
+            }
+            callback = std::move(state->callback);
+            fallback = std::move(state->fallback);
+        }
+        // An answer (or a cancel) ends a load through the default file source
+        fallback.reset();
+        if (callback) {
+            callback(*response);
+        }
+    });
 }
 
-void mln_cleanup(void) {
-    std::lock_guard<std::mutex> lock(initMutex);
-    if (initialized) {
-        // Note: thread-local RunLoops are cleaned up when threads exit
-        initialized = false;
+/* Pass a deferred request through to the default file source, from the map thread */
+static void deliverPassThrough(const std::shared_ptr<PendingResource>& state) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->cancelled) {
+        return;
     }
+    state->loop->invoke([state]() {
+        std::function<void(const std::shared_ptr<PendingResource>&)> start;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->cancelled || !state->callback) {
+                return;
+            }
+            start = std::move(state->passThrough);
+        }
+        if (start) {
+            start(state);
+        }
+    });
 }
 
-MLNHeadlessFrontend* mln_headless_frontend_create(MLNSize size, float pixel_ratio) {
-    if (!initialized) {
-        snprintf(last_error, sizeof(last_error), "Library not initialized");
-        return nullptr;
+/*
+ * Resource answers shared by all maps, least recently used first out.
+ *
+ * Glyph ranges, sprite files and source tiles are the same for every map
+ * that requests them, so the first answer for a URL is kept and handed to
+ * later requests for it from any map: one immutable buffer instead of a
+ * copy per map, no round trip through the resource loader (which reads and
+ * decompresses tiles) and nothing lost when a map is destroyed. Each map
+ * still parses the data into its own glyph atlas, sprite images and tile
+ * geometry; mbgl has no way to share those.
+ */
+class SharedResources {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit SharedResources(uint64_t limit_) : limit(limit_) {}
+
+    /* Look up a URL. data is null for an empty answer. */
+    bool find(const std::string& url, std::shared_ptr<const std::string>& data) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(url);
+        if (it != entries.end() && ttl.count() > 0 && Clock::now() >= it->second.expires) {
+            erase(it);
+            it = entries.end();
+        }
+        if (it == entries.end()) {
+            misses++;
+            return false;
+        }
+        hits++;
+        lru.splice(lru.begin(), lru, it->second.lru);
+        data = it->second.data;
+        return true;
     }
-    
-    try {
-        // Ensure this thread has a RunLoop
-        ensureRunLoop();
-        
-        auto frontend = new MLNHeadlessFrontend();
-        frontend->pixelRatio = pixel_ratio;
-        frontend->size = mbgl::Size{size.width, size.height};
-        frontend->frontend = std::make_unique<mbgl::HeadlessFrontend>(
-            frontend->size,
-            pixel_ratio
-        );
-        return frontend;
-    } catch (const std::exception& e) {
-        snprintf(last_error, sizeof(last_error), "Failed to create frontend: %s", e.what());
-        return nullptr;
+
+    void insert(const std::string& url, std::shared_ptr<const std::string> data) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const uint64_t size = url.size() + (data ? data->size() : 0);
+        if (entries.count(url)) {
+            return;
+        }
+        if (size > limit) {
+            dropped++;
+            return;
+        }
+        while (bytes + size > limit && !lru.empty()) {
+            erase(entries.find(lru.back()));
+            dropped++;
+        }
+        lru.push_front(url);
+        entries.emplace(url, Entry{std::move(data), size, lru.begin(), Clock::now() + ttl});
+        bytes += size;
+    }
+
+    /* A ttl of zero keeps answers until they are evicted */
+    void configure(uint64_t limit_, std::chrono::seconds ttl_) {
+        std::lock_guard<std::mutex> lock(mutex);
+        limit = limit_;
+        ttl = ttl_;
+        while (bytes > limit && !lru.empty()) {
+            erase(entries.find(lru.back()));
+        }
+    }
+
+    MLNSharedResourceStats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        MLNSharedResourceStats stats;
+        stats.hits = hits;
+        stats.misses = misses;
+        stats.dropped = dropped;
+        stats.entries = entries.size();
+        stats.bytes = bytes;
+        return stats;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<const std::string> data;
+        uint64_t size;
+        std::list<std::string>::iterator lru;
+        Clock::time_point expires;
+    };
+
+    void erase(std::unordered_map<std::string, Entry>::iterator it) {
+        bytes -= it->second.size;
+        lru.erase(it->second.lru);
+        entries.erase(it);
+    }
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru; /* Most recently used first */
+    uint64_t limit;
+    std::chrono::seconds ttl{0};
+    uint64_t bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t dropped = 0;
+};
+
+static SharedResources sharedResources{64ull << 20};
+static SharedResources sharedTiles{128ull << 20};
+
+/* The shared cache for answers of a kind, if they are shared */
+static SharedResources* sharedCacheFor(mbgl::Resource::Kind kind) {
+    switch (kind) {
+        case mbgl::Resource::Kind::Glyphs:
+        case mbgl::Resource::Kind::SpriteImage:
+        case mbgl::Resource::Kind::SpriteJSON:
+            return &sharedResources;
+        case mbgl::Resource::Kind::Tile:
+            return &sharedTiles;
+        default:
+            return nullptr;
     }
 }
 
-void mln_headless_frontend_destroy(MLNHeadlessFrontend* frontend) {
-    delete frontend;
+struct MLNResourceHandle {
+    std::shared_ptr<PendingResource> state;
+};
+
+/* Async request handle; destroying it cancels delivery of the response */
+class CallbackRequest : public mbgl::AsyncRequest {
+public:
+    explicit CallbackRequest(std::shared_ptr<PendingResource> state_) : state(std::move(state_)) {}
+    ~CallbackRequest() override {
+        std::unique_ptr<mbgl::AsyncRequest> fallback;
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->cancelled = true;
+        state->callback = nullptr;
+        fallback = std::move(state->fallback);
+    }
+
+private:
+    std::shared_ptr<PendingResource> state;
+};
+
+static void releaseResponse(const MLNResourceResponse& result) {
+    if (result.release) {
+        result.release(result.release_ctx);
+    }
 }
 
-void mln_headless_frontend_set_size(MLNHeadlessFrontend* frontend, MLNSize size) {
-    if (frontend && frontend->frontend) {
-        frontend->size = mbgl::Size{size.width, size.height};
-        frontend->frontend->setSize(frontend->size);
+static mbgl::Response toResponse(mbgl::Resource::Kind kind, const MLNResourceResponse& result) {
+    mbgl::Response response;
+    if (result.error) {
+        response.error = std::make_unique<mbgl::Response::Error>(
+            mbgl::Response::Error::Reason::Other, std::string(result.error));
+    } else if (result.deferred) {
+        response.error = std::make_unique<mbgl::Response::Error>(
+            mbgl::Response::Error::Reason::Other, "Resource answer cannot be deferred again");
+    } else if (result.not_found) {
+        if (kind == mbgl::Resource::Kind::Tile) {
+            // A missing tile is empty, not a failure
+            response.noContent = true;
+        } else {
+            response.error = std::make_unique<mbgl::Response::Error>(
+                mbgl::Response::Error::Reason::NotFound, "Not found");
+        }
+    } else if (result.data && result.data_len > 0) {
+        response.data = std::make_shared<const std::string>(
+            reinterpret_cast<const char*>(result.data), result.data_len);
+    } else {
+        response.noContent = true;
     }
+    return response;
 }
 
-MLNSize mln_headless_frontend_get_size(MLNHeadlessFrontend* frontend) {
-    if (frontend) {
-        return MLNSize{frontend->size.width, frontend->size.height};
+/*
+ * File source that serves requests through the map's resource callback.
+ *
+ * The callback runs on the requesting (map) thread and either answers at
+ * once or defers the request. Either way the response is delivered from the
+ * map thread's RunLoop, so callers never see a response before request()
+ * returns and deferred loads don't block the thread.
+ */
+class CallbackFileSource : public mbgl::FileSource {
+public:
+    CallbackFileSource(const mbgl::ResourceOptions& resourceOptions_,
+                       const mbgl::ClientOptions& clientOptions_,
+                       const MLNResourceLoader& loader_,
+                       mbgl::FileSourceManager::FileSourceFactory fallbackFactory_)
+        : resourceOptions(resourceOptions_.clone()),
+          clientOptions(clientOptions_.clone()),
+          loader(loader_),
+          fallbackFactory(std::move(fallbackFactory_)) {}
+
+    std::unique_ptr<mbgl::AsyncRequest> request(const mbgl::Resource& resource, Callback callback) override {
+        if (loader.stats) {
+            auto tracked = std::make_shared<TrackedRequest>(loader.stats, resource.kind);
+            callback = [tracked, callback = std::move(callback)](mbgl::Response response) {
+                tracked->complete(response);
+                callback(response);
+            };
+        }
+        
+        auto state = std::make_shared<PendingResource>();
+        state->loop = mbgl::util::RunLoop::Get();
+        state->kind = resource.kind;
+        state->callback = std::move(callback);
+
+        // Maps without a resource callback load everything the default way
+        if (!loader.callback) {
+            if (loader.pending) {
+                loader.pending->add(state);
+            }
+            startFallback(state, resource);
+            return std::make_unique<CallbackRequest>(std::move(state));
+        }
+
+        if (auto* shared = sharedCacheFor(resource.kind)) {
+            std::shared_ptr<const std::string> data;
+            if (shared->find(resource.url, data)) {
+                auto response = std::make_shared<mbgl::Response>();
+                if (data) {
+                    response->data = std::move(data);
+                } else {
+                    response->noContent = true;
+                }
+                deliverResponse(state, std::move(response));
+                return std::make_unique<CallbackRequest>(std::move(state));
+            }
+            state->shared = shared;
+            state->url = resource.url;
+        }
+        if (loader.pending) {
+            loader.pending->add(state);
+        }
+
+        // A deferred answer may still pass the request through
+        state->passThrough = [this, resource](const std::shared_ptr<PendingResource>& state) {
+            startFallback(state, resource);
+        };
+
+        auto* handle = new MLNResourceHandle{state};
+        MLNResourceRequest request{resource.url.c_str(), static_cast<uint8_t>(resource.kind), handle};
+        MLNResourceResponse result{};
+        loader.callback(&request, &result, loader.userData);
+
+        if (result.deferred) {
+            // The callback owns the handle until it calls mln_resource_respond
+            return std::make_unique<CallbackRequest>(std::move(state));
+        }
+
+        if (result.pass_through) {
+            delete handle;
+            releaseResponse(result);
+            startFallback(state, resource);
+            return std::make_unique<CallbackRequest>(std::move(state));
+        }
+
+        auto pending = std::make_unique<CallbackRequest>(state);
+        mln_resource_respond(handle, &result);
+        return pending;
+    }
+
+    bool canRequest(const mbgl::Resource&) const override { return true; }
+
+    void setResourceOptions(mbgl::ResourceOptions options) override { resourceOptions = std::move(options); }
+    mbgl::ResourceOptions getResourceOptions() override { return resourceOptions.clone(); }
+    void setClientOptions(mbgl::ClientOptions options) override { clientOptions = std::move(options); }
+    mbgl::ClientOptions getClientOptions() override { return clientOptions.clone(); }
+
+private:
+    /*
+     * Load a request through the default file source. The load is kept on
+     * the request's state, so a cancelled render ends it like any other.
+     */
+    void startFallback(const std::shared_ptr<PendingResource>& state, const mbgl::Resource& resource) {
+        auto* fallbackSource = getFallback();
+        if (!fallbackSource) {
+            auto response = std::make_shared<mbgl::Response>();
+            response->error = std::make_unique<mbgl::Response::Error>(
+                mbgl::Response::Error::Reason::Other, "No default file source available");
+            deliverResponse(state, std::move(response));
+            return;
+        }
+
+        std::weak_ptr<PendingResource> weak = state;
+        auto request = fallbackSource->request(resource, [weak](mbgl::Response response) {
+            auto state = weak.lock();
+            if (!state) {
+                return;
+            }
+            // The default file source may answer more than once (revalidation)
+            mbgl::FileSource::Callback callback;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (state->cancelled) {
+                    return;
+                }
+                callback = state->callback;
+            }
+            if (callback) {
+                callback(response);
+            }
+        });
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->fallback = std::move(request);
+    }
+
+    /* Default file source used for pass-through requests, created on first use */
+    mbgl::FileSource* getFallback() {
+        if (!fallback && fallbackFactory) {
+            fallback = fallbackFactory(resourceOptions.clone().withPlatformContext(nullptr), clientOptions);
+        }
+        return fallback.get();
+    }
+
+    mbgl::ResourceOptions resourceOptions;
+    mbgl::ClientOptions clientOptions;
+    const MLNResourceLoader loader;
+    mbgl::FileSourceManager::FileSourceFactory fallbackFactory;
+    std::unique_ptr<mbgl::FileSource> fallback;
+};
+
+/*
+ * Route maps that carry a resource loader through CallbackFileSource, and
+ * everything else through the previously registered resource loader.
+ */
+static void installCallbackFileSource() {
+    auto* manager = mbgl::FileSourceManager::get();
+    auto previous = manager->unRegisterFileSourceFactory(mbgl::FileSourceType::ResourceLoader);
+
+    manager->registerFileSourceFactory(
+        mbgl::FileSourceType::ResourceLoader,
+        [previous](const mbgl::ResourceOptions& resourceOptions,
+                   const mbgl::ClientOptions& clientOptions) -> std::unique_ptr<mbgl::FileSource> {
+            auto* loader = static_cast<const MLNResourceLoader*>(resourceOptions.platformContext());
+            if (loader && loader->magic == kResourceLoaderMagic) {
+                return std::make_unique<CallbackFileSource>(resourceOptions, clientOptions, *loader, previous);
+            }
+            return previous ? previous(resourceOptions, clientOptions) : nullptr;
+        });
+}
+
+/* Internal structures wrapping MapLibre Native objects */
+#ifdef MLN_GL_READBACK
+/* Pixel pack buffers that pipelined readbacks alternate between */
+struct PixelPackBuffers {
+    unsigned int ids[2] = {0, 0};
+    size_t bytes[2] = {0, 0};
+    unsigned int next = 0;
+};
+#endif
+
+struct MLNHeadlessFrontend {
+    std::unique_ptr<mbgl::HeadlessFrontend> frontend;
+    float pixelRatio;
+    mbgl::Size size;
+#ifdef MLN_GL_READBACK
+    PixelPackBuffers packBuffers;
+#endif
+};
+
+struct Pipeline;
+
+struct MLNMap {
+    MLNHeadlessFrontend* frontend;
+    std::unique_ptr<MLNResourceLoader> loader; /* Must outlive map */
+    std::unique_ptr<mbgl::Map> map;
+    float pixelRatio;
+    MLNMapMode mode;
+    bool styleLoaded;
+    uint64_t styleHash;          /* Hash of the loaded style, 0 if unknown */
+    bool rendering;              /* A render is in flight */
+    MLNErrorCode abortCode;      /* Why the render in flight was aborted, MLN_OK if it wasn't */
+    uint32_t timeoutMs;          /* Deadline of the next render, 0 for none */
+    std::unique_ptr<mbgl::util::Timer> deadline;
+    std::shared_ptr<Pipeline> pipeline; /* Pipelined render in progress */
+    MLNRenderStats stats;        /* Stats of the last completed render */
+    double styleParseMs;         /* Style load since the last render, reported with the next one */
+    ResourceStats statsBaseline; /* Request counters when the last render completed */
+    std::thread::id ownerThread; /* Thread whose RunLoop the map is bound to */
+};
+
+/*
+ * A map is bound to the RunLoop of the thread that created it. Driving it
+ * from another thread would race with that loop, so reject it instead.
+ */
+static bool checkOwnerThread(const MLNMap* map) {
+    if (map->ownerThread != std::this_thread::get_id()) {
+        snprintf(last_error, sizeof(last_error), "Map used from a thread other than the one that created it");
+        return false;
+    }
+    return true;
+}
+
+/* Apply the size, camera and debug options of a render */
+static void applyOptions(MLNMap* map, const MLNRenderOptions& options) {
+    if (options.size.width > 0 && options.size.height > 0) {
+        mln_map_set_size(map, options.size);
+    }
+    mln_map_set_camera(map, &options.camera);
+    mln_map_set_debug(map, options.debug);
+}
+
+/* Validate a map for rendering and apply the render options */
+static MLNErrorCode prepareRender(MLNMap* map, const MLNRenderOptions* options) {
+    if (!map || !map->map || !map->frontend || !map->frontend->frontend) {
+        snprintf(last_error, sizeof(last_error), "Invalid map");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
+    }
+    
+    if (map->rendering || map->pipeline) {
+        snprintf(last_error, sizeof(last_error), "Map is already rendering");
+        return MLN_ERROR_BUSY;
+    }
+    
+    if (!map->styleLoaded) {
+        snprintf(last_error, sizeof(last_error), "Style not loaded");
+        return MLN_ERROR_NOT_LOADED;
+    }
+    
+    // Ensure this thread has a RunLoop for async operations during render
+    ensureRunLoop();
+    
+    map->timeoutMs = options ? options->timeout_ms : 0;
+    
+    // Apply render options if provided
+    if (options) {
+        applyOptions(map, *options);
+    }
+    
+    return MLN_OK;
+}
+
+/*
+ * Pixel buffers for readback images, recycled instead of allocated for
+ * every render. Each render thread has its own pool, so renders never
+ * contend on it; a buffer goes back to the pool it came from when its
+ * image is freed, on whichever thread that happens. Buffer sizes are
+ * rounded up to size classes (at most 25% larger than requested) so
+ * similar sizes share buffers.
+ */
+static std::atomic<uint64_t> bufferPoolLimit{64ull << 20};
+
+static struct {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> returned{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> pooledBytes{0};
+} bufferPoolStats;
+
+static size_t bufferSizeClass(size_t bytes) {
+    constexpr size_t minClass = 4096;
+    if (bytes <= minClass) {
+        return minClass;
+    }
+    size_t high = minClass;
+    while (high * 2 < bytes) {
+        high *= 2;
+    }
+    const size_t step = high / 4;
+    return (bytes + step - 1) / step * step;
+}
+
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+public:
+    /* The calling thread's pool */
+    static BufferPool& local() {
+        static thread_local std::shared_ptr<BufferPool> pool = std::make_shared<BufferPool>();
+        return *pool;
+    }
+
+    ~BufferPool() {
+        bufferPoolStats.pooledBytes -= bytes;
+    }
+
+    /* An uninitialized buffer of at least `size` bytes */
+    std::unique_ptr<uint8_t[]> acquire(size_t size, size_t& capacity) {
+        capacity = bufferSizeClass(size);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = free.find(capacity);
+            if (it != free.end() && !it->second.empty()) {
+                auto buffer = std::move(it->second.back());
+                it->second.pop_back();
+                bytes -= capacity;
+                bufferPoolStats.pooledBytes -= capacity;
+                bufferPoolStats.hits++;
+                return buffer;
+            }
+        }
+        bufferPoolStats.misses++;
+        return std::unique_ptr<uint8_t[]>(new uint8_t[capacity]);
+    }
+
+    /* Keep a buffer for reuse unless the pool is full */
+    void release(std::unique_ptr<uint8_t[]> buffer, size_t capacity) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (bytes + capacity > bufferPoolLimit.load(std::memory_order_relaxed)) {
+            bufferPoolStats.dropped++;
+            return;
+        }
+        free[capacity].push_back(std::move(buffer));
+        bytes += capacity;
+        bufferPoolStats.pooledBytes += capacity;
+        bufferPoolStats.returned++;
+    }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<size_t, std::vector<std::unique_ptr<uint8_t[]>>> free;
+    uint64_t bytes = 0;
+};
+
+/* Owner of the pixels behind an MLNImageData, deleted by mln_image_free */
+struct ImageOwner {
+    virtual ~ImageOwner() = default;
+};
+
+/* Pixels in a buffer from a BufferPool, returned to it on delete */
+struct PooledImage : ImageOwner {
+    PooledImage(std::shared_ptr<BufferPool> pool_, size_t size)
+        : pool(std::move(pool_)), data(pool->acquire(size, capacity)) {}
+    ~PooledImage() override {
+        pool->release(std::move(data), capacity);
+    }
+
+    std::shared_ptr<BufferPool> pool;
+    size_t capacity = 0;
+    std::unique_ptr<uint8_t[]> data;
+};
+
+#ifdef MLN_GL_READBACK
+#ifndef GL_RGBA
+#define GL_RGBA 0x1908
+#endif
+#ifndef GL_UNSIGNED_BYTE
+#define GL_UNSIGNED_BYTE 0x1401
+#endif
+#ifndef GL_PACK_ALIGNMENT
+#define GL_PACK_ALIGNMENT 0x0D05
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT 0x0001
+#endif
+
+/*
+ * Read the drawn frame straight into a pooled buffer. Does what
+ * HeadlessFrontend::readStillImage does (read the bound framebuffer, flip it
+ * to top-down rows) without allocating a fresh image every time.
+ */
+static MLNErrorCode readImage(MLNHeadlessFrontend* frontend, MLNImageData* image) {
+    auto* backend = frontend->frontend->getBackend();
+    mbgl::gfx::BackendScope guard{*backend};
+
+    const mbgl::Size size = backend->getDefaultRenderable().getSize();
+    const size_t stride = size_t(size.width) * 4;
+    const size_t bytes = stride * size.height;
+    if (bytes == 0) {
+        snprintf(last_error, sizeof(last_error), "Render produced empty image");
+        return MLN_ERROR_RENDER_FAILED;
+    }
+
+    auto* pooled = new PooledImage(BufferPool::local().shared_from_this(), bytes);
+    uint8_t* data = pooled->data.get();
+    mbgl::platform::glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    mbgl::platform::glReadPixels(0, 0, size.width, size.height, GL_RGBA, GL_UNSIGNED_BYTE, data);
+
+    // GL rows run bottom-up
+    std::vector<uint8_t> row(stride);
+    for (uint32_t top = 0, bottom = size.height - 1; top < bottom; top++, bottom--) {
+        std::memcpy(row.data(), data + top * stride, stride);
+        std::memcpy(data + top * stride, data + bottom * stride, stride);
+        std::memcpy(data + bottom * stride, row.data(), stride);
+    }
+
+    image->data = data;
+    image->data_len = bytes;
+    image->width = size.width;
+    image->height = size.height;
+    image->owner = static_cast<ImageOwner*>(pooled);
+    return MLN_OK;
+}
+
+/* A drawn frame being copied into a pixel pack buffer */
+struct FrameReadback {
+    unsigned int slot = 0;
+    mbgl::Size size;
+};
+
+/*
+ * Queue a copy of the drawn frame into the next pixel pack buffer. Returns
+ * without waiting for it; the GPU runs the copy behind the next frame.
+ */
+static MLNErrorCode beginReadback(MLNHeadlessFrontend* frontend, FrameReadback& readback) {
+    auto* backend = frontend->frontend->getBackend();
+    mbgl::gfx::BackendScope guard{*backend};
+
+    const mbgl::Size size = backend->getDefaultRenderable().getSize();
+    const size_t bytes = size_t(size.width) * 4 * size.height;
+    if (bytes == 0) {
+        snprintf(last_error, sizeof(last_error), "Render produced empty image");
+        return MLN_ERROR_RENDER_FAILED;
+    }
+
+    PixelPackBuffers& buffers = frontend->packBuffers;
+    if (!buffers.ids[0]) {
+        mbgl::platform::glGenBuffers(2, buffers.ids);
+    }
+    const unsigned int slot = buffers.next;
+    buffers.next ^= 1;
+
+    mbgl::platform::glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers.ids[slot]);
+    if (buffers.bytes[slot] < bytes) {
+        mbgl::platform::glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+        buffers.bytes[slot] = bytes;
+    }
+    mbgl::platform::glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    mbgl::platform::glReadPixels(0, 0, size.width, size.height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    mbgl::platform::glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    readback.slot = slot;
+    readback.size = size;
+    return MLN_OK;
+}
+
+/* Wait for a queued copy and move it into a pooled buffer */
+static MLNErrorCode finishReadback(MLNHeadlessFrontend* frontend, const FrameReadback& readback,
+                                   MLNImageData* image) {
+    auto* backend = frontend->frontend->getBackend();
+    mbgl::gfx::BackendScope guard{*backend};
+
+    const mbgl::Size size = readback.size;
+    const size_t stride = size_t(size.width) * 4;
+    const size_t bytes = stride * size.height;
+    mbgl::platform::glBindBuffer(GL_PIXEL_PACK_BUFFER, frontend->packBuffers.ids[readback.slot]);
+    const auto* mapped = static_cast<const uint8_t*>(
+        mbgl::platform::glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT));
+    if (!mapped) {
+        mbgl::platform::glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        snprintf(last_error, sizeof(last_error), "Failed to map readback buffer");
+        return MLN_ERROR_RENDER_FAILED;
+    }
+
+    // GL rows run bottom-up; flip them while copying out
+    auto* pooled = new PooledImage(BufferPool::local().shared_from_this(), bytes);
+    uint8_t* data = pooled->data.get();
+    for (uint32_t y = 0; y < size.height; y++) {
+        std::memcpy(data + y * stride, mapped + (size.height - 1 - y) * stride, stride);
+    }
+    const bool intact = mbgl::platform::glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    mbgl::platform::glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!intact) {
+        delete pooled;
+        snprintf(last_error, sizeof(last_error), "Readback buffer contents were lost");
+        return MLN_ERROR_RENDER_FAILED;
+    }
+
+    image->data = data;
+    image->data_len = bytes;
+    image->width = size.width;
+    image->height = size.height;
+    image->owner = static_cast<ImageOwner*>(pooled);
+    return MLN_OK;
+}
+
+/* Release a frontend's pixel pack buffers while its context is current */
+static void destroyPackBuffers(MLNHeadlessFrontend* frontend) {
+    PixelPackBuffers& buffers = frontend->packBuffers;
+    if (buffers.ids[0] && frontend->frontend) {
+        mbgl::gfx::BackendScope guard{*frontend->frontend->getBackend()};
+        mbgl::platform::glDeleteBuffers(2, buffers.ids);
+    }
+    buffers = PixelPackBuffers{};
+}
+#else
+/* Pixels in an image allocated by mbgl */
+struct MbglImage : ImageOwner {
+    explicit MbglImage(mbgl::PremultipliedImage&& image_) : image(std::move(image_)) {}
+    mbgl::PremultipliedImage image;
+};
+
+/*
+ * Hand mbgl's readback image to the caller instead of copying it. Backends
+ * other than OpenGL allocate it themselves, so it is not pooled.
+ */
+static MLNErrorCode readImage(MLNHeadlessFrontend* frontend, MLNImageData* image) {
+    mbgl::PremultipliedImage rendered = frontend->frontend->readStillImage();
+    if (rendered.bytes() == 0) {
+        snprintf(last_error, sizeof(last_error), "Render produced empty image");
+        return MLN_ERROR_RENDER_FAILED;
+    }
+
+    auto* owner = new MbglImage(std::move(rendered));
+    image->data = owner->image.data.get();
+    image->data_len = owner->image.bytes();
+    image->width = owner->image.size.width;
+    image->height = owner->image.size.height;
+    image->owner = static_cast<ImageOwner*>(owner);
+    return MLN_OK;
+}
+
+/* A drawn frame, already read back: these backends have no async readback */
+struct FrameReadback {
+    MLNImageData image = {nullptr, 0, 0, 0, nullptr};
+};
+
+static MLNErrorCode beginReadback(MLNHeadlessFrontend* frontend, FrameReadback& readback) {
+    return readImage(frontend, &readback.image);
+}
+
+static MLNErrorCode finishReadback(MLNHeadlessFrontend*, const FrameReadback& readback,
+                                   MLNImageData* image) {
+    *image = readback.image;
+    return MLN_OK;
+}
+#endif
+
+/*
+ * Abort the render in flight by failing its outstanding resource requests,
+ * which makes mbgl end a still render with an error. Loads passed through to
+ * the default file source are stopped along with them. Work that is already
+ * running (layout, drawing) finishes first. The failed loads leave errored
+ * tiles behind, so the style is reloaded before the next render.
+ */
+static void abortRender(MLNMap* map, MLNErrorCode code) {
+    if (!map->rendering || map->abortCode != MLN_OK) {
+        return;
+    }
+    map->abortCode = code;
+    map->styleHash = 0;
+    if (!map->loader || !map->loader->pending) {
+        return;
+    }
+    
+    std::vector<std::weak_ptr<PendingResource>> requests;
+    requests.swap(map->loader->pending->requests);
+    for (auto& request : requests) {
+        if (auto state = request.lock()) {
+            auto response = std::make_shared<mbgl::Response>();
+            response->error = std::make_unique<mbgl::Response::Error>(
+                mbgl::Response::Error::Reason::Other, "Render cancelled");
+            deliverResponse(state, std::move(response));
+        }
+    }
+}
+
+/*
+ * Start drawing a still frame. drawn runs from the RunLoop once the frame is
+ * in the framebuffer (or directly, if the render cannot be started). Records
+ * the render's stats on the map, all but the readback.
+ */
+static void startDraw(MLNMap* map, std::function<void(MLNErrorCode)> drawn) {
+    using Clock = std::chrono::steady_clock;
+    using Millis = std::chrono::duration<double, std::milli>;
+    
+    try {
+        map->rendering = true;
+        map->abortCode = MLN_OK;
+        if (map->timeoutMs > 0) {
+            map->deadline = std::make_unique<mbgl::util::Timer>();
+            map->deadline->start(std::chrono::milliseconds(map->timeoutMs), std::chrono::milliseconds(0),
+                                 [map]() { abortRender(map, MLN_ERROR_TIMEOUT); });
+        }
+        const auto started = Clock::now();
+        const double busyBefore = map->loader->stats ? map->loader->stats->busyMsUntil(started) : 0;
+        map->map->renderStill([map, started, busyBefore, drawn](std::exception_ptr error) {
+            map->rendering = false;
+            map->deadline.reset();
+            const auto finished = Clock::now();
+            const ResourceStats* requests = map->loader->stats.get();
+            
+            MLNErrorCode code = MLN_OK;
+            if (map->abortCode != MLN_OK) {
+                code = map->abortCode;
+                map->abortCode = MLN_OK;
+                snprintf(last_error, sizeof(last_error), "%s",
+                         code == MLN_ERROR_TIMEOUT ? "Render deadline exceeded" : "Render cancelled");
+            } else if (error) {
+                try {
+                    std::rethrow_exception(error);
+                } catch (const std::exception& e) {
+                    snprintf(last_error, sizeof(last_error), "Render failed: %s", e.what());
+                }
+                code = MLN_ERROR_RENDER_FAILED;
+            }
+            
+            MLNRenderStats& stats = map->stats;
+            stats.style_parse_ms = map->styleParseMs;
+            stats.render_ms = Millis(finished - started).count();
+            stats.readback_ms = 0;
+            map->styleParseMs = 0;
+            if (requests) {
+                const ResourceStats& before = map->statsBaseline;
+                stats.resource_wait_ms = requests->busyMsUntil(finished) - busyBefore;
+                stats.resource_requests = requests->requests - before.requests;
+                stats.tile_requests = requests->tileRequests - before.tileRequests;
+                stats.failed_requests = requests->failedRequests - before.failedRequests;
+                stats.resource_bytes = requests->bytes - before.bytes;
+                map->statsBaseline = *requests;
+            }
+            drawn(code);
+        });
+    } catch (const std::exception& e) {
+        map->rendering = false;
+        map->deadline.reset();
+        snprintf(last_error, sizeof(last_error), "Render failed: %s", e.what());
+        drawn(MLN_ERROR_RENDER_FAILED);
+    }
+}
+
+/*
+ * Start a still render. done runs from the RunLoop once the frame has been
+ * read back (or directly, if the render cannot be started) and receives
+ * ownership of the image. Records the render's stats on the map.
+ */
+static void startRender(MLNMap* map, std::function<void(MLNErrorCode, MLNImageData*)> done) {
+    using Clock = std::chrono::steady_clock;
+    using Millis = std::chrono::duration<double, std::milli>;
+    
+    startDraw(map, [map, done](MLNErrorCode code) {
+        MLNImageData image = {nullptr, 0, 0, 0, nullptr};
+        if (code == MLN_OK) {
+            const auto drawn = Clock::now();
+            code = readImage(map->frontend, &image);
+            map->stats.readback_ms = Millis(Clock::now() - drawn).count();
+        }
+        done(code, code == MLN_OK ? &image : nullptr);
+    });
+}
+
+/* A frame of a pipelined render that has been drawn or has failed */
+struct PipelineFrame {
+    size_t index;
+    MLNErrorCode code;
+    std::string error;        /* Last error of a failed frame */
+    MLNRenderStats stats;
+    FrameReadback readback;   /* Copy of the frame, if it was drawn */
+};
+
+/*
+ * Frames rendered one after another on one map. Frame K stays in its
+ * readback buffer while frame K + 1 is drawn and is handed over once that
+ * draw is done (or nothing is drawing), so frames arrive in order.
+ */
+struct Pipeline {
+    std::vector<MLNRenderOptions> options;
+    MLNFrameCallback callback;
+    void* userData;
+    std::chrono::steady_clock::time_point started;
+    size_t next = 0;                   /* Next frame to draw */
+    bool drawing = false;              /* Frame next - 1 is being drawn */
+    size_t newest = SIZE_MAX;          /* Frame whose readback was queued last */
+    MLNErrorCode abortCode = MLN_OK;   /* Fails every frame not drawn yet */
+    std::deque<PipelineFrame> frames;  /* Finished frames not handed over yet */
+};
+
+/* Draw the pipeline's next frame and hand over the frames that are done */
+static void advancePipeline(MLNMap* map) {
+    using Clock = std::chrono::steady_clock;
+    using Millis = std::chrono::duration<double, std::milli>;
+    std::shared_ptr<Pipeline> pipeline = map->pipeline;
+    
+    while (!pipeline->drawing && pipeline->next < pipeline->options.size()) {
+        const size_t index = pipeline->next++;
+        const MLNRenderOptions& options = pipeline->options[index];
+        
+        // Deadlines count from the start of the pipeline
+        MLNErrorCode code = pipeline->abortCode;
+        uint32_t remaining = 0;
+        if (code == MLN_OK && options.timeout_ms > 0) {
+            const double elapsed = Millis(Clock::now() - pipeline->started).count();
+            if (elapsed >= options.timeout_ms) {
+                code = MLN_ERROR_TIMEOUT;
+            } else {
+                remaining = std::max<uint32_t>(1, options.timeout_ms - uint32_t(elapsed));
+            }
+        }
+        if (code != MLN_OK) {
+            const char* error = code == MLN_ERROR_TIMEOUT ? "Render deadline exceeded" : "Render cancelled";
+            pipeline->frames.push_back(PipelineFrame{index, code, error, MLNRenderStats{}, {}});
+            continue;
+        }
+        
+        applyOptions(map, options);
+        map->timeoutMs = remaining;
+        pipeline->drawing = true;
+        startDraw(map, [map, pipeline, index](MLNErrorCode code) {
+            pipeline->drawing = false;
+            PipelineFrame frame{index, code, {}, map->stats, {}};
+            if (code == MLN_OK) {
+                const auto drawn = Clock::now();
+                frame.code = beginReadback(map->frontend, frame.readback);
+                frame.stats.readback_ms = Millis(Clock::now() - drawn).count();
+                pipeline->newest = index;
+            }
+            if (frame.code != MLN_OK) {
+                frame.error = last_error;
+            }
+            pipeline->frames.push_back(std::move(frame));
+            advancePipeline(map);
+        });
+    }
+    
+    while (!pipeline->frames.empty()) {
+        PipelineFrame& frame = pipeline->frames.front();
+        // The newest copy may still be in flight on the GPU
+        if (frame.code == MLN_OK && pipeline->drawing && frame.index == pipeline->newest) {
+            break;
+        }
+        
+        const size_t index = frame.index;
+        MLNErrorCode code = frame.code;
+        MLNRenderStats stats = frame.stats;
+        MLNImageData image = {nullptr, 0, 0, 0, nullptr};
+        if (code == MLN_OK) {
+            const auto mapped = Clock::now();
+            code = finishReadback(map->frontend, frame.readback, &image);
+            stats.readback_ms += Millis(Clock::now() - mapped).count();
+        } else {
+            snprintf(last_error, sizeof(last_error), "%s", frame.error.c_str());
+        }
+        pipeline->frames.pop_front();
+        
+        map->stats = stats;
+        const bool last = pipeline->frames.empty() && !pipeline->drawing &&
+                          pipeline->next == pipeline->options.size();
+        if (last) {
+            // The map is free again once the last frame is handed over
+            map->pipeline.reset();
+        }
+        pipeline->callback(index, code, code == MLN_OK ? &image : nullptr, &stats, pipeline->userData);
+        threadLoopWake()->wake();
+    }
+}
+
+extern "C" {
+
+MLNErrorCode mln_init(void) {
+    std::lock_guard<std::mutex> lock(initMutex);
+    
+    if (initialized.load(std::memory_order_acquire)) {
+        return MLN_OK;
+    }
+    
+    try {
+        std::call_once(globalSetupOnce, [] {
+            // Suppress MapLibre Native's verbose logging by default
+            mbgl::Log::setObserver(std::make_unique<SilentLogObserver>());
+            installCallbackFileSource();
+        });
+        
+        // Ensure the calling thread has a RunLoop
+        ensureRunLoop();
+        initialized.store(true, std::memory_order_release);
+        return MLN_OK;
+    } catch (const std::exception& e) {
+        snprintf(last_error, sizeof(last_error), "Failed to initialize: %s", e.what());
+        return MLN_ERROR_UNKNOWN;
+    }
+}
+
+void mln_cleanup(void) {
+    std::lock_guard<std::mutex> lock(initMutex);
+    // Note: thread-local RunLoops are cleaned up when threads exit
+    initialized.store(false, std::memory_order_release);
+}
+
+uint32_t mln_render_device_count(void) {
+#ifdef MLN_EGL_DEVICES
+    return std::max<uint32_t>(static_cast<uint32_t>(eglDevices().size()), 1);
+#else
+    return 1;
+#endif
+}
+
+MLNErrorCode mln_set_render_device(uint32_t index) {
+#ifdef MLN_EGL_DEVICES
+    const uint32_t count = static_cast<uint32_t>(eglDevices().size());
+    if (index >= count) {
+        snprintf(last_error, sizeof(last_error), "No render device %u (%u available)", index, count);
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+
+    std::lock_guard<std::mutex> lock(deviceMutex);
+    if (renderDevice.load(std::memory_order_relaxed) == index) {
+        return MLN_OK;
+    }
+    if (liveFrontends > 0) {
+        snprintf(last_error, sizeof(last_error),
+                 "Can't change the render device while %zu frontends use it", liveFrontends);
+        return MLN_ERROR_BUSY;
+    }
+    renderDevice.store(index, std::memory_order_release);
+    return MLN_OK;
+#else
+    /* The system default device is the only one */
+    if (index > 0) {
+        snprintf(last_error, sizeof(last_error), "No render device %u (1 available)", index);
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    return MLN_OK;
+#endif
+}
+
+MLNHeadlessFrontend* mln_headless_frontend_create(MLNSize size, float pixel_ratio) {
+    if (!initialized.load(std::memory_order_acquire)) {
+        snprintf(last_error, sizeof(last_error), "Library not initialized");
+        return nullptr;
+    }
+    
+    try {
+        // Ensure this thread has a RunLoop
+        ensureRunLoop();
+        
+        auto frontend = std::make_unique<MLNHeadlessFrontend>();
+        frontend->pixelRatio = pixel_ratio;
+        frontend->size = mbgl::Size{size.width, size.height};
+        frontend->frontend = std::make_unique<mbgl::HeadlessFrontend>(
+            frontend->size,
+            pixel_ratio
+        );
+
+        std::lock_guard<std::mutex> lock(deviceMutex);
+        liveFrontends++;
+        return frontend.release();
+    } catch (const std::exception& e) {
+        snprintf(last_error, sizeof(last_error), "Failed to create frontend: %s", e.what());
+        return nullptr;
+    }
+}
+
+void mln_headless_frontend_destroy(MLNHeadlessFrontend* frontend) {
+    if (!frontend) {
+        return;
+    }
+#ifdef MLN_GL_READBACK
+    destroyPackBuffers(frontend);
+#endif
+#ifdef MLN_GL_PROGRAM_CACHE
+    /* The context's objects go with it, without being deleted one by one */
+    if (frontend->frontend && program_cache::enabled.load(std::memory_order_acquire)) {
+        mbgl::gfx::BackendScope guard{*frontend->frontend->getBackend()};
+        program_cache::forget(eglGetCurrentContext());
+    }
+#endif
+    delete frontend;
+
+    std::lock_guard<std::mutex> lock(deviceMutex);
+    liveFrontends--;
+}
+
+void mln_headless_frontend_set_size(MLNHeadlessFrontend* frontend, MLNSize size) {
+    if (frontend && frontend->frontend) {
+        frontend->size = mbgl::Size{size.width, size.height};
+        // Resizing reallocates the offscreen framebuffer
+        if (frontend->frontend->getSize() != frontend->size) {
+            frontend->frontend->setSize(frontend->size);
+        }
+    }
+}
+
+MLNSize mln_headless_frontend_get_size(MLNHeadlessFrontend* frontend) {
+    if (frontend) {
+        return MLNSize{frontend->size.width, frontend->size.height};
+    }
+    return MLNSize{0, 0};
+}
+
+MLNMap* mln_map_create(MLNHeadlessFrontend* frontend, float pixel_ratio, MLNMapMode mode) {
+    return mln_map_create_with_loader(frontend, pixel_ratio, mode, nullptr, nullptr);
+}
+
+MLNMap* mln_map_create_with_loader(
+    MLNHeadlessFrontend* frontend,
+    float pixel_ratio,
+    MLNMapMode mode,
+    MLNResourceCallback request_callback,
+    void* user_data
+) {
+    if (!initialized.load(std::memory_order_acquire)) {
+        snprintf(last_error, sizeof(last_error), "Library not initialized");
+        return nullptr;
+    }
+    
+    if (!frontend || !frontend->frontend) {
+        snprintf(last_error, sizeof(last_error), "Invalid frontend");
+        return nullptr;
+    }
+    
+    try {
+        auto map = new MLNMap();
+        map->frontend = frontend;
+        map->pixelRatio = pixel_ratio;
+        map->mode = mode;
+        map->styleLoaded = false;
+        map->styleHash = 0;
+        map->rendering = false;
+        map->abortCode = MLN_OK;
+        map->timeoutMs = 0;
+        map->ownerThread = std::this_thread::get_id();
+        
+        // Map mode
+        mbgl::MapMode mapMode = (mode == MLN_MAP_MODE_TILE) 
+            ? mbgl::MapMode::Tile 
+            : mbgl::MapMode::Static;
+        
+        // Create map options
+        mbgl::MapOptions mapOptions;
+        mapOptions.withSize(frontend->size)
+                  .withPixelRatio(pixel_ratio)
+                  .withMapMode(mapMode);
+        
+        // Every map loads through a loader, so a cancel reaches its requests.
+        // Without a callback they are all passed to the default file sources.
+        map->loader = std::make_unique<MLNResourceLoader>(
+            MLNResourceLoader{kResourceLoaderMagic, request_callback, user_data,
+                              request_callback ? std::make_shared<ResourceStats>() : nullptr,
+                              std::make_shared<PendingRequests>()});
+        mbgl::ResourceOptions resourceOptions;
+        resourceOptions.withPlatformContext(map->loader.get());
+        
+        // Create the map
+        map->map = std::make_unique<mbgl::Map>(
+            *frontend->frontend,
+            mbgl::MapObserver::nullObserver(),
+            mapOptions,
+            resourceOptions
+        );
+        
+        return map;
+    } catch (const std::exception& e) {
+        snprintf(last_error, sizeof(last_error), "Failed to create map: %s", e.what());
+        return nullptr;
+    }
+}
+
+MLNErrorCode mln_map_destroy(MLNMap* map) {
+    if (!map) {
+        return MLN_OK;
+    }
+    
+    // The map's mbgl state belongs to its thread's RunLoop; leave it be
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
+    }
+    
+    // End the render in flight, so its callbacks run before the map is gone.
+    // The abort fails every load it waits for, passed through ones included,
+    // and the wait sleeps until the render's callback has run.
+    if (map->pipeline) {
+        map->pipeline->abortCode = MLN_ERROR_CANCELLED;
+    }
+    abortRender(map, MLN_ERROR_CANCELLED);
+    while (map->rendering || map->pipeline) {
+        mln_run_loop_wait(10);
+    }
+    
+    delete map;
+    return MLN_OK;
+}
+
+MLNErrorCode mln_map_load_style(MLNMap* map, const char* style_json) {
+    if (!map || !map->map) {
+        snprintf(last_error, sizeof(last_error), "Invalid map");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    
+    if (!style_json) {
+        snprintf(last_error, sizeof(last_error), "Style JSON is null");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
+    }
+    
+    // Ensure this thread has a RunLoop
+    ensureRunLoop();
+    
+    try {
+        map->styleLoaded = false;
+        map->styleHash = 0;
+        const auto started = std::chrono::steady_clock::now();
+        map->map->getStyle().loadJSON(style_json);
+        map->styleParseMs += std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - started).count();
+        map->styleLoaded = true;
+        return MLN_OK;
+    } catch (const std::exception& e) {
+        snprintf(last_error, sizeof(last_error), "Style parse error: %s", e.what());
+        return MLN_ERROR_STYLE_PARSE;
+    }
+}
+
+MLNErrorCode mln_map_load_style_with_hash(MLNMap* map, const char* style_json, uint64_t style_hash) {
+    if (!map || !map->map) {
+        snprintf(last_error, sizeof(last_error), "Invalid map");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
+    }
+    
+    // Same style already loaded, skip parsing it again
+    if (style_hash != 0 && map->styleLoaded && map->styleHash == style_hash) {
+        return MLN_OK;
+    }
+    
+    MLNErrorCode code = mln_map_load_style(map, style_json);
+    if (code == MLN_OK) {
+        map->styleHash = style_hash;
+    }
+    return code;
+}
+
+uint64_t mln_map_get_style_hash(MLNMap* map) {
+    if (!map || !map->styleLoaded) {
+        return 0;
+    }
+    return map->styleHash;
+}
+
+MLNErrorCode mln_map_load_style_url(MLNMap* map, const char* url) {
+    if (!map || !map->map) {
+        snprintf(last_error, sizeof(last_error), "Invalid map");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    
+    if (!url) {
+        snprintf(last_error, sizeof(last_error), "URL is null");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
+    }
+    
+    try {
+        map->styleHash = 0;
+        map->map->getStyle().loadURL(url);
+        map->styleLoaded = true;
+        return MLN_OK;
+    } catch (const std::exception& e) {
+        snprintf(last_error, sizeof(last_error), "Failed to load style from URL: %s", e.what());
+        return MLN_ERROR_UNKNOWN;
+    }
+}
+
+bool mln_map_is_fully_loaded(MLNMap* map) {
+    if (!map || !map->map || !checkOwnerThread(map)) {
+        return false;
+    }
+    return map->map->isFullyLoaded();
+}
+
+void mln_map_set_camera(MLNMap* map, const MLNCameraOptions* camera) {
+    if (!map || !map->map || !camera || !checkOwnerThread(map)) {
+        return;
+    }
+    
+    mbgl::CameraOptions cameraOptions;
+    cameraOptions.center = mbgl::LatLng{camera->latitude, camera->longitude};
+    cameraOptions.zoom = camera->zoom;
+    cameraOptions.bearing = camera->bearing;
+    cameraOptions.pitch = camera->pitch;
+    
+    map->map->jumpTo(cameraOptions);
+}
+
+MLNCameraOptions mln_map_get_camera(MLNMap* map) {
+    MLNCameraOptions result = {0, 0, 0, 0, 0};
+    
+    if (!map || !map->map || !checkOwnerThread(map)) {
+        return result;
+    }
+    
+    auto camera = map->map->getCameraOptions();
+    if (camera.center) {
+        result.latitude = camera.center->latitude();
+        result.longitude = camera.center->longitude();
+    }
+    if (camera.zoom) {
+        result.zoom = *camera.zoom;
+    }
+    if (camera.bearing) {
+        result.bearing = *camera.bearing;
+    }
+    if (camera.pitch) {
+        result.pitch = *camera.pitch;
+    }
+    
+    return result;
+}
+
+void mln_map_set_size(MLNMap* map, MLNSize size) {
+    if (!map || !map->map || !map->frontend || !checkOwnerThread(map)) {
+        return;
+    }
+    
+    mbgl::Size newSize{size.width, size.height};
+    map->frontend->size = newSize;
+    // Skip no-op resizes, they reallocate the offscreen framebuffer
+    if (map->frontend->frontend->getSize() != newSize) {
+        map->frontend->frontend->setSize(newSize);
+    }
+    if (map->map->getMapOptions().size() != newSize) {
+        map->map->setSize(newSize);
+    }
+}
+
+void mln_map_set_debug(MLNMap* map, MLNDebugOptions options) {
+    if (!map || !map->map || !checkOwnerThread(map)) {
+        return;
+    }
+    
+    mbgl::MapDebugOptions debugOptions = mbgl::MapDebugOptions::NoDebug;
+    
+    if (options & MLN_DEBUG_TILE_BORDERS) {
+        debugOptions = debugOptions | mbgl::MapDebugOptions::TileBorders;
+    }
+    if (options & MLN_DEBUG_PARSE_STATUS) {
+        debugOptions = debugOptions | mbgl::MapDebugOptions::ParseStatus;
+    }
+    if (options & MLN_DEBUG_TIMESTAMPS) {
+        debugOptions = debugOptions | mbgl::MapDebugOptions::Timestamps;
+    }
+    if (options & MLN_DEBUG_COLLISION) {
+        debugOptions = debugOptions | mbgl::MapDebugOptions::Collision;
+    }
+    if (options & MLN_DEBUG_OVERDRAW) {
+        debugOptions = debugOptions | mbgl::MapDebugOptions::Overdraw;
+    }
+    
+    if (map->map->getDebug() != debugOptions) {
+        map->map->setDebug(debugOptions);
+    }
+}
+
+MLNErrorCode mln_map_render_still(MLNMap* map, const MLNRenderOptions* options, MLNImageData* image) {
+    if (!image) {
+        snprintf(last_error, sizeof(last_error), "Image output is null");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    
+    MLNErrorCode code = prepareRender(map, options);
+    if (code != MLN_OK) {
+        return code;
+    }
+    
+    // Drive this thread's RunLoop until the frame is complete, like
+    // HeadlessFrontend::render does
+    bool finished = false;
+    MLNErrorCode result = MLN_ERROR_RENDER_FAILED;
+    startRender(map, [&](MLNErrorCode code, MLNImageData* rendered) {
+        result = code;
+        if (rendered) {
+            *image = *rendered;
+        }
+        finished = true;
+    });
+    while (!finished) {
+        mbgl::util::RunLoop::Get()->runOnce();
+    }
+    return result;
+}
+
+/* Where mln_map_render_batch collects its frames */
+struct BatchOutput {
+    MLNImageData* images;
+    MLNErrorCode* results;
+    size_t remaining;
+    MLNErrorCode firstError;
+};
+
+static void collectFrame(size_t index, MLNErrorCode code, MLNImageData* image,
+                         const MLNRenderStats*, void* user_data) {
+    auto* batch = static_cast<BatchOutput*>(user_data);
+    batch->images[index] = image ? *image : MLNImageData{};
+    if (batch->results) {
+        batch->results[index] = code;
+    }
+    if (code != MLN_OK && batch->firstError == MLN_OK) {
+        batch->firstError = code;
+    }
+    batch->remaining--;
+}
+
+MLNErrorCode mln_map_render_batch(
+    MLNMap* map,
+    const MLNRenderOptions* options,
+    size_t count,
+    MLNImageData* images,
+    MLNErrorCode* results
+) {
+    if (count > 0 && (!options || !images)) {
+        snprintf(last_error, sizeof(last_error), "Batch options or images are NULL");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    if (count == 0) {
+        return MLN_OK;
+    }
+
+    BatchOutput batch{images, results, count, MLN_OK};
+    MLNErrorCode code = mln_map_render_pipelined(map, options, count, collectFrame, &batch);
+    if (code != MLN_OK) {
+        for (size_t i = 0; i < count; i++) {
+            images[i] = MLNImageData{};
+            if (results) {
+                results[i] = code;
+            }
+        }
+        return code;
+    }
+    // Drive this thread's RunLoop until every frame has been handed over
+    while (batch.remaining > 0) {
+        mbgl::util::RunLoop::Get()->runOnce();
+    }
+    return batch.firstError;
+}
+
+MLNErrorCode mln_map_render_pipelined(
+    MLNMap* map,
+    const MLNRenderOptions* options,
+    size_t count,
+    MLNFrameCallback callback,
+    void* user_data
+) {
+    if (!callback || (count > 0 && !options)) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    
+    MLNErrorCode code = prepareRender(map, nullptr);
+    if (code != MLN_OK || count == 0) {
+        return code;
+    }
+    
+    auto pipeline = std::make_shared<Pipeline>();
+    pipeline->options.assign(options, options + count);
+    pipeline->callback = callback;
+    pipeline->userData = user_data;
+    pipeline->started = std::chrono::steady_clock::now();
+    map->pipeline = pipeline;
+    advancePipeline(map);
+    return MLN_OK;
+}
+
+void mln_map_render_still_async(
+    MLNMap* map,
+    const MLNRenderOptions* options,
+    MLNRenderCallback callback,
+    void* user_data
+) {
+    if (!callback) {
+        return;
+    }
+    
+    MLNErrorCode code = prepareRender(map, options);
+    if (code != MLN_OK) {
+        callback(code, nullptr, user_data);
+        threadLoopWake()->wake();
+        return;
+    }
+    
+    // The caller may be waiting on the RunLoop for the result
+    startRender(map, [callback, user_data](MLNErrorCode code, MLNImageData* image) {
+        callback(code, image, user_data);
+        threadLoopWake()->wake();
+    });
+}
+
+MLNErrorCode mln_map_cancel(MLNMap* map) {
+    if (!map || !map->map) {
+        snprintf(last_error, sizeof(last_error), "Invalid map");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
+    }
+    
+    if (map->pipeline) {
+        map->pipeline->abortCode = MLN_ERROR_CANCELLED;
+    }
+    abortRender(map, MLN_ERROR_CANCELLED);
+    return MLN_OK;
+}
+
+MLNRenderStats mln_map_get_render_stats(MLNMap* map) {
+    if (!map || !checkOwnerThread(map)) {
+        return MLNRenderStats{};
+    }
+    return map->stats;
+}
+
+void mln_run_loop_run_once(void) {
+    ensureRunLoop();
+    mbgl::util::RunLoop::Get()->runOnce();
+}
+
+void mln_run_loop_wait(uint32_t timeout_ms) {
+    const std::shared_ptr<LoopWake> wake = threadLoopWake();
+    auto* loop = mbgl::util::RunLoop::Get();
+    {
+        std::lock_guard<std::mutex> lock(wake->mutex);
+        if (wake->pending) {
+            wake->pending = false;
+            loop->runOnce();
+            return;
+        }
+        wake->waiting = true;
+    }
+
+    mbgl::util::Timer timeout;
+    timeout.start(std::chrono::milliseconds(timeout_ms), std::chrono::milliseconds(0),
+                  [wake]() { wake->stop(); });
+    loop->run();
+
+    std::lock_guard<std::mutex> lock(wake->mutex);
+    wake->waiting = false;
+}
+
+MLNRunLoopWaker* mln_run_loop_waker_create(void) {
+    return new MLNRunLoopWaker{threadLoopWake()};
+}
+
+void mln_run_loop_wake(MLNRunLoopWaker* waker) {
+    if (waker) {
+        waker->wake->wake();
+    }
+}
+
+void mln_run_loop_waker_destroy(MLNRunLoopWaker* waker) {
+    delete waker;
+}
+
+void mln_resource_respond(MLNResourceHandle* handle, const MLNResourceResponse* response) {
+    if (!handle) {
+        return;
+    }
+    
+    std::shared_ptr<PendingResource> state = std::move(handle->state);
+    delete handle;
+    
+    MLNResourceResponse empty{};
+    const MLNResourceResponse& result = response ? *response : empty;
+    if (result.pass_through && !result.error) {
+        releaseResponse(result);
+        deliverPassThrough(state);
+        return;
+    }
+    auto converted = std::make_shared<mbgl::Response>(toResponse(state->kind, result));
+    releaseResponse(result);
+    
+    if (state->shared && !converted->error) {
+        state->shared->insert(state->url, converted->data);
+    }
+    deliverResponse(state, std::move(converted));
+}
+
+void mln_image_free(MLNImageData* image) {
+    if (!image) {
+        return;
+    }
+    
+    if (image->owner) {
+        delete static_cast<ImageOwner*>(image->owner);
+    } else if (image->data) {
+        free(image->data);
+    }
+    
+    image->data = nullptr;
+    image->data_len = 0;
+    image->width = 0;
+    image->height = 0;
+    image->owner = nullptr;
+}
+
+void mln_buffer_pool_set_limit(uint64_t bytes) {
+    bufferPoolLimit.store(bytes, std::memory_order_relaxed);
+}
+
+void mln_shader_cache_set_dir(const char* dir) {
+#ifdef MLN_GL_PROGRAM_CACHE
+    std::lock_guard<std::mutex> lock(program_cache::mutex);
+    program_cache::dir = dir ? dir : "";
+    while (program_cache::dir.size() > 1 && program_cache::dir.back() == '/') {
+        program_cache::dir.pop_back();
+    }
+    /* Keep recording once enabled, so shaders set up before the cache is
+       disabled again are still forgotten when deleted */
+    if (!program_cache::dir.empty()) {
+        program_cache::enabled.store(true, std::memory_order_release);
+    }
+#else
+    (void)dir;
+#endif
+}
+
+MLNShaderCacheStats mln_shader_cache_get_stats(void) {
+    MLNShaderCacheStats stats;
+    stats.hits = programCacheHits.load(std::memory_order_relaxed);
+    stats.misses = programCacheMisses.load(std::memory_order_relaxed);
+    stats.rejected = programCacheRejected.load(std::memory_order_relaxed);
+    return stats;
+}
+
+MLNBufferPoolStats mln_buffer_pool_get_stats(void) {
+    MLNBufferPoolStats stats;
+    stats.hits = bufferPoolStats.hits.load(std::memory_order_relaxed);
+    stats.misses = bufferPoolStats.misses.load(std::memory_order_relaxed);
+    stats.returned = bufferPoolStats.returned.load(std::memory_order_relaxed);
+    stats.dropped = bufferPoolStats.dropped.load(std::memory_order_relaxed);
+    stats.pooled_bytes = bufferPoolStats.pooledBytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void mln_shared_resources_set_limit(uint64_t bytes) {
+    sharedResources.configure(bytes, std::chrono::seconds(0));
+}
+
+MLNSharedResourceStats mln_shared_resources_get_stats(void) {
+    return sharedResources.stats();
+}
+
+void mln_tile_cache_set_limit(uint64_t bytes, uint32_t ttl_secs) {
+    sharedTiles.configure(bytes, std::chrono::seconds(ttl_secs));
+}
+
+MLNSharedResourceStats mln_tile_cache_get_stats(void) {
+    return sharedTiles.stats();
+}
+
+const char* mln_get_last_error(void) {
+    return last_error[0] ? last_error : nullptr;
+}
+
+/* Immutable style images. Copies of a style::Image share its pixels. */
+struct MLNImageSet {
+    std::vector<mbgl::style::Image> images;
+};
+
+static mbgl::style::Image makeStyleImage(const MLNStyleImage& image, bool premultiplied) {
+    const mbgl::Size size{image.width, image.height};
+    const size_t dataLen = static_cast<size_t>(image.width) * image.height * 4;
+    mbgl::PremultipliedImage pixels = premultiplied
+        ? mbgl::PremultipliedImage(size, image.data, dataLen)
+        : mbgl::util::premultiply(mbgl::UnassociatedImage(size, image.data, dataLen));
+    return mbgl::style::Image(image.id, std::move(pixels), image.pixel_ratio, image.sdf);
+}
+
+MLNErrorCode mln_map_add_image(
+    MLNMap* map,
+    const char* id,
+    const uint8_t* data,
+    uint32_t width,
+    uint32_t height,
+    float pixel_ratio,
+    bool sdf
+) {
+    if (!map || !map->map || !id || !data) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
+    }
+    
+    try {
+        const MLNStyleImage image{id, data, width, height, pixel_ratio, sdf};
+        map->map->getStyle().addImage(
+            std::make_unique<mbgl::style::Image>(makeStyleImage(image, false)));
+        return MLN_OK;
+    } catch (const std::exception& e) {
+        snprintf(last_error, sizeof(last_error), "Failed to add image: %s", e.what());
+        return MLN_ERROR_UNKNOWN;
     }
-    return MLNSize{0, 0};
-}
-
-MLNMap* mln_map_create(MLNHeadlessFrontend* frontend, float pixel_ratio, MLNMapMode mode) {
-    return mln_map_create_with_loader(frontend, pixel_ratio, mode, nullptr, nullptr);
 }
 
-MLNMap* mln_map_create_with_loader(
-    MLNHeadlessFrontend* frontend,
-    float pixel_ratio,
-    MLNMapMode mode,
-    MLNResourceCallback request_callback,
-    void* user_data
-) {
-    if (!initialized) {
-        snprintf(last_error, sizeof(last_error), "Library not initialized");
+MLNImageSet* mln_image_set_create(const MLNStyleImage* images, size_t count, bool premultiplied) {
+    if (!images && count > 0) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
         return nullptr;
     }
-    
-    if (!frontend || !frontend->frontend) {
-        snprintf(last_error, sizeof(last_error), "Invalid frontend");
-        return nullptr;
+    for (size_t i = 0; i < count; i++) {
+        if (!images[i].id || !images[i].data || images[i].width == 0 || images[i].height == 0) {
+            snprintf(last_error, sizeof(last_error), "Invalid image at index %zu", i);
+            return nullptr;
+        }
     }
     
     try {
-        auto map = new MLNMap();
-        map->frontend = frontend;
-        map->pixelRatio = pixel_ratio;
-        map->mode = mode;
-        map->styleLoaded = false;
-        
-        // Map mode
-        mbgl::MapMode mapMode = (mode == MLN_MAP_MODE_TILE) 
-            ? mbgl::MapMode::Tile 
-            : mbgl::MapMode::Static;
-        
-        // Create map options
-        mbgl::MapOptions mapOptions;
-        mapOptions.withSize(frontend->size)
-                  .withPixelRatio(pixel_ratio)
-                  .withMapMode(mapMode);
-        
-        // Resource options (using default file sources)
-        mbgl::ResourceOptions resourceOptions;
-        
-        // TODO: Handle custom resource callback if provided
-        (void)request_callback;
-        (void)user_data;
-        
-        // Create the map
-        map->map = std::make_unique<mbgl::Map>(
-            *frontend->frontend,
-            mbgl::MapObserver::nullObserver(),
-            mapOptions,
-            resourceOptions
-        );
-        
-        return map;
+        auto set = std::make_unique<MLNImageSet>();
+        set->images.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            set->images.push_back(makeStyleImage(images[i], premultiplied));
+        }
+        return set.release();
     } catch (const std::exception& e) {
-        snprintf(last_error, sizeof(last_error), "Failed to create map: %s", e.what());
+        snprintf(last_error, sizeof(last_error), "Failed to create image set: %s", e.what());
         return nullptr;
     }
 }
 
-void mln_map_destroy(MLNMap* map) {
-    delete map;
+void mln_image_set_destroy(MLNImageSet* set) {
+    delete set;
 }
 
-MLNErrorCode mln_map_load_style(MLNMap* map, const char* style_json) {
-    if (!map || !map->map) {
-        snprintf(last_error, sizeof(last_error), "Invalid map");
+MLNErrorCode mln_map_add_image_set(MLNMap* map, const MLNImageSet* set) {
+    if (!map || !map->map || !set) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
         return MLN_ERROR_INVALID_ARGUMENT;
     }
     
-    if (!style_json) {
-        snprintf(last_error, sizeof(last_error), "Style JSON is null");
-        return MLN_ERROR_INVALID_ARGUMENT;
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
     }
     
-    // Ensure this thread has a RunLoop
-    ensureRunLoop();
-    
     try {
-        map->map->getStyle().loadJSON(style_json);
-        map->styleLoaded = true;
+        auto& style = map->map->getStyle();
+        for (const auto& image : set->images) {
+            style.addImage(std::make_unique<mbgl::style::Image>(image));
+        }
         return MLN_OK;
     } catch (const std::exception& e) {
-        snprintf(last_error, sizeof(last_error), "Style parse error: %s", e.what());
-        return MLN_ERROR_STYLE_PARSE;
+        snprintf(last_error, sizeof(last_error), "Failed to add image set: %s", e.what());
+        return MLN_ERROR_UNKNOWN;
     }
 }
 
-MLNErrorCode mln_map_load_style_url(MLNMap* map, const char* url) {
-    if (!map || !map->map) {
-        snprintf(last_error, sizeof(last_error), "Invalid map");
+MLNErrorCode mln_map_remove_image(MLNMap* map, const char* id) {
+    if (!map || !map->map || !id) {
         return MLN_ERROR_INVALID_ARGUMENT;
     }
     
-    if (!url) {
-        snprintf(last_error, sizeof(last_error), "URL is null");
-        return MLN_ERROR_INVALID_ARGUMENT;
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
     }
     
     try {
-        map->map->getStyle().loadURL(url);
-        map->styleLoaded = true;
+        map->map->getStyle().removeImage(id);
         return MLN_OK;
     } catch (const std::exception& e) {
-        snprintf(last_error, sizeof(last_error), "Failed to load style from URL: %s", e.what());
+        snprintf(last_error, sizeof(last_error), "Failed to remove image: %s", e.what());
         return MLN_ERROR_UNKNOWN;
     }
 }
 
-bool mln_map_is_fully_loaded(MLNMap* map) {
-    if (!map || !map->map) {
-        return false;
+/* Look up a layer of the loaded style, setting the error if there is none */
+static mbgl::style::Layer* findLayer(MLNMap* map, const char* layer_id) {
+    mbgl::style::Layer* layer = map->map->getStyle().getLayer(layer_id);
+    if (!layer) {
+        snprintf(last_error, sizeof(last_error), "Unknown layer: %s", layer_id);
     }
-    return map->map->isFullyLoaded();
+    return layer;
 }
 
-void mln_map_set_camera(MLNMap* map, const MLNCameraOptions* camera) {
-    if (!map || !map->map || !camera) {
-        return;
+MLNErrorCode mln_map_set_layer_visibility(MLNMap* map, const char* layer_id, bool visible) {
+    if (!map || !map->map || !layer_id) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
     }
     
-    mbgl::CameraOptions cameraOptions;
-    cameraOptions.center = mbgl::LatLng{camera->latitude, camera->longitude};
-    cameraOptions.zoom = camera->zoom;
-    cameraOptions.bearing = camera->bearing;
-    cameraOptions.pitch = camera->pitch;
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
+    }
     
-    map->map->jumpTo(cameraOptions);
+    try {
+        mbgl::style::Layer* layer = findLayer(map, layer_id);
+        if (!layer) {
+            return MLN_ERROR_INVALID_ARGUMENT;
+        }
+        layer->setVisibility(visible ? mbgl::style::VisibilityType::Visible
+                                     : mbgl::style::VisibilityType::None);
+        return MLN_OK;
+    } catch (const std::exception& e) {
+        snprintf(last_error, sizeof(last_error), "Failed to set layer visibility: %s", e.what());
+        return MLN_ERROR_UNKNOWN;
+    }
 }
 
-MLNCameraOptions mln_map_get_camera(MLNMap* map) {
-    MLNCameraOptions result = {0, 0, 0, 0, 0};
-    
-    if (!map || !map->map) {
-        return result;
+MLNErrorCode mln_map_set_layer_property(
+    MLNMap* map,
+    const char* layer_id,
+    const char* name,
+    const char* value_json
+) {
+    if (!map || !map->map || !layer_id || !name || !value_json) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
     }
     
-    auto camera = map->map->getCameraOptions();
-    if (camera.center) {
-        result.latitude = camera.center->latitude();
-        result.longitude = camera.center->longitude();
-    }
-    if (camera.zoom) {
-        result.zoom = *camera.zoom;
-    }
-    if (camera.bearing) {
-        result.bearing = *camera.bearing;
-    }
-    if (camera.pitch) {
-        result.pitch = *camera.pitch;
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
     }
     
-    return result;
+    try {
+        mbgl::style::Layer* layer = findLayer(map, layer_id);
+        if (!layer) {
+            return MLN_ERROR_INVALID_ARGUMENT;
+        }
+        
+        mbgl::JSDocument document;
+        document.Parse<0>(value_json);
+        if (document.HasParseError()) {
+            snprintf(last_error, sizeof(last_error), "Invalid JSON for %s: %s",
+                     name, mbgl::formatJSONParseError(document).c_str());
+            return MLN_ERROR_STYLE_PARSE;
+        }
+        
+        // Layers convert paint, layout and filter values as the style parser does
+        const mbgl::JSValue* value = &document;
+        auto error = layer->setProperty(name, mbgl::style::conversion::Convertible(value));
+        if (error) {
+            snprintf(last_error, sizeof(last_error), "Invalid value for %s: %s",
+                     name, error->message.c_str());
+            return MLN_ERROR_STYLE_PARSE;
+        }
+        return MLN_OK;
+    } catch (const std::exception& e) {
+        snprintf(last_error, sizeof(last_error), "Failed to set layer property: %s", e.what());
+        return MLN_ERROR_UNKNOWN;
+    }
 }
 
-void mln_map_set_size(MLNMap* map, MLNSize size) {
-    if (!map || !map->map || !map->frontend) {
-        return;
-    }
-    
-    mbgl::Size newSize{size.width, size.height};
-    map->frontend->size = newSize;
-    map->frontend->frontend->setSize(newSize);
-    map->map->setSize(newSize);
+MLNErrorCode mln_map_set_layer_filter(MLNMap* map, const char* layer_id, const char* filter_json) {
+    return mln_map_set_layer_property(map, layer_id, "filter", filter_json);
 }
 
-void mln_map_set_debug(MLNMap* map, MLNDebugOptions options) {
-    if (!map || !map->map) {
-        return;
+MLNErrorCode mln_map_set_source_url(MLNMap* map, const char* source_id, const char* url) {
+    if (!map || !map->map || !source_id || !url) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
     }
     
-    mbgl::MapDebugOptions debugOptions = mbgl::MapDebugOptions::NoDebug;
-    
-    if (options & MLN_DEBUG_TILE_BORDERS) {
-        debugOptions = debugOptions | mbgl::MapDebugOptions::TileBorders;
-    }
-    if (options & MLN_DEBUG_PARSE_STATUS) {
-        debugOptions = debugOptions | mbgl::MapDebugOptions::ParseStatus;
-    }
-    if (options & MLN_DEBUG_TIMESTAMPS) {
-        debugOptions = debugOptions | mbgl::MapDebugOptions::Timestamps;
-    }
-    if (options & MLN_DEBUG_COLLISION) {
-        debugOptions = debugOptions | mbgl::MapDebugOptions::Collision;
-    }
-    if (options & MLN_DEBUG_OVERDRAW) {
-        debugOptions = debugOptions | mbgl::MapDebugOptions::Overdraw;
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
     }
     
-    map->map->setDebug(debugOptions);
+    try {
+        mbgl::style::Source* source = map->map->getStyle().getSource(source_id);
+        if (!source) {
+            snprintf(last_error, sizeof(last_error), "Unknown source: %s", source_id);
+            return MLN_ERROR_INVALID_ARGUMENT;
+        }
+        
+        // Tiled sources fix their URL or tileset when they are created
+        auto* geojson = source->as<mbgl::style::GeoJSONSource>();
+        if (!geojson) {
+            snprintf(last_error, sizeof(last_error),
+                     "Source %s is not a GeoJSON source; its URL cannot change", source_id);
+            return MLN_ERROR_INVALID_ARGUMENT;
+        }
+        geojson->setURL(url);
+        return MLN_OK;
+    } catch (const std::exception& e) {
+        snprintf(last_error, sizeof(last_error), "Failed to set source URL: %s", e.what());
+        return MLN_ERROR_UNKNOWN;
+    }
 }
 
-MLNErrorCode mln_map_render_still(MLNMap* map, const MLNRenderOptions* options, MLNImageData* image) {
-    if (!map || !map->map || !map->frontend || !map->frontend->frontend) {
-        snprintf(last_error, sizeof(last_error), "Invalid map");
-        return MLN_ERROR_INVALID_ARGUMENT;
+/* Parse a style definition into `document`, or fail with MLN_ERROR_STYLE_PARSE */
+static MLNErrorCode parseDefinition(mbgl::JSDocument& document, const char* json, const char* what) {
+    document.Parse<0>(json);
+    if (document.HasParseError()) {
+        snprintf(last_error, sizeof(last_error), "Invalid JSON for %s: %s",
+                 what, mbgl::formatJSONParseError(document).c_str());
+        return MLN_ERROR_STYLE_PARSE;
     }
-    
-    if (!image) {
-        snprintf(last_error, sizeof(last_error), "Image output is null");
+    return MLN_OK;
+}
+
+MLNErrorCode mln_map_add_source(MLNMap* map, const char* source_id, const char* source_json) {
+    if (!map || !map->map || !source_id || !source_json) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
         return MLN_ERROR_INVALID_ARGUMENT;
     }
     
-    if (!map->styleLoaded) {
-        snprintf(last_error, sizeof(last_error), "Style not loaded");
-        return MLN_ERROR_NOT_LOADED;
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
     }
     
-    // Ensure this thread has a RunLoop for async operations during render
-    ensureRunLoop();
-    
     try {
-        // Apply render options if provided
-        if (options) {
-            // Set size
-            if (options->size.width > 0 && options->size.height > 0) {
-                mln_map_set_size(map, options->size);
-            }
-            
-            // Set camera
-            mln_map_set_camera(map, &options->camera);
-            
-            // Set debug options
-            mln_map_set_debug(map, options->debug);
+        auto& style = map->map->getStyle();
+        if (style.getSource(source_id)) {
+            snprintf(last_error, sizeof(last_error), "Source already exists: %s", source_id);
+            return MLN_ERROR_INVALID_ARGUMENT;
         }
         
-        // Render
-        auto renderResult = map->frontend->frontend->render(*map->map);
-        
-        // Copy image data
-        auto& premultiplied = renderResult.image;
-        size_t dataLen = premultiplied.bytes();
-        
-        if (dataLen == 0) {
-            snprintf(last_error, sizeof(last_error), "Render produced empty image");
-            return MLN_ERROR_RENDER_FAILED;
+        mbgl::JSDocument document;
+        if (MLNErrorCode code = parseDefinition(document, source_json, source_id)) {
+            return code;
         }
-        
-        // Allocate and copy data
-        uint8_t* data = (uint8_t*)malloc(dataLen);
-        if (!data) {
-            snprintf(last_error, sizeof(last_error), "Failed to allocate image buffer");
-            return MLN_ERROR_UNKNOWN;
+        const mbgl::JSValue* value = &document;
+        mbgl::style::conversion::Error error;
+        auto source = mbgl::style::conversion::convert<std::unique_ptr<mbgl::style::Source>>(
+            mbgl::style::conversion::Convertible(value), error, std::string(source_id));
+        if (!source) {
+            snprintf(last_error, sizeof(last_error), "Invalid source %s: %s",
+                     source_id, error.message.c_str());
+            return MLN_ERROR_STYLE_PARSE;
         }
-        
-        memcpy(data, premultiplied.data.get(), dataLen);
-        
-        image->data = data;
-        image->data_len = dataLen;
-        image->width = premultiplied.size.width;
-        image->height = premultiplied.size.height;
-        
+        style.addSource(std::move(*source));
         return MLN_OK;
     } catch (const std::exception& e) {
-        snprintf(last_error, sizeof(last_error), "Render failed: %s", e.what());
-        return MLN_ERROR_RENDER_FAILED;
+        snprintf(last_error, sizeof(last_error), "Failed to add source: %s", e.what());
+        return MLN_ERROR_UNKNOWN;
     }
 }
 
-void mln_map_render_still_async(
-    MLNMap* map,
-    const MLNRenderOptions* options,
-    MLNRenderCallback callback,
-    void* user_data
-) {
-    if (!callback) {
-        return;
+MLNErrorCode mln_map_remove_source(MLNMap* map, const char* source_id) {
+    if (!map || !map->map || !source_id) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
     }
     
-    // For now, just do synchronous rendering and call the callback
-    MLNImageData image = {nullptr, 0, 0, 0};
-    MLNErrorCode error = mln_map_render_still(map, options, &image);
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
+    }
     
-    callback(error, error == MLN_OK ? &image : nullptr, user_data);
-}
-
-void mln_image_free(MLNImageData* image) {
-    if (image && image->data) {
-        free(image->data);
-        image->data = nullptr;
-        image->data_len = 0;
-        image->width = 0;
-        image->height = 0;
+    try {
+        // Sources still in use by a layer are kept
+        if (!map->map->getStyle().removeSource(source_id)) {
+            snprintf(last_error, sizeof(last_error), "Unknown or used source: %s", source_id);
+            return MLN_ERROR_INVALID_ARGUMENT;
+        }
+        return MLN_OK;
+    } catch (const std::exception& e) {
+        snprintf(last_error, sizeof(last_error), "Failed to remove source: %s", e.what());
+        return MLN_ERROR_UNKNOWN;
     }
 }
 
-const char* mln_get_last_error(void) {
-    return last_error[0] ? last_error : nullptr;
-}
-
-MLNErrorCode mln_map_add_image(
-    MLNMap* map,
-    const char* id,
-    const uint8_t* data,
-    uint32_t width,
-    uint32_t height,
-    float pixel_ratio,
-    bool sdf
-) {
-    if (!map || !map->map || !id || !data) {
+MLNErrorCode mln_map_add_layer(MLNMap* map, const char* layer_json, const char* before_layer_id) {
+    if (!map || !map->map || !layer_json) {
         snprintf(last_error, sizeof(last_error), "Invalid arguments");
         return MLN_ERROR_INVALID_ARGUMENT;
     }
     
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
+    }
+    
     try {
-        // Create an unassociated image and premultiply
-        size_t dataLen = width * height * 4;
-        auto imageData = std::make_unique<uint8_t[]>(dataLen);
-        memcpy(imageData.get(), data, dataLen);
-        
-        mbgl::UnassociatedImage unassocImage({width, height}, std::move(imageData));
-        mbgl::PremultipliedImage premultImage = mbgl::util::premultiply(std::move(unassocImage));
-        
-        map->map->getStyle().addImage(
-            std::make_unique<mbgl::style::Image>(
-                id,
-                std::move(premultImage),
-                pixel_ratio,
-                sdf
-            )
-        );
+        mbgl::JSDocument document;
+        if (MLNErrorCode code = parseDefinition(document, layer_json, "layer")) {
+            return code;
+        }
+        const mbgl::JSValue* value = &document;
+        mbgl::style::conversion::Error error;
+        auto layer = mbgl::style::conversion::convert<std::unique_ptr<mbgl::style::Layer>>(
+            mbgl::style::conversion::Convertible(value), error);
+        if (!layer) {
+            snprintf(last_error, sizeof(last_error), "Invalid layer: %s", error.message.c_str());
+            return MLN_ERROR_STYLE_PARSE;
+        }
         
+        auto& style = map->map->getStyle();
+        const std::string id = (*layer)->getID();
+        if (style.getLayer(id)) {
+            snprintf(last_error, sizeof(last_error), "Layer already exists: %s", id.c_str());
+            return MLN_ERROR_INVALID_ARGUMENT;
+        }
+        std::optional<std::string> before;
+        if (before_layer_id) {
+            if (!findLayer(map, before_layer_id)) {
+                return MLN_ERROR_INVALID_ARGUMENT;
+            }
+            before = before_layer_id;
+        }
+        style.addLayer(std::move(*layer), before);
         return MLN_OK;
     } catch (const std::exception& e) {
-        snprintf(last_error, sizeof(last_error), "Failed to add image: %s", e.what());
+        snprintf(last_error, sizeof(last_error), "Failed to add layer: %s", e.what());
         return MLN_ERROR_UNKNOWN;
     }
 }
 
-MLNErrorCode mln_map_remove_image(MLNMap* map, const char* id) {
-    if (!map || !map->map || !id) {
+MLNErrorCode mln_map_remove_layer(MLNMap* map, const char* layer_id) {
+    if (!map || !map->map || !layer_id) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
         return MLN_ERROR_INVALID_ARGUMENT;
     }
     
+    if (!checkOwnerThread(map)) {
+        return MLN_ERROR_WRONG_THREAD;
+    }
+    
     try {
-        map->map->getStyle().removeImage(id);
+        if (!map->map->getStyle().removeLayer(layer_id)) {
+            snprintf(last_error, sizeof(last_error), "Unknown layer: %s", layer_id);
+            return MLN_ERROR_INVALID_ARGUMENT;
+        }
         return MLN_OK;
     } catch (const std::exception& e) {
-        snprintf(last_error, sizeof(last_error), "Failed to remove image: %s", e.what());
+        snprintf(last_error, sizeof(last_error), "Failed to remove layer: %s", e.what());
         return MLN_ERROR_UNKNOWN;
     }
 }
 
-static char base_path[4096] = {0};
-static char api_key[256] = {0};
+/* Process-wide resource settings, shared by all maps */
+static std::mutex resourceSettingsMutex;
+static std::string base_path;
+static std::string api_key;
 
 void mln_set_base_path(const char* path) {
     if (path) {
-        strncpy(base_path, path, sizeof(base_path) - 1);
+        std::lock_guard<std::mutex> lock(resourceSettingsMutex);
+        base_path = path;
     }
 }
 
 void mln_set_api_key(const char* key) {
     if (key) {
-        strncpy(api_key, key, sizeof(api_key) - 1);
+        std::lock_guard<std::mutex> lock(resourceSettingsMutex);
+        api_key = key;
     }
 }
 
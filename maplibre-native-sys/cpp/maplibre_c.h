@@ -25,6 +25,9 @@ typedef struct MLNHeadlessFrontend MLNHeadlessFrontend;
 typedef struct MLNRenderedImage MLNRenderedImage;
 typedef struct MLNFileSource MLNFileSource;
 typedef struct MLNResourceLoader MLNResourceLoader;
+typedef struct MLNResourceHandle MLNResourceHandle;
+typedef struct MLNImageSet MLNImageSet;
+typedef struct MLNRunLoopWaker MLNRunLoopWaker;
 
 /* Error codes */
 typedef enum {
@@ -34,6 +37,9 @@ typedef enum {
     MLN_ERROR_RENDER_FAILED = 3,
     MLN_ERROR_NOT_LOADED = 4,
     MLN_ERROR_TIMEOUT = 5,
+    MLN_ERROR_WRONG_THREAD = 6,
+    MLN_ERROR_BUSY = 7,
+    MLN_ERROR_CANCELLED = 8,
     MLN_ERROR_UNKNOWN = 99,
 } MLNErrorCode;
 
@@ -75,36 +81,136 @@ typedef struct {
     MLNCameraOptions camera;
     MLNMapMode mode;
     MLNDebugOptions debug;
+    uint32_t timeout_ms;     /* Abort the render with MLN_ERROR_TIMEOUT after this long, 0 for no deadline */
 } MLNRenderOptions;
 
-/* Rendered image data */
+/*
+ * Rendered image data.
+ *
+ * The pixel buffer is the renderer's own readback buffer, handed over without
+ * copying. It stays valid until mln_image_free is called, independent of the
+ * map that produced it, and may be written to by the caller (e.g. overlays).
+ * With the OpenGL backend, readback buffers come from a per-thread pool (see
+ * mln_buffer_pool_get_stats) and mln_image_free returns them to it, from any
+ * thread.
+ */
 typedef struct {
     uint8_t* data;           /* RGBA pixel data (premultiplied alpha) */
     size_t data_len;         /* Length in bytes (width * height * 4) */
     uint32_t width;          /* Image width in pixels */
     uint32_t height;         /* Image height in pixels */
+    void* owner;             /* Opaque owner of data, released by mln_image_free */
 } MLNImageData;
 
+/*
+ * Stats of a map's most recent render. Times are in milliseconds.
+ *
+ * mbgl lays out and draws the frame in one step, so layout and GPU draw
+ * time is render_ms - resource_wait_ms (layout on worker threads can
+ * overlap with resource loading). Request counters cover everything the
+ * map requested since its previous render, including requests made by a
+ * style load, and are only kept for maps with a resource loader.
+ */
+typedef struct {
+    double style_parse_ms;      /* Style loads since the previous render, 0 if the style was reused */
+    double render_ms;           /* Start of the render until the frame was drawn */
+    double resource_wait_ms;    /* Part of render_ms with resource requests outstanding */
+    double readback_ms;         /* Reading the drawn frame back into memory */
+    uint32_t resource_requests; /* Resources requested */
+    uint32_t tile_requests;     /* Of which were tiles */
+    uint32_t failed_requests;   /* Requests answered with an error */
+    uint64_t resource_bytes;    /* Bytes received in answers */
+} MLNRenderStats;
+
+/* Readback buffer pool counters, summed over all threads */
+typedef struct {
+    uint64_t hits;          /* Readbacks into a reused buffer */
+    uint64_t misses;        /* Readbacks that allocated a new buffer */
+    uint64_t returned;      /* Freed buffers kept for reuse */
+    uint64_t dropped;       /* Freed buffers released because their pool was full */
+    uint64_t pooled_bytes;  /* Bytes currently kept for reuse */
+} MLNBufferPoolStats;
+
+/* Counters of a resource cache shared by all maps */
+typedef struct {
+    uint64_t hits;          /* Requests answered from the cache */
+    uint64_t misses;        /* Requests passed on to the resource loader */
+    uint64_t dropped;       /* Answers evicted or not kept to stay within the limit */
+    uint64_t entries;       /* Resources currently cached */
+    uint64_t bytes;         /* Bytes currently cached */
+} MLNSharedResourceStats;
+
+/* Shader program binary cache counters */
+typedef struct {
+    uint64_t hits;          /* Programs loaded from a cached binary */
+    uint64_t misses;        /* Programs linked from source, and their binary kept */
+    uint64_t rejected;      /* Cached binaries the driver didn't accept */
+} MLNShaderCacheStats;
+
+/* A style image for mln_image_set_create */
+typedef struct {
+    const char* id;
+    const uint8_t* data;    /* width * height RGBA pixels */
+    uint32_t width;
+    uint32_t height;
+    float pixel_ratio;
+    bool sdf;
+} MLNStyleImage;
+
 /* Resource request (for custom file source) */
 typedef struct {
     const char* url;
-    uint8_t kind;  /* 0=Unknown, 1=Style, 2=Source, 3=Tile, 4=Glyphs, 5=SpriteImage, 6=SpriteJSON */
+    uint8_t kind;  /* 0=Unknown, 1=Style, 2=Source, 3=Tile, 4=Glyphs, 5=SpriteImage, 6=SpriteJSON, 7=Image */
+    MLNResourceHandle* handle;  /* Answers a deferred request, see mln_resource_respond */
 } MLNResourceRequest;
 
-/* Resource response */
+/*
+ * Resource response, filled in by the resource callback.
+ *
+ * data and error may point to memory owned by the callback. The wrapper
+ * copies what it needs before returning from the request and then calls
+ * release(release_ctx) if it is set.
+ *
+ * Setting deferred instead leaves the request open: the callback keeps
+ * request->handle and answers later, from any thread, with
+ * mln_resource_respond. The map keeps rendering other work meanwhile.
+ */
 typedef struct {
-    const uint8_t* data;
+    const uint8_t* data;    /* Uncompressed resource contents */
     size_t data_len;
     const char* error;      /* NULL if no error */
     bool not_found;         /* true if 404 */
+    bool pass_through;      /* true to let the default file source handle the request */
+    bool deferred;          /* true if the answer follows via mln_resource_respond */
+    void (*release)(void* release_ctx);
+    void* release_ctx;
 } MLNResourceResponse;
 
 /* Callback types */
 typedef void (*MLNRenderCallback)(MLNErrorCode error, MLNImageData* image, void* user_data);
+typedef void (*MLNFrameCallback)(
+    size_t index,
+    MLNErrorCode error,
+    MLNImageData* image,
+    const MLNRenderStats* stats,
+    void* user_data
+);
 typedef void (*MLNResourceCallback)(const MLNResourceRequest* request,
                                     MLNResourceResponse* response,
                                     void* user_data);
 
+/**
+ * Thread safety:
+ *
+ * mln_init may be called from any thread, any number of times. After it has
+ * returned, distinct maps may be created and rendered concurrently on
+ * distinct threads without external locking. Each map is bound to the thread
+ * that created it (and that thread's RunLoop): it must only be used and
+ * destroyed on that thread. Map functions called from another thread fail
+ * with MLN_ERROR_WRONG_THREAD (or are ignored when they return nothing).
+ * mln_resource_respond is the exception: it may be called from any thread.
+ */
+
 /**
  * Initialize the MapLibre Native library.
  * Must be called once before using any other functions.
@@ -118,6 +224,30 @@ MLNErrorCode mln_init(void);
  */
 void mln_cleanup(void);
 
+/**
+ * Render devices:
+ *
+ * Frontends render on the process's render device, the backend's default
+ * unless another one was selected. MapLibre Native opens one display per
+ * process and shares it between all frontends, so the frontends of a
+ * process can't be spread over devices; run a process per device to use
+ * several.
+ */
+
+/**
+ * Number of devices frontends can be rendered on: the EGL devices on Linux,
+ * 1 on backends that render on the system default device only (Metal).
+ */
+uint32_t mln_render_device_count(void);
+
+/**
+ * Render on device `index` (0-based, below mln_render_device_count) from the
+ * next frontend on. Fails with MLN_ERROR_INVALID_ARGUMENT for an index the
+ * backend can't select, and with MLN_ERROR_BUSY for another device than the
+ * current one while frontends exist, as they share its display.
+ */
+MLNErrorCode mln_set_render_device(uint32_t index);
+
 /**
  * Create a new headless frontend for rendering.
  * @param size Initial size of the render target
@@ -152,6 +282,12 @@ MLNMap* mln_map_create(MLNHeadlessFrontend* frontend, float pixel_ratio, MLNMapM
 
 /**
  * Create a new map instance with custom resource loader.
+ *
+ * Every resource the map needs (style, sources, tiles, glyphs, sprites) is
+ * requested through request_callback on the map's thread instead of the
+ * network. Requests the callback marks as pass_through are handed to the
+ * default file source. user_data must stay valid until the map is destroyed.
+ *
  * @param frontend Headless frontend to use for rendering
  * @param pixel_ratio Pixel ratio
  * @param mode Map mode
@@ -169,8 +305,13 @@ MLNMap* mln_map_create_with_loader(
 
 /**
  * Destroy a map instance.
+ * Must be called on the thread that created the map. A render in flight is
+ * cancelled first, and its callbacks run with MLN_ERROR_CANCELLED before
+ * this returns. Called from another thread, the map is left untouched and
+ * MLN_ERROR_WRONG_THREAD is returned; the map, its frontend and loader then
+ * stay allocated for good.
  */
-void mln_map_destroy(MLNMap* map);
+MLNErrorCode mln_map_destroy(MLNMap* map);
 
 /**
  * Load a style JSON into the map.
@@ -180,6 +321,24 @@ void mln_map_destroy(MLNMap* map);
  */
 MLNErrorCode mln_map_load_style(MLNMap* map, const char* style_json);
 
+/**
+ * Load a style JSON identified by a caller-computed hash.
+ * If the map already has a style with the same hash loaded, this is a no-op
+ * and the style JSON is not parsed again.
+ * @param map The map instance
+ * @param style_json JSON string containing the style
+ * @param style_hash Non-zero hash identifying the style contents
+ * @return Error code
+ */
+MLNErrorCode mln_map_load_style_with_hash(MLNMap* map, const char* style_json, uint64_t style_hash);
+
+/**
+ * Get the hash of the currently loaded style.
+ * @return The hash passed to mln_map_load_style_with_hash, or 0 if no style
+ *         is loaded or it was loaded without a hash
+ */
+uint64_t mln_map_get_style_hash(MLNMap* map);
+
 /**
  * Load a style from a URL.
  * @param map The map instance
@@ -205,6 +364,8 @@ MLNCameraOptions mln_map_get_camera(MLNMap* map);
 
 /**
  * Set map size.
+ * A no-op if the size is unchanged; otherwise the offscreen framebuffer is
+ * reallocated.
  */
 void mln_map_set_size(MLNMap* map, MLNSize size);
 
@@ -223,9 +384,47 @@ void mln_map_set_debug(MLNMap* map, MLNDebugOptions options);
 MLNErrorCode mln_map_render_still(MLNMap* map, const MLNRenderOptions* options, MLNImageData* image);
 
 /**
- * Render a still image asynchronously.
+ * Render several still images synchronously, one after another on one map.
+ *
+ * The map keeps its style, sources and GPU state between the renders, so
+ * many cameras of one style pay for the call and its setup once. Frames are
+ * read back as with mln_map_render_pipelined. images[i] receives the image
+ * for options[i] and results[i] (if results is not NULL) its error code.
+ * Failed images are zeroed; free every other one with mln_image_free.
+ *
+ * tileserver-rs itself does not call this: static images and atlas cameras
+ * are rendered one per job, and multi-render jobs of worker processes go
+ * through mln_map_render_pipelined. It is kept for embedders and the render
+ * benchmark.
+ *
+ * @param map The map instance
+ * @param options Render options, count entries
+ * @param count Number of images to render
+ * @param images Output images, count entries
+ * @param results Per-image error codes, count entries (can be NULL)
+ * @return MLN_OK if every image rendered, the first error otherwise
+ */
+MLNErrorCode mln_map_render_batch(
+    MLNMap* map,
+    const MLNRenderOptions* options,
+    size_t count,
+    MLNImageData* images,
+    MLNErrorCode* results
+);
+
+/**
+ * Start rendering a still image and return immediately.
+ *
+ * The render progresses while the owning thread drives its RunLoop with
+ * mln_run_loop_run_once or mln_run_loop_wait, so one thread can have renders
+ * in flight on several maps at once. callback is invoked exactly once from
+ * inside one of them (or directly, if the render cannot be started),
+ * with ownership of the image data (free it with mln_image_free). A map
+ * renders one image at a time; starting another fails with MLN_ERROR_BUSY.
+ * Destroying the map cancels a render in flight.
+ *
  * @param map The map instance
- * @param options Render options
+ * @param options Render options (can be NULL to use current state)
  * @param callback Callback when rendering is complete
  * @param user_data User data passed to callback
  */
@@ -236,11 +435,164 @@ void mln_map_render_still_async(
     void* user_data
 );
 
+/**
+ * Start rendering several frames one after another on one map, reading
+ * each frame back while the next one is drawn.
+ *
+ * With the OpenGL backend the pixels of frame K are copied into one of two
+ * pixel pack buffers and only mapped once frame K + 1 has been drawn, so the
+ * transfer overlaps the next frame instead of stalling the pipeline. Other
+ * backends read every frame back as soon as it is drawn.
+ *
+ * callback is invoked once per frame, in order of index, from inside
+ * mln_run_loop_run_once or mln_run_loop_wait (or directly for frames that
+ * fail before drawing).
+ * It receives ownership of the image data (free it with mln_image_free)
+ * and the frame's stats. A failed frame does not stop the ones after it.
+ * options[i].timeout_ms counts from this call rather than from the start of
+ * frame i. The map counts as rendering until the last callback; cancelling
+ * it fails every frame not yet delivered with MLN_ERROR_CANCELLED.
+ *
+ * @param map The map instance
+ * @param options Render options, count entries, copied before returning
+ * @param count Number of frames
+ * @param callback Callback for each finished frame
+ * @param user_data User data passed to callback
+ * @return MLN_OK if the frames were started, or an error (with no
+ *         callbacks) if the map cannot render
+ */
+MLNErrorCode mln_map_render_pipelined(
+    MLNMap* map,
+    const MLNRenderOptions* options,
+    size_t count,
+    MLNFrameCallback callback,
+    void* user_data
+);
+
+/**
+ * Abort the map's render in flight, whose callback then receives
+ * MLN_ERROR_CANCELLED from a later mln_run_loop_run_once.
+ *
+ * Resource requests the render is still waiting for are answered with an
+ * error; answers that arrive for them later are dropped. Work that already
+ * started (tile parsing, drawing) cannot be interrupted and runs to the end
+ * first. A render deadline (MLNRenderOptions.timeout_ms) aborts the same
+ * way, with MLN_ERROR_TIMEOUT. The map stays usable, but the style is
+ * reloaded before its next render. Does nothing if no render is in flight.
+ *
+ * @param map The map instance
+ * @return MLN_OK, or an error if the map is invalid or used from another thread
+ */
+MLNErrorCode mln_map_cancel(MLNMap* map);
+
+/**
+ * Process pending work for every map bound to the calling thread: resource
+ * responses, tile parsing results and async render progress. Does not block.
+ */
+void mln_run_loop_run_once(void);
+
+/**
+ * Drive the calling thread's RunLoop like mln_run_loop_run_once, blocking
+ * until an async render callback has run, the thread is woken through a
+ * MLNRunLoopWaker, or timeout_ms have passed. A wake or callback that comes
+ * while the thread is not waiting ends its next wait right away, so none
+ * are lost between checking for work and waiting.
+ */
+void mln_run_loop_wait(uint32_t timeout_ms);
+
+/**
+ * Create a waker for the calling thread's RunLoop.
+ * Free it with mln_run_loop_waker_destroy, from any thread.
+ */
+MLNRunLoopWaker* mln_run_loop_waker_create(void);
+
+/**
+ * End the current or next mln_run_loop_wait of the waker's thread.
+ * Thread-safe. Does nothing once that thread has exited.
+ */
+void mln_run_loop_wake(MLNRunLoopWaker* waker);
+
+/** Free a waker. */
+void mln_run_loop_waker_destroy(MLNRunLoopWaker* waker);
+
+/**
+ * Answer a resource request that the resource callback deferred.
+ * May be called from any thread, exactly once per deferred request; the
+ * handle is invalid afterwards. response is copied (and released) before
+ * this returns. Answers for requests the map no longer needs are dropped.
+ * An answer with pass_through set loads the resource through the default
+ * file source, started from the map's thread.
+ */
+void mln_resource_respond(MLNResourceHandle* handle, const MLNResourceResponse* response);
+
+/**
+ * Get the stats of the map's most recent completed render, sync or async.
+ * All zero before the first render.
+ */
+MLNRenderStats mln_map_get_render_stats(MLNMap* map);
+
 /**
  * Free image data returned by mln_map_render_still.
+ * Releases the pixel buffer owner and zeroes all fields.
  */
 void mln_image_free(MLNImageData* image);
 
+/**
+ * Set how many bytes of freed readback buffers each thread's pool keeps
+ * for reuse (default 64 MiB). Buffers that don't fit are released.
+ */
+void mln_buffer_pool_set_limit(uint64_t bytes);
+
+/**
+ * Get the readback buffer pool counters.
+ */
+MLNBufferPoolStats mln_buffer_pool_get_stats(void);
+
+/**
+ * Set how many bytes of glyph ranges and sprite files are kept in the
+ * process-wide cache shared by all maps (default 64 MiB, 0 disables it).
+ * The first answer for a URL is kept and given to every later request for
+ * it, so maps share one buffer and the resource loader isn't asked again.
+ * The least recently used answers are evicted to stay within the limit.
+ */
+void mln_shared_resources_set_limit(uint64_t bytes);
+
+/**
+ * Get the shared glyph and sprite cache counters.
+ */
+MLNSharedResourceStats mln_shared_resources_get_stats(void);
+
+/**
+ * Set how many bytes of source tiles answered by resource loaders are kept
+ * in the process-wide cache shared by all maps (default 128 MiB, 0
+ * disables it), and for how long (0 keeps them until evicted).
+ * Works like the glyph and sprite cache: maps rendering the same area, or
+ * overzooming the same parent tiles, read and decompress each tile once,
+ * and the tiles outlive the maps that loaded them. Empty tiles are cached
+ * too.
+ */
+void mln_tile_cache_set_limit(uint64_t bytes, uint32_t ttl_secs);
+
+/**
+ * Get the shared tile cache counters.
+ */
+MLNSharedResourceStats mln_tile_cache_get_stats(void);
+
+/**
+ * Keep the binaries of linked shader programs in files in `dir`, which must
+ * exist (NULL or "" disables it, the default). New frontends load the
+ * programs they need from there instead of compiling and linking them from
+ * source. Binaries are keyed by driver and version, so a cache directory
+ * can be shared by processes and survives driver updates. Takes effect
+ * for programs linked afterwards; only the OpenGL backend keeps binaries.
+ */
+void mln_shader_cache_set_dir(const char* dir);
+
+/**
+ * Get the shader program binary cache counters.
+ */
+MLNShaderCacheStats mln_shader_cache_get_stats(void);
+
 /**
  * Get the last error message.
  * @return Static string describing the last error, or NULL if no error
@@ -268,11 +620,103 @@ MLNErrorCode mln_map_add_image(
     bool sdf
 );
 
+/**
+ * Create an immutable set of style images that any number of maps can add.
+ * Pixels are copied (and premultiplied unless already premultiplied) once;
+ * maps that add the set share them rather than holding a copy each.
+ * @param images Images to copy into the set
+ * @param count Number of images
+ * @param premultiplied True if the pixel data is already premultiplied
+ * @return Image set, or NULL on error
+ */
+MLNImageSet* mln_image_set_create(const MLNStyleImage* images, size_t count, bool premultiplied);
+
+/**
+ * Destroy an image set. Maps that added it keep their images.
+ */
+void mln_image_set_destroy(MLNImageSet* set);
+
+/**
+ * Add every image of a set to the map's style, replacing images with the
+ * same IDs. The set can be destroyed afterwards.
+ */
+MLNErrorCode mln_map_add_image_set(MLNMap* map, const MLNImageSet* set);
+
 /**
  * Remove an image from the map's style.
  */
 MLNErrorCode mln_map_remove_image(MLNMap* map, const char* id);
 
+/*
+ * Style edits.
+ *
+ * These change the loaded style in place: parsed layers, loaded sources and
+ * their tiles are kept, so switching between variants of one style costs a
+ * few property updates rather than a reload. Edits apply from the next
+ * render and are lost when another style is loaded. The style hash is left
+ * unchanged; callers that edit a style are responsible for undoing the
+ * edits before rendering the unedited style again.
+ *
+ * Unknown layers or sources fail with MLN_ERROR_INVALID_ARGUMENT, values
+ * that are not valid JSON or not valid for the property fail with
+ * MLN_ERROR_STYLE_PARSE.
+ */
+
+/**
+ * Show or hide a layer.
+ */
+MLNErrorCode mln_map_set_layer_visibility(MLNMap* map, const char* layer_id, bool visible);
+
+/**
+ * Set a paint or layout property of a layer.
+ * @param name Property name as in the style spec, e.g. "fill-color"
+ * @param value_json Property value as JSON; "null" restores the default
+ */
+MLNErrorCode mln_map_set_layer_property(
+    MLNMap* map,
+    const char* layer_id,
+    const char* name,
+    const char* value_json
+);
+
+/**
+ * Set the filter of a layer.
+ * @param filter_json Filter expression as JSON; "null" removes the filter
+ */
+MLNErrorCode mln_map_set_layer_filter(MLNMap* map, const char* layer_id, const char* filter_json);
+
+/**
+ * Point a GeoJSON source at another URL. Tiled sources cannot change their
+ * URL in place and fail with MLN_ERROR_INVALID_ARGUMENT.
+ */
+MLNErrorCode mln_map_set_source_url(MLNMap* map, const char* source_id, const char* url);
+
+/**
+ * Add a source to the style, e.g. a GeoJSON source with inline data.
+ * @param source_json Source definition as in the style's "sources" object
+ * A source ID already in the style fails with MLN_ERROR_INVALID_ARGUMENT.
+ */
+MLNErrorCode mln_map_add_source(MLNMap* map, const char* source_id, const char* source_json);
+
+/**
+ * Remove a source from the style. Layers using it must be removed first,
+ * or it fails with MLN_ERROR_INVALID_ARGUMENT.
+ */
+MLNErrorCode mln_map_remove_source(MLNMap* map, const char* source_id);
+
+/**
+ * Add a layer to the style.
+ * @param layer_json Layer definition as in the style's "layers" array
+ * @param before_layer_id Layer to insert it below, or NULL for the top
+ * A layer ID already in the style fails with MLN_ERROR_INVALID_ARGUMENT.
+ */
+MLNErrorCode mln_map_add_layer(MLNMap* map, const char* layer_json, const char* before_layer_id);
+
+/**
+ * Remove a layer from the style.
+ */
+MLNErrorCode mln_map_remove_layer(MLNMap* map, const char* layer_id);
+
 /**
  * Set the base path for local file resources.
  */
@@ -6,13 +6,101 @@
  */
 
 #include "maplibre_c.h"
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
 /* Thread-local error message */
 static __thread char last_error[1024] = {0};
 
+static double elapsed_ms(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) * 1e3 + (double)(now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+/*
+ * Readback buffer pool. Freed image buffers are kept for reuse up to a byte
+ * limit, in the same size classes as the real wrapper. The stub keeps a
+ * single pool for all threads.
+ */
+typedef struct PooledBuffer {
+    struct PooledBuffer* next;
+    size_t capacity;
+    uint8_t* data;
+} PooledBuffer;
+
+static pthread_mutex_t buffer_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PooledBuffer* buffer_pool = NULL;
+static uint64_t buffer_pool_limit = 64ull << 20;
+static MLNBufferPoolStats buffer_pool_stats;
+
+static size_t buffer_size_class(size_t bytes) {
+    const size_t min_class = 4096;
+    if (bytes <= min_class) {
+        return min_class;
+    }
+    size_t high = min_class;
+    while (high * 2 < bytes) {
+        high *= 2;
+    }
+    size_t step = high / 4;
+    return (bytes + step - 1) / step * step;
+}
+
+static PooledBuffer* buffer_acquire(size_t size) {
+    size_t capacity = buffer_size_class(size);
+
+    pthread_mutex_lock(&buffer_pool_mutex);
+    for (PooledBuffer** link = &buffer_pool; *link; link = &(*link)->next) {
+        if ((*link)->capacity == capacity) {
+            PooledBuffer* buffer = *link;
+            *link = buffer->next;
+            buffer_pool_stats.hits++;
+            buffer_pool_stats.pooled_bytes -= capacity;
+            pthread_mutex_unlock(&buffer_pool_mutex);
+            return buffer;
+        }
+    }
+    buffer_pool_stats.misses++;
+    pthread_mutex_unlock(&buffer_pool_mutex);
+
+    PooledBuffer* buffer = (PooledBuffer*)malloc(sizeof(PooledBuffer));
+    if (!buffer) {
+        return NULL;
+    }
+    buffer->data = (uint8_t*)malloc(capacity);
+    if (!buffer->data) {
+        free(buffer);
+        return NULL;
+    }
+    buffer->capacity = capacity;
+    buffer->next = NULL;
+    return buffer;
+}
+
+static void buffer_release(PooledBuffer* buffer) {
+    pthread_mutex_lock(&buffer_pool_mutex);
+    if (buffer_pool_stats.pooled_bytes + buffer->capacity <= buffer_pool_limit) {
+        buffer->next = buffer_pool;
+        buffer_pool = buffer;
+        buffer_pool_stats.returned++;
+        buffer_pool_stats.pooled_bytes += buffer->capacity;
+        buffer = NULL;
+    } else {
+        buffer_pool_stats.dropped++;
+    }
+    pthread_mutex_unlock(&buffer_pool_mutex);
+
+    if (buffer) {
+        free(buffer->data);
+        free(buffer);
+    }
+}
+
 /* Stub structures */
 struct MLNHeadlessFrontend {
     MLNSize size;
@@ -26,11 +114,57 @@ struct MLNMap {
     MLNCameraOptions camera;
     MLNDebugOptions debug;
     char* style_json;
+    uint64_t style_hash;
     bool loaded;
+    bool rendering;
+    MLNRenderStats stats;
+    double style_parse_ms;
     MLNResourceCallback request_callback;
     void* user_data;
+    struct Pipeline* pipeline;
+    pthread_t owner;     /* Thread that created the map */
+    char** added;        /* IDs of the sources and layers added to the style */
+    size_t added_count;
 };
 
+/* Answer slot for a resource request; the stub waits on it synchronously */
+struct MLNResourceHandle {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool done;
+    const char* url;     /* Passed through requests are loaded from here */
+    char* data;
+    size_t data_len;
+    char* error;
+    bool not_found;
+};
+
+/* Async render waiting for the next mln_run_loop_run_once on this thread */
+typedef struct PendingRender {
+    MLNMap* map;
+    MLNRenderOptions options;
+    bool has_options;
+    MLNRenderCallback callback;
+    void* user_data;
+    MLNErrorCode abort_code; /* Set by mln_map_cancel */
+    struct timespec started;
+    struct PendingRender* next;
+} PendingRender;
+
+static __thread PendingRender* pending_renders = NULL;
+
+/* Frames of a pipelined render; the stub draws each one after the last */
+typedef struct Pipeline {
+    MLNMap* map;
+    MLNRenderOptions* options;
+    size_t count;
+    size_t next;
+    MLNFrameCallback callback;
+    void* user_data;
+    struct timespec started;
+    MLNErrorCode abort_code; /* Fails every frame not drawn yet */
+} Pipeline;
+
 static bool initialized = false;
 
 MLNErrorCode mln_init(void) {
@@ -48,6 +182,19 @@ void mln_cleanup(void) {
     initialized = false;
 }
 
+/* The stub renders on a single device, so it is never busy */
+uint32_t mln_render_device_count(void) {
+    return 1;
+}
+
+MLNErrorCode mln_set_render_device(uint32_t index) {
+    if (index >= mln_render_device_count()) {
+        snprintf(last_error, sizeof(last_error), "No render device %u (1 available)", index);
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    return MLN_OK;
+}
+
 MLNHeadlessFrontend* mln_headless_frontend_create(MLNSize size, float pixel_ratio) {
     MLNHeadlessFrontend* frontend = (MLNHeadlessFrontend*)calloc(1, sizeof(MLNHeadlessFrontend));
     if (!frontend) {
@@ -104,6 +251,7 @@ MLNMap* mln_map_create_with_loader(
     map->frontend = frontend;
     map->pixel_ratio = pixel_ratio;
     map->mode = mode;
+    map->owner = pthread_self();
     map->camera.latitude = 0;
     map->camera.longitude = 0;
     map->camera.zoom = 0;
@@ -118,13 +266,36 @@ MLNMap* mln_map_create_with_loader(
     return map;
 }
 
-void mln_map_destroy(MLNMap* map) {
-    if (map) {
-        if (map->style_json) {
-            free(map->style_json);
-        }
-        free(map);
+static void forget_additions(MLNMap* map) {
+    for (size_t i = 0; i < map->added_count; i++) {
+        free(map->added[i]);
+    }
+    free(map->added);
+    map->added = NULL;
+    map->added_count = 0;
+}
+
+MLNErrorCode mln_map_destroy(MLNMap* map) {
+    if (!map) {
+        return MLN_OK;
+    }
+    if (!pthread_equal(map->owner, pthread_self())) {
+        snprintf(last_error, sizeof(last_error), "Map used from a thread other than the one that created it");
+        return MLN_ERROR_WRONG_THREAD;
+    }
+
+    /* Renders in flight end cancelled, rather than with a freed map */
+    mln_map_cancel(map);
+    while (map->rendering || map->pipeline) {
+        mln_run_loop_run_once();
     }
+
+    if (map->style_json) {
+        free(map->style_json);
+    }
+    forget_additions(map);
+    free(map);
+    return MLN_OK;
 }
 
 MLNErrorCode mln_map_load_style(MLNMap* map, const char* style_json) {
@@ -137,6 +308,9 @@ MLNErrorCode mln_map_load_style(MLNMap* map, const char* style_json) {
         return MLN_ERROR_INVALID_ARGUMENT;
     }
 
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
     if (map->style_json) {
         free(map->style_json);
     }
@@ -147,10 +321,38 @@ MLNErrorCode mln_map_load_style(MLNMap* map, const char* style_json) {
         return MLN_ERROR_UNKNOWN;
     }
 
+    map->style_hash = 0;
     map->loaded = true;
+    forget_additions(map);
+    /* Copying the style stands in for parsing it */
+    map->style_parse_ms += elapsed_ms(&started);
     return MLN_OK;
 }
 
+MLNErrorCode mln_map_load_style_with_hash(MLNMap* map, const char* style_json, uint64_t style_hash) {
+    if (!map) {
+        snprintf(last_error, sizeof(last_error), "Map is NULL");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+
+    if (style_hash != 0 && map->loaded && map->style_hash == style_hash) {
+        return MLN_OK;
+    }
+
+    MLNErrorCode code = mln_map_load_style(map, style_json);
+    if (code == MLN_OK) {
+        map->style_hash = style_hash;
+    }
+    return code;
+}
+
+uint64_t mln_map_get_style_hash(MLNMap* map) {
+    if (!map || !map->loaded) {
+        return 0;
+    }
+    return map->style_hash;
+}
+
 MLNErrorCode mln_map_load_style_url(MLNMap* map, const char* url) {
     if (!map) {
         snprintf(last_error, sizeof(last_error), "Map is NULL");
@@ -161,9 +363,112 @@ MLNErrorCode mln_map_load_style_url(MLNMap* map, const char* url) {
         return MLN_ERROR_INVALID_ARGUMENT;
     }
 
-    /* In a real implementation, this would fetch the URL */
-    snprintf(last_error, sizeof(last_error), "URL loading not implemented in stub");
-    return MLN_ERROR_NOT_LOADED;
+    /* Without a resource loader the real implementation would use the network */
+    if (!map->request_callback) {
+        snprintf(last_error, sizeof(last_error), "URL loading requires a resource loader in stub");
+        return MLN_ERROR_NOT_LOADED;
+    }
+
+    MLNResourceHandle* handle = (MLNResourceHandle*)calloc(1, sizeof(MLNResourceHandle));
+    if (!handle) {
+        snprintf(last_error, sizeof(last_error), "Failed to allocate resource handle");
+        return MLN_ERROR_UNKNOWN;
+    }
+    pthread_mutex_init(&handle->mutex, NULL);
+    pthread_cond_init(&handle->cond, NULL);
+    handle->url = url;
+
+    MLNResourceRequest request = {url, 1 /* Style */, handle};
+    MLNResourceResponse response;
+    memset(&response, 0, sizeof(response));
+    map->request_callback(&request, &response, map->user_data);
+
+    if (!response.deferred) {
+        mln_resource_respond(handle, &response);
+    }
+
+    /* The real implementation keeps rendering meanwhile; the stub just waits */
+    pthread_mutex_lock(&handle->mutex);
+    while (!handle->done) {
+        pthread_cond_wait(&handle->cond, &handle->mutex);
+    }
+    pthread_mutex_unlock(&handle->mutex);
+
+    MLNErrorCode code = MLN_OK;
+    if (handle->error || handle->not_found || !handle->data) {
+        snprintf(last_error, sizeof(last_error), "Failed to load style from URL: %s",
+                 handle->error ? handle->error : "not found");
+        code = MLN_ERROR_NOT_LOADED;
+    } else {
+        code = mln_map_load_style(map, handle->data);
+    }
+
+    pthread_mutex_destroy(&handle->mutex);
+    pthread_cond_destroy(&handle->cond);
+    free(handle->data);
+    free(handle->error);
+    free(handle);
+    return code;
+}
+
+/* Stands in for the default file source: reads file:// URLs, fails the rest */
+static void load_default(MLNResourceHandle* handle) {
+    const char* prefix = "file://";
+    if (strncmp(handle->url, prefix, strlen(prefix)) != 0) {
+        handle->error = strdup("The stub has no default file source for this URL");
+        return;
+    }
+    FILE* file = fopen(handle->url + strlen(prefix), "rb");
+    if (!file) {
+        handle->not_found = true;
+        return;
+    }
+    long len = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    handle->data = len >= 0 ? (char*)malloc((size_t)len + 1) : NULL;
+    if (handle->data && fseek(file, 0, SEEK_SET) == 0 &&
+        fread(handle->data, 1, (size_t)len, file) == (size_t)len) {
+        /* NUL-terminated like every other answer */
+        handle->data[len] = '\0';
+        handle->data_len = (size_t)len;
+    } else {
+        free(handle->data);
+        handle->data = NULL;
+        handle->error = strdup("Failed to read file");
+    }
+    fclose(file);
+}
+
+void mln_resource_respond(MLNResourceHandle* handle, const MLNResourceResponse* response) {
+    if (!handle) {
+        return;
+    }
+
+    pthread_mutex_lock(&handle->mutex);
+    if (response) {
+        if (response->error) {
+            handle->error = strdup(response->error);
+        } else if (response->pass_through) {
+            load_default(handle);
+        } else if (response->deferred) {
+            handle->error = strdup("Resource answer cannot be deferred again");
+        } else if (response->not_found) {
+            handle->not_found = true;
+        } else if (response->data) {
+            /* NUL-terminated so style JSON can be parsed in place */
+            handle->data = (char*)malloc(response->data_len + 1);
+            if (handle->data) {
+                memcpy(handle->data, response->data, response->data_len);
+                handle->data[response->data_len] = '\0';
+                handle->data_len = response->data_len;
+            }
+        }
+        if (response->release) {
+            response->release(response->release_ctx);
+        }
+    }
+    handle->done = true;
+    pthread_cond_signal(&handle->cond);
+    pthread_mutex_unlock(&handle->mutex);
 }
 
 bool mln_map_is_fully_loaded(MLNMap* map) {
@@ -209,6 +514,10 @@ MLNErrorCode mln_map_render_still(MLNMap* map, const MLNRenderOptions* options,
         snprintf(last_error, sizeof(last_error), "Image output is NULL");
         return MLN_ERROR_INVALID_ARGUMENT;
     }
+    if (map->rendering) {
+        snprintf(last_error, sizeof(last_error), "Map is already rendering");
+        return MLN_ERROR_BUSY;
+    }
     if (!map->loaded) {
         snprintf(last_error, sizeof(last_error), "Style not loaded");
         return MLN_ERROR_NOT_LOADED;
@@ -227,13 +536,17 @@ MLNErrorCode mln_map_render_still(MLNMap* map, const MLNRenderOptions* options,
         height = 512;
     }
 
-    /* Allocate image buffer (RGBA) */
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    /* Take an image buffer (RGBA) from the pool */
     size_t data_len = (size_t)width * height * 4;
-    uint8_t* data = (uint8_t*)malloc(data_len);
-    if (!data) {
+    PooledBuffer* buffer = buffer_acquire(data_len);
+    if (!buffer) {
         snprintf(last_error, sizeof(last_error), "Failed to allocate image buffer");
         return MLN_ERROR_UNKNOWN;
     }
+    uint8_t* data = buffer->data;
 
     /* Fill with a gradient pattern to show it's a stub */
     for (uint32_t y = 0; y < height; y++) {
@@ -266,10 +579,86 @@ MLNErrorCode mln_map_render_still(MLNMap* map, const MLNRenderOptions* options,
     image->data_len = data_len;
     image->width = width;
     image->height = height;
+    image->owner = buffer;
+
+    /* The stub draws straight into memory and requests no resources */
+    memset(&map->stats, 0, sizeof(map->stats));
+    map->stats.style_parse_ms = map->style_parse_ms;
+    map->stats.render_ms = elapsed_ms(&started);
+    map->style_parse_ms = 0;
 
     return MLN_OK;
 }
 
+MLNErrorCode mln_map_render_batch(
+    MLNMap* map,
+    const MLNRenderOptions* options,
+    size_t count,
+    MLNImageData* images,
+    MLNErrorCode* results
+) {
+    if (count > 0 && (!options || !images)) {
+        snprintf(last_error, sizeof(last_error), "Batch options or images are NULL");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+
+    MLNErrorCode first_error = MLN_OK;
+    for (size_t i = 0; i < count; i++) {
+        memset(&images[i], 0, sizeof(images[i]));
+        MLNErrorCode code = mln_map_render_still(map, &options[i], &images[i]);
+        if (code != MLN_OK) {
+            memset(&images[i], 0, sizeof(images[i]));
+            if (first_error == MLN_OK) {
+                first_error = code;
+            }
+        }
+        if (results) {
+            results[i] = code;
+        }
+    }
+    return first_error;
+}
+
+MLNRenderStats mln_map_get_render_stats(MLNMap* map) {
+    if (map) {
+        return map->stats;
+    }
+    MLNRenderStats empty = {0};
+    return empty;
+}
+
+/* Queue a render for the next mln_run_loop_run_once; its deadline counts from started */
+static void queue_render(
+    MLNMap* map,
+    const MLNRenderOptions* options,
+    MLNRenderCallback callback,
+    void* user_data,
+    const struct timespec* started
+) {
+    PendingRender* render = (PendingRender*)calloc(1, sizeof(PendingRender));
+    if (!render) {
+        snprintf(last_error, sizeof(last_error), "Failed to allocate render");
+        callback(MLN_ERROR_UNKNOWN, NULL, user_data);
+        return;
+    }
+    render->map = map;
+    render->has_options = options != NULL;
+    if (options) {
+        render->options = *options;
+    }
+    render->callback = callback;
+    render->user_data = user_data;
+    render->started = *started;
+
+    /* Append so renders complete in the order they were started */
+    PendingRender** tail = &pending_renders;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = render;
+    map->rendering = true;
+}
+
 void mln_map_render_still_async(
     MLNMap* map,
     const MLNRenderOptions* options,
@@ -279,23 +668,313 @@ void mln_map_render_still_async(
     if (!callback) {
         return;
     }
+    if (!map) {
+        snprintf(last_error, sizeof(last_error), "Map is NULL");
+        callback(MLN_ERROR_INVALID_ARGUMENT, NULL, user_data);
+        return;
+    }
+    if (map->rendering || map->pipeline) {
+        snprintf(last_error, sizeof(last_error), "Map is already rendering");
+        callback(MLN_ERROR_BUSY, NULL, user_data);
+        return;
+    }
 
-    MLNImageData image = {0};
-    MLNErrorCode error = mln_map_render_still(map, options, &image);
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    queue_render(map, options, callback, user_data, &started);
+}
+
+static void pipeline_frame_done(MLNErrorCode error, MLNImageData* image, void* user_data);
+
+/* Draw the pipeline's next frame, or fail it if the pipeline was cancelled */
+static void pipeline_start_frame(Pipeline* pipeline) {
+    if (pipeline->abort_code != MLN_OK) {
+        snprintf(last_error, sizeof(last_error), "Render cancelled");
+        pipeline_frame_done(pipeline->abort_code, NULL, pipeline);
+        return;
+    }
+    queue_render(pipeline->map, &pipeline->options[pipeline->next], pipeline_frame_done, pipeline,
+                 &pipeline->started);
+}
 
-    callback(error, error == MLN_OK ? &image : NULL, user_data);
+static void pipeline_frame_done(MLNErrorCode error, MLNImageData* image, void* user_data) {
+    Pipeline* pipeline = (Pipeline*)user_data;
+    size_t index = pipeline->next++;
+    MLNRenderStats stats = pipeline->map->stats;
+    bool last = pipeline->next == pipeline->count;
+    if (last) {
+        pipeline->map->pipeline = NULL;
+    }
+    pipeline->callback(index, error, image, &stats, pipeline->user_data);
+    if (last) {
+        free(pipeline->options);
+        free(pipeline);
+        return;
+    }
+    pipeline_start_frame(pipeline);
+}
+
+MLNErrorCode mln_map_render_pipelined(
+    MLNMap* map,
+    const MLNRenderOptions* options,
+    size_t count,
+    MLNFrameCallback callback,
+    void* user_data
+) {
+    if (!map || !callback || (count > 0 && !options)) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    if (map->rendering || map->pipeline) {
+        snprintf(last_error, sizeof(last_error), "Map is already rendering");
+        return MLN_ERROR_BUSY;
+    }
+    if (!map->loaded) {
+        snprintf(last_error, sizeof(last_error), "Style not loaded");
+        return MLN_ERROR_NOT_LOADED;
+    }
+    if (count == 0) {
+        return MLN_OK;
+    }
+
+    Pipeline* pipeline = (Pipeline*)calloc(1, sizeof(Pipeline));
+    MLNRenderOptions* copies = (MLNRenderOptions*)malloc(count * sizeof(MLNRenderOptions));
+    if (!pipeline || !copies) {
+        free(pipeline);
+        free(copies);
+        snprintf(last_error, sizeof(last_error), "Failed to allocate pipeline");
+        return MLN_ERROR_UNKNOWN;
+    }
+    memcpy(copies, options, count * sizeof(MLNRenderOptions));
+    pipeline->map = map;
+    pipeline->options = copies;
+    pipeline->count = count;
+    pipeline->callback = callback;
+    pipeline->user_data = user_data;
+    /* Deadlines count from the start of the pipeline */
+    clock_gettime(CLOCK_MONOTONIC, &pipeline->started);
+    map->pipeline = pipeline;
+    pipeline_start_frame(pipeline);
+    return MLN_OK;
+}
+
+MLNErrorCode mln_map_cancel(MLNMap* map) {
+    if (!map) {
+        snprintf(last_error, sizeof(last_error), "Map is NULL");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    if (map->pipeline) {
+        map->pipeline->abort_code = MLN_ERROR_CANCELLED;
+    }
+    for (PendingRender* render = pending_renders; render; render = render->next) {
+        if (render->map == map && render->abort_code == MLN_OK) {
+            render->abort_code = MLN_ERROR_CANCELLED;
+        }
+    }
+    return MLN_OK;
+}
+
+void mln_run_loop_run_once(void) {
+    /* Complete the renders started before this call */
+    PendingRender* render = pending_renders;
+    pending_renders = NULL;
+
+    while (render) {
+        PendingRender* next = render->next;
+        MLNImageData image;
+        memset(&image, 0, sizeof(image));
+
+        render->map->rendering = false;
+        MLNErrorCode error = render->abort_code;
+        if (error == MLN_OK && render->has_options && render->options.timeout_ms > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t elapsed_ms = (int64_t)(now.tv_sec - render->started.tv_sec) * 1000 +
+                                 (now.tv_nsec - render->started.tv_nsec) / 1000000;
+            if (elapsed_ms >= render->options.timeout_ms) {
+                error = MLN_ERROR_TIMEOUT;
+            }
+        }
+        if (error == MLN_ERROR_CANCELLED) {
+            snprintf(last_error, sizeof(last_error), "Render cancelled");
+        } else if (error == MLN_ERROR_TIMEOUT) {
+            snprintf(last_error, sizeof(last_error), "Render deadline exceeded");
+        } else {
+            error = mln_map_render_still(
+                render->map, render->has_options ? &render->options : NULL, &image);
+        }
+        render->callback(error, error == MLN_OK ? &image : NULL, render->user_data);
+
+        free(render);
+        render = next;
+    }
+}
+
+/*
+ * Wake state of a thread's run loop, shared with its wakers and freed with
+ * the last of them (or when the thread exits without any)
+ */
+typedef struct LoopWake {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool pending;
+    int refs;
+} LoopWake;
+
+struct MLNRunLoopWaker {
+    LoopWake* wake;
+};
+
+static pthread_key_t loop_wake_key;
+static pthread_once_t loop_wake_once = PTHREAD_ONCE_INIT;
+
+static void loop_wake_release(void* data) {
+    LoopWake* wake = (LoopWake*)data;
+    pthread_mutex_lock(&wake->mutex);
+    bool last = --wake->refs == 0;
+    pthread_mutex_unlock(&wake->mutex);
+    if (last) {
+        pthread_cond_destroy(&wake->cond);
+        pthread_mutex_destroy(&wake->mutex);
+        free(wake);
+    }
+}
+
+static void loop_wake_key_create(void) {
+    pthread_key_create(&loop_wake_key, loop_wake_release);
+}
+
+static LoopWake* thread_loop_wake(void) {
+    pthread_once(&loop_wake_once, loop_wake_key_create);
+    LoopWake* wake = (LoopWake*)pthread_getspecific(loop_wake_key);
+    if (!wake) {
+        wake = (LoopWake*)calloc(1, sizeof(LoopWake));
+        if (!wake) {
+            return NULL;
+        }
+        pthread_mutex_init(&wake->mutex, NULL);
+        pthread_cond_init(&wake->cond, NULL);
+        wake->refs = 1;
+        pthread_setspecific(loop_wake_key, wake);
+    }
+    return wake;
+}
+
+void mln_run_loop_wait(uint32_t timeout_ms) {
+    /* Renders queued on this thread complete right away */
+    LoopWake* wake = thread_loop_wake();
+    if (wake && !pending_renders) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&wake->mutex);
+        while (!wake->pending) {
+            if (pthread_cond_timedwait(&wake->cond, &wake->mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        wake->pending = false;
+        pthread_mutex_unlock(&wake->mutex);
+    }
+    mln_run_loop_run_once();
+}
+
+MLNRunLoopWaker* mln_run_loop_waker_create(void) {
+    LoopWake* wake = thread_loop_wake();
+    MLNRunLoopWaker* waker = wake ? (MLNRunLoopWaker*)malloc(sizeof(MLNRunLoopWaker)) : NULL;
+    if (!waker) {
+        return NULL;
+    }
+    pthread_mutex_lock(&wake->mutex);
+    wake->refs += 1;
+    pthread_mutex_unlock(&wake->mutex);
+    waker->wake = wake;
+    return waker;
+}
+
+void mln_run_loop_wake(MLNRunLoopWaker* waker) {
+    if (waker) {
+        pthread_mutex_lock(&waker->wake->mutex);
+        waker->wake->pending = true;
+        pthread_cond_signal(&waker->wake->cond);
+        pthread_mutex_unlock(&waker->wake->mutex);
+    }
+}
+
+void mln_run_loop_waker_destroy(MLNRunLoopWaker* waker) {
+    if (waker) {
+        loop_wake_release(waker->wake);
+        free(waker);
+    }
 }
 
 void mln_image_free(MLNImageData* image) {
     if (image && image->data) {
-        free(image->data);
+        if (image->owner) {
+            buffer_release((PooledBuffer*)image->owner);
+        } else {
+            free(image->data);
+        }
         image->data = NULL;
         image->data_len = 0;
         image->width = 0;
         image->height = 0;
+        image->owner = NULL;
     }
 }
 
+void mln_buffer_pool_set_limit(uint64_t bytes) {
+    pthread_mutex_lock(&buffer_pool_mutex);
+    buffer_pool_limit = bytes;
+    pthread_mutex_unlock(&buffer_pool_mutex);
+}
+
+MLNBufferPoolStats mln_buffer_pool_get_stats(void) {
+    pthread_mutex_lock(&buffer_pool_mutex);
+    MLNBufferPoolStats stats = buffer_pool_stats;
+    pthread_mutex_unlock(&buffer_pool_mutex);
+    return stats;
+}
+
+/* The stub requests no glyphs, sprites or tiles, so the shared caches stay empty */
+static uint64_t shared_resources_limit = 64ull << 20;
+static uint64_t tile_cache_limit = 128ull << 20;
+
+void mln_shared_resources_set_limit(uint64_t bytes) {
+    shared_resources_limit = bytes;
+}
+
+MLNSharedResourceStats mln_shared_resources_get_stats(void) {
+    MLNSharedResourceStats stats = {0};
+    return stats;
+}
+
+void mln_tile_cache_set_limit(uint64_t bytes, uint32_t ttl_secs) {
+    (void)ttl_secs;
+    tile_cache_limit = bytes;
+}
+
+MLNSharedResourceStats mln_tile_cache_get_stats(void) {
+    MLNSharedResourceStats stats = {0};
+    return stats;
+}
+
+/* The stub has no shaders to cache */
+void mln_shader_cache_set_dir(const char* dir) {
+    (void)dir;
+}
+
+MLNShaderCacheStats mln_shader_cache_get_stats(void) {
+    MLNShaderCacheStats stats = {0};
+    return stats;
+}
+
 const char* mln_get_last_error(void) {
     return last_error[0] ? last_error : NULL;
 }
@@ -320,6 +999,45 @@ MLNErrorCode mln_map_add_image(
     return MLN_OK;
 }
 
+struct MLNImageSet {
+    size_t count;
+};
+
+MLNImageSet* mln_image_set_create(const MLNStyleImage* images, size_t count, bool premultiplied) {
+    (void)premultiplied;
+    if (!images && count > 0) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!images[i].id || !images[i].data || images[i].width == 0 || images[i].height == 0) {
+            snprintf(last_error, sizeof(last_error), "Invalid image at index %zu", i);
+            return NULL;
+        }
+    }
+
+    MLNImageSet* set = (MLNImageSet*)malloc(sizeof(MLNImageSet));
+    if (!set) {
+        snprintf(last_error, sizeof(last_error), "Failed to allocate image set");
+        return NULL;
+    }
+    set->count = count;
+    return set;
+}
+
+void mln_image_set_destroy(MLNImageSet* set) {
+    free(set);
+}
+
+MLNErrorCode mln_map_add_image_set(MLNMap* map, const MLNImageSet* set) {
+    if (!map || !set) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    /* Stub: images are never drawn */
+    return MLN_OK;
+}
+
 MLNErrorCode mln_map_remove_image(MLNMap* map, const char* id) {
     (void)map;
     (void)id;
@@ -327,6 +1045,147 @@ MLNErrorCode mln_map_remove_image(MLNMap* map, const char* id) {
     return MLN_OK;
 }
 
+/* The stub parses no styles; an ID is known if the style JSON quotes it */
+/* Index of an ID added to the style, or added_count */
+static size_t find_addition(MLNMap* map, const char* id) {
+    size_t i = 0;
+    while (i < map->added_count && strcmp(map->added[i], id) != 0) {
+        i++;
+    }
+    return i;
+}
+
+static bool style_mentions(MLNMap* map, const char* id) {
+    char quoted[512];
+    snprintf(quoted, sizeof(quoted), "\"%s\"", id);
+    return map->loaded && ((map->style_json && strstr(map->style_json, quoted)) ||
+                           find_addition(map, id) < map->added_count);
+}
+
+static MLNErrorCode check_layer(MLNMap* map, const char* layer_id, const char* value_json) {
+    if (!map || !layer_id || !value_json) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    if (!style_mentions(map, layer_id)) {
+        snprintf(last_error, sizeof(last_error), "Unknown layer: %s", layer_id);
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    if (!value_json[0]) {
+        snprintf(last_error, sizeof(last_error), "Invalid JSON: empty value");
+        return MLN_ERROR_STYLE_PARSE;
+    }
+    /* Stub: edits are never drawn */
+    return MLN_OK;
+}
+
+MLNErrorCode mln_map_set_layer_visibility(MLNMap* map, const char* layer_id, bool visible) {
+    return check_layer(map, layer_id, visible ? "\"visible\"" : "\"none\"");
+}
+
+MLNErrorCode mln_map_set_layer_property(
+    MLNMap* map,
+    const char* layer_id,
+    const char* name,
+    const char* value_json
+) {
+    if (!name) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    return check_layer(map, layer_id, value_json);
+}
+
+MLNErrorCode mln_map_set_layer_filter(MLNMap* map, const char* layer_id, const char* filter_json) {
+    return check_layer(map, layer_id, filter_json);
+}
+
+MLNErrorCode mln_map_set_source_url(MLNMap* map, const char* source_id, const char* url) {
+    if (!map || !source_id || !url) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    if (!style_mentions(map, source_id)) {
+        snprintf(last_error, sizeof(last_error), "Unknown source: %s", source_id);
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    return MLN_OK;
+}
+
+static MLNErrorCode add_to_style(MLNMap* map, const char* id, const char* definition_json) {
+    if (!map || !id || !definition_json) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    if (!definition_json[0]) {
+        snprintf(last_error, sizeof(last_error), "Invalid JSON for %s: empty value", id);
+        return MLN_ERROR_STYLE_PARSE;
+    }
+    if (style_mentions(map, id)) {
+        snprintf(last_error, sizeof(last_error), "Already in the style: %s", id);
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    char** added = (char**)realloc(map->added, (map->added_count + 1) * sizeof(char*));
+    if (!added) {
+        snprintf(last_error, sizeof(last_error), "Failed to allocate style addition");
+        return MLN_ERROR_UNKNOWN;
+    }
+    map->added = added;
+    map->added[map->added_count++] = strdup(id);
+    return MLN_OK;
+}
+
+/* Stub: only sources and layers added since the style was loaded can be removed */
+static MLNErrorCode remove_from_style(MLNMap* map, const char* id) {
+    if (!map || !id) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    size_t i = find_addition(map, id);
+    if (i == map->added_count) {
+        snprintf(last_error, sizeof(last_error), "Unknown source or layer: %s", id);
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    free(map->added[i]);
+    map->added[i] = map->added[--map->added_count];
+    return MLN_OK;
+}
+
+MLNErrorCode mln_map_add_source(MLNMap* map, const char* source_id, const char* source_json) {
+    return add_to_style(map, source_id, source_json);
+}
+
+MLNErrorCode mln_map_remove_source(MLNMap* map, const char* source_id) {
+    return remove_from_style(map, source_id);
+}
+
+MLNErrorCode mln_map_add_layer(MLNMap* map, const char* layer_json, const char* before_layer_id) {
+    if (!map || !layer_json) {
+        snprintf(last_error, sizeof(last_error), "Invalid arguments");
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+    if (before_layer_id && !style_mentions(map, before_layer_id)) {
+        snprintf(last_error, sizeof(last_error), "Unknown layer: %s", before_layer_id);
+        return MLN_ERROR_INVALID_ARGUMENT;
+    }
+
+    /* The stub doesn't parse JSON; take the ID from the first "id" key */
+    const char* key = strstr(layer_json, "\"id\"");
+    const char* start = key ? strchr(key + 4, '"') : NULL;
+    const char* end = start ? strchr(start + 1, '"') : NULL;
+    if (!end || end - start > 256) {
+        snprintf(last_error, sizeof(last_error), "Invalid layer: missing id");
+        return MLN_ERROR_STYLE_PARSE;
+    }
+    char id[258];
+    snprintf(id, sizeof(id), "%.*s", (int)(end - start - 1), start + 1);
+    return add_to_style(map, id, layer_json);
+}
+
+MLNErrorCode mln_map_remove_layer(MLNMap* map, const char* layer_id) {
+    return remove_from_style(map, layer_id);
+}
+
 static char base_path[4096] = {0};
 static char api_key[256] = {0};
 
@@ -30,6 +30,24 @@ pub struct MLNHeadlessFrontend {
     _private: [u8; 0],
 }
 
+/// Opaque handle for answering a deferred resource request
+#[repr(C)]
+pub struct MLNResourceHandle {
+    _private: [u8; 0],
+}
+
+/// Opaque type for a shared set of style images
+#[repr(C)]
+pub struct MLNImageSet {
+    _private: [u8; 0],
+}
+
+/// Opaque type for waking a thread blocked in `mln_run_loop_wait`
+#[repr(C)]
+pub struct MLNRunLoopWaker {
+    _private: [u8; 0],
+}
+
 /// Error codes returned by the API
 #[repr(C)]
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
@@ -40,6 +58,9 @@ pub enum MLNErrorCode {
     MLN_ERROR_RENDER_FAILED = 3,
     MLN_ERROR_NOT_LOADED = 4,
     MLN_ERROR_TIMEOUT = 5,
+    MLN_ERROR_WRONG_THREAD = 6,
+    MLN_ERROR_BUSY = 7,
+    MLN_ERROR_CANCELLED = 8,
     MLN_ERROR_UNKNOWN = 99,
 }
 
@@ -119,6 +140,8 @@ pub struct MLNRenderOptions {
     pub camera: MLNCameraOptions,
     pub mode: MLNMapMode,
     pub debug: MLNDebugOptions,
+    /// Abort the render with `MLN_ERROR_TIMEOUT` after this long, 0 for no deadline
+    pub timeout_ms: u32,
 }
 
 impl Default for MLNRenderOptions {
@@ -129,6 +152,7 @@ impl Default for MLNRenderOptions {
             camera: MLNCameraOptions::default(),
             mode: MLNMapMode::MLN_MAP_MODE_TILE,
             debug: MLNDebugOptions::MLN_DEBUG_NONE,
+            timeout_ms: 0,
         }
     }
 }
@@ -145,6 +169,8 @@ pub struct MLNImageData {
     pub width: c_uint,
     /// Image height in pixels
     pub height: c_uint,
+    /// Opaque owner of `data`, released by `mln_image_free`
+    pub owner: *mut c_void,
 }
 
 impl Default for MLNImageData {
@@ -154,29 +180,123 @@ impl Default for MLNImageData {
             data_len: 0,
             width: 0,
             height: 0,
+            owner: std::ptr::null_mut(),
         }
     }
 }
 
+/// Stats of a map's most recent render. Times are in milliseconds.
+///
+/// Layout and GPU draw time is `render_ms - resource_wait_ms`. Request
+/// counters cover everything requested since the previous render and are
+/// only kept for maps with a resource loader.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct MLNRenderStats {
+    /// Style loads since the previous render, 0 if the style was reused
+    pub style_parse_ms: f64,
+    /// Start of the render until the frame was drawn
+    pub render_ms: f64,
+    /// Part of `render_ms` with resource requests outstanding
+    pub resource_wait_ms: f64,
+    /// Reading the drawn frame back into memory
+    pub readback_ms: f64,
+    /// Resources requested
+    pub resource_requests: u32,
+    /// Of which were tiles
+    pub tile_requests: u32,
+    /// Requests answered with an error
+    pub failed_requests: u32,
+    /// Bytes received in answers
+    pub resource_bytes: u64,
+}
+
+/// Readback buffer pool counters, summed over all threads
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct MLNBufferPoolStats {
+    /// Readbacks into a reused buffer
+    pub hits: u64,
+    /// Readbacks that allocated a new buffer
+    pub misses: u64,
+    /// Freed buffers kept for reuse
+    pub returned: u64,
+    /// Freed buffers released because their pool was full
+    pub dropped: u64,
+    /// Bytes currently kept for reuse
+    pub pooled_bytes: u64,
+}
+
+/// Counters of a resource cache shared by all maps
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct MLNSharedResourceStats {
+    /// Requests answered from the cache
+    pub hits: u64,
+    /// Requests passed on to the resource loader
+    pub misses: u64,
+    /// Answers evicted or not kept to stay within the limit
+    pub dropped: u64,
+    /// Resources currently cached
+    pub entries: u64,
+    /// Bytes currently cached
+    pub bytes: u64,
+}
+
+/// Shader program binary cache counters
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct MLNShaderCacheStats {
+    /// Programs loaded from a cached binary
+    pub hits: u64,
+    /// Programs linked from source, and their binary kept
+    pub misses: u64,
+    /// Cached binaries the driver didn't accept
+    pub rejected: u64,
+}
+
+/// A style image for mln_image_set_create
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct MLNStyleImage {
+    pub id: *const c_char,
+    /// width * height RGBA pixels
+    pub data: *const c_uchar,
+    pub width: c_uint,
+    pub height: c_uint,
+    pub pixel_ratio: c_float,
+    pub sdf: bool,
+}
+
 /// Resource request (for custom file source)
 #[repr(C)]
 #[derive(Debug)]
 pub struct MLNResourceRequest {
     pub url: *const c_char,
-    /// 0=Unknown, 1=Style, 2=Source, 3=Tile, 4=Glyphs, 5=SpriteImage, 6=SpriteJSON
+    /// 0=Unknown, 1=Style, 2=Source, 3=Tile, 4=Glyphs, 5=SpriteImage, 6=SpriteJSON, 7=Image
     pub kind: c_uchar,
+    /// Answers a deferred request, see `mln_resource_respond`
+    pub handle: *mut MLNResourceHandle,
 }
 
 /// Resource response
 #[repr(C)]
 #[derive(Debug)]
 pub struct MLNResourceResponse {
+    /// Uncompressed resource contents
     pub data: *const c_uchar,
     pub data_len: size_t,
     /// NULL if no error
     pub error: *const c_char,
     /// true if 404
     pub not_found: bool,
+    /// true to let the default file source handle the request
+    pub pass_through: bool,
+    /// true if the answer follows via `mln_resource_respond`
+    pub deferred: bool,
+    /// Called with `release_ctx` once the wrapper no longer needs `data`/`error`
+    pub release: Option<unsafe extern "C" fn(release_ctx: *mut c_void)>,
+    pub release_ctx: *mut c_void,
 }
 
 impl Default for MLNResourceResponse {
@@ -186,6 +306,10 @@ impl Default for MLNResourceResponse {
             data_len: 0,
             error: std::ptr::null(),
             not_found: false,
+            pass_through: false,
+            deferred: false,
+            release: None,
+            release_ctx: std::ptr::null_mut(),
         }
     }
 }
@@ -195,6 +319,17 @@ pub type MLNRenderCallback = Option<
     unsafe extern "C" fn(error: MLNErrorCode, image: *mut MLNImageData, user_data: *mut c_void),
 >;
 
+/// Callback type for pipelined rendering, invoked once per frame in order
+pub type MLNFrameCallback = Option<
+    unsafe extern "C" fn(
+        index: usize,
+        error: MLNErrorCode,
+        image: *mut MLNImageData,
+        stats: *const MLNRenderStats,
+        user_data: *mut c_void,
+    ),
+>;
+
 /// Callback type for resource requests
 pub type MLNResourceCallback = Option<
     unsafe extern "C" fn(
@@ -214,6 +349,13 @@ extern "C" {
     /// Cleanup the MapLibre Native library.
     pub fn mln_cleanup();
 
+    /// Number of devices frontends can be rendered on.
+    pub fn mln_render_device_count() -> u32;
+
+    /// Render on a device from the next frontend on. Fails while frontends
+    /// exist on another device.
+    pub fn mln_set_render_device(index: u32) -> MLNErrorCode;
+
     /// Create a new headless frontend for rendering.
     pub fn mln_headless_frontend_create(
         size: MLNSize,
@@ -245,12 +387,23 @@ extern "C" {
         user_data: *mut c_void,
     ) -> *mut MLNMap;
 
-    /// Destroy a map instance.
-    pub fn mln_map_destroy(map: *mut MLNMap);
+    /// Destroy a map instance, on the thread that created it.
+    pub fn mln_map_destroy(map: *mut MLNMap) -> MLNErrorCode;
 
     /// Load a style JSON into the map.
     pub fn mln_map_load_style(map: *mut MLNMap, style_json: *const c_char) -> MLNErrorCode;
 
+    /// Load a style JSON identified by a hash, skipping the parse if a style
+    /// with the same hash is already loaded.
+    pub fn mln_map_load_style_with_hash(
+        map: *mut MLNMap,
+        style_json: *const c_char,
+        style_hash: u64,
+    ) -> MLNErrorCode;
+
+    /// Get the hash of the currently loaded style (0 if none or unknown).
+    pub fn mln_map_get_style_hash(map: *mut MLNMap) -> u64;
+
     /// Load a style from a URL.
     pub fn mln_map_load_style_url(map: *mut MLNMap, url: *const c_char) -> MLNErrorCode;
 
@@ -263,7 +416,7 @@ extern "C" {
     /// Get current camera options.
     pub fn mln_map_get_camera(map: *mut MLNMap) -> MLNCameraOptions;
 
-    /// Set map size.
+    /// Set map size. A no-op if the size is unchanged.
     pub fn mln_map_set_size(map: *mut MLNMap, size: MLNSize);
 
     /// Set debug options.
@@ -276,7 +429,16 @@ extern "C" {
         image: *mut MLNImageData,
     ) -> MLNErrorCode;
 
-    /// Render a still image asynchronously.
+    /// Render several still images synchronously on one map.
+    pub fn mln_map_render_batch(
+        map: *mut MLNMap,
+        options: *const MLNRenderOptions,
+        count: usize,
+        images: *mut MLNImageData,
+        results: *mut MLNErrorCode,
+    ) -> MLNErrorCode;
+
+    /// Start rendering a still image; `callback` runs from `mln_run_loop_run_once`.
     pub fn mln_map_render_still_async(
         map: *mut MLNMap,
         options: *const MLNRenderOptions,
@@ -284,9 +446,72 @@ extern "C" {
         user_data: *mut c_void,
     );
 
+    /// Start rendering frames one after another, reading each back while the
+    /// next is drawn; `callback` runs once per frame, in order, from
+    /// `mln_run_loop_run_once`.
+    pub fn mln_map_render_pipelined(
+        map: *mut MLNMap,
+        options: *const MLNRenderOptions,
+        count: usize,
+        callback: MLNFrameCallback,
+        user_data: *mut c_void,
+    ) -> MLNErrorCode;
+
+    /// Abort the map's render in flight; its callback receives `MLN_ERROR_CANCELLED`.
+    pub fn mln_map_cancel(map: *mut MLNMap) -> MLNErrorCode;
+
+    /// Process pending work for the maps bound to the calling thread without blocking.
+    pub fn mln_run_loop_run_once();
+
+    /// Drive the calling thread's RunLoop until an async render callback has
+    /// run, the thread is woken, or `timeout_ms` have passed.
+    pub fn mln_run_loop_wait(timeout_ms: u32);
+
+    /// Create a waker for the calling thread's RunLoop.
+    pub fn mln_run_loop_waker_create() -> *mut MLNRunLoopWaker;
+
+    /// End the current or next `mln_run_loop_wait` of the waker's thread. May be called from any thread.
+    pub fn mln_run_loop_wake(waker: *mut MLNRunLoopWaker);
+
+    /// Free a waker.
+    pub fn mln_run_loop_waker_destroy(waker: *mut MLNRunLoopWaker);
+
+    /// Answer a deferred resource request. May be called from any thread.
+    pub fn mln_resource_respond(
+        handle: *mut MLNResourceHandle,
+        response: *const MLNResourceResponse,
+    );
+
+    /// Get the stats of the map's most recent completed render.
+    pub fn mln_map_get_render_stats(map: *mut MLNMap) -> MLNRenderStats;
+
     /// Free image data returned by mln_map_render_still.
     pub fn mln_image_free(image: *mut MLNImageData);
 
+    /// Set how many bytes of freed readback buffers each thread's pool keeps.
+    pub fn mln_buffer_pool_set_limit(bytes: u64);
+
+    /// Get the readback buffer pool counters.
+    pub fn mln_buffer_pool_get_stats() -> MLNBufferPoolStats;
+
+    /// Set how many bytes the process-wide glyph and sprite cache keeps.
+    pub fn mln_shared_resources_set_limit(bytes: u64);
+
+    /// Get the shared glyph and sprite cache counters.
+    pub fn mln_shared_resources_get_stats() -> MLNSharedResourceStats;
+
+    /// Set how many bytes, and for how long, the shared tile cache keeps.
+    pub fn mln_tile_cache_set_limit(bytes: u64, ttl_secs: u32);
+
+    /// Get the shared tile cache counters.
+    pub fn mln_tile_cache_get_stats() -> MLNSharedResourceStats;
+
+    /// Keep linked shader program binaries in `dir` (null or empty disables it).
+    pub fn mln_shader_cache_set_dir(dir: *const c_char);
+
+    /// Get the shader program binary cache counters.
+    pub fn mln_shader_cache_get_stats() -> MLNShaderCacheStats;
+
     /// Get the last error message.
     pub fn mln_get_last_error() -> *const c_char;
 
@@ -301,9 +526,72 @@ extern "C" {
         sdf: bool,
     ) -> MLNErrorCode;
 
+    /// Create an immutable set of style images shared by the maps that add it.
+    pub fn mln_image_set_create(
+        images: *const MLNStyleImage,
+        count: size_t,
+        premultiplied: bool,
+    ) -> *mut MLNImageSet;
+
+    /// Destroy an image set. Maps that added it keep their images.
+    pub fn mln_image_set_destroy(set: *mut MLNImageSet);
+
+    /// Add every image of a set to the map's style.
+    pub fn mln_map_add_image_set(map: *mut MLNMap, set: *const MLNImageSet) -> MLNErrorCode;
+
     /// Remove an image from the map's style.
     pub fn mln_map_remove_image(map: *mut MLNMap, id: *const c_char) -> MLNErrorCode;
 
+    /// Show or hide a layer of the loaded style.
+    pub fn mln_map_set_layer_visibility(
+        map: *mut MLNMap,
+        layer_id: *const c_char,
+        visible: bool,
+    ) -> MLNErrorCode;
+
+    /// Set a paint or layout property of a layer from JSON; `null` restores
+    /// the default.
+    pub fn mln_map_set_layer_property(
+        map: *mut MLNMap,
+        layer_id: *const c_char,
+        name: *const c_char,
+        value_json: *const c_char,
+    ) -> MLNErrorCode;
+
+    /// Set the filter of a layer from JSON; `null` removes it.
+    pub fn mln_map_set_layer_filter(
+        map: *mut MLNMap,
+        layer_id: *const c_char,
+        filter_json: *const c_char,
+    ) -> MLNErrorCode;
+
+    /// Point a GeoJSON source at another URL.
+    pub fn mln_map_set_source_url(
+        map: *mut MLNMap,
+        source_id: *const c_char,
+        url: *const c_char,
+    ) -> MLNErrorCode;
+
+    /// Add a source to the style.
+    pub fn mln_map_add_source(
+        map: *mut MLNMap,
+        source_id: *const c_char,
+        source_json: *const c_char,
+    ) -> MLNErrorCode;
+
+    /// Remove a source no layer uses from the style.
+    pub fn mln_map_remove_source(map: *mut MLNMap, source_id: *const c_char) -> MLNErrorCode;
+
+    /// Add a layer to the style, below `before_layer_id` or at the top if null.
+    pub fn mln_map_add_layer(
+        map: *mut MLNMap,
+        layer_json: *const c_char,
+        before_layer_id: *const c_char,
+    ) -> MLNErrorCode;
+
+    /// Remove a layer from the style.
+    pub fn mln_map_remove_layer(map: *mut MLNMap, layer_id: *const c_char) -> MLNErrorCode;
+
     /// Set the base path for local file resources.
     pub fn mln_set_base_path(path: *const c_char);
 
@@ -1,4 +1,4 @@
-use clap::Parser;
+use clap::{Args, Parser, Subcommand};
 use std::path::PathBuf;
 
 #[derive(Parser, Debug)]
@@ -32,6 +32,76 @@ pub struct Cli {
     /// Enable verbose logging
     #[arg(short, long)]
     pub verbose: bool,
+
+    #[command(subcommand)]
+    pub command: Option<Command>,
+}
+
+#[derive(Subcommand, Debug)]
+pub enum Command {
+    /// Pre-render raster tiles of a style into an MBTiles archive or the render cache
+    Seed(SeedArgs),
+    /// Render for a server, in a worker process it started (see `render.workers`)
+    #[command(hide = true)]
+    RenderWorker(RenderWorkerArgs),
+}
+
+#[derive(Args, Debug)]
+pub struct RenderWorkerArgs {
+    /// Socket of the server to render for
+    #[arg(long)]
+    pub socket: PathBuf,
+}
+
+#[derive(Args, Debug)]
+pub struct SeedArgs {
+    /// Style ID to render
+    #[arg(long)]
+    pub style: String,
+
+    /// Area to render as min_lon,min_lat,max_lon,max_lat (default: the whole world)
+    #[arg(long, value_name = "BBOX", value_parser = parse_bbox)]
+    pub bbox: Option<[f64; 4]>,
+
+    /// Lowest zoom level to render
+    #[arg(long, default_value_t = 0)]
+    pub min_zoom: u8,
+
+    /// Highest zoom level to render
+    #[arg(long)]
+    pub max_zoom: u8,
+
+    /// Pixel ratio of the tiles (1 = 512px tiles, 2 = 1024px, ...)
+    #[arg(long, default_value_t = 1)]
+    pub scale: u8,
+
+    /// Tile format: png, jpeg or webp
+    #[arg(long, default_value = "png")]
+    pub format: String,
+
+    /// MBTiles archive to write; without it tiles go to the render cache,
+    /// which needs `render.cache_dir` to outlive the command
+    #[arg(short, long, value_name = "FILE")]
+    pub output: Option<PathBuf>,
+
+    /// Metatiles rendered at once (default: render threads × maps per thread)
+    #[arg(long)]
+    pub concurrency: Option<usize>,
+}
+
+fn parse_bbox(bbox: &str) -> Result<[f64; 4], String> {
+    let values: Vec<f64> = bbox
+        .split(',')
+        .map(|v| v.trim().parse::<f64>())
+        .collect::<Result<_, _>>()
+        .map_err(|e| format!("invalid number in bbox: {}", e))?;
+    let [min_lon, min_lat, max_lon, max_lat]: [f64; 4] = values
+        .try_into()
+        .map_err(|_| "bbox needs four values: min_lon,min_lat,max_lon,max_lat".to_string())?;
+    if min_lon >= max_lon || min_lat >= max_lat {
+        return Err("bbox minimum must be below its maximum".to_string());
+    }
+    Ok([min_lon, min_lat, max_lon, max_lat])
 }
 
 impl Cli {
@@ -12,6 +12,8 @@ pub struct Config {
     #[serde(default)]
     pub telemetry: TelemetryConfig,
     #[serde(default)]
+    pub render: RenderConfig,
+    #[serde(default)]
     pub sources: Vec<SourceConfig>,
     #[serde(default)]
     pub styles: Vec<StyleConfig>,
@@ -146,6 +148,243 @@ impl Default for TelemetryConfig {
     }
 }
 
+/// Native MapLibre renderer configuration
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct RenderConfig {
+    /// Number of dedicated render threads (default: number of CPU cores).
+    /// Each thread owns its own long-lived map instances and RunLoop.
+    #[serde(default = "default_render_pool_size")]
+    pub pool_size: usize,
+    /// Maximum number of map instances kept alive per render thread (default: 4)
+    #[serde(default = "default_render_maps_per_thread")]
+    pub maps_per_thread: usize,
+    /// Destroy map instances that have been idle for this many seconds (default: 300)
+    #[serde(default = "default_render_idle_timeout_secs")]
+    pub idle_timeout_secs: u64,
+    /// Render blocks of N×N tiles in one pass and slice them (1, 2, 4 or 8; default: 1)
+    #[serde(default = "default_render_metatile")]
+    pub metatile: u32,
+    /// Extra pixels rendered around each metatile to avoid clipping labels (default: 64)
+    #[serde(default = "default_render_metatile_buffer")]
+    pub metatile_buffer: u32,
+    /// Maximum size of the rendered tile cache in megabytes, 0 disables it (default: 256)
+    #[serde(default = "default_render_cache_size_mb")]
+    pub cache_size_mb: u64,
+    /// Time-to-live for rendered tiles in seconds (default: 3600)
+    #[serde(default = "default_render_cache_ttl_secs")]
+    pub cache_ttl_secs: u64,
+    /// Directory for the on-disk tier of the rendered tile cache (default: disabled)
+    #[serde(default)]
+    pub cache_dir: Option<PathBuf>,
+    /// Maximum size of the on-disk tier in megabytes (default: 1024)
+    #[serde(default = "default_render_cache_disk_size_mb")]
+    pub cache_disk_size_mb: u64,
+    /// Memory each render thread keeps in freed readback buffers, in megabytes (default: 64)
+    #[serde(default = "default_render_buffer_pool_mb")]
+    pub buffer_pool_mb: u64,
+    /// Memory kept in glyph ranges and sprite files shared by all maps, in megabytes (default: 64)
+    #[serde(default = "default_render_shared_resources_mb")]
+    pub shared_resources_mb: u64,
+    /// Memory kept in source tiles shared by all maps, in megabytes (default: 128)
+    #[serde(default = "default_render_tile_cache_mb")]
+    pub tile_cache_mb: u64,
+    /// Give up on a tile render after this many seconds, queueing included; 0 waits forever (default: 30)
+    #[serde(default = "default_render_tile_timeout_secs")]
+    pub tile_timeout_secs: u64,
+    /// Give up on a static image render after this many seconds, queueing included; 0 waits forever (default: 60)
+    #[serde(default = "default_render_static_timeout_secs")]
+    pub static_timeout_secs: u64,
+    /// Tile renders allowed to wait for a render thread before new ones are rejected (default: 1024)
+    #[serde(default = "default_render_tile_queue_depth")]
+    pub tile_queue_depth: usize,
+    /// Static image renders allowed to wait for a render thread (default: 256)
+    #[serde(default = "default_render_static_queue_depth")]
+    pub static_queue_depth: usize,
+    /// Seeding renders allowed to wait for a render thread (default: 64)
+    #[serde(default = "default_render_bulk_queue_depth")]
+    pub bulk_queue_depth: usize,
+    /// Index of the GPU this process renders on (default: the backend's default device).
+    /// All render threads of a process share one device; render workers spread over
+    /// all devices unless one is set.
+    #[serde(default)]
+    pub device: Option<u32>,
+    /// Render in this many worker processes of `pool_size` threads each, instead of in
+    /// the server process (default: 0, render in-process)
+    #[serde(default)]
+    pub workers: usize,
+    /// Shared memory each render worker returns frames through, in megabytes (default: 64)
+    #[serde(default = "default_render_worker_frames_mb")]
+    pub worker_frames_mb: u64,
+    /// Replace a render worker once its resident memory exceeds this many megabytes;
+    /// 0 never does (default: 0)
+    #[serde(default)]
+    pub worker_max_memory_mb: u64,
+    /// Directory where compiled shader programs are kept for later maps and processes (default: disabled)
+    #[serde(default)]
+    pub shader_cache_dir: Option<PathBuf>,
+    /// Draw static map paths and markers with the map on the GPU instead of on the rendered image (default: false)
+    #[serde(default)]
+    pub gpu_overlays: bool,
+    /// Load every style on every render thread before reporting ready (default: true)
+    #[serde(default = "default_render_warm_up")]
+    pub warm_up: bool,
+    /// Tiles rendered into the cache during warm-up, as "style/z/x/y[@2x].png"
+    #[serde(default)]
+    pub warm_up_tiles: Vec<String>,
+    /// PNG compression level: "fast", "default" or "best" (default: "default")
+    #[serde(default)]
+    pub png_compression: PngCompression,
+    /// PNG row filter: "none", "sub", "up", "avg", "paeth" or "adaptive" (default: "adaptive")
+    #[serde(default)]
+    pub png_filter: PngFilter,
+    /// Reduce PNGs to an 8-bit palette of at most 256 colours (default: false)
+    #[serde(default)]
+    pub png_palette: bool,
+    /// JPEG quality, 1-100 (default: 90)
+    #[serde(default = "default_render_jpeg_quality")]
+    pub jpeg_quality: u8,
+}
+
+/// PNG compression level for rendered images
+#[derive(Debug, Clone, Copy, Default, Serialize, Deserialize, PartialEq)]
+#[serde(rename_all = "lowercase")]
+pub enum PngCompression {
+    /// Fastest encoding, larger files
+    Fast,
+    #[default]
+    Default,
+    /// Smallest files, slowest encoding
+    Best,
+}
+
+/// PNG row filter for rendered images
+#[derive(Debug, Clone, Copy, Default, Serialize, Deserialize, PartialEq)]
+#[serde(rename_all = "lowercase")]
+pub enum PngFilter {
+    None,
+    Sub,
+    Up,
+    Avg,
+    Paeth,
+    /// Choose a filter per row
+    #[default]
+    Adaptive,
+}
+
+fn default_render_pool_size() -> usize {
+    std::thread::available_parallelism()
+        .map(|n| n.get())
+        .unwrap_or(4)
+}
+
+fn default_render_maps_per_thread() -> usize {
+    4
+}
+
+fn default_render_idle_timeout_secs() -> u64 {
+    300
+}
+
+fn default_render_metatile() -> u32 {
+    1
+}
+
+fn default_render_metatile_buffer() -> u32 {
+    64
+}
+
+fn default_render_cache_size_mb() -> u64 {
+    256
+}
+
+fn default_render_cache_ttl_secs() -> u64 {
+    3600
+}
+
+fn default_render_cache_disk_size_mb() -> u64 {
+    1024
+}
+
+fn default_render_buffer_pool_mb() -> u64 {
+    64
+}
+
+fn default_render_shared_resources_mb() -> u64 {
+    64
+}
+
+fn default_render_tile_cache_mb() -> u64 {
+    128
+}
+
+fn default_render_tile_timeout_secs() -> u64 {
+    30
+}
+
+fn default_render_static_timeout_secs() -> u64 {
+    60
+}
+
+fn default_render_tile_queue_depth() -> usize {
+    1024
+}
+
+fn default_render_static_queue_depth() -> usize {
+    256
+}
+
+fn default_render_bulk_queue_depth() -> usize {
+    64
+}
+
+fn default_render_worker_frames_mb() -> u64 {
+    64
+}
+
+fn default_render_warm_up() -> bool {
+    true
+}
+
+fn default_render_jpeg_quality() -> u8 {
+    90
+}
+
+impl Default for RenderConfig {
+    fn default() -> Self {
+        Self {
+            pool_size: default_render_pool_size(),
+            maps_per_thread: default_render_maps_per_thread(),
+            idle_timeout_secs: default_render_idle_timeout_secs(),
+            metatile: default_render_metatile(),
+            metatile_buffer: default_render_metatile_buffer(),
+            cache_size_mb: default_render_cache_size_mb(),
+            cache_ttl_secs: default_render_cache_ttl_secs(),
+            cache_dir: None,
+            cache_disk_size_mb: default_render_cache_disk_size_mb(),
+            buffer_pool_mb: default_render_buffer_pool_mb(),
+            shared_resources_mb: default_render_shared_resources_mb(),
+            tile_cache_mb: default_render_tile_cache_mb(),
+            tile_timeout_secs: default_render_tile_timeout_secs(),
+            static_timeout_secs: default_render_static_timeout_secs(),
+            tile_queue_depth: default_render_tile_queue_depth(),
+            static_queue_depth: default_render_static_queue_depth(),
+            bulk_queue_depth: default_render_bulk_queue_depth(),
+            device: None,
+            workers: 0,
+            worker_frames_mb: default_render_worker_frames_mb(),
+            worker_max_memory_mb: 0,
+            shader_cache_dir: None,
+            gpu_overlays: false,
+            warm_up: default_render_warm_up(),
+            warm_up_tiles: Vec::new(),
+            png_compression: PngCompression::default(),
+            png_filter: PngFilter::default(),
+            png_palette: false,
+            jpeg_quality: default_render_jpeg_quality(),
+        }
+    }
+}
+
 /// Configuration for a tile source (PMTiles or MBTiles)
 #[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct SourceConfig {
@@ -634,6 +873,58 @@ mod tests {
         assert_eq!(config.sources[0].source_type, SourceType::PMTiles);
     }
 
+    #[test]
+    fn test_parse_render_config() {
+        let toml = r#"
+            [render]
+            pool_size = 8
+            maps_per_thread = 2
+            idle_timeout_secs = 60
+            metatile = 4
+            metatile_buffer = 128
+            cache_size_mb = 0
+            warm_up_tiles = ["osm-bright/14/8802/5373@2x.png"]
+        "#;
+
+        let config: Config = toml::from_str(toml).unwrap();
+        assert_eq!(config.render.pool_size, 8);
+        assert_eq!(config.render.maps_per_thread, 2);
+        assert_eq!(config.render.idle_timeout_secs, 60);
+        assert_eq!(config.render.metatile, 4);
+        assert_eq!(config.render.metatile_buffer, 128);
+        assert_eq!(config.render.cache_size_mb, 0);
+        assert_eq!(config.render.cache_ttl_secs, 3600);
+        assert!(config.render.warm_up);
+        assert_eq!(
+            config.render.warm_up_tiles,
+            vec!["osm-bright/14/8802/5373@2x.png".to_string()]
+        );
+    }
+
+    #[test]
+    fn test_render_config_defaults() {
+        let config: Config = toml::from_str("").unwrap();
+        assert!(config.render.pool_size >= 1);
+        assert_eq!(config.render.maps_per_thread, 4);
+        assert_eq!(config.render.idle_timeout_secs, 300);
+        assert_eq!(config.render.metatile, 1);
+        assert_eq!(config.render.metatile_buffer, 64);
+        assert_eq!(config.render.cache_size_mb, 256);
+        assert_eq!(config.render.buffer_pool_mb, 64);
+        assert_eq!(config.render.shared_resources_mb, 64);
+        assert_eq!(config.render.tile_cache_mb, 128);
+        assert_eq!(config.render.tile_timeout_secs, 30);
+        assert_eq!(config.render.static_timeout_secs, 60);
+        assert_eq!(config.render.tile_queue_depth, 1024);
+        assert_eq!(config.render.bulk_queue_depth, 64);
+        assert_eq!(config.render.device, None);
+        assert_eq!(config.render.workers, 0);
+        assert_eq!(config.render.worker_frames_mb, 64);
+        assert_eq!(config.render.worker_max_memory_mb, 0);
+        assert_eq!(config.render.shader_cache_dir, None);
+        assert!(!config.render.gpu_overlays);
+    }
+
     #[test]
     fn test_source_type_serialization() {
         assert_eq!(
@@ -1,5 +1,5 @@
 use axum::{
-    http::StatusCode,
+    http::{header, HeaderValue, StatusCode},
     response::{IntoResponse, Response},
 };
 use thiserror::Error;
@@ -42,6 +42,12 @@ pub enum TileServerError {
     #[error("Render error: {0}")]
     RenderError(String),
 
+    #[error("Render cancelled: {0}")]
+    RenderCancelled(String),
+
+    #[error("Renderer overloaded, retry in {retry_after}s")]
+    Overloaded { retry_after: u64 },
+
     #[error("MBTiles error: {0}")]
     MbTilesError(String),
 
@@ -65,6 +71,23 @@ pub enum TileServerError {
     Internal(#[from] anyhow::Error),
 }
 
+impl TileServerError {
+    /// A copy of the error for another caller waiting on the same work.
+    /// Errors that can't be copied are passed on by message.
+    pub fn shared(&self) -> Self {
+        match self {
+            TileServerError::RenderError(message) => TileServerError::RenderError(message.clone()),
+            TileServerError::RenderCancelled(message) => {
+                TileServerError::RenderCancelled(message.clone())
+            }
+            TileServerError::Overloaded { retry_after } => TileServerError::Overloaded {
+                retry_after: *retry_after,
+            },
+            e => TileServerError::RenderError(e.to_string()),
+        }
+    }
+}
+
 impl IntoResponse for TileServerError {
     fn into_response(self) -> Response {
         let (status, message) = match &self {
@@ -91,6 +114,10 @@ impl IntoResponse for TileServerError {
             TileServerError::RenderError(_) => {
                 (StatusCode::INTERNAL_SERVER_ERROR, self.to_string())
             }
+            TileServerError::RenderCancelled(_) => (StatusCode::GATEWAY_TIMEOUT, self.to_string()),
+            TileServerError::Overloaded { .. } => {
+                (StatusCode::SERVICE_UNAVAILABLE, self.to_string())
+            }
             TileServerError::MbTilesError(_) => {
                 (StatusCode::INTERNAL_SERVER_ERROR, self.to_string())
             }
@@ -116,7 +143,13 @@ impl IntoResponse for TileServerError {
             ),
         };
 
-        (status, message).into_response()
+        let mut response = (status, message).into_response();
+        if let TileServerError::Overloaded { retry_after } = self {
+            response
+                .headers_mut()
+                .insert(header::RETRY_AFTER, HeaderValue::from(retry_after));
+        }
+        response
     }
 }
 
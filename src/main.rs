@@ -8,8 +8,18 @@ use axum::{
     routing::get,
     Json, Router,
 };
+use futures::StreamExt;
 use rust_embed::Embed;
-use std::{net::SocketAddr, path::PathBuf, sync::Arc, time::Duration};
+use std::{
+    collections::HashMap,
+    net::SocketAddr,
+    path::PathBuf,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc,
+    },
+    time::{Duration, Instant},
+};
 use tokio::net::TcpListener;
 use tower_http::{
     compression::CompressionLayer,
@@ -26,6 +36,7 @@ mod error;
 mod logging;
 mod openapi;
 mod render;
+mod seed;
 mod sources;
 mod styles;
 mod telemetry;
@@ -34,7 +45,10 @@ mod wmts;
 use cli::Cli;
 use config::Config;
 use error::TileServerError;
-use render::{ImageFormat, RenderOptions, Renderer, StaticQueryParams, StaticType};
+use render::{
+    ImageFormat, PoolConfig, RenderOptions, RenderStyle, Renderer, ResourceLoader,
+    StaticQueryParams, StaticType,
+};
 use sources::{SourceManager, TileJson};
 use styles::{StyleInfo, StyleManager, UrlQueryParams};
 
@@ -49,10 +63,14 @@ pub struct AppState {
     pub sources: Arc<SourceManager>,
     pub styles: Arc<StyleManager>,
     pub renderer: Option<Arc<Renderer>>,
+    /// Styles with tile URLs inlined for the renderer, by style ID
+    pub render_styles: Arc<HashMap<String, RenderStyle>>,
     pub base_url: String,
     pub ui_enabled: bool,
     pub fonts_dir: Option<PathBuf>,
     pub files_dir: Option<PathBuf>,
+    /// Set once startup warm-up has finished; `/health` reports 503 until then
+    pub ready: Arc<AtomicBool>,
 }
 
 #[tokio::main]
@@ -61,6 +79,20 @@ async fn main() -> anyhow::Result<()> {
 
     // Parse CLI arguments
     let cli = Cli::parse_args();
+
+    // Render workers get their settings from the server, and log to stderr
+    // along with it
+    if let Some(cli::Command::RenderWorker(args)) = &cli.command {
+        tracing_subscriber::fmt()
+            .with_env_filter(
+                EnvFilter::from_default_env().add_directive("tileserver_rs=info".parse()?),
+            )
+            .with_writer(std::io::stderr)
+            .compact()
+            .init();
+        render::run_worker(&args.socket).await?;
+        return Ok(());
+    }
     let ui_enabled = cli.ui_enabled();
     let verbose = cli.verbose;
 
@@ -105,14 +137,40 @@ async fn main() -> anyhow::Result<()> {
     #[cfg(not(feature = "postgres"))]
     let sources = SourceManager::from_configs(&config.sources).await?;
     tracing::info!("Loaded {} tile source(s)", sources.len());
+    let sources = Arc::new(sources);
 
     // Load styles
     let styles = StyleManager::from_configs(&config.styles)?;
     tracing::info!("Loaded {} style(s)", styles.len());
+    let styles = Arc::new(styles);
+
+    // Build base URL - use public_url if configured, otherwise auto-generate
+    let base_url = if let Some(ref public_url) = config.server.public_url {
+        public_url.trim_end_matches('/').to_string()
+    } else {
+        let host_for_url = if config.server.host == "0.0.0.0" {
+            "localhost"
+        } else {
+            &config.server.host
+        };
+        format!("http://{}:{}", host_for_url, config.server.port)
+    };
 
-    // Initialize native renderer for rendering (if styles are configured)
+    // Initialize native renderer for rendering (if styles are configured).
+    // Tiles, glyphs and sprites are loaded in-process rather than over HTTP.
     let renderer = if !styles.is_empty() {
-        match Renderer::new() {
+        let renderer = ResourceLoader::new(
+            &base_url,
+            sources.clone(),
+            styles.clone(),
+            config.fonts.clone(),
+            config.files.clone(),
+        )
+        .and_then(|loader| {
+            Renderer::with_resource_loader(PoolConfig::from(&config.render), 3, loader)
+        });
+
+        match renderer {
             Ok(r) => {
                 tracing::info!("Native MapLibre renderer initialized");
                 Some(Arc::new(r))
@@ -126,16 +184,17 @@ async fn main() -> anyhow::Result<()> {
         None
     };
 
-    // Build base URL - use public_url if configured, otherwise auto-generate
-    let base_url = if let Some(ref public_url) = config.server.public_url {
-        public_url.trim_end_matches('/').to_string()
-    } else {
-        let host_for_url = if config.server.host == "0.0.0.0" {
-            "localhost"
-        } else {
-            &config.server.host
-        };
-        format!("http://{}:{}", host_for_url, config.server.port)
+    // Serialized and hashed once, rather than for every render
+    let render_styles = match &renderer {
+        Some(_) => styles
+            .all()
+            .into_iter()
+            .map(|style| {
+                let json = styles::rewrite_style_for_native(&style.style_json, &base_url, &sources);
+                (style.id.clone(), RenderStyle::new(json.to_string()))
+            })
+            .collect(),
+        None => HashMap::new(),
     };
 
     // Log fonts directory if configured
@@ -157,15 +216,23 @@ async fn main() -> anyhow::Result<()> {
     }
 
     let state = AppState {
-        sources: Arc::new(sources),
-        styles: Arc::new(styles),
+        sources,
+        styles,
         renderer,
+        render_styles: Arc::new(render_styles),
         base_url,
         ui_enabled,
         fonts_dir: config.fonts,
         files_dir: config.files,
+        ready: Arc::new(AtomicBool::new(false)),
     };
 
+    if let Some(cli::Command::Seed(args)) = cli.command {
+        let result = seed::run(state, args).await;
+        telemetry::shutdown_telemetry();
+        return result;
+    }
+
     if ui_enabled {
         tracing::info!("Web UI enabled at /");
     } else {
@@ -233,6 +300,13 @@ async fn main() -> anyhow::Result<()> {
 
     let listener = TcpListener::bind(addr).await?;
 
+    // Serve right away, but only report healthy once the renderer is warm
+    if config.render.warm_up {
+        tokio::spawn(warm_up(state.clone(), config.render.warm_up_tiles.clone()));
+    } else {
+        state.ready.store(true, Ordering::Release);
+    }
+
     // Run the server with graceful shutdown
     axum::serve(listener, router)
         .with_graceful_shutdown(shutdown_signal())
@@ -244,6 +318,74 @@ async fn main() -> anyhow::Result<()> {
     Ok(())
 }
 
+/// Warm the renderer up for every style, pre-render the configured hot tiles
+/// and then mark the server ready
+async fn warm_up(state: AppState, tiles: Vec<String>) {
+    let Some(renderer) = state.renderer.clone() else {
+        state.ready.store(true, Ordering::Release);
+        return;
+    };
+    let started = Instant::now();
+
+    let maps_per_thread = renderer.pool().config().maps_per_thread;
+    if state.styles.len() > maps_per_thread {
+        tracing::warn!(
+            "{} styles but render.maps_per_thread is {}; not every style stays warm",
+            state.styles.len(),
+            maps_per_thread
+        );
+    }
+
+    for (id, style) in state.render_styles.iter() {
+        if let Err(e) = renderer.warm_up(style).await {
+            tracing::warn!("Failed to warm up style '{}': {}", id, e);
+        }
+    }
+
+    // Hot tiles render concurrently, as many as the pool keeps in flight
+    let concurrency = renderer.pool().stats().threads * maps_per_thread;
+    futures::stream::iter(tiles)
+        .for_each_concurrent(concurrency, |tile| {
+            let renderer = renderer.clone();
+            let state = &state;
+            async move {
+                let Some((params, (y, scale, format))) = parse_warm_up_tile(&tile) else {
+                    tracing::warn!("Invalid render.warm_up_tiles entry '{}'", tile);
+                    return;
+                };
+                let Some(style) = state.render_styles.get(&params.style) else {
+                    tracing::warn!("Warm-up tile '{}' has an unknown style", tile);
+                    return;
+                };
+                let rendered = renderer
+                    .render_tile(style, params.z, params.x, y, scale, format)
+                    .await;
+                if let Err(e) = rendered {
+                    tracing::warn!("Failed to render warm-up tile '{}': {}", tile, e);
+                }
+            }
+        })
+        .await;
+
+    state.ready.store(true, Ordering::Release);
+    tracing::info!(
+        "Renderer warmed up in {:.1}s",
+        started.elapsed().as_secs_f64()
+    );
+}
+
+/// Parse a warm-up tile of the form "style/z/x/y[@2x].png"
+fn parse_warm_up_tile(tile: &str) -> Option<(RasterTileParams, (u32, u8, ImageFormat))> {
+    let mut parts = tile.rsplitn(4, '/');
+    let y_fmt = parts.next()?.to_string();
+    let x = parts.next()?.parse().ok()?;
+    let z = parts.next()?.parse().ok()?;
+    let style = parts.next()?.to_string();
+    let params = RasterTileParams { style, z, x, y_fmt };
+    let parsed = params.parse()?;
+    Some((params, parsed))
+}
+
 /// Signal handler for graceful shutdown
 async fn shutdown_signal() {
     let ctrl_c = async {
@@ -332,9 +474,13 @@ fn api_router(state: AppState) -> Router {
         .with_state(state)
 }
 
-/// Health check endpoint
-async fn health_check() -> (StatusCode, &'static str) {
-    (StatusCode::OK, "OK")
+/// Health check endpoint, unavailable until startup warm-up has finished
+async fn health_check(State(state): State<AppState>) -> (StatusCode, &'static str) {
+    if state.ready.load(Ordering::Acquire) {
+        (StatusCode::OK, "OK")
+    } else {
+        (StatusCode::SERVICE_UNAVAILABLE, "Warming up")
+    }
 }
 
 /// Combined index entry for /index.json
@@ -884,26 +1030,15 @@ async fn get_raster_tile(
     // Parse parameters
     let (y, scale, format) = params.parse().ok_or(TileServerError::InvalidTileRequest)?;
 
-    // Get style
+    // Get style, with tile URLs inlined for native rendering
     let style = state
-        .styles
+        .render_styles
         .get(&params.style)
         .ok_or_else(|| TileServerError::StyleNotFound(params.style.clone()))?;
 
-    // Rewrite style to inline tile URLs for native rendering
-    let rewritten_style =
-        styles::rewrite_style_for_native(&style.style_json, &state.base_url, &state.sources);
-
     // Render the tile
     let image_data = renderer
-        .render_tile(
-            &rewritten_style.to_string(),
-            params.z,
-            params.x,
-            y,
-            scale,
-            format,
-        )
+        .render_tile(style, params.z, params.x, y, scale, format)
         .await?;
 
     // Build response
@@ -988,26 +1123,15 @@ async fn get_raster_tile_with_size(
     // Clamp to valid range
     let scale = effective_scale.min(9);
 
-    // Get style
+    // Get style, with tile URLs inlined for native rendering
     let style = state
-        .styles
+        .render_styles
         .get(&params.style)
         .ok_or_else(|| TileServerError::StyleNotFound(params.style.clone()))?;
 
-    // Rewrite style to inline tile URLs for native rendering
-    let rewritten_style =
-        styles::rewrite_style_for_native(&style.style_json, &state.base_url, &state.sources);
-
     // Render the tile
     let image_data = renderer
-        .render_tile(
-            &rewritten_style.to_string(),
-            params.z,
-            params.x,
-            y,
-            scale,
-            format,
-        )
+        .render_tile(style, params.z, params.x, y, scale, format)
         .await?;
 
     // Build response
@@ -1081,20 +1205,16 @@ async fn get_static_image(
         .parse::<StaticType>()
         .map_err(TileServerError::RenderError)?;
 
-    // Get style
+    // Get style, with tile URLs inlined for native rendering
     let style = state
-        .styles
+        .render_styles
         .get(&params.style)
         .ok_or_else(|| TileServerError::StyleNotFound(params.style.clone()))?;
 
-    // Rewrite style to inline tile URLs for native rendering
-    let rewritten_style =
-        styles::rewrite_style_for_native(&style.style_json, &state.base_url, &state.sources);
-
     // Create render options
     let options = RenderOptions::for_static(
         params.style.clone(),
-        rewritten_style.to_string(),
+        style.clone(),
         static_type,
         width,
         height,
@@ -161,13 +161,14 @@ pub struct ApiError {
 
 /// Health check
 ///
-/// Returns OK if the server is running
+/// Returns OK once the server is running and the renderer has warmed up
 #[utoipa::path(
     get,
     path = "/health",
     tag = "Health",
     responses(
-        (status = 200, description = "Server is healthy", body = String, example = "OK")
+        (status = 200, description = "Server is healthy", body = String, example = "OK"),
+        (status = 503, description = "Renderer is still warming up", body = String, example = "Warming up")
     )
 )]
 pub async fn health_check() {}
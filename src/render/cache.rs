@@ -0,0 +1,473 @@
+//! Cache of encoded raster tiles.
+//!
+//! Tiles are kept in a size-bounded in-memory LRU (moka) in front of an
+//! optional disk tier of one file per tile. Disk hits are read onto the heap,
+//! so cached tiles don't each hold a memory mapping, and promoted back into
+//! memory. Disk tiles are filed under a hash of the encode settings, so a
+//! config change doesn't serve tiles encoded the old way. Metatile renders
+//! insert every tile of the block, so neighbouring requests are served
+//! without touching the renderer.
+
+use bytes::Bytes;
+use moka::future::Cache;
+use moka::policy::EvictionPolicy;
+use opentelemetry::KeyValue;
+use std::fs::File;
+use std::io::Read;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, SystemTime};
+
+use super::metrics::metrics;
+use super::types::{EncodeOptions, ImageFormat};
+use crate::error::{Result, TileServerError};
+
+/// Fraction of the disk budget kept after an eviction sweep
+const DISK_SWEEP_TARGET: f64 = 0.9;
+
+#[derive(Clone, Copy, Debug, Eq, PartialEq, Hash)]
+pub struct RenderCacheKey {
+    pub style_hash: u64,
+    pub z: u8,
+    pub x: u32,
+    pub y: u32,
+    pub scale: u8,
+    pub format: ImageFormat,
+}
+
+impl RenderCacheKey {
+    /// Key for another tile rendered with the same style, scale and format
+    pub fn with_tile(self, x: u32, y: u32) -> Self {
+        Self { x, y, ..self }
+    }
+
+    /// Location of the tile below a disk cache root
+    fn path(&self, root: &Path) -> PathBuf {
+        let extension = match self.format {
+            ImageFormat::Png => "png",
+            ImageFormat::Jpeg => "jpg",
+            ImageFormat::Webp => "webp",
+        };
+        root.join(format!("{:016x}", self.style_hash))
+            .join(self.z.to_string())
+            .join(self.x.to_string())
+            .join(format!("{}@{}x.{}", self.y, self.scale, extension))
+    }
+}
+
+/// Render cache counters
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct RenderCacheStats {
+    pub memory_hits: u64,
+    pub disk_hits: u64,
+    pub misses: u64,
+    /// Tiles held in memory
+    pub entries: u64,
+    /// Bytes held in memory
+    pub size_bytes: u64,
+    /// Bytes held on disk
+    pub disk_size_bytes: u64,
+}
+
+#[derive(Default)]
+struct Counters {
+    memory_hits: AtomicU64,
+    disk_hits: AtomicU64,
+    misses: AtomicU64,
+}
+
+#[derive(Clone)]
+pub struct RenderCache {
+    cache: Cache<RenderCacheKey, Bytes>,
+    disk: Option<Arc<DiskCache>>,
+    counters: Arc<Counters>,
+}
+
+impl RenderCache {
+    pub fn new(max_size_mb: u64, ttl: Duration) -> Self {
+        let max_size_bytes = max_size_mb * 1024 * 1024;
+
+        let cache = Cache::builder()
+            .max_capacity(max_size_bytes)
+            .weigher(|_key: &RenderCacheKey, value: &Bytes| -> u32 {
+                value.len().try_into().unwrap_or(u32::MAX)
+            })
+            .eviction_policy(EvictionPolicy::lru())
+            .time_to_live(ttl)
+            .build();
+
+        Self {
+            cache,
+            disk: None,
+            counters: Arc::default(),
+        }
+    }
+
+    /// Add a disk tier under `dir` holding up to `max_size_mb` of tiles.
+    /// Tiles already in `dir` from earlier runs are served until they expire,
+    /// if they were encoded with the same `encode` settings.
+    pub fn open_disk(
+        &mut self,
+        dir: &Path,
+        encode: &EncodeOptions,
+        max_size_mb: u64,
+        ttl: Duration,
+    ) -> Result<()> {
+        self.disk = Some(Arc::new(DiskCache::open(
+            dir,
+            encode.hash(),
+            max_size_mb,
+            ttl,
+        )?));
+        Ok(())
+    }
+
+    pub async fn get(&self, key: &RenderCacheKey) -> Option<Bytes> {
+        if let Some(data) = self.cache.get(key).await {
+            self.record(&self.counters.memory_hits, "memory");
+            return Some(data);
+        }
+
+        if let Some(disk) = &self.disk {
+            let disk = disk.clone();
+            let path = key.path(&disk.tiles);
+            let data = tokio::task::spawn_blocking(move || disk.read(&path))
+                .await
+                .ok()
+                .flatten();
+            if let Some(data) = data {
+                self.record(&self.counters.disk_hits, "disk");
+                self.cache.insert(*key, data.clone()).await;
+                return Some(data);
+            }
+        }
+
+        self.record(&self.counters.misses, "miss");
+        None
+    }
+
+    pub async fn insert(&self, key: RenderCacheKey, value: Bytes) {
+        if let Some(disk) = &self.disk {
+            // Written in the background, the tile is served from memory meanwhile
+            let disk = disk.clone();
+            let data = value.clone();
+            tokio::task::spawn_blocking(move || disk.write(&key, &data));
+        }
+        self.cache.insert(key, value).await;
+    }
+
+    #[allow(dead_code)]
+    pub fn entry_count(&self) -> u64 {
+        self.cache.entry_count()
+    }
+
+    pub fn stats(&self) -> RenderCacheStats {
+        RenderCacheStats {
+            memory_hits: self.counters.memory_hits.load(Ordering::Relaxed),
+            disk_hits: self.counters.disk_hits.load(Ordering::Relaxed),
+            misses: self.counters.misses.load(Ordering::Relaxed),
+            entries: self.cache.entry_count(),
+            size_bytes: self.cache.weighted_size(),
+            disk_size_bytes: self
+                .disk
+                .as_ref()
+                .map_or(0, |disk| disk.size.load(Ordering::Relaxed)),
+        }
+    }
+
+    fn record(&self, counter: &AtomicU64, result: &'static str) {
+        counter.fetch_add(1, Ordering::Relaxed);
+        metrics()
+            .cache_lookups
+            .add(1, &[KeyValue::new("result", result)]);
+    }
+}
+
+impl std::fmt::Debug for RenderCache {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("RenderCache")
+            .field("entry_count", &self.cache.entry_count())
+            .field("weighted_size_bytes", &self.cache.weighted_size())
+            .field("disk", &self.disk.as_ref().map(|disk| &disk.tiles))
+            .finish()
+    }
+}
+
+/// Disk tier: one file per tile, written atomically and evicted oldest first
+struct DiskCache {
+    root: PathBuf,
+    /// Tiles of the current encode settings, below `root`. Tiles of other
+    /// settings are never read but still count against the budget.
+    tiles: PathBuf,
+    max_size_bytes: u64,
+    ttl: Duration,
+    /// Approximate bytes on disk, corrected by every sweep
+    size: AtomicU64,
+    sweeping: AtomicBool,
+    next_temp: AtomicU64,
+}
+
+impl DiskCache {
+    fn open(root: &Path, encode_hash: u64, max_size_mb: u64, ttl: Duration) -> Result<Self> {
+        let tiles = root.join(format!("{:016x}", encode_hash));
+        std::fs::create_dir_all(&tiles).map_err(|e| {
+            TileServerError::RenderError(format!(
+                "Failed to create render cache directory {}: {}",
+                tiles.display(),
+                e
+            ))
+        })?;
+
+        let disk = Self {
+            root: root.to_path_buf(),
+            tiles,
+            max_size_bytes: max_size_mb * 1024 * 1024,
+            ttl,
+            size: AtomicU64::new(0),
+            sweeping: AtomicBool::new(true),
+            next_temp: AtomicU64::new(0),
+        };
+        disk.sweep();
+
+        tracing::info!(
+            "Render disk cache at {} ({} of {} MB used)",
+            root.display(),
+            disk.size.load(Ordering::Relaxed) / (1024 * 1024),
+            max_size_mb
+        );
+        Ok(disk)
+    }
+
+    fn read(&self, path: &Path) -> Option<Bytes> {
+        let file = File::open(path).ok()?;
+        let metadata = file.metadata().ok()?;
+        if metadata.len() == 0 {
+            return None;
+        }
+        if self.is_expired(metadata.modified().ok()?) {
+            drop(file);
+            if std::fs::remove_file(path).is_ok() {
+                self.size.fetch_sub(
+                    metadata.len().min(self.size.load(Ordering::Relaxed)),
+                    Ordering::Relaxed,
+                );
+            }
+            return None;
+        }
+
+        let mut data = Vec::with_capacity(metadata.len() as usize);
+        (&file).read_to_end(&mut data).ok()?;
+        Some(Bytes::from(data))
+    }
+
+    fn write(&self, key: &RenderCacheKey, data: &[u8]) {
+        if data.len() as u64 > self.max_size_bytes {
+            return;
+        }
+
+        let path = key.path(&self.tiles);
+        let temp = path.with_extension(format!(
+            "{}-{}.tmp",
+            std::process::id(),
+            self.next_temp.fetch_add(1, Ordering::Relaxed)
+        ));
+        let written = path
+            .parent()
+            .map_or(Ok(()), std::fs::create_dir_all)
+            .and_then(|_| std::fs::write(&temp, data))
+            .and_then(|_| std::fs::rename(&temp, &path));
+        if let Err(e) = written {
+            let _ = std::fs::remove_file(&temp);
+            tracing::warn!("Failed to write {} to render cache: {}", path.display(), e);
+            return;
+        }
+
+        let size = self.size.fetch_add(data.len() as u64, Ordering::Relaxed) + data.len() as u64;
+        if size > self.max_size_bytes && !self.sweeping.swap(true, Ordering::AcqRel) {
+            self.sweep();
+        }
+    }
+
+    /// Recount the tier and delete expired tiles, then the oldest ones until
+    /// it is back under budget. Caller must have set `sweeping`.
+    fn sweep(&self) {
+        let mut files = Vec::new();
+        let mut pending = vec![self.root.clone()];
+        while let Some(dir) = pending.pop() {
+            let Ok(entries) = std::fs::read_dir(&dir) else {
+                continue;
+            };
+            for entry in entries.flatten() {
+                let Ok(metadata) = entry.metadata() else {
+                    continue;
+                };
+                if metadata.is_dir() {
+                    pending.push(entry.path());
+                } else if let Ok(modified) = metadata.modified() {
+                    files.push((modified, metadata.len(), entry.path()));
+                }
+            }
+        }
+
+        let mut size: u64 = files.iter().map(|(_, len, _)| len).sum();
+        let target = if size > self.max_size_bytes {
+            (self.max_size_bytes as f64 * DISK_SWEEP_TARGET) as u64
+        } else {
+            self.max_size_bytes
+        };
+
+        files.sort_unstable_by_key(|(modified, _, _)| *modified);
+        for (modified, len, path) in files {
+            if size <= target && !self.is_expired(modified) {
+                break;
+            }
+            if std::fs::remove_file(&path).is_ok() {
+                size -= len;
+            }
+        }
+
+        self.size.store(size, Ordering::Relaxed);
+        self.sweeping.store(false, Ordering::Release);
+    }
+
+    fn is_expired(&self, modified: SystemTime) -> bool {
+        modified.elapsed().map_or(false, |age| age >= self.ttl)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::config::PngCompression;
+
+    fn key() -> RenderCacheKey {
+        RenderCacheKey {
+            style_hash: 42,
+            z: 14,
+            x: 8580,
+            y: 5737,
+            scale: 1,
+            format: ImageFormat::Png,
+        }
+    }
+
+    #[tokio::test]
+    async fn test_cache_insert_and_get() {
+        let cache = RenderCache::new(1, Duration::from_secs(3600));
+        cache.insert(key(), Bytes::from(vec![0u8; 1024])).await;
+
+        let result = cache.get(&key()).await;
+        assert_eq!(result.unwrap().len(), 1024);
+    }
+
+    #[tokio::test]
+    async fn test_cache_key_distinguishes_tiles() {
+        let cache = RenderCache::new(1, Duration::from_secs(3600));
+        cache.insert(key(), Bytes::from_static(b"tile")).await;
+
+        assert!(cache.get(&key().with_tile(8581, 5737)).await.is_none());
+        let webp = RenderCacheKey {
+            format: ImageFormat::Webp,
+            ..key()
+        };
+        assert!(cache.get(&webp).await.is_none());
+    }
+
+    #[tokio::test]
+    async fn test_cache_counts_hits_and_misses() {
+        let cache = RenderCache::new(1, Duration::from_secs(3600));
+        assert!(cache.get(&key()).await.is_none());
+        cache.insert(key(), Bytes::from_static(b"tile")).await;
+        assert!(cache.get(&key()).await.is_some());
+
+        let stats = cache.stats();
+        assert_eq!(
+            (stats.memory_hits, stats.disk_hits, stats.misses),
+            (1, 0, 1)
+        );
+        assert_eq!(stats.entries, 1);
+    }
+
+    #[tokio::test]
+    async fn test_disk_tier_survives_restart() {
+        let dir = tempfile::tempdir().unwrap();
+        let ttl = Duration::from_secs(3600);
+
+        let encode = EncodeOptions::default();
+        let tiles = dir.path().join(format!("{:016x}", encode.hash()));
+
+        let mut cache = RenderCache::new(1, ttl);
+        cache.open_disk(dir.path(), &encode, 1, ttl).unwrap();
+        cache.insert(key(), Bytes::from_static(b"tile")).await;
+        assert!(key().path(&tiles).ends_with("14/8580/5737@1x.png"));
+
+        // Disk writes happen in the background
+        for _ in 0..100 {
+            if key().path(&tiles).exists() {
+                break;
+            }
+            tokio::time::sleep(Duration::from_millis(10)).await;
+        }
+
+        let mut restarted = RenderCache::new(1, ttl);
+        restarted.open_disk(dir.path(), &encode, 1, ttl).unwrap();
+        assert_eq!(restarted.stats().disk_size_bytes, 4);
+        assert_eq!(restarted.get(&key()).await.unwrap(), &b"tile"[..]);
+        assert_eq!(restarted.get(&key()).await.unwrap(), &b"tile"[..]);
+
+        let stats = restarted.stats();
+        assert_eq!(
+            (stats.memory_hits, stats.disk_hits, stats.misses),
+            (1, 1, 0)
+        );
+    }
+
+    #[test]
+    fn test_disk_tier_evicts_oldest_over_budget() {
+        let dir = tempfile::tempdir().unwrap();
+        let disk = DiskCache::open(dir.path(), 1, 1, Duration::from_secs(3600)).unwrap();
+        let tile = vec![0u8; 400 * 1024];
+
+        for x in 0..3 {
+            disk.write(&key().with_tile(x, 0), &tile);
+            // Distinct modification times for a stable eviction order
+            std::thread::sleep(Duration::from_millis(20));
+        }
+
+        assert!(disk.size.load(Ordering::Relaxed) <= 1024 * 1024);
+        assert!(!key().with_tile(0, 0).path(&disk.tiles).exists());
+        assert!(key().with_tile(2, 0).path(&disk.tiles).exists());
+    }
+
+    #[test]
+    fn test_disk_tier_drops_expired_tiles() {
+        let dir = tempfile::tempdir().unwrap();
+        let disk = DiskCache::open(dir.path(), 1, 1, Duration::ZERO).unwrap();
+
+        disk.write(&key(), b"tile");
+        assert!(disk.read(&key().path(&disk.tiles)).is_none());
+        assert!(!key().path(&disk.tiles).exists());
+    }
+
+    #[tokio::test]
+    async fn test_disk_tier_separates_encode_settings() {
+        let dir = tempfile::tempdir().unwrap();
+        let ttl = Duration::from_secs(3600);
+        let small = EncodeOptions::default();
+        let fast = EncodeOptions {
+            png_compression: PngCompression::Fast,
+            ..small
+        };
+        assert_ne!(small.hash(), fast.hash());
+
+        let disk = DiskCache::open(dir.path(), small.hash(), 1, ttl).unwrap();
+        disk.write(&key(), b"tile");
+
+        let mut cache = RenderCache::new(1, ttl);
+        cache.open_disk(dir.path(), &fast, 1, ttl).unwrap();
+        assert!(cache.get(&key()).await.is_none());
+        // Still counted so a settings change doesn't overrun the budget
+        assert_eq!(cache.stats().disk_size_bytes, 4);
+    }
+}
@@ -0,0 +1,182 @@
+//! Single-flight request coalescing
+//!
+//! Concurrent requests for the same work share one in-flight computation: the
+//! first caller runs it, later callers wait for its result. If the running
+//! caller is cancelled (e.g. its client disconnected), one of the waiters
+//! takes over.
+
+use std::collections::HashMap;
+use std::future::Future;
+use std::hash::Hash;
+use std::sync::{Arc, Mutex};
+
+use tokio::sync::watch;
+
+use crate::error::{Result, TileServerError};
+
+/// Outcome shared with waiters
+type Outcome<V> = Option<std::result::Result<V, Arc<TileServerError>>>;
+
+pub struct Coalescer<K, V> {
+    flights: Mutex<HashMap<K, watch::Receiver<Outcome<V>>>>,
+}
+
+impl<K, V> Default for Coalescer<K, V> {
+    fn default() -> Self {
+        Self {
+            flights: Mutex::default(),
+        }
+    }
+}
+
+impl<K, V> Coalescer<K, V>
+where
+    K: Hash + Eq + Clone,
+    V: Clone,
+{
+    /// Run `work` unless a call with the same key is already in flight, in
+    /// which case wait for that call's result instead.
+    pub async fn run<F, Fut>(&self, key: K, work: F) -> Result<V>
+    where
+        F: FnOnce() -> Fut,
+        Fut: Future<Output = Result<V>>,
+    {
+        loop {
+            let (sender, mut receiver) = {
+                let mut flights = self.flights.lock().unwrap_or_else(|e| e.into_inner());
+                match flights.get(&key) {
+                    Some(receiver) => (None, receiver.clone()),
+                    None => {
+                        let (sender, receiver) = watch::channel(None);
+                        flights.insert(key.clone(), receiver.clone());
+                        (Some(sender), receiver)
+                    }
+                }
+            };
+
+            let Some(sender) = sender else {
+                match receiver.wait_for(Option::is_some).await {
+                    Ok(outcome) => {
+                        return match outcome.clone() {
+                            Some(Ok(value)) => Ok(value),
+                            Some(Err(e)) => Err(e.shared()),
+                            None => unreachable!("waited for an outcome"),
+                        };
+                    }
+                    // The running call was dropped without an outcome
+                    Err(_) => continue,
+                }
+            };
+
+            let _flight = Flight {
+                flights: &self.flights,
+                key: &key,
+            };
+            let result = work().await;
+            sender.send_replace(Some(match &result {
+                Ok(value) => Ok(value.clone()),
+                Err(e) => Err(Arc::new(e.shared())),
+            }));
+            return result;
+        }
+    }
+
+    /// Number of distinct calls in flight
+    #[allow(dead_code)]
+    pub fn in_flight(&self) -> usize {
+        self.flights.lock().unwrap_or_else(|e| e.into_inner()).len()
+    }
+}
+
+/// Unregisters a flight when its call completes or is cancelled
+struct Flight<'a, K: Hash + Eq, V> {
+    flights: &'a Mutex<HashMap<K, watch::Receiver<Outcome<V>>>>,
+    key: &'a K,
+}
+
+impl<K: Hash + Eq, V> Drop for Flight<'_, K, V> {
+    fn drop(&mut self) {
+        self.flights
+            .lock()
+            .unwrap_or_else(|e| e.into_inner())
+            .remove(self.key);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::time::Duration;
+
+    #[tokio::test]
+    async fn test_concurrent_calls_share_one_run() {
+        let coalescer = Arc::new(Coalescer::<u32, u32>::default());
+        let runs = Arc::new(AtomicUsize::new(0));
+
+        let calls = (0..8).map(|_| {
+            let coalescer = coalescer.clone();
+            let runs = runs.clone();
+            tokio::spawn(async move {
+                coalescer
+                    .run(1, || async {
+                        runs.fetch_add(1, Ordering::SeqCst);
+                        tokio::time::sleep(Duration::from_millis(50)).await;
+                        Ok(42)
+                    })
+                    .await
+            })
+        });
+
+        for call in futures::future::join_all(calls).await {
+            assert_eq!(call.unwrap().unwrap(), 42);
+        }
+        assert_eq!(runs.load(Ordering::SeqCst), 1);
+        assert_eq!(coalescer.in_flight(), 0);
+    }
+
+    #[tokio::test]
+    async fn test_errors_are_shared() {
+        let coalescer = Arc::new(Coalescer::<u32, u32>::default());
+
+        let failing = coalescer.run(1, || async {
+            tokio::time::sleep(Duration::from_millis(50)).await;
+            Err(TileServerError::RenderError("boom".to_string()))
+        });
+        let waiting = async {
+            tokio::time::sleep(Duration::from_millis(10)).await;
+            coalescer.run(1, || async { Ok(1) }).await
+        };
+
+        let (failing, waiting) = tokio::join!(failing, waiting);
+        assert!(failing.is_err());
+        assert!(waiting.unwrap_err().to_string().contains("boom"));
+    }
+
+    #[tokio::test]
+    async fn test_waiter_takes_over_cancelled_call() {
+        let coalescer = Arc::new(Coalescer::<u32, u32>::default());
+
+        let cancelled = {
+            let coalescer = coalescer.clone();
+            tokio::spawn(async move {
+                coalescer
+                    .run(1, || async {
+                        tokio::time::sleep(Duration::from_secs(60)).await;
+                        Ok(0)
+                    })
+                    .await
+            })
+        };
+        tokio::time::sleep(Duration::from_millis(10)).await;
+
+        let waiting = {
+            let coalescer = coalescer.clone();
+            tokio::spawn(async move { coalescer.run(1, || async { Ok(7) }).await })
+        };
+        tokio::time::sleep(Duration::from_millis(10)).await;
+        cancelled.abort();
+
+        assert_eq!(waiting.await.unwrap().unwrap(), 7);
+    }
+}
@@ -0,0 +1,407 @@
+//! In-process resource loader for the native renderer
+//!
+//! MapLibre Native requests every tile, glyph range and sprite a style needs.
+//! Styles rewritten by [`crate::styles::rewrite_style_for_native`] point those
+//! requests at this server's own endpoints; the loader serves them straight
+//! from the [`SourceManager`], the fonts directory and the style directories
+//! instead, so rendering never makes HTTP requests back to ourselves. URLs
+//! outside of our base URL are passed through to MapLibre's default file
+//! source.
+//!
+//! Loads are deferred onto the Tokio runtime and answered asynchronously, so
+//! render threads keep driving their other maps while sources are read.
+
+use std::io::Read;
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+
+use bytes::Bytes;
+use flate2::read::GzDecoder;
+use tokio::runtime::Handle;
+
+use super::native::{ResourceHandler, ResourceKind, ResourceResponder, ResourceResponse};
+use crate::error::{Result, TileServerError};
+use crate::sources::{SourceManager, TileCompression, TileData};
+use crate::styles::StyleManager;
+
+/// A resource served by this process
+#[derive(Debug, PartialEq, Eq)]
+enum LocalResource<'a> {
+    Tile {
+        source: &'a str,
+        z: u8,
+        x: u32,
+        y: u32,
+    },
+    Glyphs {
+        fontstack: String,
+        range: &'a str,
+    },
+    Sprite {
+        style: &'a str,
+        file: &'a str,
+    },
+    File(&'a str),
+}
+
+/// Resolves native renderer resource requests in-process
+#[derive(Clone)]
+pub struct ResourceLoader {
+    base_url: String,
+    sources: Arc<SourceManager>,
+    styles: Arc<StyleManager>,
+    fonts_dir: Option<PathBuf>,
+    files_dir: Option<PathBuf>,
+    runtime: Handle,
+}
+
+impl ResourceLoader {
+    /// Create a loader for URLs under `base_url`.
+    /// Must be called from within the Tokio runtime used to read sources.
+    pub fn new(
+        base_url: &str,
+        sources: Arc<SourceManager>,
+        styles: Arc<StyleManager>,
+        fonts_dir: Option<PathBuf>,
+        files_dir: Option<PathBuf>,
+    ) -> Result<Self> {
+        let runtime = Handle::try_current().map_err(|e| {
+            TileServerError::RenderError(format!("Resource loader needs a Tokio runtime: {}", e))
+        })?;
+
+        Ok(Self {
+            base_url: base_url.trim_end_matches('/').to_string(),
+            sources,
+            styles,
+            fonts_dir,
+            files_dir,
+            runtime,
+        })
+    }
+
+    /// Map a URL to a resource we serve, if it is one of ours
+    fn route<'a>(&self, url: &'a str) -> Option<LocalResource<'a>> {
+        let path = url.strip_prefix(self.base_url.as_str())?;
+        let path = path.split(['?', '#']).next().unwrap_or_default();
+        let path = path.strip_prefix('/')?;
+
+        let (endpoint, rest) = path.split_once('/')?;
+        match endpoint {
+            "data" => {
+                let mut parts = rest.split('/');
+                let source = parts.next()?;
+                let z = parts.next()?.parse().ok()?;
+                let x = parts.next()?.parse().ok()?;
+                let (y, _format) = parts.next()?.split_once('.')?;
+                let y = y.parse().ok()?;
+                if parts.next().is_some() {
+                    return None;
+                }
+                Some(LocalResource::Tile { source, z, x, y })
+            }
+            "fonts" => {
+                let (fontstack, range) = rest.split_once('/')?;
+                let fontstack = urlencoding::decode(fontstack).ok()?.into_owned();
+                Some(LocalResource::Glyphs { fontstack, range })
+            }
+            "styles" => {
+                let (style, file) = rest.split_once('/')?;
+                file.starts_with("sprite")
+                    .then_some(LocalResource::Sprite { style, file })
+            }
+            "files" => Some(LocalResource::File(rest)),
+            _ => None,
+        }
+    }
+
+    /// Load a resource and turn the outcome into a response for MapLibre
+    async fn respond(&self, url: &str, kind: ResourceKind) -> ResourceResponse {
+        let Some(resource) = self.route(url) else {
+            return ResourceResponse::PassThrough;
+        };
+
+        match self.load(resource).await {
+            Ok(Some(data)) => ResourceResponse::Data(data),
+            Ok(None) => {
+                tracing::debug!("Native renderer resource not found ({:?}): {}", kind, url);
+                ResourceResponse::NotFound
+            }
+            Err(e) => {
+                tracing::warn!("Failed to load native renderer resource {}: {}", url, e);
+                ResourceResponse::Error(e.to_string())
+            }
+        }
+    }
+
+    async fn load(&self, resource: LocalResource<'_>) -> Result<Option<Bytes>> {
+        match resource {
+            LocalResource::Tile { source, z, x, y } => self.load_tile(source, z, x, y).await,
+            LocalResource::Glyphs { fontstack, range } => self.load_glyphs(&fontstack, range).await,
+            LocalResource::Sprite { style, file } => self.load_sprite(style, file).await,
+            LocalResource::File(path) => self.load_file(path).await,
+        }
+    }
+
+    async fn load_tile(&self, source: &str, z: u8, x: u32, y: u32) -> Result<Option<Bytes>> {
+        if !self.sources.exists(source) {
+            return Ok(None);
+        }
+
+        #[cfg(feature = "raster")]
+        let tile = self
+            .sources
+            .get_raster_tile_with_params(source, z, x, y, 256, None, None)
+            .await?;
+        #[cfg(not(feature = "raster"))]
+        let tile = match self.sources.get(source) {
+            Some(tile_source) => tile_source.get_tile(z, x, y).await?,
+            None => None,
+        };
+
+        tile.map(decompress_tile).transpose()
+    }
+
+    async fn load_glyphs(&self, fontstack: &str, range: &str) -> Result<Option<Bytes>> {
+        let Some(fonts_dir) = self.fonts_dir.as_ref() else {
+            return Ok(None);
+        };
+
+        let range_name = range.trim_end_matches(".pbf");
+        if !range.ends_with(".pbf") || is_unsafe_path_component(range_name) {
+            return Ok(None);
+        }
+
+        // Font stacks are comma-separated, use the first font that has the range
+        for font_name in fontstack.split(',').map(|s| s.trim()) {
+            if is_unsafe_path_component(font_name) {
+                continue;
+            }
+            if let Some(data) = read_within(fonts_dir, &Path::new(font_name).join(range)).await {
+                return Ok(Some(data));
+            }
+        }
+
+        Ok(None)
+    }
+
+    async fn load_sprite(&self, style_id: &str, file: &str) -> Result<Option<Bytes>> {
+        if is_unsafe_path_component(file) || !(file.ends_with(".png") || file.ends_with(".json")) {
+            return Ok(None);
+        }
+
+        let Some(style_dir) = self.styles.get(style_id).and_then(|s| s.path.parent()) else {
+            return Ok(None);
+        };
+
+        Ok(read_within(style_dir, Path::new(file)).await)
+    }
+
+    async fn load_file(&self, path: &str) -> Result<Option<Bytes>> {
+        let Some(files_dir) = self.files_dir.as_ref() else {
+            return Ok(None);
+        };
+
+        let path = path.trim_start_matches('/');
+        if path.contains("..") {
+            return Ok(None);
+        }
+
+        Ok(read_within(files_dir, Path::new(path)).await)
+    }
+}
+
+impl ResourceHandler for ResourceLoader {
+    fn handle(&self, url: &str, kind: ResourceKind) -> ResourceResponse {
+        if self.route(url).is_none() {
+            return ResourceResponse::PassThrough;
+        }
+
+        let loader = self.clone();
+        let url = url.to_string();
+        ResourceResponse::Deferred(Box::new(move |responder: ResourceResponder| {
+            let runtime = loader.runtime.clone();
+            runtime.spawn(async move {
+                let response = loader.respond(&url, kind).await;
+                responder.respond(response);
+            });
+        }))
+    }
+}
+
+/// MapLibre Native expects uncompressed tile data
+fn decompress_tile(tile: TileData) -> Result<Bytes> {
+    match tile.compression {
+        TileCompression::None => Ok(tile.data),
+        TileCompression::Gzip => {
+            let mut data = Vec::with_capacity(tile.data.len() * 4);
+            GzDecoder::new(&tile.data[..])
+                .read_to_end(&mut data)
+                .map_err(|e| {
+                    TileServerError::RenderError(format!("Failed to decompress tile: {}", e))
+                })?;
+            Ok(Bytes::from(data))
+        }
+        other => Err(TileServerError::RenderError(format!(
+            "Unsupported tile compression for rendering: {:?}",
+            other
+        ))),
+    }
+}
+
+fn is_unsafe_path_component(name: &str) -> bool {
+    name.is_empty() || name.contains("..") || name.contains('/') || name.contains('\\')
+}
+
+/// Read `relative` under `root`, refusing paths that resolve outside of it
+async fn read_within(root: &Path, relative: &Path) -> Option<Bytes> {
+    let canonical_root = tokio::fs::canonicalize(root).await.ok()?;
+    let canonical_path = tokio::fs::canonicalize(root.join(relative)).await.ok()?;
+    if !canonical_path.starts_with(&canonical_root) {
+        return None;
+    }
+
+    tokio::fs::read(&canonical_path).await.ok().map(Bytes::from)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::io::Write;
+
+    use flate2::write::GzEncoder;
+    use flate2::Compression;
+
+    use crate::sources::TileFormat;
+
+    const BASE_URL: &str = "http://localhost:8080";
+
+    fn loader(fonts_dir: Option<PathBuf>, files_dir: Option<PathBuf>) -> Arc<ResourceLoader> {
+        Arc::new(
+            ResourceLoader::new(
+                BASE_URL,
+                Arc::new(SourceManager::new()),
+                Arc::new(StyleManager::new()),
+                fonts_dir,
+                files_dir,
+            )
+            .unwrap(),
+        )
+    }
+
+    /// Call the loader like a render thread would and wait for deferred loads
+    async fn handle(loader: &Arc<ResourceLoader>, url: &str) -> ResourceResponse {
+        match loader.handle(url, ResourceKind::Unknown) {
+            ResourceResponse::Deferred(load) => {
+                let (responder, rx) = ResourceResponder::channel();
+                load(responder);
+                rx.await.unwrap()
+            }
+            response => response,
+        }
+    }
+
+    #[tokio::test]
+    async fn test_route() {
+        let loader = loader(None, None);
+
+        assert_eq!(
+            loader.route("http://localhost:8080/data/osm/3/4/5.pbf"),
+            Some(LocalResource::Tile {
+                source: "osm",
+                z: 3,
+                x: 4,
+                y: 5
+            })
+        );
+        assert_eq!(
+            loader.route("http://localhost:8080/fonts/Noto%20Sans%20Regular,Arial/0-255.pbf"),
+            Some(LocalResource::Glyphs {
+                fontstack: "Noto Sans Regular,Arial".to_string(),
+                range: "0-255.pbf"
+            })
+        );
+        assert_eq!(
+            loader.route("http://localhost:8080/styles/light/sprite@2x.json?key=abc"),
+            Some(LocalResource::Sprite {
+                style: "light",
+                file: "sprite@2x.json"
+            })
+        );
+        assert_eq!(
+            loader.route("http://localhost:8080/files/overlays/route.geojson"),
+            Some(LocalResource::File("overlays/route.geojson"))
+        );
+
+        assert_eq!(
+            loader.route("https://tiles.example.com/data/osm/3/4/5.pbf"),
+            None
+        );
+        assert_eq!(loader.route("http://localhost:8080/data/osm/3/4.pbf"), None);
+        assert_eq!(
+            loader.route("http://localhost:8080/styles/light/style.json"),
+            None
+        );
+    }
+
+    #[tokio::test]
+    async fn test_foreign_urls_pass_through() {
+        let loader = loader(None, None);
+        let response = handle(&loader, "https://tiles.example.com/data/osm/0/0/0.pbf").await;
+        assert!(matches!(response, ResourceResponse::PassThrough));
+    }
+
+    #[tokio::test]
+    async fn test_unknown_source_not_found() {
+        let loader = loader(None, None);
+        let response = handle(&loader, "http://localhost:8080/data/missing/0/0/0.pbf").await;
+        assert!(matches!(response, ResourceResponse::NotFound));
+    }
+
+    #[tokio::test]
+    async fn test_load_glyphs_from_fontstack() {
+        let fonts = tempfile::tempdir().unwrap();
+        std::fs::create_dir(fonts.path().join("Open Sans Bold")).unwrap();
+        std::fs::write(fonts.path().join("Open Sans Bold/0-255.pbf"), b"glyphs").unwrap();
+        let loader = loader(Some(fonts.path().to_path_buf()), None);
+
+        let response = handle(
+            &loader,
+            "http://localhost:8080/fonts/Missing%20Font,Open%20Sans%20Bold/0-255.pbf",
+        )
+        .await;
+        assert!(matches!(response, ResourceResponse::Data(data) if data == &b"glyphs"[..]));
+
+        let response = handle(
+            &loader,
+            "http://localhost:8080/fonts/..,Open%20Sans%20Bold/..",
+        )
+        .await;
+        assert!(matches!(response, ResourceResponse::NotFound));
+    }
+
+    #[tokio::test]
+    async fn test_load_file_rejects_traversal() {
+        let files = tempfile::tempdir().unwrap();
+        std::fs::write(files.path().join("overlay.geojson"), b"{}").unwrap();
+        let loader = loader(None, Some(files.path().to_path_buf()));
+
+        let response = handle(&loader, "http://localhost:8080/files/overlay.geojson").await;
+        assert!(matches!(response, ResourceResponse::Data(data) if data == &b"{}"[..]));
+
+        let response = handle(&loader, "http://localhost:8080/files/../secret").await;
+        assert!(matches!(response, ResourceResponse::NotFound));
+    }
+
+    #[test]
+    fn test_decompress_gzip_tile() {
+        let mut encoder = GzEncoder::new(Vec::new(), Compression::default());
+        encoder.write_all(b"vector tile").unwrap();
+        let tile = TileData {
+            data: Bytes::from(encoder.finish().unwrap()),
+            format: TileFormat::Pbf,
+            compression: TileCompression::Gzip,
+        };
+
+        assert_eq!(decompress_tile(tile).unwrap(), &b"vector tile"[..]);
+    }
+}
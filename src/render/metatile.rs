@@ -0,0 +1,245 @@
+//! Metatile geometry
+//!
+//! A metatile is a block of N×N neighbouring tiles rendered as one static
+//! frame and sliced into individual tiles afterwards, so vector data, symbol
+//! placement and labels are processed once for the whole block. A gutter
+//! around the frame keeps labels near the block edges from being clipped.
+
+use super::native::{CameraOptions, MapMode, RenderOptions, RenderedImage, Size};
+use crate::error::Result;
+
+/// Largest supported metatile edge, in tiles
+pub const MAX_METATILE: u32 = 8;
+
+/// Largest frame edge in device pixels (stays within common GL texture limits)
+const MAX_FRAME_PX: f32 = 8192.0;
+
+/// A block of tiles rendered in a single pass
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Metatile {
+    z: u8,
+    /// Column of the top-left tile
+    x: u32,
+    /// Row of the top-left tile
+    y: u32,
+    /// Tiles per edge
+    size: u32,
+    /// Gutter in CSS pixels: top, right, bottom, left
+    gutter: [u32; 4],
+}
+
+impl Metatile {
+    /// Largest metatile edge used for a configured `size`: a power of two no
+    /// larger than [`MAX_METATILE`]
+    pub fn max_size(size: u32) -> u32 {
+        prev_power_of_two(size.clamp(1, MAX_METATILE))
+    }
+
+    /// The metatile containing tile `z/x/y`.
+    ///
+    /// `size` is rounded down to a power of two no larger than
+    /// [`MAX_METATILE`], then shrunk to fit the world at low zooms and the
+    /// frame size limit at high pixel ratios. A size of 1 means the tile
+    /// should be rendered on its own.
+    pub fn containing(
+        z: u8,
+        x: u32,
+        y: u32,
+        size: u32,
+        buffer: u32,
+        tile_size: u32,
+        pixel_ratio: f32,
+    ) -> Self {
+        let world = 1u64.checked_shl(z as u32).unwrap_or(u64::MAX);
+
+        let mut size = Self::max_size(size);
+        while size > 1
+            && (size as u64 > world
+                || ((size * tile_size + 2 * buffer) as f32 * pixel_ratio) > MAX_FRAME_PX)
+        {
+            size /= 2;
+        }
+
+        let x = x / size * size;
+        let y = y / size * size;
+
+        // No gutter past the poles (the camera would be constrained and shift
+        // the frame) or when the block already spans the full world width.
+        let horizontal = if size > 1 && (size as u64) < world {
+            buffer
+        } else {
+            0
+        };
+        let top = if size > 1 && y > 0 { buffer } else { 0 };
+        let bottom = if size > 1 && ((y + size) as u64) < world {
+            buffer
+        } else {
+            0
+        };
+
+        Self {
+            z,
+            x,
+            y,
+            size,
+            gutter: [top, horizontal, bottom, horizontal],
+        }
+    }
+
+    /// Tiles per edge
+    pub fn size(&self) -> u32 {
+        self.size
+    }
+
+    /// Column and row of the top-left tile
+    pub fn origin(&self) -> (u32, u32) {
+        (self.x, self.y)
+    }
+
+    /// Coordinates of every tile in the block, row by row
+    pub fn tiles(&self) -> impl Iterator<Item = (u32, u32)> + '_ {
+        (self.y..self.y + self.size)
+            .flat_map(move |y| (self.x..self.x + self.size).map(move |x| (x, y)))
+    }
+
+    /// Options for rendering the whole block, gutter included, as one frame
+    pub fn render_options(&self, tile_size: u32, pixel_ratio: f32) -> RenderOptions {
+        let [top, right, bottom, left] = self.gutter;
+        let width = self.size * tile_size + left + right;
+        let height = self.size * tile_size + top + bottom;
+
+        // Frame center in fractional tile coordinates
+        let ts = tile_size as f64;
+        let cx = self.x as f64 + self.size as f64 / 2.0 + (right as f64 - left as f64) / (2.0 * ts);
+        let cy = self.y as f64 + self.size as f64 / 2.0 + (bottom as f64 - top as f64) / (2.0 * ts);
+
+        let n = 2_f64.powi(self.z as i32);
+        let lon = cx / n * 360.0 - 180.0;
+        let lat = ((1.0 - 2.0 * cy / n) * std::f64::consts::PI)
+            .sinh()
+            .atan()
+            .to_degrees();
+
+        RenderOptions {
+            size: Size::new(width, height),
+            pixel_ratio,
+            camera: CameraOptions::new(lat, lon, self.z as f64),
+            mode: MapMode::Static,
+            timeout: None,
+        }
+    }
+
+    /// Cut a rendered frame into per-tile images, dropping the gutter
+    pub fn slice(
+        &self,
+        frame: &RenderedImage,
+        tile_size: u32,
+        pixel_ratio: f32,
+    ) -> Result<Vec<((u32, u32), RenderedImage)>> {
+        let px = |css: u32| (css as f32 * pixel_ratio).round() as u32;
+        let [top, _, _, left] = self.gutter;
+        let tile_px = px(tile_size);
+
+        self.tiles()
+            .map(|(x, y)| {
+                let col = x - self.x;
+                let row = y - self.y;
+                let image = frame.crop(
+                    px(left + col * tile_size),
+                    px(top + row * tile_size),
+                    tile_px,
+                    tile_px,
+                )?;
+                Ok(((x, y), image))
+            })
+            .collect()
+    }
+}
+
+fn prev_power_of_two(n: u32) -> u32 {
+    1 << (31 - n.leading_zeros())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_metatile_origin() {
+        let meta = Metatile::containing(10, 13, 6, 4, 0, 512, 1.0);
+        assert_eq!(meta.size(), 4);
+        assert_eq!((meta.x, meta.y), (12, 4));
+        assert_eq!(meta.tiles().count(), 16);
+        assert_eq!(meta.tiles().next(), Some((12, 4)));
+    }
+
+    #[test]
+    fn test_metatile_size_normalization() {
+        assert_eq!(Metatile::containing(10, 0, 0, 3, 0, 512, 1.0).size(), 2);
+        assert_eq!(Metatile::containing(10, 0, 0, 64, 0, 512, 1.0).size(), 8);
+        assert_eq!(Metatile::containing(10, 0, 0, 0, 0, 512, 1.0).size(), 1);
+        // Clamped to the world at low zoom
+        assert_eq!(Metatile::containing(1, 1, 1, 8, 0, 512, 1.0).size(), 2);
+        assert_eq!(Metatile::containing(0, 0, 0, 8, 0, 512, 1.0).size(), 1);
+        // Clamped to the frame limit at high pixel ratios
+        assert_eq!(Metatile::containing(10, 0, 0, 8, 64, 512, 3.0).size(), 4);
+    }
+
+    #[test]
+    fn test_metatile_gutter() {
+        // Interior block gets a gutter on every side
+        let meta = Metatile::containing(10, 100, 100, 2, 32, 512, 1.0);
+        assert_eq!(meta.gutter, [32, 32, 32, 32]);
+
+        // No gutter past the poles
+        let north = Metatile::containing(10, 100, 0, 2, 32, 512, 1.0);
+        assert_eq!(north.gutter, [0, 32, 32, 32]);
+        let south = Metatile::containing(10, 100, 1023, 2, 32, 512, 1.0);
+        assert_eq!(south.gutter, [32, 32, 0, 32]);
+
+        // Whole world in one block
+        let world = Metatile::containing(1, 0, 0, 2, 32, 512, 1.0);
+        assert_eq!(world.gutter, [0, 0, 0, 0]);
+    }
+
+    #[test]
+    fn test_metatile_render_options() {
+        let meta = Metatile::containing(2, 0, 0, 2, 16, 512, 2.0);
+        let options = meta.render_options(512, 2.0);
+        assert_eq!(options.size.width, 1024 + 32);
+        assert_eq!(options.size.height, 1024 + 16);
+        assert_eq!(options.mode, MapMode::Static);
+
+        // Centered on the shared corner of the four tiles, shifted by half
+        // the bottom-only vertical gutter
+        let corner = RenderOptions::for_tile(1, 0, 0, 512, 1.0);
+        assert!((options.camera.longitude - -90.0).abs() < 1e-9);
+        assert!(options.camera.latitude < corner.camera.latitude);
+    }
+
+    #[test]
+    fn test_metatile_slice() {
+        let meta = Metatile::containing(10, 5, 5, 2, 4, 8, 2.0);
+        let options = meta.render_options(8, 2.0);
+        let (w, h) = (options.size.width * 2, options.size.height * 2);
+
+        // Encode the tile column and row into each pixel
+        let mut data = Vec::with_capacity((w * h * 4) as usize);
+        for py in 0..h {
+            for px in 0..w {
+                let col = px.saturating_sub(8) / 16;
+                let row = py.saturating_sub(8) / 16;
+                data.extend_from_slice(&[col as u8, row as u8, 0, 255]);
+            }
+        }
+        let frame = RenderedImage::from_rgba(w, h, data);
+
+        let tiles = meta.slice(&frame, 8, 2.0).unwrap();
+        assert_eq!(tiles.len(), 4);
+        for ((x, y), tile) in tiles {
+            assert_eq!((tile.width(), tile.height()), (16, 16));
+            let expected = [(x - 4) as u8, (y - 4) as u8, 0, 255];
+            assert!(tile.data().chunks(4).all(|p| p == expected));
+        }
+    }
+}
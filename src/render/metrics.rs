@@ -0,0 +1,143 @@
+//! OpenTelemetry instruments for the render path
+//!
+//! Durations are recorded in seconds. Per-render instruments carry the render
+//! mode, pixel ratio, priority, style hash and render device, so slow styles,
+//! sources and devices can be told apart and queue waits are broken down by
+//! priority class. The style hash matches the `render.style` field of the
+//! `render` tracing span.
+
+use std::sync::OnceLock;
+use std::time::Duration;
+
+use opentelemetry::metrics::{Counter, Histogram};
+use opentelemetry::KeyValue;
+
+use super::native::RenderStats;
+
+pub struct RenderMetrics {
+    /// Rendered tile cache lookups, by result
+    pub cache_lookups: Counter<u64>,
+    /// Tiles served from the encoding of an earlier tile of the same colour
+    pub uniform_tiles: Counter<u64>,
+    /// Renders turned away by admission control, by priority and reason
+    pub shed_renders: Counter<u64>,
+    queue_duration: Histogram<f64>,
+    style_parse_duration: Histogram<f64>,
+    render_duration: Histogram<f64>,
+    resource_wait_duration: Histogram<f64>,
+    layout_draw_duration: Histogram<f64>,
+    readback_duration: Histogram<f64>,
+    resource_requests: Counter<u64>,
+    tile_requests: Counter<u64>,
+    failed_requests: Counter<u64>,
+    resource_bytes: Counter<u64>,
+}
+
+pub fn metrics() -> &'static RenderMetrics {
+    static METRICS: OnceLock<RenderMetrics> = OnceLock::new();
+    METRICS.get_or_init(|| {
+        let meter = opentelemetry::global::meter("tileserver-rs");
+        let seconds = |name: &'static str, description: &'static str| {
+            meter
+                .f64_histogram(name)
+                .with_description(description)
+                .with_unit("s")
+                .build()
+        };
+        let counter = |name: &'static str, description: &'static str, unit: &'static str| {
+            meter
+                .u64_counter(name)
+                .with_description(description)
+                .with_unit(unit)
+                .build()
+        };
+
+        RenderMetrics {
+            cache_lookups: counter(
+                "render.cache.lookups",
+                "Rendered tile cache lookups by result (memory, disk, miss)",
+                "lookups",
+            ),
+            uniform_tiles: counter(
+                "render.uniform_tiles",
+                "Single-colour tiles that reused an earlier encoding",
+                "tiles",
+            ),
+            shed_renders: counter(
+                "render.shed",
+                "Renders rejected with 503 because their queue was full or they would miss their deadline",
+                "renders",
+            ),
+            queue_duration: seconds(
+                "render.queue.duration",
+                "Time render jobs waited for a render thread",
+            ),
+            style_parse_duration: seconds(
+                "render.style_parse.duration",
+                "Style parsing before a render, when the map had another style loaded",
+            ),
+            render_duration: seconds(
+                "render.duration",
+                "Native render time, from start until the frame was drawn",
+            ),
+            resource_wait_duration: seconds(
+                "render.resource_wait.duration",
+                "Part of the render time with resource requests outstanding",
+            ),
+            layout_draw_duration: seconds(
+                "render.layout_draw.duration",
+                "Part of the render time spent on layout and drawing",
+            ),
+            readback_duration: seconds(
+                "render.readback.duration",
+                "Reading rendered frames back into memory",
+            ),
+            resource_requests: counter(
+                "render.resource.requests",
+                "Resources (tiles, glyphs, sprites, ...) requested by renders",
+                "requests",
+            ),
+            tile_requests: counter(
+                "render.resource.tile_requests",
+                "Tiles requested by renders",
+                "requests",
+            ),
+            failed_requests: counter(
+                "render.resource.failures",
+                "Resource requests answered with an error",
+                "requests",
+            ),
+            resource_bytes: counter(
+                "render.resource.size",
+                "Bytes of resources received by renders",
+                "By",
+            ),
+        }
+    })
+}
+
+impl RenderMetrics {
+    /// Record a completed render
+    pub fn record(&self, queued: Duration, stats: &RenderStats, attributes: &[KeyValue]) {
+        self.queue_duration.record(queued.as_secs_f64(), attributes);
+        if !stats.style_parse.is_zero() {
+            self.style_parse_duration
+                .record(stats.style_parse.as_secs_f64(), attributes);
+        }
+        self.render_duration
+            .record(stats.render.as_secs_f64(), attributes);
+        self.resource_wait_duration
+            .record(stats.resource_wait.as_secs_f64(), attributes);
+        self.layout_draw_duration
+            .record(stats.layout_and_draw().as_secs_f64(), attributes);
+        self.readback_duration
+            .record(stats.readback.as_secs_f64(), attributes);
+        self.resource_requests
+            .add(stats.resource_requests.into(), attributes);
+        self.tile_requests
+            .add(stats.tile_requests.into(), attributes);
+        self.failed_requests
+            .add(stats.failed_requests.into(), attributes);
+        self.resource_bytes.add(stats.resource_bytes, attributes);
+    }
+}
@@ -1,8 +1,22 @@
+mod cache;
+mod coalesce;
+mod loader;
+mod metatile;
+mod metrics;
 mod native;
 pub mod overlay;
+mod palette;
+mod pixels;
 mod pool;
+mod process;
 mod renderer;
 mod types;
+mod uniform;
+mod variant;
 
+pub use cache::RenderCacheStats;
+pub use loader::ResourceLoader;
+pub use pool::{PoolConfig, Priority};
+pub use process::run_worker;
 pub use renderer::Renderer;
-pub use types::{ImageFormat, RenderOptions, StaticQueryParams, StaticType};
+pub use types::{ImageFormat, RenderOptions, RenderStyle, StaticQueryParams, StaticType};
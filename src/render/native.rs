@@ -3,19 +3,42 @@
 //! This module provides safe Rust wrappers around the MapLibre Native C API.
 //! It is designed for server-side rendering of map tiles and static images.
 
-use std::ffi::{CStr, CString};
+use std::ffi::{c_void, CStr, CString};
+use std::panic::{catch_unwind, AssertUnwindSafe};
+use std::path::Path;
 use std::ptr;
-use std::sync::Once;
+use std::sync::{Arc, Once};
+use std::time::Duration;
+
+use bytes::Bytes;
+use serde::{Deserialize, Serialize};
 
 use maplibre_native_sys::{
-    mln_cleanup, mln_get_last_error, mln_headless_frontend_create, mln_headless_frontend_destroy,
-    mln_headless_frontend_set_size, mln_image_free, mln_init, mln_map_create,
-    mln_map_create_with_loader, mln_map_destroy, mln_map_is_fully_loaded, mln_map_load_style,
-    mln_map_render_still, mln_map_set_camera, mln_map_set_size, MLNCameraOptions, MLNErrorCode,
-    MLNHeadlessFrontend, MLNImageData, MLNMap, MLNMapMode, MLNRenderOptions, MLNResourceCallback,
-    MLNSize,
+    mln_buffer_pool_get_stats, mln_buffer_pool_set_limit, mln_cleanup, mln_get_last_error,
+    mln_headless_frontend_create, mln_headless_frontend_destroy, mln_headless_frontend_set_size,
+    mln_image_free, mln_init, mln_map_add_layer, mln_map_add_source, mln_map_cancel,
+    mln_map_create, mln_map_create_with_loader, mln_map_destroy, mln_map_get_render_stats,
+    mln_map_get_style_hash, mln_map_is_fully_loaded, mln_map_load_style,
+    mln_map_load_style_with_hash, mln_map_remove_layer, mln_map_remove_source,
+    mln_map_render_pipelined, mln_map_render_still, mln_map_render_still_async, mln_map_set_camera,
+    mln_map_set_layer_filter, mln_map_set_layer_property, mln_map_set_layer_visibility,
+    mln_map_set_size, mln_map_set_source_url, mln_render_device_count, mln_resource_respond,
+    mln_run_loop_run_once, mln_run_loop_wait, mln_run_loop_wake, mln_run_loop_waker_create,
+    mln_run_loop_waker_destroy, mln_set_render_device, mln_shader_cache_get_stats,
+    mln_shader_cache_set_dir, mln_shared_resources_get_stats, mln_shared_resources_set_limit,
+    mln_tile_cache_get_stats, mln_tile_cache_set_limit, MLNBufferPoolStats, MLNCameraOptions,
+    MLNErrorCode, MLNHeadlessFrontend, MLNImageData, MLNMap, MLNMapMode, MLNRenderOptions,
+    MLNRenderStats, MLNResourceHandle, MLNResourceRequest, MLNResourceResponse, MLNRunLoopWaker,
+    MLNShaderCacheStats, MLNSharedResourceStats, MLNSize,
 };
 
+#[cfg(test)]
+use maplibre_native_sys::mln_map_load_style_url;
+
+use super::process::FrameSlot;
+use super::types::EncodeOptions;
+use super::variant::StyleEdit;
+use crate::config::{PngCompression, PngFilter};
 use crate::error::{Result, TileServerError};
 
 static INIT: Once = Once::new();
@@ -53,6 +76,25 @@ pub fn cleanup() {
     }
 }
 
+/// Number of devices maps can be rendered on
+pub fn render_device_count() -> u32 {
+    unsafe { mln_render_device_count() }
+}
+
+/// Render on `device` from the next map on. All maps of a process share one
+/// device, so this fails while maps exist on another one.
+pub fn set_render_device(device: u32) -> Result<()> {
+    let code = unsafe { mln_set_render_device(device) };
+    if code != MLNErrorCode::MLN_OK {
+        return Err(TileServerError::RenderError(
+            get_last_error().unwrap_or_else(|| {
+                format!("Failed to select render device {}: {:?}", device, code)
+            }),
+        ));
+    }
+    Ok(())
+}
+
 /// Get the last error message from MapLibre Native.
 fn get_last_error() -> Option<String> {
     unsafe {
@@ -66,7 +108,7 @@ fn get_last_error() -> Option<String> {
 }
 
 /// Size of a render target
-#[derive(Debug, Clone, Copy, Default)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq, Serialize, Deserialize)]
 pub struct Size {
     pub width: u32,
     pub height: u32,
@@ -97,7 +139,7 @@ impl From<MLNSize> for Size {
 }
 
 /// Camera options for rendering
-#[derive(Debug, Clone, Copy, Default)]
+#[derive(Debug, Clone, Copy, Default, Serialize, Deserialize)]
 pub struct CameraOptions {
     pub latitude: f64,
     pub longitude: f64,
@@ -153,7 +195,7 @@ impl From<MLNCameraOptions> for CameraOptions {
 }
 
 /// Map rendering mode
-#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default, Serialize, Deserialize)]
 pub enum MapMode {
     /// Static mode for rendering complete images
     #[default]
@@ -171,9 +213,536 @@ impl From<MapMode> for MLNMapMode {
     }
 }
 
+/// Kind of resource requested by a map
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+pub enum ResourceKind {
+    Unknown,
+    Style,
+    Source,
+    Tile,
+    Glyphs,
+    SpriteImage,
+    SpriteJson,
+    Image,
+}
+
+impl From<u8> for ResourceKind {
+    fn from(kind: u8) -> Self {
+        match kind {
+            1 => ResourceKind::Style,
+            2 => ResourceKind::Source,
+            3 => ResourceKind::Tile,
+            4 => ResourceKind::Glyphs,
+            5 => ResourceKind::SpriteImage,
+            6 => ResourceKind::SpriteJson,
+            7 => ResourceKind::Image,
+            _ => ResourceKind::Unknown,
+        }
+    }
+}
+
+/// Starts a deferred resource load; must eventually complete the responder
+pub type DeferredLoad = Box<dyn FnOnce(ResourceResponder) + Send>;
+
+/// Result of a resource request
+pub enum ResourceResponse {
+    /// Uncompressed resource contents
+    Data(Bytes),
+    /// The resource does not exist
+    NotFound,
+    /// The resource could not be loaded
+    Error(String),
+    /// Not handled here, let MapLibre fetch it with its default file source
+    PassThrough,
+    /// Answered later: the closure is called with a responder that can be
+    /// completed from any thread, so the map thread is not blocked meanwhile
+    Deferred(DeferredLoad),
+}
+
+impl std::fmt::Debug for ResourceResponse {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Self::Data(data) => f.debug_tuple("Data").field(&data.len()).finish(),
+            Self::NotFound => f.write_str("NotFound"),
+            Self::Error(message) => f.debug_tuple("Error").field(message).finish(),
+            Self::PassThrough => f.write_str("PassThrough"),
+            Self::Deferred(_) => f.write_str("Deferred"),
+        }
+    }
+}
+
+/// Serves resource requests issued by a map in-process.
+///
+/// Called synchronously on the thread that owns the map, while it loads a
+/// style or renders. Anything slower than a lookup should be
+/// [`ResourceResponse::Deferred`] so the thread can keep rendering.
+pub trait ResourceHandler: Send + Sync {
+    fn handle(&self, url: &str, kind: ResourceKind) -> ResourceResponse;
+}
+
+enum ResponderTarget {
+    Native(*mut MLNResourceHandle),
+    Callback(Box<dyn FnOnce(ResourceResponse) + Send>),
+    #[cfg(test)]
+    Channel(tokio::sync::oneshot::Sender<ResourceResponse>),
+}
+
+/// Completes a deferred resource request, from any thread.
+/// Dropping it without responding fails the request.
+pub struct ResourceResponder {
+    target: Option<ResponderTarget>,
+}
+
+// SAFETY: the native handle may be answered from any thread
+unsafe impl Send for ResourceResponder {}
+
+impl ResourceResponder {
+    /// Responder that delivers into a channel instead of a native map
+    #[cfg(test)]
+    pub fn channel() -> (Self, tokio::sync::oneshot::Receiver<ResourceResponse>) {
+        let (tx, rx) = tokio::sync::oneshot::channel();
+        let responder = Self {
+            target: Some(ResponderTarget::Channel(tx)),
+        };
+        (responder, rx)
+    }
+
+    /// Responder that hands the response to `callback`, e.g. to forward it
+    /// to another process
+    pub fn from_fn(callback: impl FnOnce(ResourceResponse) + Send + 'static) -> Self {
+        Self {
+            target: Some(ResponderTarget::Callback(Box::new(callback))),
+        }
+    }
+
+    pub fn respond(mut self, response: ResourceResponse) {
+        if let Some(target) = self.target.take() {
+            Self::deliver(target, response);
+        }
+    }
+
+    fn deliver(target: ResponderTarget, response: ResourceResponse) {
+        match target {
+            ResponderTarget::Native(handle) => {
+                let mut native = MLNResourceResponse::default();
+                fill_response(&mut native, response);
+                unsafe { mln_resource_respond(handle, &native) };
+            }
+            ResponderTarget::Callback(callback) => callback(response),
+            #[cfg(test)]
+            ResponderTarget::Channel(tx) => {
+                let _ = tx.send(response);
+            }
+        }
+    }
+}
+
+impl Drop for ResourceResponder {
+    fn drop(&mut self) {
+        if let Some(target) = self.target.take() {
+            Self::deliver(
+                target,
+                ResourceResponse::Error("Resource request dropped".to_string()),
+            );
+        }
+    }
+}
+
+/// Buffers handed to the native side until it calls `release_response`
+struct ResponseBuffers {
+    data: Bytes,
+    error: Option<CString>,
+}
+
+unsafe extern "C" fn release_response(ctx: *mut c_void) {
+    drop(Box::from_raw(ctx as *mut ResponseBuffers));
+}
+
+/// Resource callback passed to the native map; `user_data` is the map's
+/// boxed `Arc<dyn ResourceHandler>`
+unsafe extern "C" fn resource_callback(
+    request: *const MLNResourceRequest,
+    response: *mut MLNResourceResponse,
+    user_data: *mut c_void,
+) {
+    let (Some(request), Some(response)) = (request.as_ref(), response.as_mut()) else {
+        return;
+    };
+    let handler = &*(user_data as *const Arc<dyn ResourceHandler>);
+
+    let url = if request.url.is_null() {
+        String::new()
+    } else {
+        CStr::from_ptr(request.url).to_string_lossy().into_owned()
+    };
+    let kind = ResourceKind::from(request.kind);
+
+    // Never unwind into C++
+    let result =
+        catch_unwind(AssertUnwindSafe(|| handler.handle(&url, kind))).unwrap_or_else(|_| {
+            ResourceResponse::Error(format!("Resource handler panicked for {}", url))
+        });
+
+    match result {
+        ResourceResponse::Deferred(load) if !request.handle.is_null() => {
+            response.deferred = true;
+            let responder = ResourceResponder {
+                target: Some(ResponderTarget::Native(request.handle)),
+            };
+            // A panic drops the responder, which fails the request
+            if catch_unwind(AssertUnwindSafe(|| load(responder))).is_err() {
+                tracing::warn!("Deferred resource load panicked for {}", url);
+            }
+        }
+        result => fill_response(response, result),
+    }
+}
+
+/// Fill a native response; buffers stay alive until the wrapper releases them
+fn fill_response(response: &mut MLNResourceResponse, result: ResourceResponse) {
+    let buffers = match result {
+        ResourceResponse::Data(data) => ResponseBuffers { data, error: None },
+        ResourceResponse::Error(message) => ResponseBuffers {
+            data: Bytes::new(),
+            error: Some(CString::new(message.replace('\0', " ")).unwrap_or_default()),
+        },
+        ResourceResponse::Deferred(_) => ResponseBuffers {
+            data: Bytes::new(),
+            error: CString::new("Resource response cannot be deferred here").ok(),
+        },
+        ResourceResponse::NotFound => {
+            response.not_found = true;
+            return;
+        }
+        ResourceResponse::PassThrough => {
+            response.pass_through = true;
+            return;
+        }
+    };
+
+    let buffers = Box::new(buffers);
+    response.data = buffers.data.as_ptr();
+    response.data_len = buffers.data.len();
+    response.error = buffers
+        .error
+        .as_ref()
+        .map(|e| e.as_ptr())
+        .unwrap_or(ptr::null());
+    response.release = Some(release_response);
+    response.release_ctx = Box::into_raw(buffers) as *mut c_void;
+}
+
+/// Completion of [`NativeMap::render_async`]
+pub type RenderCallback = Box<dyn FnOnce(Result<RenderedImage>)>;
+
+/// Render completion passed to the native map; `user_data` is a boxed `RenderCallback`
+unsafe extern "C" fn render_callback(
+    code: MLNErrorCode,
+    image: *mut MLNImageData,
+    user_data: *mut c_void,
+) {
+    let done = Box::from_raw(user_data as *mut RenderCallback);
+    let result = take_image(code, image);
+
+    // Never unwind into C++
+    if catch_unwind(AssertUnwindSafe(|| done(result))).is_err() {
+        tracing::warn!("Render completion panicked");
+    }
+}
+
+/// Frame completion of [`NativeMap::render_pipelined`], with the frame's
+/// index and stats
+pub type FrameCallback = Box<dyn FnMut(usize, Result<RenderedImage>, RenderStats)>;
+
+/// A pipelined render's callback and how many frames it receives
+struct Frames {
+    count: usize,
+    done: FrameCallback,
+}
+
+/// Frame completion passed to the native map; `user_data` is a boxed `Frames`
+unsafe extern "C" fn frame_callback(
+    index: usize,
+    code: MLNErrorCode,
+    image: *mut MLNImageData,
+    stats: *const MLNRenderStats,
+    user_data: *mut c_void,
+) {
+    let frames = &mut *(user_data as *mut Frames);
+    let result = take_image(code, image);
+    let stats = stats.as_ref().map(|&s| s.into()).unwrap_or_default();
+
+    // Never unwind into C++
+    if catch_unwind(AssertUnwindSafe(|| (frames.done)(index, result, stats))).is_err() {
+        tracing::warn!("Render completion panicked");
+    }
+    // Frames arrive in order, the last one releases the callback
+    if index + 1 == frames.count {
+        drop(Box::from_raw(user_data as *mut Frames));
+    }
+}
+
+/// The result of a finished render, taking over its image
+unsafe fn take_image(code: MLNErrorCode, image: *mut MLNImageData) -> Result<RenderedImage> {
+    if code != MLNErrorCode::MLN_OK || image.is_null() {
+        return Err(render_error(code));
+    }
+    // The wrapper does not free the image after the callback
+    let image = ptr::read(image);
+    let (width, height) = (image.width, image.height);
+    Ok(RenderedImage {
+        pixels: Pixels::Native(NativeImage(image)),
+        width,
+        height,
+    })
+}
+
+/// The error for a render that ended with `code`
+fn render_error(code: MLNErrorCode) -> TileServerError {
+    match code {
+        MLNErrorCode::MLN_ERROR_TIMEOUT => {
+            TileServerError::RenderCancelled("deadline exceeded".to_string())
+        }
+        MLNErrorCode::MLN_ERROR_CANCELLED => {
+            TileServerError::RenderCancelled("request dropped".to_string())
+        }
+        _ => TileServerError::RenderError(
+            get_last_error().unwrap_or_else(|| format!("Render failed: {:?}", code)),
+        ),
+    }
+}
+
+/// Drive the calling thread's RunLoop once without blocking: deliver
+/// resource responses and advance renders started with `render_async`
+pub fn run_loop_once() {
+    unsafe { mln_run_loop_run_once() };
+}
+
+/// Drive the calling thread's RunLoop, blocking until a `render_async`
+/// callback has run, a [`RunLoopWaker`] of the thread is woken, or `timeout`
+/// has passed
+pub fn run_loop_wait(timeout: Duration) {
+    let millis = timeout.as_millis().min(u32::MAX as u128) as u32;
+    unsafe { mln_run_loop_wait(millis) };
+}
+
+/// Ends the [`run_loop_wait`] of the thread that created it, from any thread
+pub struct RunLoopWaker {
+    ptr: *mut MLNRunLoopWaker,
+}
+
+// Safety: the native waker is thread-safe
+unsafe impl Send for RunLoopWaker {}
+unsafe impl Sync for RunLoopWaker {}
+
+impl RunLoopWaker {
+    /// A waker for the calling thread
+    pub fn current() -> Self {
+        Self {
+            ptr: unsafe { mln_run_loop_waker_create() },
+        }
+    }
+
+    /// End the thread's current wait, or else its next one
+    pub fn wake(&self) {
+        if !self.ptr.is_null() {
+            unsafe { mln_run_loop_wake(self.ptr) };
+        }
+    }
+}
+
+impl Drop for RunLoopWaker {
+    fn drop(&mut self) {
+        if !self.ptr.is_null() {
+            unsafe { mln_run_loop_waker_destroy(self.ptr) };
+        }
+    }
+}
+
+/// Set how much memory each render thread keeps in freed readback buffers
+pub fn set_buffer_pool_limit(megabytes: u64) {
+    unsafe { mln_buffer_pool_set_limit(megabytes * 1024 * 1024) };
+}
+
+/// Readback buffer pool counters, summed over all render threads
+pub fn buffer_pool_stats() -> BufferPoolStats {
+    unsafe { mln_buffer_pool_get_stats() }.into()
+}
+
+/// Readback buffer pool counters
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct BufferPoolStats {
+    /// Renders read back into a reused buffer
+    pub hits: u64,
+    /// Renders that allocated a new buffer
+    pub misses: u64,
+    /// Freed buffers kept for reuse
+    pub returned: u64,
+    /// Freed buffers released because the pool was full
+    pub dropped: u64,
+    /// Bytes currently kept for reuse
+    pub pooled_bytes: u64,
+}
+
+impl From<MLNBufferPoolStats> for BufferPoolStats {
+    fn from(s: MLNBufferPoolStats) -> Self {
+        Self {
+            hits: s.hits,
+            misses: s.misses,
+            returned: s.returned,
+            dropped: s.dropped,
+            pooled_bytes: s.pooled_bytes,
+        }
+    }
+}
+
+/// Set how much memory the glyph and sprite cache shared by all maps keeps
+pub fn set_shared_resources_limit(megabytes: u64) {
+    unsafe { mln_shared_resources_set_limit(megabytes * 1024 * 1024) };
+}
+
+/// Shared glyph and sprite cache counters
+pub fn shared_resources_stats() -> SharedResourceStats {
+    unsafe { mln_shared_resources_get_stats() }.into()
+}
+
+/// Set how much memory the source tile cache shared by all maps keeps, and
+/// for how long (zero keeps tiles until they are evicted)
+pub fn set_tile_cache_limit(megabytes: u64, ttl: Duration) {
+    let ttl = ttl.as_secs().min(u32::MAX as u64) as u32;
+    unsafe { mln_tile_cache_set_limit(megabytes * 1024 * 1024, ttl) };
+}
+
+/// Shared source tile cache counters
+pub fn tile_cache_stats() -> SharedResourceStats {
+    unsafe { mln_tile_cache_get_stats() }.into()
+}
+
+/// Counters of a resource cache shared by all maps
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct SharedResourceStats {
+    /// Requests answered from the cache
+    pub hits: u64,
+    /// Requests passed on to the resource loader
+    pub misses: u64,
+    /// Answers evicted or not kept to stay within the limit
+    pub dropped: u64,
+    /// Resources currently cached
+    pub entries: u64,
+    /// Bytes currently cached
+    pub bytes: u64,
+}
+
+impl From<MLNSharedResourceStats> for SharedResourceStats {
+    fn from(s: MLNSharedResourceStats) -> Self {
+        Self {
+            hits: s.hits,
+            misses: s.misses,
+            dropped: s.dropped,
+            entries: s.entries,
+            bytes: s.bytes,
+        }
+    }
+}
+
+/// Keep the binaries of linked shader programs in `dir`, creating it, so new
+/// maps skip compiling them (`None` disables it)
+pub fn set_shader_cache_dir(dir: Option<&Path>) -> Result<()> {
+    let Some(dir) = dir else {
+        unsafe { mln_shader_cache_set_dir(ptr::null()) };
+        return Ok(());
+    };
+
+    std::fs::create_dir_all(dir).map_err(|e| {
+        TileServerError::RenderError(format!(
+            "Failed to create shader cache directory {}: {}",
+            dir.display(),
+            e
+        ))
+    })?;
+    let c_dir = dir
+        .to_str()
+        .and_then(|dir| CString::new(dir).ok())
+        .ok_or_else(|| {
+            TileServerError::RenderError(format!(
+                "Invalid shader cache directory {}",
+                dir.display()
+            ))
+        })?;
+    unsafe { mln_shader_cache_set_dir(c_dir.as_ptr()) };
+    Ok(())
+}
+
+/// Shader program binary cache counters
+pub fn shader_cache_stats() -> ShaderCacheStats {
+    unsafe { mln_shader_cache_get_stats() }.into()
+}
+
+/// Shader program binary cache counters
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct ShaderCacheStats {
+    /// Programs loaded from a cached binary
+    pub hits: u64,
+    /// Programs linked from source, and their binary kept
+    pub misses: u64,
+    /// Cached binaries the driver didn't accept
+    pub rejected: u64,
+}
+
+impl From<MLNShaderCacheStats> for ShaderCacheStats {
+    fn from(s: MLNShaderCacheStats) -> Self {
+        Self {
+            hits: s.hits,
+            misses: s.misses,
+            rejected: s.rejected,
+        }
+    }
+}
+
+/// Pixel buffer handed over by `mln_map_render_still`, released on drop
+struct NativeImage(MLNImageData);
+
+// SAFETY: the buffer is owned by this value alone and is not tied to the
+// thread or map that rendered it.
+unsafe impl Send for NativeImage {}
+
+impl NativeImage {
+    fn as_slice(&self) -> &[u8] {
+        if self.0.data.is_null() {
+            return &[];
+        }
+        unsafe { std::slice::from_raw_parts(self.0.data, self.0.data_len) }
+    }
+
+    fn as_mut_slice(&mut self) -> &mut [u8] {
+        if self.0.data.is_null() {
+            return &mut [];
+        }
+        unsafe { std::slice::from_raw_parts_mut(self.0.data, self.0.data_len) }
+    }
+}
+
+impl Drop for NativeImage {
+    fn drop(&mut self) {
+        unsafe {
+            mln_image_free(&mut self.0);
+        }
+    }
+}
+
+enum Pixels {
+    Native(NativeImage),
+    Frame(FrameSlot),
+    Owned(Vec<u8>),
+}
+
 /// Rendered image data
+///
+/// Images from the renderer borrow MapLibre's readback buffer directly, and
+/// images from a render worker process the shared memory it wrote them
+/// into, so pixels are not copied between rendering and encoding.
 pub struct RenderedImage {
-    data: Vec<u8>,
+    pixels: Pixels,
     width: u32,
     height: u32,
 }
@@ -182,7 +751,16 @@ impl RenderedImage {
     /// Create a new RenderedImage from raw RGBA data
     pub fn from_rgba(width: u32, height: u32, data: Vec<u8>) -> Self {
         Self {
-            data,
+            pixels: Pixels::Owned(data),
+            width,
+            height,
+        }
+    }
+
+    /// An image a render worker process wrote into shared memory
+    pub(super) fn from_frame(width: u32, height: u32, frame: FrameSlot) -> Self {
+        Self {
+            pixels: Pixels::Frame(frame),
             width,
             height,
         }
@@ -190,12 +768,37 @@ impl RenderedImage {
 
     /// Get the raw RGBA pixel data (premultiplied alpha)
     pub fn data(&self) -> &[u8] {
-        &self.data
+        match &self.pixels {
+            Pixels::Native(image) => image.as_slice(),
+            Pixels::Frame(frame) => frame.as_slice(),
+            Pixels::Owned(data) => data,
+        }
+    }
+
+    /// Get mutable access to the raw RGBA pixel data
+    pub fn data_mut(&mut self) -> &mut [u8] {
+        match &mut self.pixels {
+            Pixels::Native(image) => image.as_mut_slice(),
+            Pixels::Frame(frame) => frame.as_mut_slice(),
+            Pixels::Owned(data) => data,
+        }
     }
 
-    /// Take ownership of the raw data
+    /// Take ownership of the raw data (copies if the buffer is renderer-owned
+    /// or shared)
+    #[allow(dead_code)]
     pub fn take_data(&mut self) -> Vec<u8> {
-        std::mem::take(&mut self.data)
+        match std::mem::replace(&mut self.pixels, Pixels::Owned(Vec::new())) {
+            Pixels::Native(image) => image.as_slice().to_vec(),
+            Pixels::Frame(frame) => frame.as_slice().to_vec(),
+            Pixels::Owned(data) => data,
+        }
+    }
+
+    /// Whether the pixels still live in the renderer's readback buffer
+    #[allow(dead_code)]
+    pub fn is_native(&self) -> bool {
+        matches!(self.pixels, Pixels::Native(_))
     }
 
     /// Get the image width in pixels
@@ -208,80 +811,144 @@ impl RenderedImage {
         self.height
     }
 
-    /// Convert to PNG format
-    pub fn to_png(&self) -> Result<Vec<u8>> {
-        use image::{ImageBuffer, Rgba};
-        use std::io::Cursor;
+    /// Borrow the pixels as a mutable image for in-place drawing
+    pub fn as_image_mut(&mut self) -> Result<image::ImageBuffer<image::Rgba<u8>, &mut [u8]>> {
+        let (width, height) = (self.width, self.height);
+        image::ImageBuffer::from_raw(width, height, self.data_mut()).ok_or_else(|| {
+            TileServerError::RenderError("Failed to create image buffer".to_string())
+        })
+    }
 
-        // Create image from raw RGBA data
-        let img: ImageBuffer<Rgba<u8>, _> =
-            ImageBuffer::from_raw(self.width, self.height, self.data.clone()).ok_or_else(|| {
-                TileServerError::RenderError("Failed to create image buffer".to_string())
-            })?;
+    /// Copy a rectangular region into a new image
+    pub fn crop(&self, x: u32, y: u32, width: u32, height: u32) -> Result<RenderedImage> {
+        if x + width > self.width || y + height > self.height {
+            return Err(TileServerError::RenderError(format!(
+                "Crop {}x{}+{}+{} outside {}x{} image",
+                width, height, x, y, self.width, self.height
+            )));
+        }
+        self.check_len()?;
+
+        let stride = self.width as usize * 4;
+        let row_len = width as usize * 4;
+        let mut data = Vec::with_capacity(row_len * height as usize);
+        for row in self
+            .data()
+            .chunks_exact(stride)
+            .skip(y as usize)
+            .take(height as usize)
+        {
+            let start = x as usize * 4;
+            data.extend_from_slice(&row[start..start + row_len]);
+        }
 
-        // Encode to PNG using the DynamicImage interface
-        let mut buffer = Cursor::new(Vec::new());
-        image::DynamicImage::ImageRgba8(img)
-            .write_to(&mut buffer, image::ImageFormat::Png)
-            .map_err(|e| TileServerError::RenderError(format!("PNG encoding failed: {}", e)))?;
+        Ok(RenderedImage::from_rgba(width, height, data))
+    }
 
-        Ok(buffer.into_inner())
+    /// The colour of every pixel, if the image is a single colour
+    pub fn uniform_color(&self) -> Option<[u8; 4]> {
+        let len = (self.width as usize) * (self.height as usize) * 4;
+        super::pixels::uniform_color(self.data().get(..len)?)
     }
 
-    /// Convert to JPEG format
-    pub fn to_jpeg(&self, quality: u8) -> Result<Vec<u8>> {
-        use image::{ImageBuffer, Rgb};
+    fn check_len(&self) -> Result<()> {
+        if self.data().len() < (self.width as usize) * (self.height as usize) * 4 {
+            return Err(TileServerError::RenderError(
+                "Failed to create image buffer".to_string(),
+            ));
+        }
+        Ok(())
+    }
 
-        // Convert RGBA to RGB (JPEG doesn't support alpha)
-        let mut rgb_data = Vec::with_capacity((self.width * self.height * 3) as usize);
-        for chunk in self.data.chunks(4) {
-            rgb_data.push(chunk[0]);
-            rgb_data.push(chunk[1]);
-            rgb_data.push(chunk[2]);
+    /// Prepare the pixels for an encoder, in place: opaque frames (and all
+    /// frames when `drop_alpha` is set) are packed to RGB, others converted
+    /// to straight alpha. Alpha is dropped without compositing, which for
+    /// premultiplied pixels is the same as compositing over black.
+    fn encoder_pixels(&mut self, drop_alpha: bool) -> Result<(&[u8], image::ExtendedColorType)> {
+        self.check_len()?;
+
+        let len = (self.width as usize) * (self.height as usize) * 4;
+        let data = &mut self.data_mut()[..len];
+        if drop_alpha || super::pixels::is_opaque(data) {
+            let rgb = super::pixels::strip_alpha(data);
+            Ok((&data[..rgb], image::ExtendedColorType::Rgb8))
+        } else {
+            super::pixels::unpremultiply(data);
+            Ok((data, image::ExtendedColorType::Rgba8))
         }
+    }
 
-        let img: ImageBuffer<Rgb<u8>, _> = ImageBuffer::from_raw(self.width, self.height, rgb_data)
-            .ok_or_else(|| {
-                TileServerError::RenderError("Failed to create image buffer".to_string())
-            })?;
+    /// Encode as PNG, reduced to an 8-bit palette if `options.png_palette`
+    /// is set
+    pub fn into_png(mut self, options: &EncodeOptions) -> Result<Vec<u8>> {
+        use image::codecs::png::{CompressionType, FilterType, PngEncoder};
+        use image::{ExtendedColorType, ImageEncoder};
+
+        let (width, height) = (self.width, self.height);
+        let (data, color) = self.encoder_pixels(false)?;
+
+        if options.png_palette {
+            let channels = if color == ExtendedColorType::Rgba8 {
+                4
+            } else {
+                3
+            };
+            let level = match options.png_compression {
+                PngCompression::Fast => flate2::Compression::fast(),
+                PngCompression::Default => flate2::Compression::default(),
+                PngCompression::Best => flate2::Compression::best(),
+            };
+            let indexed = super::palette::quantize(data, channels);
+            return super::palette::write_png(&indexed, width, height, level);
+        }
+
+        let compression = match options.png_compression {
+            PngCompression::Fast => CompressionType::Fast,
+            PngCompression::Default => CompressionType::Default,
+            PngCompression::Best => CompressionType::Best,
+        };
+        let filter = match options.png_filter {
+            PngFilter::None => FilterType::NoFilter,
+            PngFilter::Sub => FilterType::Sub,
+            PngFilter::Up => FilterType::Up,
+            PngFilter::Avg => FilterType::Avg,
+            PngFilter::Paeth => FilterType::Paeth,
+            PngFilter::Adaptive => FilterType::Adaptive,
+        };
 
-        // Encode to JPEG
         let mut buffer = Vec::new();
-        {
-            let mut encoder =
-                image::codecs::jpeg::JpegEncoder::new_with_quality(&mut buffer, quality);
-            encoder
-                .encode(
-                    img.as_raw(),
-                    self.width,
-                    self.height,
-                    image::ExtendedColorType::Rgb8,
-                )
-                .map_err(|e| {
-                    TileServerError::RenderError(format!("JPEG encoding failed: {}", e))
-                })?;
-        }
+        PngEncoder::new_with_quality(&mut buffer, compression, filter)
+            .write_image(data, width, height, color)
+            .map_err(|e| TileServerError::RenderError(format!("PNG encoding failed: {}", e)))?;
 
         Ok(buffer)
     }
 
-    /// Convert to WebP format
-    pub fn to_webp(&self, _quality: u8) -> Result<Vec<u8>> {
-        use image::{ImageBuffer, Rgba};
-        use std::io::Cursor;
+    /// Encode as JPEG (JPEG doesn't support alpha)
+    pub fn into_jpeg(mut self, quality: u8) -> Result<Vec<u8>> {
+        let (width, height) = (self.width, self.height);
+        let (data, color) = self.encoder_pixels(true)?;
 
-        let img: ImageBuffer<Rgba<u8>, _> =
-            ImageBuffer::from_raw(self.width, self.height, self.data.clone()).ok_or_else(|| {
-                TileServerError::RenderError("Failed to create image buffer".to_string())
-            })?;
+        let mut buffer = Vec::new();
+        image::codecs::jpeg::JpegEncoder::new_with_quality(&mut buffer, quality)
+            .encode(data, width, height, color)
+            .map_err(|e| TileServerError::RenderError(format!("JPEG encoding failed: {}", e)))?;
 
-        // Encode to WebP using DynamicImage interface
-        let mut buffer = Cursor::new(Vec::new());
-        image::DynamicImage::ImageRgba8(img)
-            .write_to(&mut buffer, image::ImageFormat::WebP)
+        Ok(buffer)
+    }
+
+    /// Encode as WebP. The encoder is lossless only, so there is no quality
+    /// setting.
+    pub fn into_webp(mut self) -> Result<Vec<u8>> {
+        let (width, height) = (self.width, self.height);
+        let (data, color) = self.encoder_pixels(false)?;
+
+        let mut buffer = Vec::new();
+        image::codecs::webp::WebPEncoder::new_lossless(&mut buffer)
+            .encode(data, width, height, color)
             .map_err(|e| TileServerError::RenderError(format!("WebP encoding failed: {}", e)))?;
 
-        Ok(buffer.into_inner())
+        Ok(buffer)
     }
 }
 
@@ -339,6 +1006,7 @@ impl Drop for HeadlessFrontend {
 pub struct NativeMap {
     ptr: *mut MLNMap,
     _frontend: HeadlessFrontend, // Keep frontend alive
+    _handler: Option<Box<Arc<dyn ResourceHandler>>>, // Keep resource handler alive
 }
 
 // Safety: Same as HeadlessFrontend
@@ -360,26 +1028,29 @@ impl NativeMap {
         Ok(Self {
             ptr,
             _frontend: frontend,
+            _handler: None,
         })
     }
 
-    /// Create a new map instance with a custom resource loader callback
-    #[allow(dead_code)]
-    pub fn with_resource_loader(
+    /// Create a new map instance that requests all its resources from `handler`
+    pub fn with_resource_handler(
         size: Size,
         pixel_ratio: f32,
         mode: MapMode,
-        callback: MLNResourceCallback,
-        user_data: *mut std::ffi::c_void,
+        handler: Arc<dyn ResourceHandler>,
     ) -> Result<Self> {
         let frontend = HeadlessFrontend::new(size, pixel_ratio)?;
 
+        // Box the fat Arc so the native side gets a thin, stable pointer
+        let handler = Box::new(handler);
+        let user_data = &*handler as *const Arc<dyn ResourceHandler> as *mut c_void;
+
         let ptr = unsafe {
             mln_map_create_with_loader(
                 frontend.as_ptr(),
                 pixel_ratio,
                 mode.into(),
-                callback,
+                Some(resource_callback),
                 user_data,
             )
         };
@@ -393,10 +1064,12 @@ impl NativeMap {
         Ok(Self {
             ptr,
             _frontend: frontend,
+            _handler: Some(handler),
         })
     }
 
     /// Load a style JSON
+    #[allow(dead_code)]
     pub fn load_style(&mut self, style_json: &str) -> Result<()> {
         let c_style = CString::new(style_json).map_err(|_| {
             TileServerError::RenderError("Style JSON contains null bytes".to_string())
@@ -413,6 +1086,128 @@ impl NativeMap {
         Ok(())
     }
 
+    /// Load a style JSON identified by `hash` (see [`hash_style`]).
+    /// Does nothing if the same style is already loaded.
+    pub fn load_style_with_hash(&mut self, style_json: &str, hash: u64) -> Result<()> {
+        if hash != 0 && self.style_hash() == hash {
+            return Ok(());
+        }
+
+        let c_style = CString::new(style_json).map_err(|_| {
+            TileServerError::RenderError("Style JSON contains null bytes".to_string())
+        })?;
+
+        let code = unsafe { mln_map_load_style_with_hash(self.ptr, c_style.as_ptr(), hash) };
+
+        if code != MLNErrorCode::MLN_OK {
+            return Err(TileServerError::RenderError(
+                get_last_error().unwrap_or_else(|| format!("Failed to load style: {:?}", code)),
+            ));
+        }
+
+        Ok(())
+    }
+
+    /// Load a style from a URL
+    #[cfg(test)]
+    pub fn load_style_url(&mut self, url: &str) -> Result<()> {
+        let c_url = CString::new(url).map_err(|_| {
+            TileServerError::RenderError("Style URL contains null bytes".to_string())
+        })?;
+
+        let code = unsafe { mln_map_load_style_url(self.ptr, c_url.as_ptr()) };
+
+        if code != MLNErrorCode::MLN_OK {
+            return Err(TileServerError::RenderError(
+                get_last_error().unwrap_or_else(|| format!("Failed to load style: {:?}", code)),
+            ));
+        }
+
+        Ok(())
+    }
+
+    /// Edit the loaded style in place, keeping its parsed layers and loaded
+    /// tiles. The style hash is unchanged, so the edit must be undone before
+    /// the map renders the unedited style again.
+    pub fn edit_style(&mut self, edit: &StyleEdit) -> Result<()> {
+        let c_string = |value: &str| {
+            CString::new(value).map_err(|_| {
+                TileServerError::RenderError("Style edit contains null bytes".to_string())
+            })
+        };
+
+        let code = match edit {
+            StyleEdit::Visibility { layer, visible } => {
+                let layer = c_string(layer)?;
+                unsafe { mln_map_set_layer_visibility(self.ptr, layer.as_ptr(), *visible) }
+            }
+            StyleEdit::Property { layer, name, value } => {
+                let layer = c_string(layer)?;
+                let name = c_string(name)?;
+                let value = c_string(&value.to_string())?;
+                unsafe {
+                    mln_map_set_layer_property(
+                        self.ptr,
+                        layer.as_ptr(),
+                        name.as_ptr(),
+                        value.as_ptr(),
+                    )
+                }
+            }
+            StyleEdit::Filter { layer, filter } => {
+                let layer = c_string(layer)?;
+                let filter = c_string(&filter.to_string())?;
+                unsafe { mln_map_set_layer_filter(self.ptr, layer.as_ptr(), filter.as_ptr()) }
+            }
+            StyleEdit::SourceUrl { source, url } => {
+                let source = c_string(source)?;
+                let url = c_string(url)?;
+                unsafe { mln_map_set_source_url(self.ptr, source.as_ptr(), url.as_ptr()) }
+            }
+            StyleEdit::AddSource { source, definition } => {
+                let source = c_string(source)?;
+                let definition = c_string(&definition.to_string())?;
+                unsafe { mln_map_add_source(self.ptr, source.as_ptr(), definition.as_ptr()) }
+            }
+            StyleEdit::RemoveSource { source } => {
+                let source = c_string(source)?;
+                unsafe { mln_map_remove_source(self.ptr, source.as_ptr()) }
+            }
+            StyleEdit::AddLayer { layer, before } => {
+                let layer = c_string(&layer.to_string())?;
+                let before = before.as_deref().map(c_string).transpose()?;
+                let before = before
+                    .as_ref()
+                    .map_or(ptr::null(), |before| before.as_ptr());
+                unsafe { mln_map_add_layer(self.ptr, layer.as_ptr(), before) }
+            }
+            StyleEdit::RemoveLayer { layer } => {
+                let layer = c_string(layer)?;
+                unsafe { mln_map_remove_layer(self.ptr, layer.as_ptr()) }
+            }
+        };
+
+        if code != MLNErrorCode::MLN_OK {
+            return Err(TileServerError::RenderError(
+                get_last_error().unwrap_or_else(|| format!("Failed to edit style: {:?}", code)),
+            ));
+        }
+
+        Ok(())
+    }
+
+    /// Hash of the currently loaded style, or 0 if none is loaded
+    pub fn style_hash(&self) -> u64 {
+        unsafe { mln_map_get_style_hash(self.ptr) }
+    }
+
+    /// Stats of the most recent render, all zero before the first one.
+    ///
+    /// For an async render these are final once its callback has run.
+    pub fn render_stats(&self) -> RenderStats {
+        unsafe { mln_map_get_render_stats(self.ptr) }.into()
+    }
+
     /// Check if the map is fully loaded
     #[allow(dead_code)]
     pub fn is_fully_loaded(&self) -> bool {
@@ -454,37 +1249,97 @@ impl NativeMap {
         };
 
         if code != MLNErrorCode::MLN_OK {
-            return Err(TileServerError::RenderError(
-                get_last_error().unwrap_or_else(|| format!("Render failed: {:?}", code)),
-            ));
+            return Err(render_error(code));
         }
 
-        // Save dimensions before freeing (mln_image_free zeros them)
         let width = image_data.width;
         let height = image_data.height;
 
-        // Copy the data and free the native buffer
-        let data = if !image_data.data.is_null() && image_data.data_len > 0 {
-            let slice = unsafe { std::slice::from_raw_parts(image_data.data, image_data.data_len) };
-            let data = slice.to_vec();
-
-            unsafe {
-                mln_image_free(&mut image_data);
-            }
-
-            data
-        } else {
-            Vec::new()
-        };
-
+        // Keep the native buffer; it is released when the image is dropped
         Ok(RenderedImage {
-            data,
+            pixels: Pixels::Native(NativeImage(image_data)),
             width,
             height,
         })
     }
 
+    /// Start rendering without blocking.
+    ///
+    /// `done` runs on this thread from a later [`run_loop_once`] call (or
+    /// immediately if the render cannot start). The map renders one image at
+    /// a time and must stay alive until `done` has run.
+    pub fn render_async(&mut self, options: Option<RenderOptions>, done: RenderCallback) {
+        let c_options = options.map(|o| o.into_native());
+        let user_data = Box::into_raw(Box::new(done)) as *mut c_void;
+
+        unsafe {
+            mln_map_render_still_async(
+                self.ptr,
+                c_options
+                    .as_ref()
+                    .map(|o| o as *const MLNRenderOptions)
+                    .unwrap_or(ptr::null()),
+                Some(render_callback),
+                user_data,
+            );
+        }
+    }
+
+    /// Start rendering several images one after another without blocking,
+    /// reading each one back while the next is drawn.
+    ///
+    /// `done` runs on this thread once per image, in order, from later
+    /// [`run_loop_once`] calls (or immediately for images that cannot
+    /// start). Each image succeeds or fails on its own, and each
+    /// `options.timeout` counts from this call. The map must stay alive
+    /// until the last image is done.
+    pub fn render_pipelined(&mut self, options: &[RenderOptions], done: FrameCallback) {
+        if options.is_empty() {
+            return;
+        }
+        let c_options: Vec<MLNRenderOptions> =
+            options.iter().map(|o| o.clone().into_native()).collect();
+        let frames = Box::into_raw(Box::new(Frames {
+            count: options.len(),
+            done,
+        }));
+
+        let code = unsafe {
+            mln_map_render_pipelined(
+                self.ptr,
+                c_options.as_ptr(),
+                c_options.len(),
+                Some(frame_callback),
+                frames as *mut c_void,
+            )
+        };
+
+        // Nothing started, so no frame has been reported
+        if code != MLNErrorCode::MLN_OK {
+            let mut frames = unsafe { Box::from_raw(frames) };
+            for index in 0..frames.count {
+                (frames.done)(index, Err(render_error(code)), RenderStats::default());
+            }
+        }
+    }
+
+    /// Abort the render in flight, whose callback then fails with
+    /// [`TileServerError::RenderCancelled`]. Resource loads it waits for are
+    /// failed; layout and drawing already under way finish first. The map
+    /// stays usable but reloads its style before the next render. Does
+    /// nothing if no render is in flight.
+    pub fn cancel(&mut self) -> Result<()> {
+        let code = unsafe { mln_map_cancel(self.ptr) };
+        if code != MLNErrorCode::MLN_OK {
+            return Err(TileServerError::RenderError(
+                get_last_error().unwrap_or_else(|| format!("Cancel failed: {:?}", code)),
+            ));
+        }
+        Ok(())
+    }
+
     /// Render a tile at the given coordinates
+    #[allow(dead_code)]
     pub fn render_tile(
         &mut self,
         z: u8,
@@ -493,42 +1348,97 @@ impl NativeMap {
         tile_size: u32,
         pixel_ratio: f32,
     ) -> Result<RenderedImage> {
-        // Calculate center of tile
-        let n = 2_f64.powi(z as i32);
-        let lon = (x as f64 + 0.5) / n * 360.0 - 180.0;
-        let lat_rad = ((1.0 - 2.0 * (y as f64 + 0.5) / n) * std::f64::consts::PI)
-            .sinh()
-            .atan();
-        let lat = lat_rad.to_degrees();
-
-        let options = RenderOptions {
-            size: Size::new(tile_size, tile_size),
-            pixel_ratio,
-            camera: CameraOptions::new(lat, lon, z as f64),
-            mode: MapMode::Tile,
-        };
+        let options = RenderOptions::for_tile(z, x, y, tile_size, pixel_ratio);
 
         self.render(Some(options))
     }
 }
 
+/// Where the time of one render went, and what it requested
+#[derive(Debug, Clone, Copy, Default, PartialEq, Serialize, Deserialize)]
+pub struct RenderStats {
+    /// Style parsing since the previous render, zero if the style was reused
+    pub style_parse: Duration,
+    /// Start of the render until the frame was drawn
+    pub render: Duration,
+    /// Part of `render` spent with resource requests outstanding
+    pub resource_wait: Duration,
+    /// Reading the frame back into memory
+    pub readback: Duration,
+    pub resource_requests: u32,
+    pub tile_requests: u32,
+    pub failed_requests: u32,
+    pub resource_bytes: u64,
+}
+
+impl RenderStats {
+    /// Layout and GPU draw time (the part of `render` not spent waiting)
+    pub fn layout_and_draw(&self) -> Duration {
+        self.render.saturating_sub(self.resource_wait)
+    }
+}
+
+impl From<MLNRenderStats> for RenderStats {
+    fn from(s: MLNRenderStats) -> Self {
+        let ms = |ms: f64| Duration::from_secs_f64(ms.max(0.0) / 1e3);
+        Self {
+            style_parse: ms(s.style_parse_ms),
+            render: ms(s.render_ms),
+            resource_wait: ms(s.resource_wait_ms),
+            readback: ms(s.readback_ms),
+            resource_requests: s.resource_requests,
+            tile_requests: s.tile_requests,
+            failed_requests: s.failed_requests,
+            resource_bytes: s.resource_bytes,
+        }
+    }
+}
+
 impl Drop for NativeMap {
     fn drop(&mut self) {
-        if !self.ptr.is_null() {
-            unsafe {
-                mln_map_destroy(self.ptr);
-            }
+        if self.ptr.is_null() {
+            return;
+        }
+        let code = unsafe { mln_map_destroy(self.ptr) };
+        if code != MLNErrorCode::MLN_OK {
+            // The map still points at its frontend and loader, so they must outlive it
+            tracing::error!(
+                "Leaking native map dropped off its thread: {}",
+                get_last_error().unwrap_or_else(|| format!("{:?}", code))
+            );
+            self._frontend.ptr = ptr::null_mut();
+            std::mem::forget(self._handler.take());
         }
     }
 }
 
+/// Hash a style JSON string to identify it across map instances.
+///
+/// Uses 64-bit FNV-1a. Never returns 0, which the native API reserves for
+/// "no style / unknown style".
+pub fn hash_style(style_json: &str) -> u64 {
+    const OFFSET_BASIS: u64 = 0xcbf2_9ce4_8422_2325;
+    const PRIME: u64 = 0x0100_0000_01b3;
+
+    let hash = style_json
+        .as_bytes()
+        .iter()
+        .fold(OFFSET_BASIS, |hash, &byte| {
+            (hash ^ byte as u64).wrapping_mul(PRIME)
+        });
+
+    hash.max(1)
+}
+
 /// Render options
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct RenderOptions {
     pub size: Size,
     pub pixel_ratio: f32,
     pub camera: CameraOptions,
     pub mode: MapMode,
+    /// Abort the render once it has run this long
+    pub timeout: Option<Duration>,
 }
 
 impl Default for RenderOptions {
@@ -538,11 +1448,31 @@ impl Default for RenderOptions {
             pixel_ratio: 1.0,
             camera: CameraOptions::default(),
             mode: MapMode::Tile,
+            timeout: None,
         }
     }
 }
 
 impl RenderOptions {
+    /// Options for rendering the tile at the given coordinates
+    pub fn for_tile(z: u8, x: u32, y: u32, tile_size: u32, pixel_ratio: f32) -> Self {
+        // Calculate center of tile
+        let n = 2_f64.powi(z as i32);
+        let lon = (x as f64 + 0.5) / n * 360.0 - 180.0;
+        let lat_rad = ((1.0 - 2.0 * (y as f64 + 0.5) / n) * std::f64::consts::PI)
+            .sinh()
+            .atan();
+        let lat = lat_rad.to_degrees();
+
+        Self {
+            size: Size::new(tile_size, tile_size),
+            pixel_ratio,
+            camera: CameraOptions::new(lat, lon, z as f64),
+            mode: MapMode::Tile,
+            timeout: None,
+        }
+    }
+
     fn into_native(self) -> MLNRenderOptions {
         MLNRenderOptions {
             size: self.size.into(),
@@ -550,6 +1480,10 @@ impl RenderOptions {
             camera: self.camera.into(),
             mode: self.mode.into(),
             debug: maplibre_native_sys::MLNDebugOptions::MLN_DEBUG_NONE,
+            // At least 1ms, 0 would disable the deadline
+            timeout_ms: self
+                .timeout
+                .map_or(0, |t| t.as_millis().clamp(1, u32::MAX as u128) as u32),
         }
     }
 }
@@ -563,6 +1497,25 @@ mod tests {
         assert!(init().is_ok());
     }
 
+    #[test]
+    fn test_render_device_selection() {
+        init().unwrap();
+        let count = render_device_count();
+
+        assert!(count >= 1);
+        assert!(set_render_device(count).is_err());
+    }
+
+    #[test]
+    fn test_shader_cache_dir_is_created() {
+        let dir = tempfile::tempdir().unwrap();
+        let cache = dir.path().join("shaders");
+
+        set_shader_cache_dir(Some(&cache)).unwrap();
+        assert!(cache.is_dir());
+        set_shader_cache_dir(None).unwrap();
+    }
+
     #[test]
     fn test_size_conversion() {
         let size = Size::new(512, 256);
@@ -571,6 +1524,378 @@ mod tests {
         assert_eq!(native.height, 256);
     }
 
+    #[test]
+    fn test_hash_style() {
+        let a = hash_style(r#"{"version":8,"layers":[]}"#);
+        let b = hash_style(r#"{"version":8,"layers":[{}]}"#);
+        assert_ne!(a, 0);
+        assert_ne!(a, b);
+        assert_eq!(a, hash_style(r#"{"version":8,"layers":[]}"#));
+    }
+
+    #[test]
+    fn test_load_style_with_hash() {
+        init().unwrap();
+        let mut map = NativeMap::new(Size::new(256, 256), 1.0, MapMode::Tile).unwrap();
+        assert_eq!(map.style_hash(), 0);
+
+        let style = r#"{"version":8,"sources":{},"layers":[]}"#;
+        let hash = hash_style(style);
+        map.load_style_with_hash(style, hash).unwrap();
+        assert_eq!(map.style_hash(), hash);
+
+        // A plain load forgets the hash
+        map.load_style(style).unwrap();
+        assert_eq!(map.style_hash(), 0);
+    }
+
+    #[test]
+    fn test_readback_buffers_are_reused() {
+        init().unwrap();
+        // A size no other test renders at, so the pool's buffers of this
+        // class are ours alone
+        let mut map = NativeMap::new(Size::new(1000, 777), 1.0, MapMode::Static).unwrap();
+        map.load_style(r#"{"version":8,"sources":{},"layers":[]}"#)
+            .unwrap();
+
+        drop(map.render(None).unwrap());
+        let before = buffer_pool_stats();
+        drop(map.render(None).unwrap());
+        let after = buffer_pool_stats();
+        assert!(after.hits > before.hits);
+        assert!(after.returned > before.returned);
+    }
+
+    #[test]
+    fn test_render_stats() {
+        init().unwrap();
+        let mut map = NativeMap::new(Size::new(64, 64), 1.0, MapMode::Static).unwrap();
+        assert_eq!(map.render_stats(), RenderStats::default());
+
+        map.load_style(r#"{"version":8,"sources":{},"layers":[]}"#)
+            .unwrap();
+        map.render(None).unwrap();
+        let stats = map.render_stats();
+        assert!(stats.render > Duration::ZERO);
+        assert!(stats.resource_wait <= stats.render);
+        assert_eq!(stats.failed_requests, 0);
+
+        // Style parsing is only reported by the first render after a load
+        map.render(None).unwrap();
+        assert_eq!(map.render_stats().style_parse, Duration::ZERO);
+    }
+
+    #[test]
+    fn test_render_pipelined_delivers_frames_in_order() {
+        use std::cell::RefCell;
+        use std::rc::Rc;
+
+        init().unwrap();
+        let mut map = NativeMap::new(Size::new(64, 64), 1.0, MapMode::Static).unwrap();
+        map.load_style(r#"{"version":8,"sources":{},"layers":[]}"#)
+            .unwrap();
+
+        let options: Vec<RenderOptions> = [64, 32, 16]
+            .into_iter()
+            .map(|size| RenderOptions {
+                size: Size::new(size, size),
+                ..RenderOptions::for_tile(0, 0, 0, 64, 1.0)
+            })
+            .collect();
+        let frames = Rc::new(RefCell::new(Vec::new()));
+        let seen = frames.clone();
+        map.render_pipelined(
+            &options,
+            Box::new(move |index, result, _| {
+                let width = result.map(|image| image.width());
+                seen.borrow_mut().push((index, width.ok()));
+            }),
+        );
+        // The map renders nothing else until the last frame is done
+        assert!(map.render(None).is_err());
+        while frames.borrow().len() < options.len() {
+            run_loop_once();
+        }
+        assert_eq!(
+            *frames.borrow(),
+            [(0, Some(64)), (1, Some(32)), (2, Some(16))]
+        );
+
+        // Cancelling fails every frame not yet done
+        let frames = Rc::new(RefCell::new(Vec::new()));
+        let seen = frames.clone();
+        map.render_pipelined(
+            &options,
+            Box::new(move |index, result, _| seen.borrow_mut().push((index, result.is_err()))),
+        );
+        map.cancel().unwrap();
+        while frames.borrow().len() < options.len() {
+            run_loop_once();
+        }
+        assert_eq!(*frames.borrow(), [(0, true), (1, true), (2, true)]);
+        assert!(map.render(None).is_ok());
+    }
+
+    #[test]
+    fn test_render_hands_over_native_buffer() {
+        init().unwrap();
+        let mut map = NativeMap::new(Size::new(64, 32), 1.0, MapMode::Static).unwrap();
+        map.load_style(r#"{"version":8,"sources":{},"layers":[]}"#)
+            .unwrap();
+
+        let mut image = map.render(None).unwrap();
+        drop(map);
+
+        // The buffer outlives the map and is usable in place
+        assert!(image.is_native());
+        assert_eq!(image.data().len(), 64 * 32 * 4);
+        image.data_mut()[0] = 7;
+        assert_eq!(image.data()[0], 7);
+
+        let data = image.take_data();
+        assert_eq!(data[0], 7);
+        assert!(!image.is_native());
+    }
+
+    #[test]
+    fn test_crop() {
+        let data: Vec<u8> = (0..4 * 3).flat_map(|i| [i as u8; 4]).collect();
+        let image = RenderedImage::from_rgba(4, 3, data);
+
+        let cropped = image.crop(1, 1, 2, 2).unwrap();
+        assert_eq!((cropped.width(), cropped.height()), (2, 2));
+        let pixels: Vec<u8> = cropped.data().chunks(4).map(|p| p[0]).collect();
+        assert_eq!(pixels, vec![5, 6, 9, 10]);
+
+        assert!(image.crop(3, 0, 2, 1).is_err());
+    }
+
+    #[test]
+    fn test_encode_rejects_short_buffer() {
+        let image = || RenderedImage::from_rgba(4, 4, vec![0; 8]);
+        assert!(image().into_png(&EncodeOptions::default()).is_err());
+        assert!(image().into_jpeg(90).is_err());
+        assert!(image().into_webp().is_err());
+    }
+
+    #[test]
+    fn test_encoder_pixels() {
+        use image::ExtendedColorType;
+
+        // Opaque frames are packed to RGB
+        let mut opaque = RenderedImage::from_rgba(2, 1, vec![10, 20, 30, 255, 40, 50, 60, 255]);
+        let (data, color) = opaque.encoder_pixels(false).unwrap();
+        assert_eq!(data, [10, 20, 30, 40, 50, 60]);
+        assert_eq!(color, ExtendedColorType::Rgb8);
+
+        // Translucent ones are un-premultiplied, unless alpha is dropped
+        let pixels = vec![64, 0, 128, 128, 0, 0, 0, 0];
+        let mut translucent = RenderedImage::from_rgba(2, 1, pixels.clone());
+        let (data, color) = translucent.encoder_pixels(false).unwrap();
+        assert_eq!(data, [128, 0, 255, 128, 0, 0, 0, 0]);
+        assert_eq!(color, ExtendedColorType::Rgba8);
+
+        let mut jpeg = RenderedImage::from_rgba(2, 1, pixels);
+        let (data, color) = jpeg.encoder_pixels(true).unwrap();
+        assert_eq!(data, [64, 0, 128, 0, 0, 0]);
+        assert_eq!(color, ExtendedColorType::Rgb8);
+    }
+
+    struct StaticHandler;
+
+    impl ResourceHandler for StaticHandler {
+        fn handle(&self, url: &str, kind: ResourceKind) -> ResourceResponse {
+            match (url, kind) {
+                ("test://style.json", ResourceKind::Style) => ResourceResponse::Data(
+                    Bytes::from_static(br#"{"version":8,"sources":{},"layers":[]}"#),
+                ),
+                ("test://error.json", _) => ResourceResponse::Error("broken".to_string()),
+                ("test://panic.json", _) => panic!("handler panic"),
+                ("test://deferred.json", ResourceKind::Style) => {
+                    ResourceResponse::Deferred(Box::new(|responder| {
+                        std::thread::spawn(move || {
+                            responder.respond(ResourceResponse::Data(Bytes::from_static(
+                                br#"{"version":8,"sources":{},"layers":[]}"#,
+                            )))
+                        });
+                    }))
+                }
+                ("test://dropped.json", _) => ResourceResponse::Deferred(Box::new(drop)),
+                _ => ResourceResponse::NotFound,
+            }
+        }
+    }
+
+    #[test]
+    fn test_resource_handler() {
+        init().unwrap();
+        let mut map = NativeMap::with_resource_handler(
+            Size::new(256, 256),
+            1.0,
+            MapMode::Tile,
+            Arc::new(StaticHandler),
+        )
+        .unwrap();
+
+        assert!(map.load_style_url("test://style.json").is_ok());
+        assert!(map.load_style_url("test://missing.json").is_err());
+
+        let err = map.load_style_url("test://error.json").unwrap_err();
+        assert!(err.to_string().contains("broken"));
+
+        // Panics are contained on the Rust side of the callback
+        assert!(map.load_style_url("test://panic.json").is_err());
+
+        // Deferred answers may come from another thread
+        assert!(map.load_style_url("test://deferred.json").is_ok());
+        let err = map.load_style_url("test://dropped.json").unwrap_err();
+        assert!(err.to_string().contains("dropped"));
+    }
+
+    #[test]
+    fn test_render_async_multiplexes_maps() {
+        use std::cell::RefCell;
+        use std::rc::Rc;
+
+        init().unwrap();
+        let style = r#"{"version":8,"sources":{},"layers":[]}"#;
+        let mut maps: Vec<NativeMap> = (0..3)
+            .map(|_| {
+                let mut map = NativeMap::new(Size::new(32, 32), 1.0, MapMode::Tile).unwrap();
+                map.load_style(style).unwrap();
+                map
+            })
+            .collect();
+
+        let done = Rc::new(RefCell::new(Vec::new()));
+        for (i, map) in maps.iter_mut().enumerate() {
+            let done = done.clone();
+            map.render_async(
+                None,
+                Box::new(move |result| done.borrow_mut().push((i, result))),
+            );
+        }
+
+        // A second render on a busy map is rejected right away
+        let busy = Rc::new(RefCell::new(None));
+        let slot = busy.clone();
+        maps[0].render_async(
+            None,
+            Box::new(move |result| *slot.borrow_mut() = Some(result)),
+        );
+        assert!(busy.borrow_mut().take().unwrap().is_err());
+
+        // All three renders are in flight on one thread at once
+        assert!(done.borrow().is_empty());
+        while done.borrow().len() < 3 {
+            run_loop_once();
+        }
+        for (_, result) in done.borrow_mut().drain(..) {
+            let image = result.unwrap();
+            assert!(image.is_native());
+            assert_eq!(image.data().len(), 32 * 32 * 4);
+        }
+    }
+
+    #[test]
+    fn test_cancel_aborts_render_in_flight() {
+        use std::cell::RefCell;
+        use std::rc::Rc;
+
+        init().unwrap();
+        let mut map = NativeMap::new(Size::new(32, 32), 1.0, MapMode::Tile).unwrap();
+        map.load_style(r#"{"version":8,"sources":{},"layers":[]}"#)
+            .unwrap();
+        // Nothing to cancel
+        map.cancel().unwrap();
+
+        let done = Rc::new(RefCell::new(None));
+        let slot = done.clone();
+        map.render_async(
+            None,
+            Box::new(move |result| *slot.borrow_mut() = Some(result)),
+        );
+        map.cancel().unwrap();
+        while done.borrow().is_none() {
+            run_loop_once();
+        }
+        let result = done.borrow_mut().take().unwrap();
+        assert!(matches!(result, Err(TileServerError::RenderCancelled(_))));
+
+        // The map renders again afterwards
+        assert!(map.render(None).is_ok());
+    }
+
+    #[test]
+    fn test_drop_finishes_render_in_flight() {
+        use std::cell::RefCell;
+        use std::rc::Rc;
+
+        init().unwrap();
+        let mut map = NativeMap::new(Size::new(32, 32), 1.0, MapMode::Tile).unwrap();
+        map.load_style(r#"{"version":8,"sources":{},"layers":[]}"#)
+            .unwrap();
+
+        let done = Rc::new(RefCell::new(None));
+        let slot = done.clone();
+        map.render_async(
+            None,
+            Box::new(move |result| *slot.borrow_mut() = Some(result)),
+        );
+        drop(map);
+        let result = done.borrow_mut().take().unwrap();
+        assert!(matches!(result, Err(TileServerError::RenderCancelled(_))));
+    }
+
+    #[test]
+    fn test_drop_off_thread_leaks_map() {
+        init().unwrap();
+        let map = NativeMap::with_resource_handler(
+            Size::new(32, 32),
+            1.0,
+            MapMode::Tile,
+            Arc::new(StaticHandler),
+        )
+        .unwrap();
+        std::thread::spawn(move || drop(map)).join().unwrap();
+    }
+
+    #[test]
+    fn test_run_loop_wait_is_woken() {
+        use std::time::Instant;
+
+        init().unwrap();
+        let waker = RunLoopWaker::current();
+
+        // A wake before the wait ends it right away
+        waker.wake();
+        let started = Instant::now();
+        run_loop_wait(Duration::from_secs(10));
+        assert!(started.elapsed() < Duration::from_secs(5));
+
+        // Without one the wait runs out
+        let started = Instant::now();
+        run_loop_wait(Duration::from_millis(20));
+        assert!(started.elapsed() >= Duration::from_millis(20));
+
+        // Woken from another thread
+        let waking = std::thread::spawn(move || {
+            std::thread::sleep(Duration::from_millis(20));
+            waker.wake();
+        });
+        let started = Instant::now();
+        run_loop_wait(Duration::from_secs(10));
+        assert!(started.elapsed() < Duration::from_secs(5));
+        waking.join().unwrap();
+    }
+
+    #[test]
+    fn test_resource_kind_from_u8() {
+        assert_eq!(ResourceKind::from(3), ResourceKind::Tile);
+        assert_eq!(ResourceKind::from(6), ResourceKind::SpriteJson);
+        assert_eq!(ResourceKind::from(42), ResourceKind::Unknown);
+    }
+
     #[test]
     fn test_camera_options() {
         let camera = CameraOptions::new(37.8, -122.4, 12.0)
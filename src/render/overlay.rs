@@ -1,8 +1,17 @@
 //! Overlay drawing for static map images
 //!
-//! Supports drawing paths (polylines) and markers on rendered map images.
+//! Supports drawing paths (polylines) and markers on rendered map images,
+//! or adding them to the style so MapLibre draws them with the map.
 
-use image::{Rgba, RgbaImage};
+use std::ops::DerefMut;
+
+use image::{ImageBuffer, Rgba};
+use serde_json::{json, Value};
+
+use super::variant::StyleEdit;
+
+/// Prefix of the source and layers overlays add to a style
+const OVERLAY_ID: &str = "tileserver-overlay";
 
 /// A point in geographic coordinates
 #[derive(Debug, Clone, Copy)]
@@ -399,9 +408,97 @@ fn geo_to_pixel(
     (px, py)
 }
 
+/// Style edits that add overlays to a style, above all of its layers: a
+/// GeoJSON source with a feature per path and marker, a line layer for the
+/// paths and circle layers for the markers. Markers are drawn as the round
+/// head of the pin `draw_marker` draws, without its point, centred on their
+/// position.
+pub fn style_edits(paths: &[PathOverlay], markers: &[MarkerOverlay]) -> Vec<StyleEdit> {
+    let coordinates = |p: &GeoPoint| json!([p.lon, p.lat]);
+    let lines = paths
+        .iter()
+        .filter(|path| path.points.len() >= 2)
+        .map(|path| {
+            json!({
+                "type": "Feature",
+                "geometry": {
+                    "type": "LineString",
+                    "coordinates": path.points.iter().map(coordinates).collect::<Vec<_>>(),
+                },
+                "properties": {
+                    "color": css_color(path.stroke_color),
+                    "width": path.stroke_width,
+                },
+            })
+        });
+    let points = markers.iter().map(|marker| {
+        json!({
+            "type": "Feature",
+            "geometry": {"type": "Point", "coordinates": coordinates(&marker.position)},
+            "properties": {
+                "color": css_color(marker.color),
+                // As in draw_marker
+                "radius": marker.size * 0.3,
+                "dot": marker.size * 0.12,
+            },
+        })
+    });
+
+    let layer = |suffix: &str, kind: &str, geometry: &str, layout: Value, paint: Value| {
+        StyleEdit::AddLayer {
+            layer: json!({
+                "id": format!("{}-{}", OVERLAY_ID, suffix),
+                "type": kind,
+                "source": OVERLAY_ID,
+                "filter": ["==", ["geometry-type"], geometry],
+                "layout": layout,
+                "paint": paint,
+            }),
+            before: None,
+        }
+    };
+    vec![
+        StyleEdit::AddSource {
+            source: OVERLAY_ID.to_string(),
+            definition: json!({
+                "type": "geojson",
+                "data": {"type": "FeatureCollection", "features": lines.chain(points).collect::<Vec<_>>()},
+            }),
+        },
+        layer(
+            "paths",
+            "line",
+            "LineString",
+            json!({"line-cap": "round", "line-join": "round"}),
+            json!({"line-color": ["get", "color"], "line-width": ["get", "width"]}),
+        ),
+        layer(
+            "markers",
+            "circle",
+            "Point",
+            json!({}),
+            json!({"circle-color": ["get", "color"], "circle-radius": ["get", "radius"]}),
+        ),
+        layer(
+            "marker-dots",
+            "circle",
+            "Point",
+            json!({}),
+            json!({"circle-color": "#ffffff", "circle-radius": ["get", "dot"]}),
+        ),
+    ]
+}
+
+fn css_color(color: Rgba<u8>) -> String {
+    let [r, g, b, a] = color.0;
+    format!("rgba({}, {}, {}, {})", r, g, b, a as f32 / 255.0)
+}
+
 /// Draw overlays on an image
-pub fn draw_overlays(
-    image: &mut RgbaImage,
+///
+/// Works on any RGBA buffer, including a rendered image borrowed in place.
+pub fn draw_overlays<C: DerefMut<Target = [u8]>>(
+    image: &mut ImageBuffer<Rgba<u8>, C>,
     paths: &[PathOverlay],
     markers: &[MarkerOverlay],
     center_lon: f64,
@@ -429,8 +526,8 @@ pub fn draw_overlays(
 
 /// Draw a path on the image
 #[allow(clippy::too_many_arguments)]
-fn draw_path(
-    image: &mut RgbaImage,
+fn draw_path<C: DerefMut<Target = [u8]>>(
+    image: &mut ImageBuffer<Rgba<u8>, C>,
     path: &PathOverlay,
     center_lon: f64,
     center_lat: f64,
@@ -466,8 +563,8 @@ fn draw_path(
 }
 
 /// Draw a line segment with thickness using Bresenham's algorithm
-fn draw_line(
-    image: &mut RgbaImage,
+fn draw_line<C: DerefMut<Target = [u8]>>(
+    image: &mut ImageBuffer<Rgba<u8>, C>,
     x0: f32,
     y0: f32,
     x1: f32,
@@ -511,8 +608,8 @@ fn draw_line(
 
 /// Draw a marker on the image
 #[allow(clippy::too_many_arguments)]
-fn draw_marker(
-    image: &mut RgbaImage,
+fn draw_marker<C: DerefMut<Target = [u8]>>(
+    image: &mut ImageBuffer<Rgba<u8>, C>,
     marker: &MarkerOverlay,
     center_lon: f64,
     center_lat: f64,
@@ -599,7 +696,12 @@ fn draw_marker(
 }
 
 /// Blend a pixel with alpha compositing
-fn blend_pixel(image: &mut RgbaImage, x: u32, y: u32, color: Rgba<u8>) {
+fn blend_pixel<C: DerefMut<Target = [u8]>>(
+    image: &mut ImageBuffer<Rgba<u8>, C>,
+    x: u32,
+    y: u32,
+    color: Rgba<u8>,
+) {
     let existing = image.get_pixel(x, y);
     let alpha = color.0[3] as f32 / 255.0;
     let inv_alpha = 1.0 - alpha;
@@ -652,6 +754,7 @@ pub fn calculate_bounds(
 #[cfg(test)]
 mod tests {
     use super::*;
+    use image::RgbaImage;
 
     // ============================================================
     // Hex Color Parsing Tests
@@ -1415,4 +1518,34 @@ mod tests {
         assert!((decoded[1].lat - 85.0).abs() < 0.00001);
         assert!((decoded[1].lon - 180.0).abs() < 0.00001);
     }
+
+    #[test]
+    fn test_style_edits_add_overlays_on_top() {
+        let path = parse_path("path-4+f00(-122.4,37.8|-122.5,37.9)").unwrap();
+        let marker = parse_marker("pin-s+00ff00(-122.4,37.8)").unwrap();
+        let edits = style_edits(&[path], &[marker]);
+
+        let StyleEdit::AddSource { source, definition } = &edits[0] else {
+            panic!("expected the overlay source first: {:?}", edits[0]);
+        };
+        let features = definition["data"]["features"].as_array().unwrap();
+        assert_eq!(features.len(), 2);
+        assert_eq!(
+            features[0]["geometry"]["coordinates"],
+            json!([[-122.4, 37.8], [-122.5, 37.9]])
+        );
+        assert_eq!(features[0]["properties"]["color"], "rgba(255, 0, 0, 1)");
+        assert_eq!(features[0]["properties"]["width"], 4.0);
+        assert_eq!(features[1]["geometry"]["type"], "Point");
+
+        // Every layer draws from the source, above the style's own layers
+        assert_eq!(edits.len(), 4);
+        for edit in &edits[1..] {
+            let StyleEdit::AddLayer { layer, before } = edit else {
+                panic!("expected a layer: {:?}", edit);
+            };
+            assert_eq!(layer["source"], source.as_str());
+            assert!(before.is_none());
+        }
+    }
 }
@@ -0,0 +1,287 @@
+//! 8-bit palette PNG encoding
+//!
+//! Map tiles are mostly flat fills with anti-aliased edges, so they reduce to
+//! 256 colours with little visible loss and encode to a fraction of the size
+//! of RGBA PNGs. Images with at most 256 distinct colours keep them exactly;
+//! others are reduced with weighted median cut over their colour histogram.
+//! No dithering is applied, which keeps flat fills flat.
+
+use std::collections::HashMap;
+use std::io::Write;
+
+use flate2::write::ZlibEncoder;
+use flate2::{Compression, Crc};
+
+use crate::error::{Result, TileServerError};
+
+const MAX_COLORS: usize = 256;
+
+/// An image reduced to a palette
+pub struct Indexed {
+    /// RGB triples
+    pub palette: Vec<u8>,
+    /// Alpha of the leading palette entries; the rest are opaque
+    pub alpha: Vec<u8>,
+    /// One palette index per pixel
+    pub indices: Vec<u8>,
+}
+
+/// Reduce straight-alpha pixels with `channels` (3 or 4) bytes each to at
+/// most 256 colours
+pub fn quantize(pixels: &[u8], channels: usize) -> Indexed {
+    let color_of = |p: &[u8]| {
+        let alpha = if channels == 4 { p[3] } else { 255 };
+        // All fully transparent pixels are the same colour
+        if alpha == 0 {
+            0
+        } else {
+            u32::from_be_bytes([p[0], p[1], p[2], alpha])
+        }
+    };
+
+    let mut histogram: HashMap<u32, u32> = HashMap::new();
+    for p in pixels.chunks_exact(channels) {
+        *histogram.entry(color_of(p)).or_default() += 1;
+    }
+
+    let mut colors: Vec<(u32, u32)> = histogram.into_iter().collect();
+    // Translucent colours first, so the alpha table can stop at the last one
+    colors.sort_unstable_by_key(|&(color, _)| ((color & 0xFF) == 255, color));
+
+    let (palette, index_of) = if colors.len() <= MAX_COLORS {
+        let index_of: HashMap<u32, u8> = colors
+            .iter()
+            .enumerate()
+            .map(|(i, &(color, _))| (color, i as u8))
+            .collect();
+        let palette = colors.iter().map(|&(color, _)| color).collect();
+        (palette, index_of)
+    } else {
+        median_cut(colors)
+    };
+
+    let mut indices = Vec::with_capacity(pixels.len() / channels);
+    // Neighbouring pixels are usually the same colour
+    let mut last = (u32::MAX, 0);
+    for p in pixels.chunks_exact(channels) {
+        let color = color_of(p);
+        if color != last.0 {
+            last = (color, index_of[&color]);
+        }
+        indices.push(last.1);
+    }
+
+    let translucent = palette.iter().take_while(|&&c| (c & 0xFF) != 255).count();
+    Indexed {
+        palette: palette
+            .iter()
+            .flat_map(|c| c.to_be_bytes()[..3].to_vec())
+            .collect(),
+        alpha: palette[..translucent]
+            .iter()
+            .map(|c| (c & 0xFF) as u8)
+            .collect(),
+        indices,
+    }
+}
+
+/// Split the histogram into boxes until there are 256, always splitting the
+/// box with the most pixels along its widest channel at the weighted median.
+/// Each box becomes the weighted mean of its colours.
+fn median_cut(mut colors: Vec<(u32, u32)>) -> (Vec<u32>, HashMap<u32, u8>) {
+    let channel = |color: u32, c: usize| color.to_be_bytes()[c];
+
+    // Boxes are ranges of `colors`, with their pixel counts
+    let mut boxes = vec![(0..colors.len(), pixel_count(&colors))];
+    while boxes.len() < MAX_COLORS {
+        let Some((i, _)) = boxes
+            .iter()
+            .enumerate()
+            .filter(|(_, (range, _))| range.len() > 1)
+            .max_by_key(|(_, (_, count))| *count)
+        else {
+            break;
+        };
+        let (range, count) = boxes.swap_remove(i);
+        let entries = &mut colors[range.clone()];
+
+        let widest = (0..4)
+            .max_by_key(|&c| {
+                let values = entries.iter().map(|&(color, _)| channel(color, c));
+                values.clone().max().unwrap_or(0) - values.min().unwrap_or(0)
+            })
+            .unwrap_or(0);
+        entries.sort_unstable_by_key(|&(color, _)| channel(color, widest));
+
+        // First entry past half the pixels, keeping both halves non-empty
+        let mut seen = 0u64;
+        let split = entries
+            .iter()
+            .position(|&(_, n)| {
+                seen += n as u64;
+                seen * 2 >= count
+            })
+            .unwrap_or(0)
+            .clamp(0, entries.len() - 2)
+            + 1;
+        let low = pixel_count(&entries[..split]);
+        boxes.push((range.start..range.start + split, low));
+        boxes.push((range.start + split..range.end, count - low));
+    }
+
+    // Translucent entries first, as for exact palettes
+    let mut means: Vec<(u32, std::ops::Range<usize>)> = boxes
+        .into_iter()
+        .map(|(range, count)| {
+            let mut sums = [0u64; 4];
+            for &(color, n) in &colors[range.clone()] {
+                for (c, sum) in sums.iter_mut().enumerate() {
+                    *sum += channel(color, c) as u64 * n as u64;
+                }
+            }
+            let mean = sums.map(|sum| ((sum + count / 2) / count.max(1)) as u8);
+            (u32::from_be_bytes(mean), range)
+        })
+        .collect();
+    means.sort_unstable_by_key(|(color, _)| (color & 0xFF) == 255);
+
+    let mut index_of = HashMap::with_capacity(colors.len());
+    for (i, (_, range)) in means.iter().enumerate() {
+        for &(color, _) in &colors[range.clone()] {
+            index_of.insert(color, i as u8);
+        }
+    }
+    (
+        means.into_iter().map(|(color, _)| color).collect(),
+        index_of,
+    )
+}
+
+fn pixel_count(colors: &[(u32, u32)]) -> u64 {
+    colors.iter().map(|&(_, n)| n as u64).sum()
+}
+
+/// Write an 8-bit indexed PNG. Rows are unfiltered, which suits palette
+/// images best.
+pub fn write_png(
+    image: &Indexed,
+    width: u32,
+    height: u32,
+    compression: Compression,
+) -> Result<Vec<u8>> {
+    let error =
+        |e: std::io::Error| TileServerError::RenderError(format!("PNG encoding failed: {}", e));
+
+    let mut data = ZlibEncoder::new(Vec::new(), compression);
+    for row in image.indices.chunks_exact(width.max(1) as usize) {
+        data.write_all(&[0]).map_err(error)?;
+        data.write_all(row).map_err(error)?;
+    }
+    let data = data.finish().map_err(error)?;
+
+    let mut header = Vec::with_capacity(13);
+    header.extend_from_slice(&width.to_be_bytes());
+    header.extend_from_slice(&height.to_be_bytes());
+    // 8-bit depth, indexed colour, deflate, filter method 0, no interlace
+    header.extend_from_slice(&[8, 3, 0, 0, 0]);
+
+    let mut png = b"\x89PNG\r\n\x1a\n".to_vec();
+    write_chunk(&mut png, b"IHDR", &header);
+    write_chunk(&mut png, b"PLTE", &image.palette);
+    if !image.alpha.is_empty() {
+        write_chunk(&mut png, b"tRNS", &image.alpha);
+    }
+    write_chunk(&mut png, b"IDAT", &data);
+    write_chunk(&mut png, b"IEND", &[]);
+    Ok(png)
+}
+
+fn write_chunk(png: &mut Vec<u8>, kind: &[u8; 4], data: &[u8]) {
+    let mut crc = Crc::new();
+    crc.update(kind);
+    crc.update(data);
+
+    png.extend_from_slice(&(data.len() as u32).to_be_bytes());
+    png.extend_from_slice(kind);
+    png.extend_from_slice(data);
+    png.extend_from_slice(&crc.sum().to_be_bytes());
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use flate2::read::ZlibDecoder;
+    use std::io::Read;
+
+    fn palette_color(image: &Indexed, i: u8) -> [u8; 4] {
+        let i = i as usize;
+        let rgb = &image.palette[i * 3..i * 3 + 3];
+        [rgb[0], rgb[1], rgb[2], *image.alpha.get(i).unwrap_or(&255)]
+    }
+
+    #[test]
+    fn test_few_colors_are_exact() {
+        let pixels = [
+            [170, 211, 223, 255],
+            [0, 0, 0, 0],
+            [9, 9, 9, 0],
+            [242, 239, 233, 128],
+        ]
+        .repeat(10)
+        .concat();
+        let image = quantize(&pixels, 4);
+
+        // Fully transparent pixels share one entry; translucent ones lead
+        assert_eq!(image.palette.len(), 3 * 3);
+        assert_eq!(image.alpha.len(), 2);
+        for (p, &i) in pixels.chunks(4).zip(&image.indices) {
+            let expected = if p[3] == 0 {
+                [0; 4]
+            } else {
+                p.try_into().unwrap()
+            };
+            assert_eq!(palette_color(&image, i), expected);
+        }
+    }
+
+    #[test]
+    fn test_many_colors_are_reduced() {
+        let pixels: Vec<u8> = (0..64 * 64u32)
+            .flat_map(|i| [(i % 64 * 4) as u8, (i / 64 * 4) as u8, 128])
+            .collect();
+        let image = quantize(&pixels, 3);
+
+        assert_eq!(image.palette.len(), MAX_COLORS * 3);
+        assert!(image.alpha.is_empty());
+        // A 64×64 gradient in 256 boxes is within a few steps everywhere
+        for (p, &i) in pixels.chunks(3).zip(&image.indices) {
+            let color = palette_color(&image, i);
+            for c in 0..3 {
+                assert!(
+                    (color[c] as i32 - p[c] as i32).abs() <= 16,
+                    "{:?} {:?}",
+                    p,
+                    color
+                );
+            }
+        }
+    }
+
+    #[test]
+    fn test_write_png() {
+        let image = quantize(&[[1, 2, 3, 255], [4, 5, 6, 0]].repeat(3).concat(), 4);
+        let png = write_png(&image, 2, 3, Compression::fast()).unwrap();
+
+        assert!(png.starts_with(b"\x89PNG\r\n\x1a\n"));
+        assert!(png.ends_with(&[0, 0, 0, 0, b'I', b'E', b'N', b'D', 0xAE, 0x42, 0x60, 0x82]));
+
+        // Image data is one unfiltered row per image row
+        let start = png.windows(4).position(|w| w == b"IDAT").unwrap();
+        let len = u32::from_be_bytes(png[start - 4..start].try_into().unwrap()) as usize;
+        let mut rows = Vec::new();
+        ZlibDecoder::new(&png[start + 4..start + 4 + len])
+            .read_to_end(&mut rows)
+            .unwrap();
+        assert_eq!(rows, [0, 1, 0, 0, 1, 0, 0, 1, 0]);
+    }
+}
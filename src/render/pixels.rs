@@ -0,0 +1,379 @@
+//! In-place pixel conversions for encoding rendered frames
+//!
+//! Frames are read back as premultiplied RGBA. Before encoding they are
+//! checked for transparency, then either stripped to RGB (opaque frames and
+//! JPEG) or converted to straight alpha, in the render buffer itself. Frames
+//! of a single colour are detected so their encoding can be shared.
+//!
+//! x86_64 uses SSE2, plus SSSE3 for the alpha strip when the CPU has it, and
+//! aarch64 uses NEON. Other targets, and the last few pixels of a buffer, use
+//! the scalar versions.
+
+/// Bytes handled per SIMD iteration (16 pixels)
+const BLOCK: usize = 64;
+
+/// Whether every pixel of an RGBA buffer is fully opaque
+pub fn is_opaque(rgba: &[u8]) -> bool {
+    let (head, tail) = rgba.split_at(rgba.len() / BLOCK * BLOCK);
+    simd::is_opaque(head) && scalar::is_opaque(tail)
+}
+
+/// The colour of an RGBA buffer whose pixels are all the same
+pub fn uniform_color(rgba: &[u8]) -> Option<[u8; 4]> {
+    let first: [u8; 4] = rgba.get(..4)?.try_into().ok()?;
+    let (head, tail) = rgba.split_at(rgba.len() / BLOCK * BLOCK);
+    (simd::is_uniform(head, first) && scalar::is_uniform(tail, first)).then_some(first)
+}
+
+/// Convert premultiplied RGBA to straight alpha in place
+pub fn unpremultiply(rgba: &mut [u8]) {
+    let (head, tail) = rgba.split_at_mut(rgba.len() / BLOCK * BLOCK);
+    simd::unpremultiply(head);
+    scalar::unpremultiply(tail);
+}
+
+/// Drop the alpha channel in place, packing the RGB values at the start of
+/// the buffer. Returns the length of the RGB data.
+pub fn strip_alpha(rgba: &mut [u8]) -> usize {
+    let pixels = rgba.len() / 4;
+    let head = rgba.len() / BLOCK * BLOCK;
+    simd::strip_alpha(&mut rgba[..head]);
+    scalar::strip_alpha(&mut rgba[..pixels * 4], head / 4);
+    pixels * 3
+}
+
+mod scalar {
+    pub fn is_opaque(rgba: &[u8]) -> bool {
+        rgba.chunks_exact(4).all(|p| p[3] == 255)
+    }
+
+    pub fn is_uniform(rgba: &[u8], color: [u8; 4]) -> bool {
+        rgba.chunks_exact(4).all(|p| p == color)
+    }
+
+    pub fn unpremultiply(rgba: &mut [u8]) {
+        for p in rgba.chunks_exact_mut(4) {
+            let a = p[3] as u32;
+            match a {
+                255 => {}
+                0 => p[..3].fill(0),
+                _ => {
+                    for c in &mut p[..3] {
+                        *c = ((*c as u32 * 255 + a / 2) / a).min(255) as u8;
+                    }
+                }
+            }
+        }
+    }
+
+    /// Move pixels `from..` to their RGB position, after `from` pixels of
+    /// RGB data
+    pub fn strip_alpha(rgba: &mut [u8], from: usize) {
+        for i in from..rgba.len() / 4 {
+            rgba.copy_within(i * 4..i * 4 + 3, i * 3);
+        }
+    }
+}
+
+/// SIMD kernels. Buffer lengths are multiples of [`BLOCK`].
+#[cfg(target_arch = "x86_64")]
+mod simd {
+    use std::arch::x86_64::*;
+
+    pub fn is_opaque(rgba: &[u8]) -> bool {
+        // SAFETY: SSE2 is part of the x86_64 baseline; loads stay in the block
+        unsafe {
+            let alpha = _mm_set1_epi32(0xFF00_0000u32 as i32);
+            for block in rgba.chunks_exact(super::BLOCK) {
+                let p = block.as_ptr() as *const __m128i;
+                let all = _mm_and_si128(
+                    _mm_and_si128(_mm_loadu_si128(p), _mm_loadu_si128(p.add(1))),
+                    _mm_and_si128(_mm_loadu_si128(p.add(2)), _mm_loadu_si128(p.add(3))),
+                );
+                if !all_opaque(all, alpha) {
+                    return false;
+                }
+            }
+        }
+        true
+    }
+
+    pub fn is_uniform(rgba: &[u8], color: [u8; 4]) -> bool {
+        // SAFETY: SSE2 is part of the x86_64 baseline; loads stay in the block
+        unsafe {
+            let color = _mm_set1_epi32(i32::from_ne_bytes(color));
+            for block in rgba.chunks_exact(super::BLOCK) {
+                let p = block.as_ptr() as *const __m128i;
+                let equal = _mm_and_si128(
+                    _mm_and_si128(
+                        _mm_cmpeq_epi8(_mm_loadu_si128(p), color),
+                        _mm_cmpeq_epi8(_mm_loadu_si128(p.add(1)), color),
+                    ),
+                    _mm_and_si128(
+                        _mm_cmpeq_epi8(_mm_loadu_si128(p.add(2)), color),
+                        _mm_cmpeq_epi8(_mm_loadu_si128(p.add(3)), color),
+                    ),
+                );
+                if _mm_movemask_epi8(equal) != 0xFFFF {
+                    return false;
+                }
+            }
+        }
+        true
+    }
+
+    pub fn unpremultiply(rgba: &mut [u8]) {
+        // SAFETY: SSE2 is part of the x86_64 baseline; each load and store
+        // covers exactly one 16-byte chunk
+        unsafe {
+            let alpha = _mm_set1_epi32(0xFF00_0000u32 as i32);
+            let zero = _mm_setzero_si128();
+            for chunk in rgba.chunks_exact_mut(16) {
+                let p = chunk.as_mut_ptr() as *mut __m128i;
+                let px = _mm_loadu_si128(p);
+                if all_opaque(px, alpha) {
+                    continue;
+                }
+
+                let lo = _mm_unpacklo_epi8(px, zero);
+                let hi = _mm_unpackhi_epi8(px, zero);
+                let straight = _mm_packus_epi16(
+                    _mm_packs_epi32(
+                        unpremultiply_pixel(_mm_unpacklo_epi16(lo, zero)),
+                        unpremultiply_pixel(_mm_unpackhi_epi16(lo, zero)),
+                    ),
+                    _mm_packs_epi32(
+                        unpremultiply_pixel(_mm_unpacklo_epi16(hi, zero)),
+                        unpremultiply_pixel(_mm_unpackhi_epi16(hi, zero)),
+                    ),
+                );
+                // Keep the original alpha
+                let straight =
+                    _mm_or_si128(_mm_andnot_si128(alpha, straight), _mm_and_si128(px, alpha));
+                _mm_storeu_si128(p, straight);
+            }
+        }
+    }
+
+    /// One pixel as four i32 lanes (r, g, b, a) to straight alpha, computing
+    /// `(c * 255 + a / 2) / a` in f32 (exact for 8-bit inputs)
+    #[inline(always)]
+    unsafe fn unpremultiply_pixel(v: __m128i) -> __m128i {
+        let a = _mm_shuffle_epi32(v, 0xFF);
+        let num = _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(v, 8), v), _mm_srli_epi32(a, 1));
+        let q = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(num), _mm_cvtepi32_ps(a)));
+        // Fully transparent pixels become black
+        _mm_and_si128(q, _mm_cmpgt_epi32(a, _mm_setzero_si128()))
+    }
+
+    #[inline(always)]
+    unsafe fn all_opaque(px: __m128i, alpha: __m128i) -> bool {
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(px, alpha), alpha)) == 0xFFFF
+    }
+
+    pub fn strip_alpha(rgba: &mut [u8]) {
+        if is_x86_feature_detected!("ssse3") {
+            // SAFETY: the CPU supports SSSE3
+            unsafe { strip_alpha_ssse3(rgba) }
+        } else {
+            super::scalar::strip_alpha(rgba, 0)
+        }
+    }
+
+    #[target_feature(enable = "ssse3")]
+    unsafe fn strip_alpha_ssse3(rgba: &mut [u8]) {
+        let rgb = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        let ptr = rgba.as_mut_ptr();
+        // Chunk i's 12 RGB bytes (and 4 bytes of padding, overwritten by the
+        // next chunk) land below chunk i + 1, which has not been read yet
+        for i in 0..rgba.len() / 16 {
+            let px = _mm_loadu_si128(ptr.add(i * 16) as *const __m128i);
+            _mm_storeu_si128(ptr.add(i * 12) as *mut __m128i, _mm_shuffle_epi8(px, rgb));
+        }
+    }
+}
+
+/// SIMD kernels. Buffer lengths are multiples of [`BLOCK`].
+#[cfg(target_arch = "aarch64")]
+mod simd {
+    use std::arch::aarch64::*;
+
+    pub fn is_opaque(rgba: &[u8]) -> bool {
+        // SAFETY: NEON is part of the aarch64 baseline; loads stay in the block
+        unsafe {
+            for block in rgba.chunks_exact(super::BLOCK) {
+                if vminvq_u8(vld4q_u8(block.as_ptr()).3) != 255 {
+                    return false;
+                }
+            }
+        }
+        true
+    }
+
+    pub fn is_uniform(rgba: &[u8], color: [u8; 4]) -> bool {
+        // SAFETY: NEON is part of the aarch64 baseline; loads stay in the block
+        unsafe {
+            let color = vdupq_n_u32(u32::from_ne_bytes(color));
+            for block in rgba.chunks_exact(super::BLOCK) {
+                let p = block.as_ptr();
+                let load = |offset| vreinterpretq_u32_u8(vld1q_u8(p.add(offset)));
+                let equal = vandq_u32(
+                    vandq_u32(vceqq_u32(load(0), color), vceqq_u32(load(16), color)),
+                    vandq_u32(vceqq_u32(load(32), color), vceqq_u32(load(48), color)),
+                );
+                if vminvq_u32(equal) != u32::MAX {
+                    return false;
+                }
+            }
+        }
+        true
+    }
+
+    pub fn unpremultiply(rgba: &mut [u8]) {
+        // SAFETY: NEON is part of the aarch64 baseline; each load and store
+        // covers exactly one block
+        unsafe {
+            for block in rgba.chunks_exact_mut(super::BLOCK) {
+                let mut px = vld4q_u8(block.as_ptr());
+                if vminvq_u8(px.3) == 255 {
+                    continue;
+                }
+                px.0 = unpremultiply_channel(px.0, px.3);
+                px.1 = unpremultiply_channel(px.1, px.3);
+                px.2 = unpremultiply_channel(px.2, px.3);
+                vst4q_u8(block.as_mut_ptr(), px);
+            }
+        }
+    }
+
+    /// One channel of 16 pixels to straight alpha, computing
+    /// `(c * 255 + a / 2) / a` in f32 (exact for 8-bit inputs)
+    #[inline(always)]
+    unsafe fn unpremultiply_channel(c: uint8x16_t, a: uint8x16_t) -> uint8x16_t {
+        let c_lo = vmovl_u8(vget_low_u8(c));
+        let c_hi = vmovl_u8(vget_high_u8(c));
+        let a_lo = vmovl_u8(vget_low_u8(a));
+        let a_hi = vmovl_u8(vget_high_u8(a));
+
+        let lo = vcombine_u16(
+            divide(vmovl_u16(vget_low_u16(c_lo)), vmovl_u16(vget_low_u16(a_lo))),
+            divide(
+                vmovl_u16(vget_high_u16(c_lo)),
+                vmovl_u16(vget_high_u16(a_lo)),
+            ),
+        );
+        let hi = vcombine_u16(
+            divide(vmovl_u16(vget_low_u16(c_hi)), vmovl_u16(vget_low_u16(a_hi))),
+            divide(
+                vmovl_u16(vget_high_u16(c_hi)),
+                vmovl_u16(vget_high_u16(a_hi)),
+            ),
+        );
+        let straight = vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi));
+        // Fully transparent pixels become black
+        vbicq_u8(straight, vceqq_u8(a, vdupq_n_u8(0)))
+    }
+
+    #[inline(always)]
+    unsafe fn divide(c: uint32x4_t, a: uint32x4_t) -> uint16x4_t {
+        let num = vaddq_u32(vmulq_n_u32(c, 255), vshrq_n_u32::<1>(a));
+        vqmovn_u32(vcvtq_u32_f32(vdivq_f32(
+            vcvtq_f32_u32(num),
+            vcvtq_f32_u32(a),
+        )))
+    }
+
+    pub fn strip_alpha(rgba: &mut [u8]) {
+        let ptr = rgba.as_mut_ptr();
+        // SAFETY: NEON is part of the aarch64 baseline. Block i's 48 RGB
+        // bytes land below block i + 1, which has not been read yet.
+        unsafe {
+            for i in 0..rgba.len() / super::BLOCK {
+                let px = vld4q_u8(ptr.add(i * 64));
+                vst3q_u8(ptr.add(i * 48), uint8x16x3_t(px.0, px.1, px.2));
+            }
+        }
+    }
+}
+
+#[cfg(not(any(target_arch = "x86_64", target_arch = "aarch64")))]
+mod simd {
+    pub use super::scalar::{is_opaque, is_uniform, unpremultiply};
+
+    pub fn strip_alpha(rgba: &mut [u8]) {
+        super::scalar::strip_alpha(rgba, 0)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Premultiplied pixels covering every valid (color, alpha) pair
+    fn all_pixels() -> Vec<u8> {
+        let mut data = Vec::new();
+        for a in 0..=255u8 {
+            for c in 0..=a {
+                data.extend_from_slice(&[c, a - c, c / 2, a]);
+            }
+        }
+        data
+    }
+
+    #[test]
+    fn test_unpremultiply_matches_scalar() {
+        let mut expected = all_pixels();
+        scalar::unpremultiply(&mut expected);
+
+        // Odd length so the scalar tail runs too
+        let mut data = all_pixels();
+        data.truncate(data.len() - 4 * 3);
+        unpremultiply(&mut data);
+        assert_eq!(data, expected[..data.len()]);
+    }
+
+    #[test]
+    fn test_unpremultiply_values() {
+        let mut data = [128, 64, 0, 128, 10, 20, 30, 0, 1, 2, 3, 255].repeat(8);
+        unpremultiply(&mut data);
+        assert_eq!(data[..12], [255, 128, 0, 128, 0, 0, 0, 0, 1, 2, 3, 255]);
+        assert!(data.chunks(12).all(|p| p == &data[..12]));
+    }
+
+    #[test]
+    fn test_is_opaque() {
+        let mut data = vec![255u8; 4 * 37];
+        assert!(is_opaque(&data));
+        for pixel in [0, 15, 16, 31, 36] {
+            data[pixel * 4 + 3] = 254;
+            assert!(!is_opaque(&data), "pixel {}", pixel);
+            data[pixel * 4 + 3] = 255;
+        }
+        // Color channels don't matter
+        data[0] = 0;
+        assert!(is_opaque(&data));
+    }
+
+    #[test]
+    fn test_uniform_color() {
+        let mut data = [12, 34, 56, 78].repeat(37);
+        assert_eq!(uniform_color(&data), Some([12, 34, 56, 78]));
+        for i in [3, 62, 64, 147] {
+            data[i] ^= 1;
+            assert_eq!(uniform_color(&data), None, "byte {}", i);
+            data[i] ^= 1;
+        }
+        assert_eq!(uniform_color(&[]), None);
+    }
+
+    #[test]
+    fn test_strip_alpha_in_place() {
+        let pixels = 16 * 3 + 5;
+        let mut data: Vec<u8> = (0..pixels * 4).map(|i| i as u8).collect();
+        let expected: Vec<u8> = data.chunks(4).flat_map(|p| p[..3].to_vec()).collect();
+
+        let len = strip_alpha(&mut data);
+        assert_eq!(len, pixels * 3);
+        assert_eq!(data[..len], expected[..]);
+    }
+}
@@ -1,124 +1,1570 @@
 //! Renderer pool for efficient tile rendering
 //!
-//! This module provides a pool of native MapLibre renderers.
+//! This module provides a pool of long-lived native MapLibre renderers.
 //!
-//! IMPORTANT: MapLibre Native is NOT thread-safe for concurrent style loading.
-//! We use a global mutex to serialize all render operations, but run them in
-//! spawn_blocking to avoid blocking the async runtime (MapLibre fetches tiles
-//! from our server during rendering).
+//! Each render thread owns its map instances (and the thread-local RunLoop
+//! MapLibre Native creates for it) for its whole lifetime. Render requests are
+//! queued and picked up by the next free render thread, which checks out a map
+//! that already has the requested style loaded (identified by a hash of the
+//! style JSON) with a matching pixel ratio, mode and size, and only moves its
+//! camera before rendering. Style JSON is therefore parsed once per map, not
+//! once per render, and maps are bucketed by size so a steady mix of tile and
+//! metatile sizes does not reallocate framebuffers. When a resource handler
+//! is configured, maps request their tiles, glyphs and sprites through it
+//! in-process.
+//!
+//! Renders are asynchronous: a thread starts a render on one of its maps,
+//! then keeps accepting jobs for its other maps while it drives its RunLoop,
+//! so each thread has up to `maps_per_thread` renders in flight while their
+//! resources load. While renders are in flight the thread blocks on the
+//! RunLoop itself, and a finished render or a newly queued job wakes it. The
+//! native wrapper guarantees that distinct maps on distinct threads can be
+//! driven concurrently. A map is bound to the thread that created it and
+//! never leaves it.
+//!
+//! Jobs are queued per [`Priority`] class, and render threads take tiles
+//! before static images before bulk work. Each class has a bounded depth,
+//! and a render whose estimated queue wait exceeds its deadline is rejected
+//! up front with [`TileServerError::Overloaded`] instead of timing out later.
+//!
+//! Renders whose caller stopped waiting (its client disconnected) or whose
+//! deadline passed are dropped from the queue, and aborted on their map if
+//! they already started, so abandoned work doesn't hold on to render capacity.
+//!
+//! Renders of a [`StyleVariant`] check out a map with the base style loaded
+//! and switch it to the variant by editing the style in place, so variants
+//! of one style share maps, parsed styles and loaded tiles.
+//!
+//! With `workers` set, the render threads run in worker processes instead
+//! (see [`super::process`]), and each of this pool's threads forwards the
+//! jobs it takes to its worker, up to as many at a time as the worker has
+//! maps.
+
+use std::cell::RefCell;
+use std::collections::{HashMap, VecDeque};
+use std::path::PathBuf;
+use std::rc::Rc;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
 
-use std::sync::{Mutex, OnceLock};
+use opentelemetry::KeyValue;
+use serde::{Deserialize, Serialize};
+use tokio::sync::oneshot;
+use tracing::Instrument;
 
-use super::native::{MapMode, NativeMap, RenderOptions, RenderedImage, Size};
+use super::metrics::metrics;
+use super::native::{
+    buffer_pool_stats, run_loop_once, run_loop_wait, shader_cache_stats, shared_resources_stats,
+    tile_cache_stats, BufferPoolStats, MapMode, NativeMap, RenderOptions, RenderStats,
+    RenderedImage, ResourceHandler, RunLoopWaker, ShaderCacheStats, SharedResourceStats, Size,
+};
+use super::process::{Launch, PoolCounters, RenderDone, WorkerProcess};
+use super::types::{EncodeOptions, RenderStyle};
+use super::variant::StyleVariant;
+use crate::config::RenderConfig;
 use crate::error::{Result, TileServerError};
 
-/// Global mutex to serialize all MapLibre Native operations
-/// This is necessary because MapLibre Native has shared state that isn't thread-safe
-static RENDER_MUTEX: OnceLock<Mutex<()>> = OnceLock::new();
+/// Shortest interval at which render threads check for idle maps
+const MIN_SWEEP_INTERVAL: Duration = Duration::from_millis(10);
 
-fn get_render_mutex() -> &'static Mutex<()> {
-    RENDER_MUTEX.get_or_init(|| Mutex::new(()))
+/// Longest interval at which render threads check for idle maps
+const MAX_SWEEP_INTERVAL: Duration = Duration::from_secs(30);
+
+/// Longest a render thread with renders in flight waits on its RunLoop
+/// before checking for abandoned renders
+const RUN_LOOP_TIMEOUT: Duration = Duration::from_millis(50);
+
+/// How often a thread forwarding to a worker process checks on it
+const WORKER_CHECK_INTERVAL: Duration = Duration::from_millis(100);
+
+/// How long to wait before starting another worker process after a failed start
+const WORKER_RESTART_BACKOFF: Duration = Duration::from_secs(1);
+
+/// Scheduling class of a render. Render threads always take a job of the
+/// most urgent class first, and each class queues up to its own depth, so a
+/// burst in one class neither delays nor crowds out a more urgent one.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+pub enum Priority {
+    /// Tiles for interactive map clients
+    Tile,
+    /// Static map images
+    Static,
+    /// Seeding and other bulk rendering
+    Bulk,
+}
+
+impl Priority {
+    const COUNT: usize = 3;
+
+    fn as_str(self) -> &'static str {
+        match self {
+            Priority::Tile => "tile",
+            Priority::Static => "static",
+            Priority::Bulk => "bulk",
+        }
+    }
 }
 
 /// Configuration for a renderer pool
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct PoolConfig {
     /// Default tile size
     pub tile_size: u32,
+    /// Number of dedicated render threads, of each worker process if any
+    pub pool_size: usize,
+    /// Maximum number of map instances kept alive per render thread
+    pub maps_per_thread: usize,
+    /// Idle time after which a map instance is destroyed
+    pub idle_timeout: Duration,
+    /// Tiles per metatile edge (1 disables metatiling)
+    pub metatile: u32,
+    /// Gutter rendered around each metatile, in CSS pixels
+    pub metatile_buffer: u32,
+    /// Rendered tile cache capacity in megabytes (0 disables the cache)
+    pub cache_size_mb: u64,
+    /// Time-to-live for cached tiles
+    pub cache_ttl: Duration,
+    /// Directory of the on-disk cache tier, if enabled
+    pub cache_dir: Option<PathBuf>,
+    /// On-disk cache tier capacity in megabytes
+    pub cache_disk_size_mb: u64,
+    /// Memory each render thread keeps in freed readback buffers, in megabytes
+    pub buffer_pool_mb: u64,
+    /// Memory kept in glyph ranges and sprite files shared by all maps, in megabytes
+    pub shared_resources_mb: u64,
+    /// Memory kept in source tiles shared by all maps, in megabytes
+    pub tile_cache_mb: u64,
+    /// Deadline of tile renders, queueing included
+    pub tile_timeout: Option<Duration>,
+    /// Deadline of static image renders, queueing included
+    pub static_timeout: Option<Duration>,
+    /// Renders of each priority class allowed to wait for a render thread
+    pub queue_depths: [usize; Priority::COUNT],
+    /// Render device of the process, or the backend's default
+    pub device: Option<u32>,
+    /// Worker processes to render in, 0 to render in this process
+    pub workers: usize,
+    /// Shared memory each worker process returns frames through, in megabytes
+    pub worker_frames_mb: u64,
+    /// Resident memory above which a worker process is replaced, in megabytes (0 never)
+    pub worker_max_memory_mb: u64,
+    /// Directory of the shader program binary cache, if enabled
+    pub shader_cache_dir: Option<PathBuf>,
+    /// Add static image overlays to the style rather than drawing them on the image
+    pub gpu_overlays: bool,
+    /// Encoder settings for rendered images
+    pub encode: EncodeOptions,
 }
 
 impl Default for PoolConfig {
     fn default() -> Self {
-        Self { tile_size: 512 }
+        Self::from(&RenderConfig::default())
+    }
+}
+
+impl From<&RenderConfig> for PoolConfig {
+    fn from(config: &RenderConfig) -> Self {
+        Self {
+            tile_size: 512,
+            pool_size: config.pool_size.max(1),
+            maps_per_thread: config.maps_per_thread.max(1),
+            idle_timeout: Duration::from_secs(config.idle_timeout_secs),
+            metatile: config.metatile,
+            metatile_buffer: config.metatile_buffer,
+            cache_size_mb: config.cache_size_mb,
+            cache_ttl: Duration::from_secs(config.cache_ttl_secs),
+            cache_dir: config.cache_dir.clone(),
+            cache_disk_size_mb: config.cache_disk_size_mb,
+            buffer_pool_mb: config.buffer_pool_mb,
+            shared_resources_mb: config.shared_resources_mb,
+            tile_cache_mb: config.tile_cache_mb,
+            tile_timeout: (config.tile_timeout_secs > 0)
+                .then(|| Duration::from_secs(config.tile_timeout_secs)),
+            static_timeout: (config.static_timeout_secs > 0)
+                .then(|| Duration::from_secs(config.static_timeout_secs)),
+            queue_depths: [
+                config.tile_queue_depth,
+                config.static_queue_depth,
+                config.bulk_queue_depth,
+            ],
+            device: config.device,
+            workers: config.workers,
+            worker_frames_mb: config.worker_frames_mb,
+            worker_max_memory_mb: config.worker_max_memory_mb,
+            shader_cache_dir: config.shader_cache_dir.clone(),
+            gpu_overlays: config.gpu_overlays,
+            encode: EncodeOptions::from(config),
+        }
+    }
+}
+
+/// How a render device is reported in logs and metrics
+fn device_label(device: Option<u32>) -> String {
+    device.map_or_else(|| "default".to_string(), |device| device.to_string())
+}
+
+/// Metric attributes of a render
+fn render_attributes(
+    options: &RenderOptions,
+    style_hash: u64,
+    priority: Priority,
+    device: Option<u32>,
+) -> [KeyValue; 5] {
+    [
+        KeyValue::new("render.mode", format!("{:?}", options.mode).to_lowercase()),
+        KeyValue::new("render.scale", options.pixel_ratio as f64),
+        KeyValue::new("render.style", format!("{:016x}", style_hash)),
+        KeyValue::new("render.priority", priority.as_str()),
+        KeyValue::new("render.device", device_label(device)),
+    ]
+}
+
+/// Identifies interchangeable map instances.
+///
+/// The pixel ratio and mode are fixed when a map is created. The size can be
+/// changed but reallocates the map's framebuffer, and the style can be
+/// swapped but is expensive to load.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct MapKey {
+    style_hash: u64,
+    pixel_ratio_bits: u32,
+    mode: MapMode,
+    size: Size,
+}
+
+impl MapKey {
+    fn new(style_hash: u64, options: &RenderOptions) -> Self {
+        Self {
+            style_hash,
+            pixel_ratio_bits: options.pixel_ratio.to_bits(),
+            mode: options.mode,
+            size: options.size,
+        }
+    }
+
+    /// Whether a map with this key can be reused for `other` by loading a new style
+    fn is_compatible(&self, other: &MapKey) -> bool {
+        self.pixel_ratio_bits == other.pixel_ratio_bits && self.mode == other.mode
+    }
+
+    /// Whether a map with this key can be reused for `other` by resizing it
+    fn has_style_of(&self, other: &MapKey) -> bool {
+        self.is_compatible(other) && self.style_hash == other.style_hash
+    }
+}
+
+/// A rendered image and where its time went
+type Rendered = (RenderedImage, RenderStats);
+
+/// Sends a render's result to its caller
+struct Responder(oneshot::Sender<Result<Rendered>>);
+
+impl Responder {
+    fn send(self, result: Result<Rendered>) {
+        let _ = self.0.send(result);
+    }
+
+    /// The caller stopped waiting for the result, e.g. its client disconnected
+    fn is_abandoned(&self) -> bool {
+        self.0.is_closed()
+    }
+}
+
+/// A queued render request
+struct RenderJob {
+    style: RenderStyle,
+    /// Edits of the style to render, if any
+    variant: Option<Arc<StyleVariant>>,
+    /// Renders run in order on one map; a batch has several
+    renders: VecDeque<JobRender>,
+    /// Render thread that must run the job, any if `None`
+    thread: Option<usize>,
+    priority: Priority,
+}
+
+/// One image of a render job
+struct JobRender {
+    options: RenderOptions,
+    respond: Responder,
+    trace: JobTrace,
+    /// When the render is given up on; `options.timeout` counts from queueing
+    deadline: Option<Instant>,
+}
+
+impl JobRender {
+    /// A render and the future of its result
+    fn new(
+        style_hash: u64,
+        priority: Priority,
+        options: RenderOptions,
+    ) -> (Self, impl std::future::Future<Output = Result<Rendered>>) {
+        let (tx, rx) = oneshot::channel();
+        let trace = JobTrace::new(style_hash, priority, &options);
+        let span = trace.span.clone();
+        let render = Self {
+            deadline: options.timeout.map(|timeout| trace.queued + timeout),
+            options,
+            respond: Responder(tx),
+            trace,
+        };
+        let result = async move {
+            rx.await
+                .map_err(|_| TileServerError::RenderError("Render thread terminated".to_string()))?
+        };
+        (render, result.instrument(span))
+    }
+}
+
+impl RenderJob {
+    /// Answer every render of the job with the error
+    fn fail(self, error: TileServerError) {
+        let message = error.to_string();
+        let mut renders = self.renders.into_iter();
+        if let Some(render) = renders.next() {
+            render.respond.send(Err(error));
+        }
+        for render in renders {
+            render
+                .respond
+                .send(Err(TileServerError::RenderError(message.clone())));
+        }
+    }
+
+    /// Drop renders whose callers stopped waiting and fail those past their
+    /// deadline, so they never reach a map
+    fn prune(&mut self, cancelled: &AtomicU64) {
+        let now = Instant::now();
+        for render in std::mem::take(&mut self.renders) {
+            if render.respond.is_abandoned() {
+                cancelled.fetch_add(1, Ordering::Relaxed);
+            } else if render.deadline.is_some_and(|deadline| deadline <= now) {
+                cancelled.fetch_add(1, Ordering::Relaxed);
+                render.respond.send(Err(TileServerError::RenderCancelled(
+                    "deadline exceeded".to_string(),
+                )));
+            } else {
+                self.renders.push_back(render);
+            }
+        }
+    }
+}
+
+/// Where a job's stats are reported
+struct JobTrace {
+    /// The caller's `render` span
+    span: tracing::Span,
+    queued: Instant,
+}
+
+impl JobTrace {
+    fn new(style_hash: u64, priority: Priority, options: &RenderOptions) -> Self {
+        let span = tracing::info_span!(
+            "render",
+            "render.style" = %format_args!("{:016x}", style_hash),
+            "render.priority" = priority.as_str(),
+            "render.mode" = ?options.mode,
+            "render.width" = options.size.width,
+            "render.height" = options.size.height,
+            "render.scale" = options.pixel_ratio,
+            "render.queue_ms" = tracing::field::Empty,
+            "render.style_parse_ms" = tracing::field::Empty,
+            "render.render_ms" = tracing::field::Empty,
+            "render.resource_wait_ms" = tracing::field::Empty,
+            "render.layout_draw_ms" = tracing::field::Empty,
+            "render.readback_ms" = tracing::field::Empty,
+            "render.resource_requests" = tracing::field::Empty,
+            "render.tile_requests" = tracing::field::Empty,
+            "render.failed_requests" = tracing::field::Empty,
+            "render.resource_bytes" = tracing::field::Empty,
+        );
+        Self {
+            span,
+            queued: Instant::now(),
+        }
+    }
+
+    /// Record the stats of the job's render on its span and in the render metrics
+    fn finish(&self, queued: Duration, stats: &RenderStats, attributes: &[KeyValue]) {
+        let ms = |d: Duration| d.as_secs_f64() * 1e3;
+        let span = &self.span;
+        span.record("render.queue_ms", ms(queued));
+        span.record("render.style_parse_ms", ms(stats.style_parse));
+        span.record("render.render_ms", ms(stats.render));
+        span.record("render.resource_wait_ms", ms(stats.resource_wait));
+        span.record("render.layout_draw_ms", ms(stats.layout_and_draw()));
+        span.record("render.readback_ms", ms(stats.readback));
+        span.record("render.resource_requests", stats.resource_requests);
+        span.record("render.tile_requests", stats.tile_requests);
+        span.record("render.failed_requests", stats.failed_requests);
+        span.record("render.resource_bytes", stats.resource_bytes);
+
+        metrics().record(queued, stats, attributes);
+    }
+}
+
+/// Outcome of waiting for the next job
+enum NextJob {
+    Job(RenderJob),
+    Timeout,
+    Closed,
+}
+
+#[derive(Default)]
+struct QueueState {
+    /// Jobs of each priority class, in order of urgency
+    jobs: [VecDeque<RenderJob>; Priority::COUNT],
+    closed: bool,
+    /// Render threads blocked in `pop`, less those already notified
+    sleeping: usize,
+    /// Render threads waiting on their RunLoop with a free map slot
+    loop_waiting: Vec<usize>,
+}
+
+/// Job queues shared by all render threads, one FIFO per priority class.
+/// Jobs bound to a thread are skipped by the others.
+struct JobQueue {
+    state: Mutex<QueueState>,
+    available: Condvar,
+    /// Wakes render threads waiting on their RunLoop, by thread
+    wakers: Mutex<HashMap<usize, RunLoopWaker>>,
+    /// Renders each class may have waiting
+    depths: [usize; Priority::COUNT],
+    /// Renders in flight at once when every map of every thread is busy
+    capacity: usize,
+    in_flight: Arc<AtomicUsize>,
+    /// Moving average of the time a render keeps its map busy, in microseconds
+    render_micros: AtomicU64,
+    /// Renders rejected by admission control
+    shed: AtomicU64,
+}
+
+impl JobQueue {
+    fn new(config: &PoolConfig, in_flight: Arc<AtomicUsize>) -> Self {
+        Self {
+            state: Mutex::default(),
+            available: Condvar::new(),
+            wakers: Mutex::default(),
+            depths: config.queue_depths,
+            capacity: (config.pool_size * config.maps_per_thread * config.workers.max(1)).max(1),
+            in_flight,
+            render_micros: AtomicU64::new(0),
+            shed: AtomicU64::new(0),
+        }
+    }
+
+    /// Queue a job, unless its class is full or it would wait past its
+    /// deadline, so overload is turned away before it builds up. A rejected
+    /// job's renders fail with [`TileServerError::Overloaded`].
+    fn push(&self, job: RenderJob) -> Result<()> {
+        let mut state = self.state.lock().unwrap_or_else(|e| e.into_inner());
+        if state.closed {
+            return Err(TileServerError::RenderError(
+                "Renderer pool is shut down".to_string(),
+            ));
+        }
+
+        let class = job.priority as usize;
+        let renders = |jobs: &VecDeque<RenderJob>| jobs.iter().map(|j| j.renders.len()).sum();
+        let waiting: usize = renders(&state.jobs[class]);
+        // Jobs of more urgent classes are taken first
+        let ahead: usize = state.jobs[..=class].iter().map(renders).sum();
+        let wait = self.estimated_wait(ahead);
+        let timeout = job
+            .renders
+            .front()
+            .and_then(|render| render.options.timeout);
+        let reason = if waiting >= self.depths[class] {
+            Some("queue_full")
+        } else if timeout.is_some_and(|timeout| wait > timeout) {
+            Some("deadline")
+        } else {
+            None
+        };
+        if let Some(reason) = reason {
+            drop(state);
+            self.shed.fetch_add(1, Ordering::Relaxed);
+            metrics().shed_renders.add(
+                1,
+                &[
+                    KeyValue::new("render.priority", job.priority.as_str()),
+                    KeyValue::new("reason", reason),
+                ],
+            );
+            let error = TileServerError::Overloaded {
+                retry_after: (wait.as_secs_f64().ceil() as u64).max(1),
+            };
+            job.fail(error.shared());
+            return Err(error);
+        }
+
+        let thread = job.thread;
+        state.jobs[class].push_back(job);
+        // An unbound job wakes one thread that can start it: an idle one,
+        // else one with a free map slot waiting on its RunLoop
+        let woken = match thread {
+            Some(_) => thread,
+            None if state.sleeping > 0 => {
+                state.sleeping -= 1;
+                None
+            }
+            None => state.loop_waiting.pop(),
+        };
+        drop(state);
+        if thread.is_some() {
+            self.available.notify_all();
+        } else if woken.is_none() {
+            self.available.notify_one();
+        }
+        if let Some(woken) = woken {
+            self.wake(Some(woken));
+        }
+        Ok(())
+    }
+
+    /// Let a render thread be woken from its RunLoop when jobs arrive
+    fn register(&self, thread: usize, waker: RunLoopWaker) {
+        let mut wakers = self.wakers.lock().unwrap_or_else(|e| e.into_inner());
+        wakers.insert(thread, waker);
+    }
+
+    fn unregister(&self, thread: usize) {
+        let mut wakers = self.wakers.lock().unwrap_or_else(|e| e.into_inner());
+        wakers.remove(&thread);
+    }
+
+    /// Wake render thread `thread`, or all of them, from their RunLoop
+    fn wake(&self, thread: Option<usize>) {
+        let wakers = self.wakers.lock().unwrap_or_else(|e| e.into_inner());
+        match thread {
+            Some(thread) => wakers.get(&thread).into_iter().for_each(RunLoopWaker::wake),
+            None => wakers.values().for_each(RunLoopWaker::wake),
+        }
+    }
+
+    /// How long a render queued behind `ahead` others would wait for a map,
+    /// going by recent render times
+    fn estimated_wait(&self, ahead: usize) -> Duration {
+        let queued = ahead + self.in_flight.load(Ordering::Relaxed) + 1;
+        let rounds = queued.saturating_sub(self.capacity).div_ceil(self.capacity);
+        Duration::from_micros(self.render_micros.load(Ordering::Relaxed)) * rounds as u32
+    }
+
+    /// Fold the time a completed render kept its map busy into the average
+    fn record_render(&self, busy: Duration) {
+        let sample = busy.as_micros() as u64;
+        let average = self.render_micros.load(Ordering::Relaxed);
+        let next = if average == 0 {
+            sample
+        } else {
+            (average * 7 + sample) / 8
+        };
+        self.render_micros.store(next, Ordering::Relaxed);
+    }
+
+    /// Renders waiting for a render thread
+    fn len(&self) -> usize {
+        let state = self.state.lock().unwrap_or_else(|e| e.into_inner());
+        state
+            .jobs
+            .iter()
+            .flatten()
+            .map(|job| job.renders.len())
+            .sum()
+    }
+
+    /// Wait up to `timeout` for the next job render thread `thread` may run.
+    /// A zero timeout means the thread goes on to wait on its RunLoop with a
+    /// free map slot, where the next unbound job wakes it.
+    fn pop(&self, thread: usize, timeout: Duration) -> NextJob {
+        let deadline = Instant::now() + timeout;
+        let mut state = self.state.lock().unwrap_or_else(|e| e.into_inner());
+        state.loop_waiting.retain(|&t| t != thread);
+        loop {
+            let next = state.jobs.iter().enumerate().find_map(|(class, jobs)| {
+                jobs.iter()
+                    .position(|job| job.thread.map_or(true, |t| t == thread))
+                    .map(|index| (class, index))
+            });
+            if let Some(job) = next.and_then(|(class, index)| state.jobs[class].remove(index)) {
+                return NextJob::Job(job);
+            }
+            if state.closed {
+                return NextJob::Closed;
+            }
+            let now = Instant::now();
+            if now >= deadline {
+                if timeout.is_zero() {
+                    state.loop_waiting.push(thread);
+                }
+                return NextJob::Timeout;
+            }
+            state.sleeping += 1;
+            state = self
+                .available
+                .wait_timeout(state, deadline - now)
+                .unwrap_or_else(|e| e.into_inner())
+                .0;
+            // A push that notified this thread already counted it off. An
+            // undercount only sends pushes to RunLoop waiters instead.
+            state.sleeping = state.sleeping.saturating_sub(1);
+        }
+    }
+
+    fn close(&self) {
+        self.state.lock().unwrap_or_else(|e| e.into_inner()).closed = true;
+        self.available.notify_all();
+        self.wake(None);
+    }
+
+    fn is_closed(&self) -> bool {
+        self.state.lock().unwrap_or_else(|e| e.into_inner()).closed
+    }
+}
+
+/// A map instance owned by a render thread
+struct PooledMap {
+    id: u64,
+    key: MapKey,
+    map: NativeMap,
+    last_used: Instant,
+    /// A render is in flight; the map must not be reused or destroyed
+    busy: bool,
+    /// The renders in flight, once they have started
+    render: Option<InFlight>,
+    /// Edits applied to the loaded style
+    variant: Option<Arc<StyleVariant>>,
+}
+
+/// The async renders of a job in flight on a map
+struct InFlight {
+    /// In the order their results arrive
+    renders: VecDeque<StartedRender>,
+    /// The map was asked to abort the renders
+    cancelled: bool,
+    /// A render failed, leaving the map's state unknown
+    failed: bool,
+}
+
+/// A started render and where its result goes
+struct StartedRender {
+    respond: Responder,
+    trace: JobTrace,
+    /// Time the render waited for this thread
+    queued: Duration,
+    attributes: [KeyValue; 5],
+}
+
+/// A finished async render, collected on the render thread
+struct Completion {
+    map_id: u64,
+    result: Result<RenderedImage>,
+    /// Stats of a pipelined render; others read them from the map
+    stats: Option<RenderStats>,
+}
+
+type Completions = Rc<RefCell<Vec<Completion>>>;
+
+/// A dedicated render thread and the maps it owns
+struct RenderWorker {
+    index: usize,
+    config: PoolConfig,
+    queue: Arc<JobQueue>,
+    resource_handler: Option<Arc<dyn ResourceHandler>>,
+    maps: Vec<PooledMap>,
+    next_map_id: u64,
+    live_maps: Arc<AtomicUsize>,
+    in_flight: Arc<AtomicUsize>,
+    renders: Arc<AtomicU64>,
+    style_loads: Arc<AtomicU64>,
+    resizes: Arc<AtomicU64>,
+    style_edits: Arc<AtomicU64>,
+    cancelled: Arc<AtomicU64>,
+}
+
+impl RenderWorker {
+    fn run(mut self) {
+        let sweep_interval = self
+            .config
+            .idle_timeout
+            .clamp(MIN_SWEEP_INTERVAL, MAX_SWEEP_INTERVAL);
+        let completions = Completions::default();
+        self.queue.register(self.index, RunLoopWaker::current());
+
+        loop {
+            let busy = self.busy_maps();
+            if busy < self.config.maps_per_thread {
+                // Sleep on the queue when idle. With renders in flight the
+                // RunLoop wait in drive is woken by new jobs instead
+                let timeout = if busy == 0 {
+                    sweep_interval
+                } else {
+                    Duration::ZERO
+                };
+                match self.queue.pop(self.index, timeout) {
+                    NextJob::Job(job) => {
+                        self.start(job, &completions);
+                        // Start whatever else is already queued before driving the loop
+                        while self.busy_maps() < self.config.maps_per_thread {
+                            match self.queue.pop(self.index, Duration::ZERO) {
+                                NextJob::Job(job) => self.start(job, &completions),
+                                _ => break,
+                            }
+                        }
+                    }
+                    NextJob::Timeout => {}
+                    NextJob::Closed => break,
+                }
+            }
+
+            self.drive(&completions);
+            self.evict_idle();
+        }
+
+        // Let renders in flight finish and reach their callers
+        while self.busy_maps() > 0 {
+            self.drive(&completions);
+        }
+        self.queue.unregister(self.index);
+
+        // Maps must be destroyed on the thread that created them
+        self.live_maps.fetch_sub(self.maps.len(), Ordering::Relaxed);
+        self.maps.clear();
+    }
+
+    fn busy_maps(&self) -> usize {
+        self.maps.iter().filter(|m| m.busy).count()
+    }
+
+    /// Check out a map for the job and start rendering on it
+    fn start(&mut self, mut job: RenderJob, completions: &Completions) {
+        job.prune(&self.cancelled);
+        let Some(first) = job.renders.front() else {
+            return;
+        };
+        let key = MapKey::new(job.style.hash(), &first.options);
+        let variant = job.variant.as_ref().map(|v| v.hash());
+        let index = match self.checkout(key, variant, &first.options) {
+            Ok(index) => index,
+            Err(e) => return job.fail(e),
+        };
+        let pooled = &mut self.maps[index];
+        pooled.last_used = Instant::now();
+
+        let loaded = Self::load_style(pooled, &job.style, &self.style_loads)
+            .and_then(|()| Self::switch_variant(pooled, job.variant.as_ref(), &self.style_edits));
+        if let Err(e) = loaded {
+            // The map's state is unknown after a failure, don't hand it out again
+            self.remove(index);
+            return job.fail(e);
+        }
+
+        pooled.busy = true;
+        self.in_flight.fetch_add(1, Ordering::Relaxed);
+        self.render_job(index, job, completions);
+    }
+
+    /// Start the job's renders on its busy map, or release the map if none
+    /// are left. A batch is pipelined, so each image is read back while the
+    /// next one is drawn.
+    fn render_job(&mut self, index: usize, mut job: RenderJob, completions: &Completions) {
+        job.prune(&self.cancelled);
+        if job.renders.is_empty() {
+            return self.release(index);
+        }
+
+        let now = Instant::now();
+        let pooled = &mut self.maps[index];
+        let mut options = Vec::with_capacity(job.renders.len());
+        let mut started = VecDeque::with_capacity(job.renders.len());
+        for render in job.renders {
+            let mut render_options = render.options;
+            // The map gets whatever time queueing left of the deadline
+            if let Some(deadline) = render.deadline {
+                render_options.timeout = Some(deadline.saturating_duration_since(now));
+            }
+
+            let key = MapKey::new(job.style.hash(), &render_options);
+            if pooled.key.size != key.size {
+                // The render resizes the map and reallocates its framebuffer
+                self.resizes.fetch_add(1, Ordering::Relaxed);
+            }
+            pooled.key = key;
+
+            started.push_back(StartedRender {
+                respond: render.respond,
+                queued: render.trace.queued.elapsed(),
+                trace: render.trace,
+                attributes: render_attributes(
+                    &render_options,
+                    job.style.hash(),
+                    job.priority,
+                    self.config.device,
+                ),
+            });
+            options.push(render_options);
+        }
+        pooled.render = Some(InFlight {
+            renders: started,
+            cancelled: false,
+            failed: false,
+        });
+
+        let map_id = pooled.id;
+        let completions = completions.clone();
+        if options.len() == 1 {
+            pooled.map.render_async(
+                options.pop(),
+                Box::new(move |result| {
+                    completions.borrow_mut().push(Completion {
+                        map_id,
+                        result,
+                        stats: None,
+                    })
+                }),
+            );
+        } else {
+            pooled.map.render_pipelined(
+                &options,
+                Box::new(move |_, result, stats| {
+                    completions.borrow_mut().push(Completion {
+                        map_id,
+                        result,
+                        stats: Some(stats),
+                    })
+                }),
+            );
+        }
+    }
+
+    /// Mark a busy map free again
+    fn release(&mut self, index: usize) {
+        let pooled = &mut self.maps[index];
+        pooled.busy = false;
+        pooled.last_used = Instant::now();
+        self.in_flight.fetch_sub(1, Ordering::Relaxed);
+    }
+
+    /// Abort renders in flight whose callers stopped waiting, so their maps
+    /// don't keep loading resources nobody will see
+    fn cancel_abandoned(&mut self) {
+        for pooled in &mut self.maps {
+            let Some(render) = &mut pooled.render else {
+                continue;
+            };
+            if !render.cancelled && render.renders.iter().all(|r| r.respond.is_abandoned()) {
+                render.cancelled = true;
+                if let Err(e) = pooled.map.cancel() {
+                    tracing::warn!("Failed to cancel abandoned render: {}", e);
+                }
+            }
+        }
+    }
+
+    /// Drive the RunLoop, waiting for a render to finish or a job to arrive
+    /// unless one already has, and hand finished renders back to their callers
+    fn drive(&mut self, completions: &Completions) {
+        if self.busy_maps() > 0 {
+            self.cancel_abandoned();
+            if completions.borrow().is_empty() {
+                run_loop_wait(RUN_LOOP_TIMEOUT);
+            } else {
+                run_loop_once();
+            }
+        }
+
+        let finished = std::mem::take(&mut *completions.borrow_mut());
+        for Completion {
+            map_id,
+            result,
+            stats,
+        } in finished
+        {
+            let Some(index) = self.maps.iter().position(|m| m.id == map_id) else {
+                continue;
+            };
+            let pooled = &mut self.maps[index];
+            let Some(in_flight) = &mut pooled.render else {
+                continue;
+            };
+            let Some(StartedRender {
+                respond,
+                trace,
+                queued,
+                attributes,
+            }) = in_flight.renders.pop_front()
+            else {
+                continue;
+            };
+            let result = result.map(|image| {
+                let stats = stats.unwrap_or_else(|| pooled.map.render_stats());
+                trace.finish(queued, &stats, &attributes);
+                self.queue
+                    .record_render(stats.style_parse + stats.render + stats.readback);
+                (image, stats)
+            });
+            self.renders.fetch_add(1, Ordering::Relaxed);
+
+            // An aborted render leaves its map usable, other failures leave
+            // the map's state unknown. The rest of a batch still renders on
+            // it, as they are already queued on the map.
+            let aborted = matches!(result, Err(TileServerError::RenderCancelled(_)));
+            if aborted {
+                self.cancelled.fetch_add(1, Ordering::Relaxed);
+            } else if result.is_err() {
+                in_flight.failed = true;
+            }
+            if in_flight.renders.is_empty() {
+                let failed = in_flight.failed;
+                pooled.render = None;
+                self.release(index);
+                if failed {
+                    self.remove(index);
+                }
+            }
+            respond.send(result);
+        }
+    }
+
+    /// Load the style unless the map already has it
+    fn load_style(
+        pooled: &mut PooledMap,
+        style: &RenderStyle,
+        style_loads: &AtomicU64,
+    ) -> Result<()> {
+        if pooled.map.style_hash() == style.hash() {
+            return Ok(());
+        }
+        style_loads.fetch_add(1, Ordering::Relaxed);
+        // A freshly loaded style has no edits
+        pooled.variant = None;
+        pooled.map.load_style_with_hash(style.json(), style.hash())
+    }
+
+    /// Undo the edits of the map's current variant and apply those of
+    /// `variant`, unless the map already renders it
+    fn switch_variant(
+        pooled: &mut PooledMap,
+        variant: Option<&Arc<StyleVariant>>,
+        style_edits: &AtomicU64,
+    ) -> Result<()> {
+        if pooled.variant.as_ref().map(|v| v.hash()) == variant.map(|v| v.hash()) {
+            return Ok(());
+        }
+        style_edits.fetch_add(1, Ordering::Relaxed);
+        if let Some(current) = pooled.variant.take() {
+            current.undo(&mut pooled.map)?;
+        }
+        if let Some(variant) = variant {
+            variant.apply(&mut pooled.map)?;
+            pooled.variant = Some(variant.clone());
+        }
+        Ok(())
+    }
+
+    /// Find a map for the key, preferring one that already has the style loaded
+    /// at the requested size, with the variant's edits applied. Below capacity
+    /// a new map is created for a new size, so each size keeps its own
+    /// framebuffer. At capacity the least recently used map with the style is
+    /// resized, or else the least recently used compatible map is reused with
+    /// the new style, or else the least recently used map is replaced by a new
+    /// one. Maps with a render in flight are never picked.
+    fn checkout(
+        &mut self,
+        key: MapKey,
+        variant: Option<u64>,
+        options: &RenderOptions,
+    ) -> Result<usize> {
+        let renders_variant = |m: &PooledMap| m.variant.as_ref().map(|v| v.hash()) == variant;
+        if let Some(index) = self
+            .maps
+            .iter()
+            .position(|m| !m.busy && m.key == key && renders_variant(m))
+        {
+            return Ok(index);
+        }
+        if let Some(index) = self.maps.iter().position(|m| !m.busy && m.key == key) {
+            return Ok(index);
+        }
+
+        if self.maps.len() >= self.config.maps_per_thread {
+            let least_recently_used = |maps: &[PooledMap], accept: &dyn Fn(&MapKey) -> bool| {
+                (0..maps.len())
+                    .filter(|&i| !maps[i].busy && accept(&maps[i].key))
+                    .min_by_key(|&i| maps[i].last_used)
+            };
+
+            if let Some(index) = least_recently_used(&self.maps, &|k| k.has_style_of(&key)) {
+                return Ok(index);
+            }
+            if let Some(index) = least_recently_used(&self.maps, &|k| k.is_compatible(&key)) {
+                return Ok(index);
+            }
+
+            // Make room by destroying the least recently used map
+            if let Some(index) = least_recently_used(&self.maps, &|_| true) {
+                self.remove(index);
+            }
+        }
+
+        let map = match &self.resource_handler {
+            Some(handler) => NativeMap::with_resource_handler(
+                options.size,
+                options.pixel_ratio,
+                options.mode,
+                handler.clone(),
+            )?,
+            None => NativeMap::new(options.size, options.pixel_ratio, options.mode)?,
+        };
+        self.next_map_id += 1;
+        self.maps.push(PooledMap {
+            id: self.next_map_id,
+            key,
+            map,
+            last_used: Instant::now(),
+            busy: false,
+            render: None,
+            variant: None,
+        });
+        self.live_maps.fetch_add(1, Ordering::Relaxed);
+
+        Ok(self.maps.len() - 1)
+    }
+
+    fn remove(&mut self, index: usize) {
+        self.maps.swap_remove(index);
+        self.live_maps.fetch_sub(1, Ordering::Relaxed);
+    }
+
+    /// Destroy maps that have not been used within the idle timeout
+    fn evict_idle(&mut self) {
+        let idle_timeout = self.config.idle_timeout;
+        let before = self.maps.len();
+        self.maps
+            .retain(|m| m.busy || m.last_used.elapsed() < idle_timeout);
+        let evicted = before - self.maps.len();
+        if evicted > 0 {
+            self.live_maps.fetch_sub(evicted, Ordering::Relaxed);
+            tracing::debug!("Evicted {} idle map instance(s)", evicted);
+        }
+    }
+}
+
+/// A pool thread that forwards the jobs it takes to a worker process, and
+/// replaces the process when it exits or outgrows its memory limit
+struct ProcessWorker {
+    index: usize,
+    /// Configuration of the worker's own pool
+    config: PoolConfig,
+    max_scale: u8,
+    launch: Launch,
+    queue: Arc<JobQueue>,
+    resource_handler: Option<Arc<dyn ResourceHandler>>,
+    counters: PoolCounters,
+    in_flight: Arc<AtomicUsize>,
+    renders: Arc<AtomicU64>,
+    restarts: Arc<AtomicU64>,
+}
+
+impl ProcessWorker {
+    fn start_process(&self) -> Result<WorkerProcess> {
+        WorkerProcess::start(
+            self.index,
+            self.launch,
+            &self.config,
+            self.max_scale,
+            self.resource_handler.clone(),
+            self.counters.clone(),
+        )
+    }
+
+    fn run(self, process: WorkerProcess) {
+        let capacity = (self.config.pool_size * self.config.maps_per_thread).max(1);
+        let max_memory = self.config.worker_max_memory_mb << 20;
+        let mut current = Some(process);
+        // Replaced processes finishing their renders
+        let mut retiring: Vec<WorkerProcess> = Vec::new();
+        let mut next_start = Instant::now();
+
+        loop {
+            if let Some(process) = &current {
+                if !process.is_alive() {
+                    // Its renders in flight have failed, others go to a new process
+                    tracing::warn!("Render worker {} exited, starting another", self.index);
+                    current = None;
+                } else if max_memory > 0 && process.resident_bytes() > max_memory {
+                    tracing::info!(
+                        "Render worker {} uses {} MB, replacing it",
+                        self.index,
+                        process.resident_bytes() >> 20
+                    );
+                    retiring.extend(current.take());
+                }
+            }
+            if current.is_none() && Instant::now() >= next_start && !self.queue.is_closed() {
+                match self.start_process() {
+                    Ok(process) => {
+                        self.restarts.fetch_add(1, Ordering::Relaxed);
+                        current = Some(process);
+                    }
+                    Err(e) => {
+                        tracing::error!("Failed to start render worker {}: {}", self.index, e);
+                        next_start = Instant::now() + WORKER_RESTART_BACKOFF;
+                    }
+                }
+            }
+            // Dropping a process waits for it to exit
+            retiring.retain(|process| process.is_alive() && process.jobs() > 0);
+
+            match &mut current {
+                Some(process) if process.jobs() < capacity => {
+                    match self.queue.pop(self.index, WORKER_CHECK_INTERVAL) {
+                        NextJob::Job(job) => self.forward(process, job),
+                        NextJob::Timeout => {}
+                        NextJob::Closed => break,
+                    }
+                }
+                Some(process) => process.wait_for_jobs(capacity, WORKER_CHECK_INTERVAL),
+                None if self.queue.is_closed() => break,
+                None => std::thread::sleep(
+                    next_start
+                        .saturating_duration_since(Instant::now())
+                        .min(WORKER_CHECK_INTERVAL),
+                ),
+            }
+        }
+
+        // Let renders in flight finish
+        for process in current.iter().chain(&retiring) {
+            while process.is_alive() && process.jobs() > 0 {
+                process.wait_for_jobs(1, WORKER_CHECK_INTERVAL);
+            }
+        }
+    }
+
+    /// Forward a job to the worker process. Its renders are answered as
+    /// their frames come back.
+    fn forward(&self, process: &mut WorkerProcess, mut job: RenderJob) {
+        job.prune(&self.counters.cancelled);
+        if job.renders.is_empty() {
+            return;
+        }
+
+        let now = Instant::now();
+        let left = Arc::new(AtomicUsize::new(job.renders.len()));
+        self.in_flight.fetch_add(1, Ordering::Relaxed);
+        let renders = job
+            .renders
+            .into_iter()
+            .map(|render| {
+                let JobRender {
+                    mut options,
+                    respond,
+                    trace,
+                    deadline,
+                } = render;
+                // The worker gets whatever time queueing left of the deadline
+                if let Some(deadline) = deadline {
+                    options.timeout = Some(deadline.saturating_duration_since(now));
+                }
+                let queued = trace.queued.elapsed();
+                let attributes =
+                    render_attributes(&options, job.style.hash(), job.priority, self.config.device);
+                let (queue, renders, in_flight, left) = (
+                    self.queue.clone(),
+                    self.renders.clone(),
+                    self.in_flight.clone(),
+                    left.clone(),
+                );
+                let done: RenderDone = Box::new(move |result| {
+                    if let Ok((_, stats)) = &result {
+                        trace.finish(queued, stats, &attributes);
+                        queue.record_render(stats.style_parse + stats.render + stats.readback);
+                    }
+                    renders.fetch_add(1, Ordering::Relaxed);
+                    if left.fetch_sub(1, Ordering::Relaxed) == 1 {
+                        in_flight.fetch_sub(1, Ordering::Relaxed);
+                    }
+                    respond.send(result);
+                });
+                (options, done)
+            })
+            .collect();
+
+        process.render(
+            &job.style,
+            job.variant.as_deref(),
+            job.priority,
+            job.thread.is_some(),
+            renders,
+        );
     }
 }
 
 /// Pool of native MapLibre renderers
 ///
-/// Currently uses a global mutex to serialize all render operations.
-/// Each render creates a fresh renderer to avoid thread-safety issues
-/// with MapLibre Native's shared state.
+/// Owns a fixed number of render threads, each keeping its own long-lived
+/// map instances. Requests are dispatched to the next free thread.
 pub struct RendererPool {
     /// Configuration
     config: PoolConfig,
     /// Maximum scale factor
     max_scale: u8,
+    /// Pending render jobs
+    queue: Arc<JobQueue>,
+    /// Render thread handles
+    workers: Vec<JoinHandle<()>>,
+    /// Number of map instances currently alive across all threads
+    live_maps: Arc<AtomicUsize>,
+    /// Number of renders currently in flight across all threads
+    in_flight: Arc<AtomicUsize>,
+    /// Number of renders completed
+    renders: Arc<AtomicU64>,
+    /// Number of times a style was parsed into a map
+    style_loads: Arc<AtomicU64>,
+    /// Number of times a map was resized for a render
+    resizes: Arc<AtomicU64>,
+    /// Number of times a map was switched to another variant of its style
+    style_edits: Arc<AtomicU64>,
+    /// Number of renders dropped or aborted for their caller or deadline
+    cancelled: Arc<AtomicU64>,
+    /// Counters of worker processes, if rendering in them
+    processes: Option<PoolCounters>,
+    /// Number of worker processes started to replace others
+    worker_restarts: Arc<AtomicU64>,
 }
 
 impl RendererPool {
-    /// Create a new renderer pool
-    pub fn new(config: PoolConfig, max_scale: u8) -> Result<Self> {
+    /// Create a new renderer pool.
+    /// Maps request their resources from `resource_handler` if given, or from
+    /// MapLibre's default (network) file source otherwise.
+    pub fn new(
+        config: PoolConfig,
+        max_scale: u8,
+        resource_handler: Option<Arc<dyn ResourceHandler>>,
+    ) -> Result<Self> {
+        Self::with_launch(config, max_scale, resource_handler, Launch::Process)
+    }
+
+    /// Create a pool whose worker processes, if any, are started with `launch`
+    fn with_launch(
+        config: PoolConfig,
+        max_scale: u8,
+        resource_handler: Option<Arc<dyn ResourceHandler>>,
+        launch: Launch,
+    ) -> Result<Self> {
+        let live_maps = Arc::new(AtomicUsize::new(0));
+        let in_flight = Arc::new(AtomicUsize::new(0));
+        let queue = Arc::new(JobQueue::new(&config, in_flight.clone()));
+        let renders = Arc::new(AtomicU64::new(0));
+        let style_loads = Arc::new(AtomicU64::new(0));
+        let resizes = Arc::new(AtomicU64::new(0));
+        let style_edits = Arc::new(AtomicU64::new(0));
+        let cancelled = Arc::new(AtomicU64::new(0));
+
+        let mut pool = Self {
+            config: config.clone(),
+            max_scale,
+            queue: queue.clone(),
+            workers: Vec::with_capacity(config.pool_size),
+            live_maps: live_maps.clone(),
+            in_flight: in_flight.clone(),
+            renders: renders.clone(),
+            style_loads: style_loads.clone(),
+            resizes: resizes.clone(),
+            style_edits: style_edits.clone(),
+            cancelled: cancelled.clone(),
+            processes: None,
+            worker_restarts: Arc::default(),
+        };
+
+        if config.workers > 0 {
+            pool.start_processes(launch, resource_handler)?;
+            return Ok(pool);
+        }
+
         // Initialize MapLibre Native
         super::native::init()?;
+        super::native::set_buffer_pool_limit(config.buffer_pool_mb);
+        super::native::set_shared_resources_limit(config.shared_resources_mb);
+        // Source tiles may change as often as rendered ones expire
+        super::native::set_tile_cache_limit(config.tile_cache_mb, config.cache_ttl);
+        if let Some(device) = config.device {
+            super::native::set_render_device(device)?;
+        }
+        super::native::set_shader_cache_dir(config.shader_cache_dir.as_deref())?;
+
+        for index in 0..config.pool_size {
+            let worker = RenderWorker {
+                index,
+                config: config.clone(),
+                queue: queue.clone(),
+                resource_handler: resource_handler.clone(),
+                maps: Vec::new(),
+                next_map_id: 0,
+                live_maps: live_maps.clone(),
+                in_flight: in_flight.clone(),
+                renders: renders.clone(),
+                style_loads: style_loads.clone(),
+                resizes: resizes.clone(),
+                style_edits: style_edits.clone(),
+                cancelled: cancelled.clone(),
+            };
+
+            let handle = std::thread::Builder::new()
+                .name(format!("render-{}", index))
+                .spawn(move || worker.run())
+                .map_err(|e| {
+                    TileServerError::RenderError(format!("Failed to spawn render thread: {}", e))
+                })?;
+            pool.workers.push(handle);
+        }
 
         tracing::info!(
-            "Renderer pool initialized (tile_size={}, max_scale={})",
+            "Renderer pool initialized (tile_size={}, max_scale={}, threads={}, maps_per_thread={}, idle_timeout={}s, device={} of {})",
             config.tile_size,
-            max_scale
+            max_scale,
+            config.pool_size,
+            config.maps_per_thread,
+            config.idle_timeout.as_secs(),
+            device_label(config.device),
+            super::native::render_device_count()
         );
 
-        Ok(Self { config, max_scale })
+        Ok(pool)
+    }
+
+    /// Start the worker processes, and a thread forwarding jobs to each
+    fn start_processes(
+        &mut self,
+        launch: Launch,
+        resource_handler: Option<Arc<dyn ResourceHandler>>,
+    ) -> Result<()> {
+        let counters = PoolCounters {
+            maps: self.live_maps.clone(),
+            style_loads: self.style_loads.clone(),
+            resizes: self.resizes.clone(),
+            style_edits: self.style_edits.clone(),
+            cancelled: self.cancelled.clone(),
+            ..PoolCounters::default()
+        };
+        self.processes = Some(counters.clone());
+        let devices = super::native::render_device_count();
+
+        for index in 0..self.config.workers {
+            // Workers spread over the render devices unless one is set
+            let device = self
+                .config
+                .device
+                .or_else(|| (devices > 1).then(|| index as u32 % devices));
+            let config = PoolConfig {
+                workers: 0,
+                device,
+                ..self.config.clone()
+            };
+            let process = WorkerProcess::start(
+                index,
+                launch,
+                &config,
+                self.max_scale,
+                resource_handler.clone(),
+                counters.clone(),
+            )?;
+            let worker = ProcessWorker {
+                index,
+                config,
+                max_scale: self.max_scale,
+                launch,
+                queue: self.queue.clone(),
+                resource_handler: resource_handler.clone(),
+                counters: counters.clone(),
+                in_flight: self.in_flight.clone(),
+                renders: self.renders.clone(),
+                restarts: self.worker_restarts.clone(),
+            };
+
+            let handle = std::thread::Builder::new()
+                .name(format!("render-{}", index))
+                .spawn(move || worker.run(process))
+                .map_err(|e| {
+                    TileServerError::RenderError(format!("Failed to spawn render thread: {}", e))
+                })?;
+            self.workers.push(handle);
+        }
+
+        tracing::info!(
+            "Renderer pool initialized (tile_size={}, max_scale={}, workers={}, threads_per_worker={}, maps_per_thread={}, idle_timeout={}s, devices={})",
+            self.config.tile_size,
+            self.max_scale,
+            self.config.workers,
+            self.config.pool_size,
+            self.config.maps_per_thread,
+            self.config.idle_timeout.as_secs(),
+            devices
+        );
+        Ok(())
+    }
+
+    /// Queue a render job and wait for a render thread to complete it.
+    async fn submit(
+        &self,
+        style: &RenderStyle,
+        options: RenderOptions,
+        priority: Priority,
+    ) -> Result<RenderedImage> {
+        self.submit_to(None, style, None, options, priority).await
+    }
+
+    /// Queue a render job for `thread` (any thread if `None`) and wait for it
+    async fn submit_to(
+        &self,
+        thread: Option<usize>,
+        style: &RenderStyle,
+        variant: Option<Arc<StyleVariant>>,
+        options: RenderOptions,
+        priority: Priority,
+    ) -> Result<RenderedImage> {
+        let mut results = self.queue_renders(thread, style, variant, vec![options], priority);
+        let (image, _) = results.remove(0).await?;
+        Ok(image)
+    }
+
+    /// Queue renders of one style for `thread` (any thread if `None`), in
+    /// order on one map, and return the future of each result with its
+    /// stats. Runs of renders that need another map (a different mode or
+    /// pixel ratio) go to a job of their own.
+    pub(super) fn queue_renders(
+        &self,
+        thread: Option<usize>,
+        style: &RenderStyle,
+        variant: Option<Arc<StyleVariant>>,
+        options: Vec<RenderOptions>,
+        priority: Priority,
+    ) -> Vec<impl std::future::Future<Output = Result<Rendered>>> {
+        let mut results = Vec::with_capacity(options.len());
+        let mut job: Option<(MapKey, VecDeque<JobRender>)> = None;
+        let mut jobs = Vec::new();
+
+        for options in options {
+            let key = MapKey::new(style.hash(), &options);
+            let (render, result) = JobRender::new(style.hash(), priority, options);
+            results.push(result);
+            match &mut job {
+                Some((first, renders)) if first.is_compatible(&key) => renders.push_back(render),
+                _ => jobs.extend(job.replace((key, VecDeque::from([render])))),
+            }
+        }
+        jobs.extend(job);
+
+        for (_, renders) in jobs {
+            let job = RenderJob {
+                style: style.clone(),
+                variant: variant.clone(),
+                renders,
+                thread,
+                priority,
+            };
+            // The job's renders fail when it is rejected or dropped
+            let _ = self.queue.push(job);
+        }
+
+        results
+    }
+
+    /// Clamp a requested scale factor to the supported range
+    pub fn clamp_scale(&self, scale: u8) -> u8 {
+        scale.min(self.max_scale).max(1)
+    }
+
+    /// Pool configuration
+    pub fn config(&self) -> &PoolConfig {
+        &self.config
     }
 
-    /// Render a tile
+    /// Render a tile, returning raw pixels for the caller to encode
     pub async fn render_tile(
         &self,
-        style_json: &str,
+        style: &RenderStyle,
         z: u8,
         x: u32,
         y: u32,
         scale: u8,
-    ) -> Result<Vec<u8>> {
-        let scale = scale.min(self.max_scale).max(1);
-        let tile_size = self.config.tile_size;
-        let style_json = style_json.to_string();
-
-        // Use spawn_blocking to avoid deadlock (MapLibre fetches tiles from our server)
-        tokio::task::spawn_blocking(move || {
-            // Acquire global render lock to serialize all MapLibre operations
-            let _global_lock = get_render_mutex().lock().map_err(|e| {
-                TileServerError::RenderError(format!("Failed to acquire render lock: {}", e))
-            })?;
-
-            // Create a fresh renderer for each request
-            // This avoids issues with MapLibre Native's shared state across threads
-            let mut map =
-                NativeMap::new(Size::new(tile_size, tile_size), scale as f32, MapMode::Tile)?;
-
-            map.load_style(&style_json)?;
-            let image = map.render_tile(z, x, y, tile_size, scale as f32)?;
-            image.to_png()
-        })
-        .await
-        .map_err(|e| TileServerError::RenderError(format!("Render task panicked: {}", e)))?
+        priority: Priority,
+    ) -> Result<RenderedImage> {
+        let scale = self.clamp_scale(scale);
+        let options = RenderOptions {
+            timeout: self.config.tile_timeout,
+            ..RenderOptions::for_tile(z, x, y, self.config.tile_size, scale as f32)
+        };
+
+        self.submit(style, options, priority).await
     }
 
-    /// Render a static image
+    /// Render a static image. `options.timeout` is its deadline, counted
+    /// from when it is queued.
     pub async fn render_static(
         &self,
-        style_json: &str,
+        style: &RenderStyle,
         options: RenderOptions,
+        priority: Priority,
     ) -> Result<RenderedImage> {
-        let style_json = style_json.to_string();
-
-        tokio::task::spawn_blocking(move || {
-            // Acquire global render lock to serialize all MapLibre operations
-            let _global_lock = get_render_mutex().lock().map_err(|e| {
-                TileServerError::RenderError(format!("Failed to acquire render lock: {}", e))
-            })?;
-
-            let mut map = NativeMap::new(options.size, options.pixel_ratio, MapMode::Static)?;
-            map.load_style(&style_json)?;
-            map.render(Some(options))
-        })
-        .await
-        .map_err(|e| TileServerError::RenderError(format!("Render task panicked: {}", e)))?
+        self.submit(style, options, priority).await
+    }
+
+    /// Render a static image of a variant of `style`, on a map that has
+    /// the base style loaded
+    pub async fn render_variant(
+        &self,
+        style: &RenderStyle,
+        variant: Arc<StyleVariant>,
+        options: RenderOptions,
+        priority: Priority,
+    ) -> Result<RenderedImage> {
+        self.submit_to(None, style, Some(variant), options, priority)
+            .await
+    }
+
+    /// Render once with `options` on every render thread, so each of them has
+    /// a map with the style loaded and its resources and shaders warm. With
+    /// worker processes, every thread of each worker does.
+    pub async fn warm_up(&self, style: &RenderStyle, options: RenderOptions) -> Result<()> {
+        let renders = (0..self.workers.len()).map(|thread| {
+            self.submit_to(Some(thread), style, None, options.clone(), Priority::Tile)
+        });
+        futures::future::try_join_all(renders).await?;
+        Ok(())
     }
 
     /// Get pool statistics
     pub fn stats(&self) -> PoolStats {
         PoolStats {
             max_scale: self.max_scale,
+            threads: self.workers.len()
+                * self.processes.as_ref().map_or(1, |_| self.config.pool_size),
+            maps: self.live_maps.load(Ordering::Relaxed),
+            in_flight: self.in_flight.load(Ordering::Relaxed),
+            renders: self.renders.load(Ordering::Relaxed),
+            style_loads: self.style_loads.load(Ordering::Relaxed),
+            resizes: self.resizes.load(Ordering::Relaxed),
+            style_edits: self.style_edits.load(Ordering::Relaxed),
+            queued: self.queue.len(),
+            shed: self.queue.shed.load(Ordering::Relaxed),
+            cancelled: self.cancelled.load(Ordering::Relaxed),
+            device: self.config.device,
+            workers: self
+                .processes
+                .as_ref()
+                .map_or(0, |counters| counters.workers.load(Ordering::Relaxed)),
+            worker_restarts: self.worker_restarts.load(Ordering::Relaxed),
+            inline_frames: self
+                .processes
+                .as_ref()
+                .map_or(0, |counters| counters.inline_frames.load(Ordering::Relaxed)),
+            shader_cache: shader_cache_stats(),
+            buffer_pool: buffer_pool_stats(),
+            shared_resources: shared_resources_stats(),
+            tile_cache: tile_cache_stats(),
         }
     }
 }
@@ -126,6 +1572,10 @@ impl RendererPool {
 impl Drop for RendererPool {
     fn drop(&mut self) {
         tracing::info!("Renderer pool shutting down");
+        self.queue.close();
+        for handle in self.workers.drain(..) {
+            let _ = handle.join();
+        }
     }
 }
 
@@ -133,16 +1583,649 @@ impl Drop for RendererPool {
 #[derive(Debug, Clone)]
 pub struct PoolStats {
     pub max_scale: u8,
+    /// Number of render threads
+    pub threads: usize,
+    /// Number of live map instances across all render threads
+    pub maps: usize,
+    /// Number of renders currently in flight
+    pub in_flight: usize,
+    /// Number of renders completed, failed ones included
+    pub renders: u64,
+    /// Number of times a style was parsed into a map
+    pub style_loads: u64,
+    /// Number of times a map was resized (reallocating its framebuffer)
+    pub resizes: u64,
+    /// Number of times a map switched style variants by editing its style
+    pub style_edits: u64,
+    /// Number of renders waiting for a render thread
+    pub queued: usize,
+    /// Number of renders rejected because their queue was full or they
+    /// would have missed their deadline
+    pub shed: u64,
+    /// Number of renders dropped or aborted because their caller went away
+    /// or their deadline passed
+    pub cancelled: u64,
+    /// Render device of the process, or `None` for the backend's default
+    pub device: Option<u32>,
+    /// Number of worker processes running, replaced ones still finishing included
+    pub workers: usize,
+    /// Number of worker processes started to replace ones that exited or
+    /// outgrew their memory limit
+    pub worker_restarts: u64,
+    /// Number of frames sent over a worker's socket because its shared
+    /// memory had no room for them
+    pub inline_frames: u64,
+    /// Shader programs loaded from compiled binaries, across all pools in the process
+    pub shader_cache: ShaderCacheStats,
+    /// Readback buffer reuse, across all pools in the process
+    pub buffer_pool: BufferPoolStats,
+    /// Glyph and sprite sharing between maps, across all pools in the process
+    pub shared_resources: SharedResourceStats,
+    /// Source tile sharing between maps, across all pools in the process
+    pub tile_cache: SharedResourceStats,
 }
 
 #[cfg(test)]
 mod tests {
     use super::*;
 
+    const STYLE: &str = r#"{"version":8,"sources":{},"layers":[]}"#;
+    const OTHER_STYLE: &str = r#"{"version":8,"name":"other","sources":{},"layers":[]}"#;
+
+    fn test_config() -> PoolConfig {
+        PoolConfig {
+            tile_size: 256,
+            pool_size: 1,
+            maps_per_thread: 2,
+            idle_timeout: Duration::from_secs(300),
+            ..PoolConfig::default()
+        }
+    }
+
+    #[test]
+    fn test_pool_renders_on_configured_device() {
+        let on = |device| PoolConfig {
+            device: Some(device),
+            ..test_config()
+        };
+
+        let pool = RendererPool::new(on(0), 3, None).unwrap();
+        assert_eq!(pool.stats().device, Some(0));
+        let devices = super::super::native::render_device_count();
+        assert!(RendererPool::new(on(devices), 3, None).is_err());
+    }
+
+    #[tokio::test]
+    async fn test_pool_switches_variants_by_editing_style() {
+        use super::super::variant::StyleEdit;
+
+        const LAYERED: &str =
+            r#"{"version":8,"sources":{},"layers":[{"id":"land","type":"background"}]}"#;
+        let base = serde_json::from_str(LAYERED).unwrap();
+        let variant = |visible| {
+            let edit = StyleEdit::Visibility {
+                layer: "land".to_string(),
+                visible,
+            };
+            Arc::new(StyleVariant::new(&base, vec![edit]).unwrap())
+        };
+        let (hidden, shown) = (variant(false), variant(true));
+        let pool = RendererPool::new(test_config(), 3, None).unwrap();
+        let options = RenderOptions::for_tile(0, 0, 0, 256, 1.0);
+
+        for variant in [&hidden, &hidden, &shown] {
+            pool.render_variant(
+                &RenderStyle::new(LAYERED),
+                variant.clone(),
+                options.clone(),
+                Priority::Static,
+            )
+            .await
+            .unwrap();
+        }
+        pool.render_static(
+            &RenderStyle::new(LAYERED),
+            options.clone(),
+            Priority::Static,
+        )
+        .await
+        .unwrap();
+
+        // One map parsed the style once and was edited for each change
+        let stats = pool.stats();
+        assert_eq!(
+            (stats.maps, stats.style_loads, stats.style_edits),
+            (1, 1, 3)
+        );
+
+        // Edits the style can't take fail the render, not the pool
+        let missing = StyleEdit::Visibility {
+            layer: "missing".to_string(),
+            visible: false,
+        };
+        let broken = Arc::new(
+            StyleVariant::new(
+                &serde_json::json!({"layers": [{"id": "missing"}]}),
+                vec![missing],
+            )
+            .unwrap(),
+        );
+        assert!(pool
+            .render_variant(
+                &RenderStyle::new(LAYERED),
+                broken,
+                options.clone(),
+                Priority::Static
+            )
+            .await
+            .is_err());
+        pool.render_variant(
+            &RenderStyle::new(LAYERED),
+            hidden,
+            options,
+            Priority::Static,
+        )
+        .await
+        .unwrap();
+    }
+
+    fn worker_config(workers: usize) -> PoolConfig {
+        PoolConfig {
+            workers,
+            ..test_config()
+        }
+    }
+
+    #[tokio::test(flavor = "multi_thread")]
+    async fn test_pool_renders_in_worker_processes() {
+        use super::super::variant::StyleEdit;
+
+        let pool = RendererPool::with_launch(worker_config(2), 2, None, Launch::Thread).unwrap();
+        let tile = pool
+            .render_tile(&RenderStyle::new(STYLE), 0, 0, 0, 2, Priority::Tile)
+            .await
+            .unwrap();
+        let local = RendererPool::new(test_config(), 2, None).unwrap();
+        let expected = local
+            .render_tile(&RenderStyle::new(STYLE), 0, 0, 0, 2, Priority::Tile)
+            .await
+            .unwrap();
+        assert_eq!(
+            (tile.width(), tile.height()),
+            (expected.width(), expected.height())
+        );
+        assert_eq!(tile.data(), expected.data());
+
+        let options = RenderOptions::for_tile(1, 0, 0, 256, 1.0);
+        let batch = pool.queue_renders(
+            None,
+            &RenderStyle::new(STYLE),
+            None,
+            vec![options.clone(), options.clone()],
+            Priority::Bulk,
+        );
+        assert!(futures::future::join_all(batch)
+            .await
+            .iter()
+            .all(|image| image.is_ok()));
+
+        const LAYERED: &str =
+            r#"{"version":8,"sources":{},"layers":[{"id":"land","type":"background"}]}"#;
+        let edit = StyleEdit::Visibility {
+            layer: "land".to_string(),
+            visible: false,
+        };
+        let variant = StyleVariant::new(&serde_json::from_str(LAYERED).unwrap(), vec![edit]);
+        pool.render_variant(
+            &RenderStyle::new(LAYERED),
+            Arc::new(variant.unwrap()),
+            options.clone(),
+            Priority::Static,
+        )
+        .await
+        .unwrap();
+        pool.warm_up(&RenderStyle::new(STYLE), options)
+            .await
+            .unwrap();
+
+        // Frames came back through shared memory, counters from the workers
+        let stats = pool.stats();
+        assert_eq!((stats.workers, stats.threads), (2, 2));
+        assert_eq!(stats.inline_frames, 0);
+        assert!(stats.maps >= 1 && stats.style_edits >= 1);
+        drop(tile);
+        assert_eq!(pool.stats().renders, 6);
+    }
+
+    #[tokio::test(flavor = "multi_thread")]
+    async fn test_worker_frames_without_room_go_inline() {
+        let config = PoolConfig {
+            worker_frames_mb: 0,
+            ..worker_config(1)
+        };
+        let pool = RendererPool::with_launch(config, 1, None, Launch::Thread).unwrap();
+        let tile = pool
+            .render_tile(&RenderStyle::new(STYLE), 0, 0, 0, 1, Priority::Tile)
+            .await
+            .unwrap();
+
+        assert_eq!(tile.data().len(), 256 * 256 * 4);
+        assert_eq!(pool.stats().inline_frames, 1);
+    }
+
+    #[tokio::test(flavor = "multi_thread")]
+    async fn test_workers_are_replaced_past_their_memory_limit() {
+        let config = PoolConfig {
+            worker_max_memory_mb: 1,
+            ..worker_config(1)
+        };
+        let pool = RendererPool::with_launch(config, 1, None, Launch::Thread).unwrap();
+
+        for _ in 0..3 {
+            pool.render_tile(&RenderStyle::new(STYLE), 0, 0, 0, 1, Priority::Tile)
+                .await
+                .unwrap();
+            tokio::time::sleep(WORKER_CHECK_INTERVAL * 2).await;
+        }
+
+        // Every worker outgrows 1 MB, and traffic moved on to its replacement
+        let stats = pool.stats();
+        assert!(stats.worker_restarts >= 1);
+        assert_eq!(stats.renders, 3);
+    }
+
     #[tokio::test]
     async fn test_pool_creation() {
         let config = PoolConfig::default();
-        let pool = RendererPool::new(config, 3);
+        let pool = RendererPool::new(config, 3, None);
         assert!(pool.is_ok());
     }
+
+    #[tokio::test]
+    async fn test_pool_reuses_maps() {
+        let pool = RendererPool::new(test_config(), 3, None).unwrap();
+
+        pool.render_tile(&RenderStyle::new(STYLE), 0, 0, 0, 1, Priority::Tile)
+            .await
+            .unwrap();
+        pool.render_tile(&RenderStyle::new(STYLE), 1, 1, 0, 1, Priority::Tile)
+            .await
+            .unwrap();
+        assert_eq!(pool.stats().maps, 1);
+        assert_eq!(pool.stats().style_loads, 1);
+
+        // A different pixel ratio needs its own map
+        pool.render_tile(&RenderStyle::new(STYLE), 1, 1, 0, 2, Priority::Tile)
+            .await
+            .unwrap();
+        assert_eq!(pool.stats().maps, 2);
+
+        // Beyond maps_per_thread the least recently used map is replaced
+        pool.render_tile(&RenderStyle::new(STYLE), 1, 1, 0, 3, Priority::Tile)
+            .await
+            .unwrap();
+        assert_eq!(pool.stats().maps, 2);
+    }
+
+    async fn render_batch(
+        pool: &RendererPool,
+        options: Vec<RenderOptions>,
+    ) -> Vec<Result<RenderedImage>> {
+        let results = pool.queue_renders(
+            None,
+            &RenderStyle::new(STYLE),
+            None,
+            options,
+            Priority::Static,
+        );
+        futures::future::join_all(results)
+            .await
+            .into_iter()
+            .map(|result| result.map(|(image, _)| image))
+            .collect()
+    }
+
+    #[tokio::test]
+    async fn test_pool_renders_batch_on_one_map() {
+        let pool = RendererPool::new(test_config(), 3, None).unwrap();
+
+        let mut options: Vec<RenderOptions> = (0..4)
+            .map(|x| RenderOptions::for_tile(2, x, 1, 256, 1.0))
+            .collect();
+        options[2].size = Size::new(128, 64);
+        let images = render_batch(&pool, options).await;
+
+        assert_eq!(images.len(), 4);
+        let sizes: Vec<_> = images
+            .iter()
+            .map(|image| {
+                let image = image.as_ref().unwrap();
+                (image.width(), image.height())
+            })
+            .collect();
+        assert_eq!(sizes, [(256, 256), (256, 256), (128, 64), (256, 256)]);
+
+        let stats = pool.stats();
+        assert_eq!((stats.maps, stats.style_loads, stats.renders), (1, 1, 4));
+        assert_eq!(stats.resizes, 2);
+        assert_eq!(stats.in_flight, 0);
+
+        // Cameras at another pixel ratio get a map of their own
+        let options = vec![
+            RenderOptions::for_tile(0, 0, 0, 256, 1.0),
+            RenderOptions::for_tile(0, 0, 0, 256, 2.0),
+        ];
+        let images = render_batch(&pool, options).await;
+        assert!(images.iter().all(Result::is_ok));
+        assert_eq!(pool.stats().maps, 2);
+    }
+
+    #[tokio::test]
+    async fn test_pool_keys_maps_by_style() {
+        let pool = RendererPool::new(test_config(), 3, None).unwrap();
+
+        pool.render_tile(&RenderStyle::new(STYLE), 0, 0, 0, 1, Priority::Tile)
+            .await
+            .unwrap();
+        pool.render_tile(&RenderStyle::new(OTHER_STYLE), 0, 0, 0, 1, Priority::Tile)
+            .await
+            .unwrap();
+        pool.render_tile(&RenderStyle::new(STYLE), 0, 0, 0, 1, Priority::Tile)
+            .await
+            .unwrap();
+        pool.render_tile(&RenderStyle::new(OTHER_STYLE), 0, 0, 0, 1, Priority::Tile)
+            .await
+            .unwrap();
+
+        let stats = pool.stats();
+        assert_eq!(stats.maps, 2);
+        assert_eq!(stats.style_loads, 2);
+    }
+
+    #[tokio::test]
+    async fn test_pool_reuses_compatible_map_for_new_style() {
+        let config = PoolConfig {
+            maps_per_thread: 1,
+            ..test_config()
+        };
+        let pool = RendererPool::new(config, 3, None).unwrap();
+
+        pool.render_tile(&RenderStyle::new(STYLE), 0, 0, 0, 1, Priority::Tile)
+            .await
+            .unwrap();
+        pool.render_tile(&RenderStyle::new(OTHER_STYLE), 0, 0, 0, 1, Priority::Tile)
+            .await
+            .unwrap();
+
+        let stats = pool.stats();
+        assert_eq!(stats.maps, 1);
+        assert_eq!(stats.style_loads, 2);
+    }
+
+    #[tokio::test]
+    async fn test_pool_renders_concurrently() {
+        let config = PoolConfig {
+            pool_size: 4,
+            ..test_config()
+        };
+        let pool = Arc::new(RendererPool::new(config, 3, None).unwrap());
+
+        let renders = (0..16u32).map(|x| {
+            let pool = pool.clone();
+            tokio::spawn(async move {
+                pool.render_tile(&RenderStyle::new(STYLE), 4, x, 0, 1, Priority::Tile)
+                    .await
+            })
+        });
+
+        for render in futures::future::join_all(renders).await {
+            assert!(!render.unwrap().unwrap().data().is_empty());
+        }
+        assert!(pool.stats().maps <= 4 * 2);
+    }
+
+    #[tokio::test]
+    async fn test_pool_buckets_maps_by_size() {
+        let pool = RendererPool::new(test_config(), 3, None).unwrap();
+        let tile = RenderOptions::for_tile(4, 0, 0, 256, 1.0);
+        let frame = RenderOptions {
+            size: Size::new(1024, 1024),
+            ..tile.clone()
+        };
+
+        // Alternating sizes settle on one map per size
+        for _ in 0..3 {
+            pool.render_static(&RenderStyle::new(STYLE), tile.clone(), Priority::Static)
+                .await
+                .unwrap();
+            pool.render_static(&RenderStyle::new(STYLE), frame.clone(), Priority::Static)
+                .await
+                .unwrap();
+        }
+        let stats = pool.stats();
+        assert_eq!(stats.maps, 2);
+        assert_eq!(stats.resizes, 0);
+
+        // At capacity a map with the style is resized rather than reloaded
+        let other = RenderOptions {
+            size: Size::new(300, 200),
+            ..tile
+        };
+        pool.render_static(&RenderStyle::new(STYLE), other, Priority::Static)
+            .await
+            .unwrap();
+        let stats = pool.stats();
+        assert_eq!(stats.maps, 2);
+        assert_eq!(stats.resizes, 1);
+        assert_eq!(stats.style_loads, 2);
+    }
+
+    #[tokio::test]
+    async fn test_warm_up_loads_style_on_every_thread() {
+        let config = PoolConfig {
+            pool_size: 3,
+            ..test_config()
+        };
+        let pool = RendererPool::new(config, 3, None).unwrap();
+
+        let options = RenderOptions::for_tile(0, 0, 0, 256, 1.0);
+        pool.warm_up(&RenderStyle::new(STYLE), options)
+            .await
+            .unwrap();
+        assert_eq!(pool.stats().maps, 3);
+        assert_eq!(pool.stats().style_loads, 3);
+
+        // Requests that follow find the style loaded wherever they land
+        for x in 0..6 {
+            pool.render_tile(&RenderStyle::new(STYLE), 3, x, 0, 1, Priority::Tile)
+                .await
+                .unwrap();
+        }
+        assert_eq!(pool.stats().style_loads, 3);
+    }
+
+    #[tokio::test]
+    async fn test_thread_multiplexes_maps() {
+        let config = PoolConfig {
+            maps_per_thread: 4,
+            ..test_config()
+        };
+        let pool = Arc::new(RendererPool::new(config, 3, None).unwrap());
+
+        let renders = (0..12u32).map(|x| {
+            let pool = pool.clone();
+            let style = RenderStyle::new(if x % 2 == 0 { STYLE } else { OTHER_STYLE });
+            tokio::spawn(async move { pool.render_tile(&style, 4, x, 0, 1, Priority::Tile).await })
+        });
+
+        for render in futures::future::join_all(renders).await {
+            assert!(!render.unwrap().unwrap().data().is_empty());
+        }
+
+        let stats = pool.stats();
+        assert!(stats.maps <= 4);
+        assert_eq!(stats.in_flight, 0);
+    }
+
+    #[tokio::test]
+    async fn test_pool_evicts_idle_maps() {
+        let config = PoolConfig {
+            idle_timeout: Duration::from_millis(20),
+            ..test_config()
+        };
+        let pool = RendererPool::new(config, 3, None).unwrap();
+
+        pool.render_tile(&RenderStyle::new(STYLE), 0, 0, 0, 1, Priority::Tile)
+            .await
+            .unwrap();
+        tokio::time::sleep(Duration::from_millis(200)).await;
+        assert_eq!(pool.stats().maps, 0);
+    }
+
+    #[tokio::test]
+    async fn test_pool_fails_renders_past_their_deadline() {
+        let pool = RendererPool::new(test_config(), 3, None).unwrap();
+        let options = RenderOptions {
+            timeout: Some(Duration::ZERO),
+            ..RenderOptions::for_tile(0, 0, 0, 256, 1.0)
+        };
+
+        let result = pool
+            .render_static(&RenderStyle::new(STYLE), options, Priority::Static)
+            .await;
+        assert!(matches!(result, Err(TileServerError::RenderCancelled(_))));
+        // The render was given up on before it reached a map
+        let stats = pool.stats();
+        assert_eq!(stats.maps, 0);
+        assert_eq!(stats.cancelled, 1);
+    }
+
+    #[test]
+    fn test_job_prunes_abandoned_renders() {
+        let options = RenderOptions::for_tile(0, 0, 0, 256, 1.0);
+        let (abandoned, result) = JobRender::new(0, Priority::Tile, options.clone());
+        drop(result);
+        let (waiting, _result) = JobRender::new(0, Priority::Tile, options);
+        let mut job = RenderJob {
+            style: RenderStyle::new(STYLE),
+            variant: None,
+            renders: VecDeque::from([abandoned, waiting]),
+            thread: None,
+            priority: Priority::Tile,
+        };
+
+        let cancelled = AtomicU64::new(0);
+        job.prune(&cancelled);
+        assert_eq!(job.renders.len(), 1);
+        assert_eq!(cancelled.load(Ordering::Relaxed), 1);
+    }
+
+    /// A one-render job and the future of its result
+    fn test_job(
+        priority: Priority,
+        timeout: Option<Duration>,
+    ) -> (
+        RenderJob,
+        impl std::future::Future<Output = Result<Rendered>>,
+    ) {
+        let options = RenderOptions {
+            timeout,
+            ..RenderOptions::for_tile(0, 0, 0, 256, 1.0)
+        };
+        let (render, result) = JobRender::new(0, priority, options);
+        let job = RenderJob {
+            style: RenderStyle::new(STYLE),
+            variant: None,
+            renders: VecDeque::from([render]),
+            thread: None,
+            priority,
+        };
+        (job, result)
+    }
+
+    #[test]
+    fn test_queue_takes_urgent_classes_first() {
+        let queue = JobQueue::new(&test_config(), Arc::default());
+        let (bulk, _bulk) = test_job(Priority::Bulk, None);
+        let (tile, _tile) = test_job(Priority::Tile, None);
+        queue.push(bulk).unwrap();
+        queue.push(tile).unwrap();
+        assert_eq!(queue.len(), 2);
+
+        let priorities: Vec<_> = (0..2)
+            .map(|_| match queue.pop(0, Duration::ZERO) {
+                NextJob::Job(job) => job.priority,
+                _ => panic!("expected a job"),
+            })
+            .collect();
+        assert_eq!(priorities, [Priority::Tile, Priority::Bulk]);
+    }
+
+    #[tokio::test]
+    async fn test_queue_sheds_full_classes() {
+        let config = PoolConfig {
+            queue_depths: [1, 1, 1],
+            ..test_config()
+        };
+        let queue = JobQueue::new(&config, Arc::default());
+        let (first, _first) = test_job(Priority::Static, None);
+        let (second, second_result) = test_job(Priority::Static, None);
+        queue.push(first).unwrap();
+
+        let rejected = queue.push(second);
+        assert!(matches!(rejected, Err(TileServerError::Overloaded { .. })));
+        // The rejected job's caller sees the same error
+        assert!(matches!(
+            second_result.await,
+            Err(TileServerError::Overloaded { retry_after: 1 })
+        ));
+        assert_eq!(queue.shed.load(Ordering::Relaxed), 1);
+
+        // Other classes have room of their own
+        let (tile, _tile) = test_job(Priority::Tile, None);
+        queue.push(tile).unwrap();
+    }
+
+    #[test]
+    fn test_queue_sheds_renders_that_would_miss_their_deadline() {
+        let config = PoolConfig {
+            maps_per_thread: 1,
+            ..test_config()
+        };
+        let queue = JobQueue::new(&config, Arc::default());
+        queue.record_render(Duration::from_secs(10));
+
+        // The first render gets the only map right away, the second would
+        // wait for it
+        let (first, _first) = test_job(Priority::Tile, Some(Duration::from_secs(1)));
+        queue.push(first).unwrap();
+        let (second, _second) = test_job(Priority::Tile, Some(Duration::from_secs(1)));
+        assert!(matches!(
+            queue.push(second),
+            Err(TileServerError::Overloaded { retry_after: 10 })
+        ));
+
+        // Without a deadline it is queued
+        let (patient, _patient) = test_job(Priority::Tile, None);
+        queue.push(patient).unwrap();
+        assert_eq!(queue.estimated_wait(2), Duration::from_secs(20));
+    }
+
+    #[test]
+    fn test_queue_wakes_one_thread_with_a_free_map() {
+        let queue = JobQueue::new(&test_config(), Arc::default());
+        // Threads with a free map ask for jobs before waiting on their
+        // RunLoop; full threads don't ask at all
+        assert!(matches!(queue.pop(1, Duration::ZERO), NextJob::Timeout));
+        assert!(matches!(queue.pop(2, Duration::ZERO), NextJob::Timeout));
+
+        let (job, _job) = test_job(Priority::Tile, None);
+        queue.push(job).unwrap();
+        let waiting = |queue: &JobQueue| queue.state.lock().unwrap().loop_waiting.clone();
+        assert_eq!(waiting(&queue), [1]);
+
+        // Taking the job clears the thread's mark, whichever thread runs it
+        assert!(matches!(queue.pop(1, Duration::ZERO), NextJob::Job(_)));
+        assert!(waiting(&queue).is_empty());
+    }
 }
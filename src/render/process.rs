@@ -0,0 +1,1467 @@
+//! Out-of-process render workers
+//!
+//! With `render.workers` set, the renderer pool renders in worker processes
+//! (this executable, started with the hidden `render-worker` command)
+//! instead of in the server. Each worker has its own MapLibre state, GL
+//! context and render threads with their RunLoops, so a render that crashes
+//! or leaks takes down only its worker, which is replaced. A worker whose
+//! resident memory outgrows `render.worker_max_memory_mb` is replaced too:
+//! a fresh one takes over its traffic while it finishes the renders it has
+//! in flight.
+//!
+//! The server talks to a worker over a Unix socket. It forwards styles and
+//! render jobs, and answers the worker's tile, glyph and sprite requests
+//! from its own resource handler. Pixels don't go over the socket: each
+//! worker shares a memory-mapped ring of frames with the server, which
+//! reserves room for every render it forwards. The worker writes the frame
+//! there, and the server encodes straight out of the ring, releasing the
+//! room when the image is dropped. Frames the ring has no room for are sent
+//! inline instead.
+
+use std::collections::{HashMap, HashSet, VecDeque};
+use std::fs::{File, OpenOptions};
+use std::io::{self, Read, Write};
+use std::net::Shutdown;
+use std::os::unix::fs::OpenOptionsExt;
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::path::{Path, PathBuf};
+use std::process::{Child, Command, Stdio};
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
+
+use bytes::Bytes;
+use memmap2::MmapMut;
+use serde::{Deserialize, Serialize};
+use tokio::runtime::Handle;
+
+use super::native::{
+    RenderOptions, RenderStats, RenderedImage, ResourceHandler, ResourceKind, ResourceResponder,
+    ResourceResponse,
+};
+use super::pool::{PoolConfig, Priority, RendererPool};
+use super::types::RenderStyle;
+use super::variant::StyleVariant;
+use crate::error::{Result, TileServerError};
+
+/// How long a worker may take to connect and start its pool
+const STARTUP_TIMEOUT: Duration = Duration::from_secs(30);
+
+/// How long a worker may take to exit after the server hangs up, before it
+/// is killed
+const EXIT_TIMEOUT: Duration = Duration::from_secs(10);
+
+/// Styles a worker keeps before the server has it forget them all
+const MAX_WORKER_STYLES: usize = 64;
+
+/// Largest message header accepted, to catch a corrupt stream early
+const MAX_HEADER_LEN: usize = 256 << 20;
+
+/// Largest message payload accepted: room for an inline 4096×4096 frame at
+/// @4x, or any resource
+const MAX_PAYLOAD_LEN: usize = 1 << 30;
+
+/// Names the socket and frames files of the workers of this process
+static NEXT_FILE: AtomicU64 = AtomicU64::new(0);
+
+/// A message between the server and a worker. Each is sent as the lengths of
+/// its JSON header and its binary payload (u32, little-endian), followed by
+/// the two.
+#[derive(Debug, Serialize, Deserialize)]
+#[serde(tag = "type", rename_all = "snake_case")]
+enum Message {
+    /// Server: start the worker's pool
+    Init {
+        config: PoolConfig,
+        max_scale: u8,
+        frames: Option<FramesFile>,
+        resources: bool,
+    },
+    /// Worker: its pool is running
+    Ready,
+    /// Worker: its pool failed to start
+    Failed { message: String },
+    /// Server: a style later jobs refer to by its hash
+    Style { hash: u64, json: String },
+    /// Server: forget the styles sent so far
+    ForgetStyles,
+    /// Server: render a job, on every render thread if `every_thread`
+    Render {
+        style: u64,
+        variant: Option<StyleVariant>,
+        priority: Priority,
+        every_thread: bool,
+        renders: Vec<WorkerRender>,
+    },
+    /// Worker: result of a render, with its pixels in the payload unless it
+    /// was written to the ring
+    Frame {
+        id: u64,
+        result: std::result::Result<FrameInfo, WireError>,
+        counters: WorkerCounters,
+    },
+    /// Worker: load a resource for one of its maps
+    Request {
+        id: u64,
+        url: String,
+        kind: ResourceKind,
+    },
+    /// Server: a requested resource, with its contents in the payload
+    Resource { id: u64, response: WireResource },
+}
+
+/// The frames file of a worker
+#[derive(Debug, Serialize, Deserialize)]
+struct FramesFile {
+    path: PathBuf,
+    len: usize,
+}
+
+/// A render of a forwarded job
+#[derive(Debug, Serialize, Deserialize)]
+struct WorkerRender {
+    id: u64,
+    options: RenderOptions,
+    /// Room reserved in the ring as (offset, length)
+    frame: Option<(usize, usize)>,
+}
+
+/// A rendered frame
+#[derive(Debug, Serialize, Deserialize)]
+struct FrameInfo {
+    width: u32,
+    height: u32,
+    len: usize,
+    /// Written to the room reserved in the ring rather than sent inline
+    in_ring: bool,
+    stats: RenderStats,
+}
+
+/// A render error
+#[derive(Debug, Serialize, Deserialize)]
+enum WireError {
+    Render(String),
+    Cancelled(String),
+    Overloaded { retry_after: u64 },
+}
+
+impl From<&TileServerError> for WireError {
+    fn from(error: &TileServerError) -> Self {
+        match error.shared() {
+            TileServerError::RenderCancelled(message) => WireError::Cancelled(message),
+            TileServerError::Overloaded { retry_after } => WireError::Overloaded { retry_after },
+            error => WireError::Render(error.to_string()),
+        }
+    }
+}
+
+impl From<WireError> for TileServerError {
+    fn from(error: WireError) -> Self {
+        match error {
+            WireError::Render(message) => TileServerError::RenderError(message),
+            WireError::Cancelled(message) => TileServerError::RenderCancelled(message),
+            WireError::Overloaded { retry_after } => TileServerError::Overloaded { retry_after },
+        }
+    }
+}
+
+/// A resource response, other than deferred
+#[derive(Debug, Serialize, Deserialize)]
+enum WireResource {
+    Data,
+    NotFound,
+    Error(String),
+    PassThrough,
+}
+
+/// Counters of a worker's pool, reported with each frame
+#[derive(Debug, Clone, Copy, Default, Serialize, Deserialize)]
+struct WorkerCounters {
+    maps: usize,
+    style_loads: u64,
+    resizes: u64,
+    style_edits: u64,
+    cancelled: u64,
+    resident_bytes: u64,
+}
+
+fn write_message(writer: &mut impl Write, message: &Message, payload: &[u8]) -> io::Result<()> {
+    let header = serde_json::to_vec(message)?;
+    let payload_len = u32::try_from(payload.len())
+        .map_err(|_| io::Error::new(io::ErrorKind::InvalidInput, "Payload too large"))?;
+    let mut lengths = [0; 8];
+    lengths[..4].copy_from_slice(&(header.len() as u32).to_le_bytes());
+    lengths[4..].copy_from_slice(&payload_len.to_le_bytes());
+    writer.write_all(&lengths)?;
+    writer.write_all(&header)?;
+    writer.write_all(payload)
+}
+
+fn read_message(reader: &mut impl Read) -> io::Result<(Message, Vec<u8>)> {
+    let mut lengths = [0; 8];
+    reader.read_exact(&mut lengths)?;
+    let header_len = u32::from_le_bytes(lengths[..4].try_into().unwrap_or_default()) as usize;
+    let payload_len = u32::from_le_bytes(lengths[4..].try_into().unwrap_or_default()) as usize;
+    if header_len > MAX_HEADER_LEN {
+        return Err(io::Error::new(
+            io::ErrorKind::InvalidData,
+            "Message header too large",
+        ));
+    }
+    if payload_len > MAX_PAYLOAD_LEN {
+        return Err(io::Error::new(
+            io::ErrorKind::InvalidData,
+            "Message payload too large",
+        ));
+    }
+
+    let mut header = vec![0; header_len];
+    reader.read_exact(&mut header)?;
+    let mut payload = vec![0; payload_len];
+    reader.read_exact(&mut payload)?;
+    Ok((serde_json::from_slice(&header)?, payload))
+}
+
+fn io_error(context: &str, error: impl std::fmt::Display) -> TileServerError {
+    TileServerError::RenderError(format!("{}: {}", context, error))
+}
+
+/// The sending end of a socket, shared by the threads that write to it
+struct Channel(Mutex<UnixStream>);
+
+impl Channel {
+    fn send(&self, message: &Message, payload: &[u8]) -> io::Result<()> {
+        let mut stream = self.0.lock().unwrap_or_else(|e| e.into_inner());
+        write_message(&mut *stream, message, payload)
+    }
+
+    /// Hang up, so the other end's reads fail
+    fn close(&self) {
+        let stream = self.0.lock().unwrap_or_else(|e| e.into_inner());
+        let _ = stream.shutdown(Shutdown::Both);
+    }
+}
+
+/// Shared memory the frames of one worker are passed through.
+///
+/// The server reserves room for each frame at the head of the ring, and
+/// room is reclaimed from the tail once the oldest frame is released, so
+/// frames released out of order hold on to the room behind them until then.
+pub(super) struct FrameRing {
+    map: MmapMut,
+    ptr: *mut u8,
+    /// Reserved room as (offset, length, released), oldest first
+    regions: Mutex<(u64, VecDeque<(usize, usize, bool)>)>,
+}
+
+// SAFETY: the mapping is only accessed through disjoint reserved regions
+unsafe impl Send for FrameRing {}
+unsafe impl Sync for FrameRing {}
+
+impl FrameRing {
+    /// Create a ring of `len` bytes in a new file at `path`, readable by
+    /// this user only
+    fn create(path: &Path, len: usize) -> Result<Self> {
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create_new(true)
+            .mode(0o600)
+            .open(path)
+            .and_then(|file| file.set_len(len as u64).map(|()| file))
+            .map_err(|e| io_error("Failed to create render frames file", e))?;
+        Self::map(&file)
+    }
+
+    /// Map the ring the server created
+    fn open(path: &Path) -> Result<Self> {
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .open(path)
+            .map_err(|e| io_error("Failed to open render frames file", e))?;
+        Self::map(&file)
+    }
+
+    fn map(file: &File) -> Result<Self> {
+        // SAFETY: the file is private to the server and its worker
+        let mut map = unsafe { MmapMut::map_mut(file) }
+            .map_err(|e| io_error("Failed to map render frames", e))?;
+        let ptr = map.as_mut_ptr();
+        Ok(Self {
+            map,
+            ptr,
+            regions: Mutex::default(),
+        })
+    }
+
+    fn len(&self) -> usize {
+        self.map.len()
+    }
+
+    /// Reserve `len` bytes for a frame, if there is room
+    fn reserve(self: &Arc<Self>, len: usize) -> Option<FrameSlot> {
+        if len == 0 {
+            return None;
+        }
+        let mut guard = self.regions.lock().unwrap_or_else(|e| e.into_inner());
+        let (first, regions) = &mut *guard;
+        let offset = match (regions.front(), regions.back()) {
+            // Reserved room is contiguous, free room is after and before it
+            (Some(&(tail, ..)), Some(&(offset, reserved, _))) if offset >= tail => {
+                let head = offset + reserved;
+                if head + len <= self.len() {
+                    head
+                } else if len <= tail {
+                    0
+                } else {
+                    return None;
+                }
+            }
+            // Reserved room wrapped around, free room is between head and tail
+            (Some(&(tail, ..)), Some(&(offset, reserved, _))) => {
+                let head = offset + reserved;
+                if head + len <= tail {
+                    head
+                } else {
+                    return None;
+                }
+            }
+            _ if len <= self.len() => 0,
+            _ => return None,
+        };
+
+        regions.push_back((offset, len, false));
+        Some(FrameSlot {
+            ring: self.clone(),
+            sequence: *first + regions.len() as u64 - 1,
+            offset,
+            len,
+        })
+    }
+
+    fn release(&self, sequence: u64) {
+        let mut guard = self.regions.lock().unwrap_or_else(|e| e.into_inner());
+        let (first, regions) = &mut *guard;
+        if let Some(region) = regions.get_mut((sequence - *first) as usize) {
+            region.2 = true;
+        }
+        while regions.front().is_some_and(|region| region.2) {
+            regions.pop_front();
+            *first += 1;
+        }
+    }
+
+    /// Copy a frame into the room the server reserved for it, if it fits
+    fn write(&self, (offset, len): (usize, usize), data: &[u8]) -> bool {
+        if data.len() > len || offset.checked_add(len).map_or(true, |end| end > self.len()) {
+            return false;
+        }
+        // SAFETY: in bounds, and the region is reserved for this frame
+        unsafe { std::ptr::copy_nonoverlapping(data.as_ptr(), self.ptr.add(offset), data.len()) };
+        true
+    }
+}
+
+/// Room reserved in a [`FrameRing`] for one frame, released when dropped
+pub(super) struct FrameSlot {
+    ring: Arc<FrameRing>,
+    sequence: u64,
+    offset: usize,
+    len: usize,
+}
+
+impl FrameSlot {
+    pub(super) fn as_slice(&self) -> &[u8] {
+        // SAFETY: the region is in bounds and reserved for this slot
+        unsafe { std::slice::from_raw_parts(self.ring.ptr.add(self.offset), self.len) }
+    }
+
+    pub(super) fn as_mut_slice(&mut self) -> &mut [u8] {
+        // SAFETY: as above, and the slot is borrowed mutably
+        unsafe { std::slice::from_raw_parts_mut(self.ring.ptr.add(self.offset), self.len) }
+    }
+}
+
+impl Drop for FrameSlot {
+    fn drop(&mut self) {
+        self.ring.release(self.sequence);
+    }
+}
+
+/// Bytes of the frame a render produces
+fn frame_len(options: &RenderOptions) -> usize {
+    let side = |pixels: u32| (pixels as f32 * options.pixel_ratio).ceil() as usize;
+    side(options.size.width) * side(options.size.height) * 4
+}
+
+/// Where shared memory files go: memory-backed when the system has it
+fn shared_memory_dir() -> PathBuf {
+    let shm = Path::new("/dev/shm");
+    if shm.is_dir() {
+        shm.to_path_buf()
+    } else {
+        std::env::temp_dir()
+    }
+}
+
+/// A file of this process, named for it
+fn process_file(dir: &Path, extension: &str) -> PathBuf {
+    dir.join(format!(
+        "tileserver-rs-{}-{}.{}",
+        std::process::id(),
+        NEXT_FILE.fetch_add(1, Ordering::Relaxed),
+        extension
+    ))
+}
+
+/// How worker processes are started
+#[derive(Debug, Clone, Copy)]
+pub(super) enum Launch {
+    /// Run this executable's `render-worker` command
+    Process,
+    /// Serve from a thread of this process
+    #[cfg(test)]
+    Thread,
+}
+
+impl Launch {
+    /// Start a worker and connect to it
+    fn start(self, index: usize) -> Result<(UnixStream, Option<Child>)> {
+        match self {
+            Launch::Process => {
+                let socket = process_file(&std::env::temp_dir(), "sock");
+                let listener = UnixListener::bind(&socket)
+                    .map_err(|e| io_error("Failed to create render worker socket", e));
+                let started = listener.and_then(|listener| {
+                    let executable = std::env::current_exe()
+                        .map_err(|e| io_error("Failed to find the render worker executable", e))?;
+                    let child = Command::new(executable)
+                        .arg("render-worker")
+                        .arg("--socket")
+                        .arg(&socket)
+                        .stdin(Stdio::null())
+                        .spawn()
+                        .map_err(|e| {
+                            io_error(&format!("Failed to start render worker {}", index), e)
+                        })?;
+                    accept(&listener, child)
+                });
+                let _ = std::fs::remove_file(&socket);
+                let (stream, child) = started?;
+                Ok((stream, Some(child)))
+            }
+            #[cfg(test)]
+            Launch::Thread => {
+                let (server, worker) =
+                    UnixStream::pair().map_err(|e| io_error("Failed to create socket pair", e))?;
+                std::thread::Builder::new()
+                    .name(format!("render-worker-{}", index))
+                    .spawn(move || {
+                        let runtime = tokio::runtime::Builder::new_multi_thread()
+                            .worker_threads(2)
+                            .enable_all()
+                            .build()
+                            .expect("worker runtime");
+                        if let Err(e) = runtime.block_on(serve(worker)) {
+                            tracing::warn!("Render worker failed: {}", e);
+                        }
+                    })
+                    .map_err(|e| io_error("Failed to spawn render worker thread", e))?;
+                Ok((server, None))
+            }
+        }
+    }
+}
+
+/// Wait for a started worker to connect, unless it exits first
+fn accept(listener: &UnixListener, mut child: Child) -> Result<(UnixStream, Child)> {
+    let deadline = Instant::now() + STARTUP_TIMEOUT;
+    listener
+        .set_nonblocking(true)
+        .map_err(|e| io_error("Failed to poll render worker socket", e))?;
+    loop {
+        match listener.accept() {
+            Ok((stream, _)) => {
+                stream
+                    .set_nonblocking(false)
+                    .map_err(|e| io_error("Failed to configure render worker socket", e))?;
+                return Ok((stream, child));
+            }
+            Err(e) if e.kind() == io::ErrorKind::WouldBlock => {}
+            Err(e) => return Err(io_error("Failed to accept render worker", e)),
+        }
+        if let Ok(Some(status)) = child.try_wait() {
+            return Err(TileServerError::RenderError(format!(
+                "Render worker exited on startup ({})",
+                status
+            )));
+        }
+        if Instant::now() >= deadline {
+            let _ = child.kill();
+            let _ = child.wait();
+            return Err(TileServerError::RenderError(
+                "Render worker did not connect in time".to_string(),
+            ));
+        }
+        std::thread::sleep(Duration::from_millis(10));
+    }
+}
+
+/// Receives the result of a forwarded render
+pub(super) type RenderDone = Box<dyn FnOnce(Result<(RenderedImage, RenderStats)>) + Send>;
+
+/// Pool counters that the reports of worker processes are added to
+#[derive(Clone, Default)]
+pub(super) struct PoolCounters {
+    pub maps: Arc<AtomicUsize>,
+    pub style_loads: Arc<AtomicU64>,
+    pub resizes: Arc<AtomicU64>,
+    pub style_edits: Arc<AtomicU64>,
+    pub cancelled: Arc<AtomicU64>,
+    /// Frames sent over the socket because the ring had no room for them
+    pub inline_frames: Arc<AtomicU64>,
+    /// Worker processes running
+    pub workers: Arc<AtomicUsize>,
+}
+
+/// A forwarded render waiting for its frame
+struct PendingRender {
+    done: RenderDone,
+    slot: Option<FrameSlot>,
+    /// The last render of its job
+    last: bool,
+}
+
+/// State of a worker shared with the thread reading its messages
+struct WorkerState {
+    /// Renders waiting for their frames; `None` once the worker is gone
+    pending: Mutex<Option<HashMap<u64, PendingRender>>>,
+    /// Jobs with renders waiting
+    jobs: AtomicUsize,
+    /// Notified when a job finishes or the worker is gone
+    finished: Condvar,
+    /// Counters of the latest report
+    reported: Mutex<WorkerCounters>,
+    resident_bytes: AtomicU64,
+    counters: PoolCounters,
+}
+
+impl WorkerState {
+    fn is_alive(&self) -> bool {
+        self.pending
+            .lock()
+            .unwrap_or_else(|e| e.into_inner())
+            .is_some()
+    }
+
+    /// Fold a report into the pool counters. Reports of concurrent renders
+    /// may arrive out of order, so totals only move forward.
+    fn report(&self, counters: WorkerCounters) {
+        let mut guard = self.reported.lock().unwrap_or_else(|e| e.into_inner());
+        let reported = &mut *guard;
+        let pool = &self.counters;
+        for (total, last, now) in [
+            (
+                &pool.style_loads,
+                &mut reported.style_loads,
+                counters.style_loads,
+            ),
+            (&pool.resizes, &mut reported.resizes, counters.resizes),
+            (
+                &pool.style_edits,
+                &mut reported.style_edits,
+                counters.style_edits,
+            ),
+            (&pool.cancelled, &mut reported.cancelled, counters.cancelled),
+        ] {
+            total.fetch_add(now.saturating_sub(*last), Ordering::Relaxed);
+            *last = (*last).max(now);
+        }
+        pool.maps.fetch_add(counters.maps, Ordering::Relaxed);
+        pool.maps.fetch_sub(reported.maps, Ordering::Relaxed);
+        reported.maps = counters.maps;
+        self.resident_bytes
+            .store(counters.resident_bytes, Ordering::Relaxed);
+    }
+
+    /// Hand a frame to its render
+    fn finish(
+        &self,
+        id: u64,
+        result: std::result::Result<FrameInfo, WireError>,
+        counters: WorkerCounters,
+        payload: Vec<u8>,
+    ) {
+        let pending = self
+            .pending
+            .lock()
+            .unwrap_or_else(|e| e.into_inner())
+            .as_mut()
+            .and_then(|pending| pending.remove(&id));
+        let Some(PendingRender { done, slot, last }) = pending else {
+            return;
+        };
+        self.report(counters);
+
+        let result = result.map_err(TileServerError::from).map(|frame| {
+            let image = match slot {
+                Some(mut slot) if frame.in_ring => {
+                    slot.len = frame.len.min(slot.len);
+                    RenderedImage::from_frame(frame.width, frame.height, slot)
+                }
+                _ => {
+                    if !payload.is_empty() {
+                        self.counters.inline_frames.fetch_add(1, Ordering::Relaxed);
+                    }
+                    RenderedImage::from_rgba(frame.width, frame.height, payload)
+                }
+            };
+            (image, frame.stats)
+        });
+        if last {
+            self.jobs.fetch_sub(1, Ordering::Relaxed);
+            self.notify_finished();
+        }
+        done(result);
+    }
+
+    fn notify_finished(&self) {
+        // Taking the lock orders this after a waiter's check of `jobs`
+        drop(self.pending.lock().unwrap_or_else(|e| e.into_inner()));
+        self.finished.notify_all();
+    }
+
+    /// Fail the renders still waiting, as the worker is gone
+    fn close(&self, reason: &str) {
+        let pending = self
+            .pending
+            .lock()
+            .unwrap_or_else(|e| e.into_inner())
+            .take();
+        let mut reported = self.reported.lock().unwrap_or_else(|e| e.into_inner());
+        self.counters
+            .maps
+            .fetch_sub(std::mem::take(&mut reported.maps), Ordering::Relaxed);
+        drop(reported);
+
+        for (_, render) in pending.into_iter().flatten() {
+            if render.last {
+                self.jobs.fetch_sub(1, Ordering::Relaxed);
+            }
+            (render.done)(Err(TileServerError::RenderError(reason.to_string())));
+        }
+        self.notify_finished();
+    }
+}
+
+/// A render worker process, as seen from the server
+pub(super) struct WorkerProcess {
+    index: usize,
+    child: Option<Child>,
+    channel: Arc<Channel>,
+    state: Arc<WorkerState>,
+    ring: Option<Arc<FrameRing>>,
+    reader: Option<JoinHandle<()>>,
+    /// Styles sent to the worker
+    styles: HashSet<u64>,
+    next_id: u64,
+}
+
+impl WorkerProcess {
+    /// Start worker `index` with a pool of `config`, and wait for the pool
+    /// to come up. Its resource requests go to `resource_handler` if given.
+    pub(super) fn start(
+        index: usize,
+        launch: Launch,
+        config: &PoolConfig,
+        max_scale: u8,
+        resource_handler: Option<Arc<dyn ResourceHandler>>,
+        counters: PoolCounters,
+    ) -> Result<Self> {
+        let frames_len = (config.worker_frames_mb << 20) as usize;
+        let frames = process_file(&shared_memory_dir(), "frames");
+        let ring = (frames_len > 0)
+            .then(|| FrameRing::create(&frames, frames_len).map(Arc::new))
+            .transpose()?;
+
+        let connected = launch.start(index).and_then(|(stream, mut child)| {
+            match Self::handshake(stream, config, max_scale, &ring, &frames, &resource_handler) {
+                Ok((reader, channel)) => Ok((reader, channel, child)),
+                Err(e) => {
+                    if let Some(child) = &mut child {
+                        let _ = child.kill();
+                        let _ = child.wait();
+                    }
+                    Err(e)
+                }
+            }
+        });
+        // Both ends have it mapped by now, or never will
+        if ring.is_some() {
+            let _ = std::fs::remove_file(&frames);
+        }
+        let (reader, channel, child) = connected?;
+
+        let state = Arc::new(WorkerState {
+            pending: Mutex::new(Some(HashMap::new())),
+            jobs: AtomicUsize::new(0),
+            finished: Condvar::new(),
+            reported: Mutex::default(),
+            resident_bytes: AtomicU64::new(0),
+            counters: counters.clone(),
+        });
+        let reader = {
+            let (channel, state) = (channel.clone(), state.clone());
+            std::thread::Builder::new()
+                .name(format!("render-worker-{}-io", index))
+                .spawn(move || read_worker(reader, &channel, &state, resource_handler))
+                .map_err(|e| io_error("Failed to spawn render worker reader", e))?
+        };
+        counters.workers.fetch_add(1, Ordering::Relaxed);
+
+        Ok(Self {
+            index,
+            child,
+            channel,
+            state,
+            ring,
+            reader: Some(reader),
+            styles: HashSet::new(),
+            next_id: 0,
+        })
+    }
+
+    /// Configure a connected worker and wait for its pool
+    fn handshake(
+        stream: UnixStream,
+        config: &PoolConfig,
+        max_scale: u8,
+        ring: &Option<Arc<FrameRing>>,
+        frames: &Path,
+        resource_handler: &Option<Arc<dyn ResourceHandler>>,
+    ) -> Result<(UnixStream, Arc<Channel>)> {
+        let mut reader = stream
+            .try_clone()
+            .map_err(|e| io_error("Failed to clone render worker socket", e))?;
+        let channel = Arc::new(Channel(Mutex::new(stream)));
+        let init = Message::Init {
+            config: config.clone(),
+            max_scale,
+            frames: ring.as_ref().map(|ring| FramesFile {
+                path: frames.to_path_buf(),
+                len: ring.len(),
+            }),
+            resources: resource_handler.is_some(),
+        };
+        channel
+            .send(&init, &[])
+            .map_err(|e| io_error("Failed to configure render worker", e))?;
+
+        match read_message(&mut reader) {
+            Ok((Message::Ready, _)) => Ok((reader, channel)),
+            Ok((Message::Failed { message }, _)) => Err(TileServerError::RenderError(message)),
+            Ok((message, _)) => Err(TileServerError::RenderError(format!(
+                "Unexpected render worker message on startup: {:?}",
+                message
+            ))),
+            Err(e) => Err(io_error("Render worker exited on startup", e)),
+        }
+    }
+
+    /// Whether the worker is still running
+    pub(super) fn is_alive(&self) -> bool {
+        self.state.is_alive()
+    }
+
+    /// Jobs forwarded that haven't finished
+    pub(super) fn jobs(&self) -> usize {
+        self.state.jobs.load(Ordering::Relaxed)
+    }
+
+    /// Wait up to `timeout` for fewer than `jobs` jobs to be left unfinished,
+    /// or for the worker to exit
+    pub(super) fn wait_for_jobs(&self, jobs: usize, timeout: Duration) {
+        let deadline = Instant::now() + timeout;
+        let mut pending = self.state.pending.lock().unwrap_or_else(|e| e.into_inner());
+        while pending.is_some() && self.state.jobs.load(Ordering::Relaxed) >= jobs {
+            let now = Instant::now();
+            if now >= deadline {
+                return;
+            }
+            pending = self
+                .state
+                .finished
+                .wait_timeout(pending, deadline - now)
+                .unwrap_or_else(|e| e.into_inner())
+                .0;
+        }
+    }
+
+    /// Resident memory of the worker at its latest report
+    pub(super) fn resident_bytes(&self) -> u64 {
+        self.state.resident_bytes.load(Ordering::Relaxed)
+    }
+
+    /// Forward the renders of a job, each with where its result goes
+    pub(super) fn render(
+        &mut self,
+        style: &RenderStyle,
+        variant: Option<&StyleVariant>,
+        priority: Priority,
+        every_thread: bool,
+        renders: Vec<(RenderOptions, RenderDone)>,
+    ) {
+        let count = renders.len();
+        let mut forwarded = Vec::with_capacity(count);
+        {
+            let mut guard = self.state.pending.lock().unwrap_or_else(|e| e.into_inner());
+            let Some(pending) = guard.as_mut() else {
+                drop(guard);
+                for (_, done) in renders {
+                    done(Err(TileServerError::RenderError(
+                        "Render worker exited".to_string(),
+                    )));
+                }
+                return;
+            };
+            for (index, (options, done)) in renders.into_iter().enumerate() {
+                self.next_id += 1;
+                let slot = self
+                    .ring
+                    .as_ref()
+                    .and_then(|ring| ring.reserve(frame_len(&options)));
+                forwarded.push(WorkerRender {
+                    id: self.next_id,
+                    options,
+                    frame: slot.as_ref().map(|slot| (slot.offset, slot.len)),
+                });
+                let last = index + 1 == count;
+                pending.insert(self.next_id, PendingRender { done, slot, last });
+            }
+            self.state.jobs.fetch_add(1, Ordering::Relaxed);
+        }
+
+        let message = Message::Render {
+            style: style.hash(),
+            variant: variant.cloned(),
+            priority,
+            every_thread,
+            renders: forwarded,
+        };
+        if let Err(e) = self
+            .send_style(style)
+            .and_then(|()| self.channel.send(&message, &[]))
+        {
+            // The reader sees the hang-up and fails the job's renders
+            tracing::warn!("Failed to forward render to worker {}: {}", self.index, e);
+            self.channel.close();
+        }
+    }
+
+    /// Send a style unless the worker has it
+    fn send_style(&mut self, style: &RenderStyle) -> io::Result<()> {
+        if self.styles.contains(&style.hash()) {
+            return Ok(());
+        }
+        if self.styles.len() >= MAX_WORKER_STYLES {
+            self.channel.send(&Message::ForgetStyles, &[])?;
+            self.styles.clear();
+        }
+        self.channel.send(
+            &Message::Style {
+                hash: style.hash(),
+                json: style.json().to_string(),
+            },
+            &[],
+        )?;
+        self.styles.insert(style.hash());
+        Ok(())
+    }
+}
+
+impl Drop for WorkerProcess {
+    fn drop(&mut self) {
+        // The worker exits once it sees the hang-up and its renders finished
+        self.channel.close();
+        if let Some(reader) = self.reader.take() {
+            let _ = reader.join();
+        }
+        if let Some(mut child) = self.child.take() {
+            reap(&mut child, EXIT_TIMEOUT);
+        }
+        self.state.counters.workers.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+/// Wait up to `timeout` for a worker to exit, then kill it, so a worker hung
+/// in the renderer can't hold up the server
+fn reap(child: &mut Child, timeout: Duration) {
+    let deadline = Instant::now() + timeout;
+    while Instant::now() < deadline {
+        match child.try_wait() {
+            Ok(None) => std::thread::sleep(Duration::from_millis(10)),
+            _ => return,
+        }
+    }
+    tracing::warn!("Render worker {} did not exit, killing it", child.id());
+    let _ = child.kill();
+    let _ = child.wait();
+}
+
+/// Read a worker's messages until it hangs up
+fn read_worker(
+    mut stream: UnixStream,
+    channel: &Arc<Channel>,
+    state: &WorkerState,
+    resource_handler: Option<Arc<dyn ResourceHandler>>,
+) {
+    loop {
+        match read_message(&mut stream) {
+            Ok((
+                Message::Frame {
+                    id,
+                    result,
+                    counters,
+                },
+                payload,
+            )) => state.finish(id, result, counters, payload),
+            Ok((Message::Request { id, url, kind }, _)) => {
+                let reply = {
+                    let channel = channel.clone();
+                    move |response| send_resource(&channel, id, response)
+                };
+                match resource_handler
+                    .as_ref()
+                    .map(|handler| handler.handle(&url, kind))
+                {
+                    Some(ResourceResponse::Deferred(load)) => {
+                        load(ResourceResponder::from_fn(reply))
+                    }
+                    Some(response) => reply(response),
+                    None => reply(ResourceResponse::PassThrough),
+                }
+            }
+            Ok((message, _)) => {
+                tracing::warn!("Unexpected message from render worker: {:?}", message)
+            }
+            Err(e) => {
+                if e.kind() != io::ErrorKind::UnexpectedEof {
+                    tracing::warn!("Lost connection to render worker: {}", e);
+                }
+                break;
+            }
+        }
+    }
+    state.close("Render worker exited");
+}
+
+fn send_resource(channel: &Channel, id: u64, response: ResourceResponse) {
+    let (response, payload) = match response {
+        ResourceResponse::Data(data) => (WireResource::Data, data),
+        ResourceResponse::NotFound => (WireResource::NotFound, Bytes::new()),
+        ResourceResponse::Error(message) => (WireResource::Error(message), Bytes::new()),
+        ResourceResponse::PassThrough => (WireResource::PassThrough, Bytes::new()),
+        ResourceResponse::Deferred(_) => (
+            WireResource::Error("Resource response cannot be deferred here".to_string()),
+            Bytes::new(),
+        ),
+    };
+    if let Err(e) = channel.send(&Message::Resource { id, response }, &payload) {
+        tracing::debug!("Failed to send resource to render worker: {}", e);
+    }
+}
+
+/// Forwards a worker's resource requests to the server
+struct RemoteResources {
+    channel: Arc<Channel>,
+    pending: Arc<Mutex<HashMap<u64, ResourceResponder>>>,
+    next_id: AtomicU64,
+}
+
+impl RemoteResources {
+    /// Complete a request with the server's response
+    fn respond(&self, id: u64, response: WireResource, payload: Vec<u8>) {
+        let responder = self
+            .pending
+            .lock()
+            .unwrap_or_else(|e| e.into_inner())
+            .remove(&id);
+        if let Some(responder) = responder {
+            responder.respond(match response {
+                WireResource::Data => ResourceResponse::Data(Bytes::from(payload)),
+                WireResource::NotFound => ResourceResponse::NotFound,
+                WireResource::Error(message) => ResourceResponse::Error(message),
+                WireResource::PassThrough => ResourceResponse::PassThrough,
+            });
+        }
+    }
+}
+
+impl ResourceHandler for RemoteResources {
+    fn handle(&self, url: &str, kind: ResourceKind) -> ResourceResponse {
+        let id = self.next_id.fetch_add(1, Ordering::Relaxed);
+        let (channel, pending) = (self.channel.clone(), self.pending.clone());
+        let url = url.to_string();
+        ResourceResponse::Deferred(Box::new(move |responder: ResourceResponder| {
+            pending
+                .lock()
+                .unwrap_or_else(|e| e.into_inner())
+                .insert(id, responder);
+            if let Err(e) = channel.send(&Message::Request { id, url, kind }, &[]) {
+                tracing::debug!("Failed to request resource from server: {}", e);
+                // Dropping the responder fails the request
+                pending
+                    .lock()
+                    .unwrap_or_else(|e| e.into_inner())
+                    .remove(&id);
+            }
+        }))
+    }
+}
+
+/// The worker end: a pool rendering the jobs the server forwards
+struct Worker {
+    pool: RendererPool,
+    channel: Arc<Channel>,
+    ring: Option<FrameRing>,
+    resources: Arc<RemoteResources>,
+}
+
+/// Run a render worker for the server listening on `socket`, until the
+/// server hangs up
+pub async fn run_worker(socket: &Path) -> Result<()> {
+    let stream =
+        UnixStream::connect(socket).map_err(|e| io_error("Failed to connect to the server", e))?;
+    serve(stream).await
+}
+
+/// Serve the server connected on `stream`
+async fn serve(stream: UnixStream) -> Result<()> {
+    let mut reader = stream
+        .try_clone()
+        .map_err(|e| io_error("Failed to clone server socket", e))?;
+    let channel = Arc::new(Channel(Mutex::new(stream)));
+    let (message, _) =
+        read_message(&mut reader).map_err(|e| io_error("Failed to read worker settings", e))?;
+    let Message::Init {
+        config,
+        max_scale,
+        frames,
+        resources,
+    } = message
+    else {
+        return Err(TileServerError::RenderError(format!(
+            "Expected worker settings, got {:?}",
+            message
+        )));
+    };
+
+    let remote = Arc::new(RemoteResources {
+        channel: channel.clone(),
+        pending: Arc::default(),
+        next_id: AtomicU64::new(0),
+    });
+    let handler = resources.then(|| remote.clone() as Arc<dyn ResourceHandler>);
+    let started = frames
+        .map(|frames| {
+            FrameRing::open(&frames.path).and_then(|ring| {
+                if ring.len() == frames.len {
+                    Ok(ring)
+                } else {
+                    Err(TileServerError::RenderError(
+                        "Render frames file has the wrong size".to_string(),
+                    ))
+                }
+            })
+        })
+        .transpose()
+        .and_then(|ring| Ok((ring, RendererPool::new(config, max_scale, handler)?)));
+    let (ring, pool) = match started {
+        Ok(started) => started,
+        Err(e) => {
+            let failed = Message::Failed {
+                message: e.to_string(),
+            };
+            let _ = channel.send(&failed, &[]);
+            return Err(e);
+        }
+    };
+    channel
+        .send(&Message::Ready, &[])
+        .map_err(|e| io_error("Failed to report to the server", e))?;
+
+    let worker = Arc::new(Worker {
+        pool,
+        channel,
+        ring,
+        resources: remote,
+    });
+    let runtime = Handle::current();
+    tokio::task::spawn_blocking(move || worker.read(reader, runtime))
+        .await
+        .map_err(|e| io_error("Render worker reader failed", e))
+}
+
+impl Worker {
+    /// Read the server's messages until it hangs up, rendering on the runtime
+    fn read(self: Arc<Self>, mut reader: UnixStream, runtime: Handle) {
+        let mut styles: HashMap<u64, RenderStyle> = HashMap::new();
+        loop {
+            match read_message(&mut reader) {
+                Ok((Message::Style { hash, json }, _)) => {
+                    styles.insert(hash, RenderStyle::new(json));
+                }
+                Ok((Message::ForgetStyles, _)) => styles.clear(),
+                Ok((
+                    Message::Render {
+                        style,
+                        variant,
+                        priority,
+                        every_thread,
+                        renders,
+                    },
+                    _,
+                )) => {
+                    let worker = self.clone();
+                    let style = styles.get(&style).cloned();
+                    runtime.spawn(async move {
+                        worker
+                            .render(style, variant, priority, every_thread, renders)
+                            .await
+                    });
+                }
+                Ok((Message::Resource { id, response }, payload)) => {
+                    self.resources.respond(id, response, payload)
+                }
+                Ok((message, _)) => {
+                    tracing::warn!("Unexpected message from server: {:?}", message)
+                }
+                Err(e) => {
+                    if e.kind() != io::ErrorKind::UnexpectedEof {
+                        tracing::warn!("Lost connection to the server: {}", e);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    /// Render a forwarded job, sending each frame as soon as it is ready
+    async fn render(
+        &self,
+        style: Option<RenderStyle>,
+        variant: Option<StyleVariant>,
+        priority: Priority,
+        every_thread: bool,
+        renders: Vec<WorkerRender>,
+    ) {
+        let Some(style) = style else {
+            for render in renders {
+                let error = TileServerError::RenderError("Unknown style".to_string());
+                self.send_frame(render.id, render.frame, Err(error));
+            }
+            return;
+        };
+
+        if every_thread {
+            for render in renders {
+                let result = self.pool.warm_up(&style, render.options).await.map(|()| {
+                    (
+                        RenderedImage::from_rgba(0, 0, Vec::new()),
+                        RenderStats::default(),
+                    )
+                });
+                self.send_frame(render.id, render.frame, result);
+            }
+            return;
+        }
+
+        let (frames, options): (Vec<_>, Vec<_>) = renders
+            .into_iter()
+            .map(|render| ((render.id, render.frame), render.options))
+            .unzip();
+        let results =
+            self.pool
+                .queue_renders(None, &style, variant.map(Arc::new), options, priority);
+        for ((id, frame), result) in frames.into_iter().zip(results) {
+            self.send_frame(id, frame, result.await);
+        }
+    }
+
+    fn send_frame(
+        &self,
+        id: u64,
+        frame: Option<(usize, usize)>,
+        result: Result<(RenderedImage, RenderStats)>,
+    ) {
+        let (result, payload) = match &result {
+            Ok((image, stats)) => {
+                let data = image.data();
+                let in_ring = frame
+                    .zip(self.ring.as_ref())
+                    .is_some_and(|(frame, ring)| ring.write(frame, data));
+                let info = FrameInfo {
+                    width: image.width(),
+                    height: image.height(),
+                    len: data.len(),
+                    in_ring,
+                    stats: *stats,
+                };
+                (Ok(info), if in_ring { &[][..] } else { data })
+            }
+            Err(e) => (Err(WireError::from(e)), &[][..]),
+        };
+
+        let message = Message::Frame {
+            id,
+            result,
+            counters: self.counters(),
+        };
+        if let Err(e) = self.channel.send(&message, payload) {
+            tracing::debug!("Failed to send frame to the server: {}", e);
+        }
+    }
+
+    fn counters(&self) -> WorkerCounters {
+        let stats = self.pool.stats();
+        WorkerCounters {
+            maps: stats.maps,
+            style_loads: stats.style_loads,
+            resizes: stats.resizes,
+            style_edits: stats.style_edits,
+            cancelled: stats.cancelled,
+            resident_bytes: resident_bytes(),
+        }
+    }
+}
+
+/// Resident memory of this process, or 0 where it can't be read
+fn resident_bytes() -> u64 {
+    std::fs::read_to_string("/proc/self/status")
+        .ok()
+        .and_then(|status| {
+            let line = status.lines().find(|line| line.starts_with("VmRSS:"))?;
+            line.split_whitespace().nth(1)?.parse::<u64>().ok()
+        })
+        .map_or(0, |kilobytes| kilobytes << 10)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn ring(len: usize) -> (tempfile::TempDir, Arc<FrameRing>) {
+        let dir = tempfile::tempdir().unwrap();
+        let ring = FrameRing::create(&dir.path().join("frames"), len).unwrap();
+        (dir, Arc::new(ring))
+    }
+
+    #[test]
+    fn test_ring_reclaims_room_from_the_tail() {
+        let (_dir, ring) = ring(100);
+
+        let a = ring.reserve(40).unwrap();
+        let b = ring.reserve(40).unwrap();
+        assert_eq!((a.offset, b.offset), (0, 40));
+        assert!(ring.reserve(40).is_none());
+
+        // Released out of order, room behind the oldest frame stays taken
+        drop(b);
+        assert!(ring.reserve(40).is_none());
+        drop(a);
+        let c = ring.reserve(60).unwrap();
+        let d = ring.reserve(40).unwrap();
+        assert_eq!((c.offset, d.offset), (0, 60));
+
+        // Wraps around once the tail moves on
+        drop(c);
+        let e = ring.reserve(50).unwrap();
+        assert_eq!(e.offset, 0);
+        assert!(ring.reserve(20).is_none());
+        assert!(ring.reserve(101).is_none());
+    }
+
+    #[test]
+    fn test_frames_written_by_the_worker_are_read_in_place() {
+        let (dir, ring) = ring(64);
+        let worker = FrameRing::open(&dir.path().join("frames")).unwrap();
+
+        let _first = ring.reserve(16).unwrap();
+        let slot = ring.reserve(16).unwrap();
+        assert!(worker.write((slot.offset, slot.len), &[7; 16]));
+        // Frames larger than their room are sent inline instead
+        assert!(!worker.write((slot.offset, slot.len), &[7; 17]));
+
+        let image = RenderedImage::from_frame(2, 2, slot);
+        assert_eq!(image.data(), &[7; 16]);
+    }
+
+    struct TileHandler;
+
+    impl ResourceHandler for TileHandler {
+        fn handle(&self, url: &str, _kind: ResourceKind) -> ResourceResponse {
+            match url {
+                "local://tile" => ResourceResponse::Deferred(Box::new(|responder| {
+                    responder.respond(ResourceResponse::Data(Bytes::from_static(b"pbf")))
+                })),
+                "local://missing" => ResourceResponse::NotFound,
+                _ => ResourceResponse::PassThrough,
+            }
+        }
+    }
+
+    #[tokio::test]
+    async fn test_worker_resources_are_loaded_by_the_server() {
+        let (server, worker) = UnixStream::pair().unwrap();
+        let state = WorkerState {
+            pending: Mutex::new(Some(HashMap::new())),
+            jobs: AtomicUsize::new(0),
+            finished: Condvar::new(),
+            reported: Mutex::default(),
+            resident_bytes: AtomicU64::new(0),
+            counters: PoolCounters::default(),
+        };
+        let server_channel = Arc::new(Channel(Mutex::new(server.try_clone().unwrap())));
+        let server_reader = std::thread::spawn(move || {
+            read_worker(server, &server_channel, &state, Some(Arc::new(TileHandler)))
+        });
+
+        let mut reader = worker.try_clone().unwrap();
+        let remote = Arc::new(RemoteResources {
+            channel: Arc::new(Channel(Mutex::new(worker))),
+            pending: Arc::default(),
+            next_id: AtomicU64::new(0),
+        });
+        let mut responses = Vec::new();
+        for url in [
+            "local://tile",
+            "local://missing",
+            "https://example.com/tile",
+        ] {
+            let ResourceResponse::Deferred(load) = remote.handle(url, ResourceKind::Tile) else {
+                panic!("worker requests are deferred");
+            };
+            let (responder, response) = ResourceResponder::channel();
+            load(responder);
+            let (Message::Resource { id, response: wire }, payload) =
+                read_message(&mut reader).unwrap()
+            else {
+                panic!("expected a resource");
+            };
+            remote.respond(id, wire, payload);
+            responses.push(response.await.unwrap());
+        }
+
+        assert!(matches!(&responses[0], ResourceResponse::Data(data) if data == "pbf"));
+        assert!(matches!(responses[1], ResourceResponse::NotFound));
+        assert!(matches!(responses[2], ResourceResponse::PassThrough));
+
+        remote.channel.close();
+        server_reader.join().unwrap();
+    }
+
+    #[test]
+    fn test_hung_worker_is_killed() {
+        let mut child = Command::new("sleep").arg("60").spawn().unwrap();
+        let started = Instant::now();
+        reap(&mut child, Duration::from_millis(50));
+        assert!(started.elapsed() < Duration::from_secs(30));
+        assert!(child.try_wait().unwrap().is_some());
+    }
+
+    #[test]
+    fn test_worker_maps_load_passed_through_resources() {
+        use super::super::native::{init, MapMode, NativeMap, Size};
+
+        let (server, worker) = UnixStream::pair().unwrap();
+        let state = WorkerState {
+            pending: Mutex::new(Some(HashMap::new())),
+            jobs: AtomicUsize::new(0),
+            finished: Condvar::new(),
+            reported: Mutex::default(),
+            resident_bytes: AtomicU64::new(0),
+            counters: PoolCounters::default(),
+        };
+        let server_channel = Arc::new(Channel(Mutex::new(server.try_clone().unwrap())));
+        let server_reader = std::thread::spawn(move || {
+            read_worker(server, &server_channel, &state, Some(Arc::new(TileHandler)))
+        });
+
+        let mut reader = worker.try_clone().unwrap();
+        let remote = Arc::new(RemoteResources {
+            channel: Arc::new(Channel(Mutex::new(worker))),
+            pending: Arc::default(),
+            next_id: AtomicU64::new(0),
+        });
+        let worker_reader = {
+            let remote = remote.clone();
+            std::thread::spawn(move || {
+                while let Ok((Message::Resource { id, response }, payload)) =
+                    read_message(&mut reader)
+                {
+                    remote.respond(id, response, payload);
+                }
+            })
+        };
+
+        // The server doesn't route file URLs, so the worker's map loads them
+        let dir = tempfile::tempdir().unwrap();
+        let style = dir.path().join("style.json");
+        std::fs::write(&style, r#"{"version":8,"sources":{},"layers":[]}"#).unwrap();
+
+        init().unwrap();
+        let mut map =
+            NativeMap::with_resource_handler(Size::new(32, 32), 1.0, MapMode::Tile, remote.clone())
+                .unwrap();
+        map.load_style_url(&format!("file://{}", style.display()))
+            .unwrap();
+        assert!(map
+            .load_style_url(&format!(
+                "file://{}",
+                dir.path().join("missing.json").display()
+            ))
+            .is_err());
+        drop(map);
+
+        remote.channel.close();
+        worker_reader.join().unwrap();
+        server_reader.join().unwrap();
+    }
+
+    #[test]
+    fn test_messages_round_trip_with_payload() {
+        let mut buffer = Vec::new();
+        let message = Message::Resource {
+            id: 3,
+            response: WireResource::Data,
+        };
+        write_message(&mut buffer, &message, b"tile").unwrap();
+
+        let (message, payload) = read_message(&mut &buffer[..]).unwrap();
+        assert!(matches!(
+            message,
+            Message::Resource {
+                id: 3,
+                response: WireResource::Data
+            }
+        ));
+        assert_eq!(payload, b"tile");
+
+        // A corrupt length is rejected before anything is allocated
+        buffer[4..8].copy_from_slice(&u32::MAX.to_le_bytes());
+        assert!(read_message(&mut &buffer[..]).is_err());
+    }
+
+    #[test]
+    fn test_frames_file_is_private() {
+        use std::os::unix::fs::PermissionsExt;
+
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("frames");
+        FrameRing::create(&path, 100).unwrap();
+        let mode = std::fs::metadata(&path).unwrap().permissions().mode();
+        assert_eq!(mode & 0o777, 0o600);
+    }
+}
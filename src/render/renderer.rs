@@ -5,39 +5,98 @@
 
 use std::sync::Arc;
 
-use super::pool::{PoolConfig, RendererPool};
-use super::types::{ImageFormat, RenderOptions};
+use bytes::Bytes;
+
+use super::cache::{RenderCache, RenderCacheKey, RenderCacheStats};
+use super::coalesce::Coalescer;
+use super::loader::ResourceLoader;
+use super::metatile::Metatile;
+use super::native::RenderedImage;
+use super::overlay::{MarkerOverlay, PathOverlay};
+use super::pool::{PoolConfig, Priority, RendererPool};
+use super::types::{EncodeOptions, ImageFormat, RenderOptions, RenderStyle};
+use super::uniform::UniformTiles;
+use super::variant::StyleVariant;
 use crate::error::{Result, TileServerError};
 
 /// High-level renderer that manages the native renderer pool
 pub struct Renderer {
     pool: Arc<RendererPool>,
+    cache: Option<RenderCache>,
+    metatile: u32,
+    /// Tile renders in flight, keyed by their metatile's top-left tile
+    flights: Coalescer<RenderCacheKey, RenderedTiles>,
+    uniform: Arc<UniformTiles>,
 }
 
+/// Encoded tiles of one render
+pub type RenderedTiles = Arc<[((u32, u32), Bytes)]>;
+
 impl Renderer {
     /// Create a new renderer with default configuration
+    #[allow(dead_code)]
     pub fn new() -> Result<Self> {
         Self::with_config(PoolConfig::default(), 3)
     }
 
-    /// Create a new renderer with custom configuration
+    /// Create a new renderer with custom configuration.
+    /// Resources are fetched by MapLibre Native's default file source.
     pub fn with_config(config: PoolConfig, max_scale: u8) -> Result<Self> {
-        let pool = RendererPool::new(config, max_scale)?;
-        Ok(Self {
+        let pool = RendererPool::new(config, max_scale, None)?;
+        Ok(Self::from_pool(pool))
+    }
+
+    /// Create a new renderer that loads tiles, glyphs and sprites in-process
+    /// through `loader` instead of over HTTP.
+    pub fn with_resource_loader(
+        config: PoolConfig,
+        max_scale: u8,
+        loader: ResourceLoader,
+    ) -> Result<Self> {
+        let pool = RendererPool::new(config, max_scale, Some(Arc::new(loader)))?;
+        Ok(Self::from_pool(pool))
+    }
+
+    fn from_pool(pool: RendererPool) -> Self {
+        let config = pool.config();
+        let mut cache = (config.cache_size_mb > 0 || config.cache_dir.is_some())
+            .then(|| RenderCache::new(config.cache_size_mb, config.cache_ttl));
+        if let (Some(cache), Some(dir)) = (&mut cache, &config.cache_dir) {
+            let disk_size_mb = config.cache_disk_size_mb;
+            if let Err(e) = cache.open_disk(dir, &config.encode, disk_size_mb, config.cache_ttl) {
+                tracing::warn!("{}. Render cache is memory-only.", e);
+            }
+        }
+
+        // Sibling tiles of a metatile are only useful if they can be cached
+        let metatile = if cache.is_some() {
+            config.metatile.max(1)
+        } else {
+            if config.metatile > 1 {
+                tracing::warn!("render.metatile requires the render cache; rendering single tiles");
+            }
+            1
+        };
+
+        Self {
             pool: Arc::new(pool),
-        })
+            cache,
+            metatile,
+            flights: Coalescer::default(),
+            uniform: Arc::default(),
+        }
     }
 
     /// Render a map tile
     pub async fn render_tile(
         &self,
-        style_json: &str,
+        style: &RenderStyle,
         z: u8,
         x: u32,
         y: u32,
         scale: u8,
         format: ImageFormat,
-    ) -> Result<Vec<u8>> {
+    ) -> Result<Bytes> {
         tracing::debug!(
             "Rendering tile z={}, x={}, y={}, scale={}, format={:?}",
             z,
@@ -47,17 +106,146 @@ impl Renderer {
             format
         );
 
-        // Get PNG from pool
-        let png_data = self.pool.render_tile(style_json, z, x, y, scale).await?;
+        let key = self.cache_key(style, z, x, y, scale, format);
+        if let Some(cache) = &self.cache {
+            if let Some(data) = cache.get(&key).await {
+                return Ok(data);
+            }
+        }
+
+        self.render_tiles(style, z, x, y, scale, format, Priority::Tile)
+            .await?
+            .iter()
+            .find(|(tile, _)| *tile == (x, y))
+            .map(|(_, data)| data.clone())
+            .ok_or_else(|| {
+                TileServerError::RenderError("Metatile did not contain requested tile".to_string())
+            })
+    }
 
-        // Convert to requested format if needed
-        match format {
-            ImageFormat::Png => Ok(png_data),
-            ImageFormat::Jpeg => self.convert_png_to_jpeg(&png_data, 90),
-            ImageFormat::Webp => self.convert_png_to_webp(&png_data, 90),
+    /// Render the metatile containing a tile and return all of its tiles,
+    /// without looking in the cache first. The tiles are stored in the cache.
+    #[allow(clippy::too_many_arguments)]
+    pub async fn render_tiles(
+        &self,
+        style: &RenderStyle,
+        z: u8,
+        x: u32,
+        y: u32,
+        scale: u8,
+        format: ImageFormat,
+        priority: Priority,
+    ) -> Result<RenderedTiles> {
+        let key = self.cache_key(style, z, x, y, scale, format);
+        let config = self.pool.config();
+        let metatile = Metatile::containing(
+            z,
+            x,
+            y,
+            self.metatile,
+            config.metatile_buffer,
+            config.tile_size,
+            key.scale as f32,
+        );
+
+        // Concurrent requests for any tile of the same metatile share its render
+        let (origin_x, origin_y) = metatile.origin();
+        self.flights
+            .run(key.with_tile(origin_x, origin_y), || async {
+                let tiles = if metatile.size() > 1 {
+                    self.render_metatile(style, key, metatile, priority).await?
+                } else {
+                    let image = self
+                        .pool
+                        .render_tile(style, z, x, y, key.scale, priority)
+                        .await?;
+                    vec![((x, y), self.encode_tile(image, format).await?)]
+                };
+
+                if let Some(cache) = &self.cache {
+                    for ((x, y), data) in &tiles {
+                        cache.insert(key.with_tile(*x, *y), data.clone()).await;
+                    }
+                }
+                Ok(Arc::from(tiles))
+            })
+            .await
+    }
+
+    /// Whether a tile is in the render cache
+    pub async fn is_cached(
+        &self,
+        style: &RenderStyle,
+        z: u8,
+        x: u32,
+        y: u32,
+        scale: u8,
+        format: ImageFormat,
+    ) -> bool {
+        let key = self.cache_key(style, z, x, y, scale, format);
+        match &self.cache {
+            Some(cache) => cache.get(&key).await.is_some(),
+            None => false,
+        }
+    }
+
+    /// Tiles per metatile edge, at most. Metatiles are aligned to multiples
+    /// of it and smaller at low zooms and high scales.
+    pub fn metatile(&self) -> u32 {
+        Metatile::max_size(self.metatile)
+    }
+
+    fn cache_key(
+        &self,
+        style: &RenderStyle,
+        z: u8,
+        x: u32,
+        y: u32,
+        scale: u8,
+        format: ImageFormat,
+    ) -> RenderCacheKey {
+        RenderCacheKey {
+            style_hash: style.hash(),
+            z,
+            x,
+            y,
+            scale: self.pool.clamp_scale(scale),
+            format,
         }
     }
 
+    /// Render the metatile containing `key` in one pass and encode every tile
+    /// in it
+    async fn render_metatile(
+        &self,
+        style: &RenderStyle,
+        key: RenderCacheKey,
+        metatile: Metatile,
+        priority: Priority,
+    ) -> Result<Vec<((u32, u32), Bytes)>> {
+        let tile_size = self.pool.config().tile_size;
+        let pixel_ratio = key.scale as f32;
+
+        let options = super::native::RenderOptions {
+            timeout: self.pool.config().tile_timeout,
+            ..metatile.render_options(tile_size, pixel_ratio)
+        };
+        let frame = self.pool.render_static(style, options, priority).await?;
+
+        let uniform = self.uniform.clone();
+        let options = self.pool.config().encode;
+        tokio::task::spawn_blocking(move || {
+            let encode = |image| encode_image(image, key.format, &options);
+            metatile
+                .slice(&frame, tile_size, pixel_ratio)?
+                .into_iter()
+                .map(|(tile, image)| Ok((tile, uniform.encode(image, key.format, encode)?)))
+                .collect::<Result<Vec<_>>>()
+        })
+        .await
+        .map_err(|e| TileServerError::RenderError(format!("Encode task failed: {}", e)))?
+    }
+
     /// Render a static map image
     pub async fn render_static(&self, options: RenderOptions) -> Result<Vec<u8>> {
         tracing::debug!(
@@ -70,141 +258,74 @@ impl Renderer {
             options.lat
         );
 
-        let native_options = super::native::RenderOptions {
+        let (paths, markers) = parse_overlays(&options);
+        let native_options = self.native_options(&options);
+        let image = if paths.is_empty() && markers.is_empty() {
+            self.pool
+                .render_static(&options.style, native_options, Priority::Static)
+                .await?
+        } else if self.pool.config().gpu_overlays {
+            // Styles that already use the reserved overlay IDs are rejected here
+            let edits = super::overlay::style_edits(&paths, &markers);
+            let variant = Arc::new(StyleVariant::new(options.style.parsed(), edits)?);
+            self.pool
+                .render_variant(&options.style, variant, native_options, Priority::Static)
+                .await?
+        } else {
+            let image = self
+                .pool
+                .render_static(&options.style, native_options, Priority::Static)
+                .await?;
+            draw_overlays(image, &paths, &markers, &options)?
+        };
+
+        self.encode(image, options.format).await
+    }
+
+    fn native_options(&self, options: &RenderOptions) -> super::native::RenderOptions {
+        super::native::RenderOptions {
             size: super::native::Size::new(options.width, options.height),
             pixel_ratio: options.scale as f32,
             camera: super::native::CameraOptions::new(options.lat, options.lon, options.zoom)
                 .with_bearing(options.bearing)
                 .with_pitch(options.pitch),
             mode: super::native::MapMode::Static,
-        };
-
-        let rendered_image = self
-            .pool
-            .render_static(&options.style_json, native_options)
-            .await?;
-
-        // Apply overlays if specified
-        let final_image = self.apply_overlays(rendered_image, &options)?;
-
-        // Convert to requested format
-        match options.format {
-            ImageFormat::Png => final_image.to_png(),
-            ImageFormat::Jpeg => final_image.to_jpeg(90),
-            ImageFormat::Webp => final_image.to_webp(90),
+            timeout: self.pool.config().static_timeout,
         }
     }
 
-    /// Apply path and marker overlays to a rendered image
-    fn apply_overlays(
-        &self,
-        mut image: super::native::RenderedImage,
-        options: &RenderOptions,
-    ) -> Result<super::native::RenderedImage> {
-        // Parse paths and markers
-        let mut paths = Vec::new();
-        let mut markers = Vec::new();
-
-        if let Some(ref path_str) = options.path {
-            // Multiple paths can be separated by |
-            for path_part in path_str.split('~') {
-                if let Some(path) = super::overlay::parse_path(path_part) {
-                    paths.push(path);
-                }
-            }
-        }
-
-        if let Some(ref marker_str) = options.marker {
-            // Multiple markers can be separated by |
-            for marker_part in marker_str.split('~') {
-                if let Some(marker) = super::overlay::parse_marker(marker_part) {
-                    markers.push(marker);
-                }
-            }
-        }
-
-        // If no overlays, return the original image
-        if paths.is_empty() && markers.is_empty() {
-            return Ok(image);
-        }
-
-        // Convert to image::RgbaImage for drawing
-        let actual_width = options.width * options.scale as u32;
-        let actual_height = options.height * options.scale as u32;
-
-        let mut rgba_image =
-            image::RgbaImage::from_raw(actual_width, actual_height, image.take_data()).ok_or_else(
-                || TileServerError::RenderError("Failed to create image buffer".to_string()),
-            )?;
-
-        // Draw overlays
-        super::overlay::draw_overlays(
-            &mut rgba_image,
-            &paths,
-            &markers,
-            options.lon,
-            options.lat,
-            options.zoom,
-            options.scale as f32,
-        );
-
-        // Convert back to native RenderedImage
-        Ok(super::native::RenderedImage::from_rgba(
-            actual_width,
-            actual_height,
-            rgba_image.into_raw(),
-        ))
-    }
-
-    /// Convert PNG data to JPEG
-    fn convert_png_to_jpeg(&self, png_data: &[u8], quality: u8) -> Result<Vec<u8>> {
-        use image::ImageReader;
-        use std::io::Cursor;
-
-        let img = ImageReader::new(Cursor::new(png_data))
-            .with_guessed_format()
-            .map_err(|e| TileServerError::RenderError(format!("Failed to read PNG: {}", e)))?
-            .decode()
-            .map_err(|e| TileServerError::RenderError(format!("Failed to decode PNG: {}", e)))?;
-
-        let rgb = img.to_rgb8();
-
-        let mut buffer = Vec::new();
-        {
-            let mut encoder =
-                image::codecs::jpeg::JpegEncoder::new_with_quality(&mut buffer, quality);
-            encoder
-                .encode(
-                    rgb.as_raw(),
-                    rgb.width(),
-                    rgb.height(),
-                    image::ExtendedColorType::Rgb8,
-                )
-                .map_err(|e| {
-                    TileServerError::RenderError(format!("JPEG encoding failed: {}", e))
-                })?;
-        }
-
-        Ok(buffer)
+    /// Encode rendered pixels once, straight into the requested format.
+    /// Runs on the blocking pool so render threads are free for the next job.
+    async fn encode(&self, image: RenderedImage, format: ImageFormat) -> Result<Vec<u8>> {
+        let options = self.pool.config().encode;
+        tokio::task::spawn_blocking(move || encode_image(image, format, &options))
+            .await
+            .map_err(|e| TileServerError::RenderError(format!("Encode task failed: {}", e)))?
     }
 
-    /// Convert PNG data to WebP
-    fn convert_png_to_webp(&self, png_data: &[u8], _quality: u8) -> Result<Vec<u8>> {
-        use image::ImageReader;
-        use std::io::Cursor;
-
-        let img = ImageReader::new(Cursor::new(png_data))
-            .with_guessed_format()
-            .map_err(|e| TileServerError::RenderError(format!("Failed to read PNG: {}", e)))?
-            .decode()
-            .map_err(|e| TileServerError::RenderError(format!("Failed to decode PNG: {}", e)))?;
+    /// Encode a rendered tile, sharing the encoding of single-colour tiles
+    async fn encode_tile(&self, image: RenderedImage, format: ImageFormat) -> Result<Bytes> {
+        let uniform = self.uniform.clone();
+        let options = self.pool.config().encode;
+        tokio::task::spawn_blocking(move || {
+            uniform.encode(image, format, |image| encode_image(image, format, &options))
+        })
+        .await
+        .map_err(|e| TileServerError::RenderError(format!("Encode task failed: {}", e)))?
+    }
 
-        // Use DynamicImage to write WebP
-        let mut buffer = Cursor::new(Vec::new());
-        img.write_to(&mut buffer, image::ImageFormat::WebP)
-            .map_err(|e| TileServerError::RenderError(format!("WebP encoding failed: {}", e)))?;
+    /// Render a low-zoom tile with the style on every render thread, so
+    /// requests that follow find a map with the style parsed, its sprite and
+    /// glyphs loaded and its GL context and shaders initialized
+    pub async fn warm_up(&self, style: &RenderStyle) -> Result<()> {
+        let config = self.pool.config();
+        let options = super::native::RenderOptions::for_tile(0, 0, 0, config.tile_size, 1.0);
+        self.pool.warm_up(style, options).await
+    }
 
-        Ok(buffer.into_inner())
+    /// Rendered tile cache counters, if the cache is enabled
+    pub fn cache_stats(&self) -> Option<RenderCacheStats> {
+        self.cache.as_ref().map(RenderCache::stats)
     }
 
     /// Get the underlying pool (for advanced usage)
@@ -213,6 +334,59 @@ impl Renderer {
     }
 }
 
+/// Paths and markers of a static image; several of each are separated by `~`
+fn parse_overlays(options: &RenderOptions) -> (Vec<PathOverlay>, Vec<MarkerOverlay>) {
+    let paths = options
+        .path
+        .iter()
+        .flat_map(|paths| paths.split('~'))
+        .filter_map(super::overlay::parse_path)
+        .collect();
+    let markers = options
+        .marker
+        .iter()
+        .flat_map(|markers| markers.split('~'))
+        .filter_map(super::overlay::parse_marker)
+        .collect();
+    (paths, markers)
+}
+
+/// Draw overlays directly into the rendered pixels
+fn draw_overlays(
+    mut image: RenderedImage,
+    paths: &[PathOverlay],
+    markers: &[MarkerOverlay],
+    options: &RenderOptions,
+) -> Result<RenderedImage> {
+    if paths.is_empty() && markers.is_empty() {
+        return Ok(image);
+    }
+
+    let mut canvas = image.as_image_mut()?;
+    super::overlay::draw_overlays(
+        &mut canvas,
+        paths,
+        markers,
+        options.lon,
+        options.lat,
+        options.zoom,
+        options.scale as f32,
+    );
+    Ok(image)
+}
+
+fn encode_image(
+    image: RenderedImage,
+    format: ImageFormat,
+    options: &EncodeOptions,
+) -> Result<Vec<u8>> {
+    match format {
+        ImageFormat::Png => image.into_png(options),
+        ImageFormat::Jpeg => image.into_jpeg(options.jpeg_quality),
+        ImageFormat::Webp => image.into_webp(),
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -222,4 +396,181 @@ mod tests {
         let renderer = Renderer::new();
         assert!(renderer.is_ok());
     }
+
+    fn test_config(metatile: u32, cache_size_mb: u64) -> PoolConfig {
+        PoolConfig {
+            tile_size: 256,
+            pool_size: 1,
+            metatile,
+            metatile_buffer: 16,
+            cache_size_mb,
+            ..PoolConfig::default()
+        }
+    }
+
+    const STYLE: &str = r#"{"version":8,"sources":{},"layers":[]}"#;
+
+    #[tokio::test]
+    async fn test_render_tile_is_cached() {
+        let renderer = Renderer::with_config(test_config(1, 16), 3).unwrap();
+
+        let first = renderer
+            .render_tile(&RenderStyle::new(STYLE), 3, 1, 1, 1, ImageFormat::Png)
+            .await
+            .unwrap();
+        let second = renderer
+            .render_tile(&RenderStyle::new(STYLE), 3, 1, 1, 1, ImageFormat::Png)
+            .await
+            .unwrap();
+
+        assert_eq!(first, second);
+        assert_eq!(renderer.pool.stats().maps, 1);
+        assert_eq!(renderer.cache.as_ref().unwrap().entry_count(), 1);
+    }
+
+    #[tokio::test]
+    async fn test_concurrent_requests_share_render() {
+        let renderer = Arc::new(Renderer::with_config(test_config(1, 0), 3).unwrap());
+
+        // Without a cache every request reaches the coalescer
+        let renders = (0..8).map(|_| {
+            let renderer = renderer.clone();
+            tokio::spawn(async move {
+                renderer
+                    .render_tile(&RenderStyle::new(STYLE), 3, 1, 1, 1, ImageFormat::Png)
+                    .await
+            })
+        });
+
+        let tiles: Vec<_> = futures::future::join_all(renders)
+            .await
+            .into_iter()
+            .map(|render| render.unwrap().unwrap())
+            .collect();
+        assert!(tiles.iter().all(|tile| *tile == tiles[0]));
+        assert_eq!(renderer.pool.stats().renders, 1);
+    }
+
+    #[tokio::test]
+    async fn test_metatile_fills_cache() {
+        let renderer = Renderer::with_config(test_config(2, 16), 3).unwrap();
+
+        renderer
+            .render_tile(&RenderStyle::new(STYLE), 3, 5, 2, 1, ImageFormat::Png)
+            .await
+            .unwrap();
+
+        // One frame rendered, all four tiles of the block cached
+        let cache = renderer.cache.as_ref().unwrap();
+        assert_eq!(cache.entry_count(), 4);
+        let key = RenderCacheKey {
+            style_hash: RenderStyle::new(STYLE).hash(),
+            z: 3,
+            x: 4,
+            y: 3,
+            scale: 1,
+            format: ImageFormat::Png,
+        };
+        assert!(cache.get(&key).await.is_some());
+    }
+
+    #[tokio::test]
+    async fn test_metatile_requires_cache() {
+        let renderer = Renderer::with_config(test_config(4, 0), 3).unwrap();
+        assert!(renderer.cache.is_none());
+        assert_eq!(renderer.metatile, 1);
+
+        let tile = renderer
+            .render_tile(&RenderStyle::new(STYLE), 3, 5, 2, 1, ImageFormat::Png)
+            .await
+            .unwrap();
+        assert!(!tile.is_empty());
+    }
+
+    #[tokio::test]
+    async fn test_encode_formats() {
+        let renderer = Renderer::new().unwrap();
+        let encode =
+            |format| renderer.encode(RenderedImage::from_rgba(2, 2, vec![255; 16]), format);
+
+        assert!(encode(ImageFormat::Png)
+            .await
+            .unwrap()
+            .starts_with(b"\x89PNG"));
+        assert!(encode(ImageFormat::Jpeg)
+            .await
+            .unwrap()
+            .starts_with(&[0xFF, 0xD8]));
+        assert!(encode(ImageFormat::Webp)
+            .await
+            .unwrap()
+            .starts_with(b"RIFF"));
+    }
+
+    #[tokio::test]
+    async fn test_gpu_overlays_are_added_to_the_style() {
+        let config = PoolConfig {
+            gpu_overlays: true,
+            ..test_config(1, 0)
+        };
+        let renderer = Renderer::with_config(config, 3).unwrap();
+        let options = |path: Option<&str>| RenderOptions {
+            style_id: "test".to_string(),
+            style: RenderStyle::new(STYLE),
+            width: 64,
+            height: 32,
+            scale: 1,
+            lon: 0.0,
+            lat: 0.0,
+            zoom: 2.0,
+            bearing: 0.0,
+            pitch: 0.0,
+            format: ImageFormat::Png,
+            path: path.map(str::to_string),
+            marker: Some("pin-s+f00(0,0)".to_string()),
+        };
+
+        for path in [Some("path-4+00f(-10,-10|10,10)"), None] {
+            let png = renderer.render_static(options(path)).await.unwrap();
+            assert!(png.starts_with(b"\x89PNG"));
+        }
+        // One map, whose overlays were replaced rather than its style reloaded
+        let stats = renderer.pool().stats();
+        assert_eq!(
+            (stats.maps, stats.style_loads, stats.style_edits),
+            (1, 1, 2)
+        );
+
+        // The overlay IDs are reserved
+        const CLASHING: &str = r#"{"version":8,"sources":{"tileserver-overlay":{"type":"geojson","data":"https://example.com/a.geojson"}},"layers":[]}"#;
+        let clashing = RenderOptions {
+            style: RenderStyle::new(CLASHING),
+            ..options(None)
+        };
+        assert!(renderer.render_static(clashing).await.is_err());
+        assert_eq!(renderer.pool().stats().renders, 2);
+    }
+
+    #[tokio::test]
+    async fn test_encode_palette_png() {
+        let config = PoolConfig {
+            encode: EncodeOptions {
+                png_palette: true,
+                ..EncodeOptions::default()
+            },
+            ..test_config(1, 0)
+        };
+        let renderer = Renderer::with_config(config, 3).unwrap();
+
+        let png = renderer
+            .encode(
+                RenderedImage::from_rgba(2, 2, vec![255; 16]),
+                ImageFormat::Png,
+            )
+            .await
+            .unwrap();
+        assert!(png.starts_with(b"\x89PNG"));
+        // Indexed colour
+        assert_eq!(png[25], 3);
+    }
 }
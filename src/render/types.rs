@@ -1,5 +1,10 @@
-use serde::Deserialize;
+use serde::{Deserialize, Serialize};
+use serde_json::Value;
 use std::str::FromStr;
+use std::sync::{Arc, OnceLock};
+
+use super::native::hash_style;
+use crate::config::{PngCompression, PngFilter, RenderConfig};
 
 /// Maximum allowed image dimension (width or height) in pixels
 pub const MAX_IMAGE_DIMENSION: u32 = 4096;
@@ -8,7 +13,7 @@ pub const MAX_IMAGE_DIMENSION: u32 = 4096;
 pub const MAX_SCALE_FACTOR: u8 = 4;
 
 /// Image format for rendered output
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 pub enum ImageFormat {
     Png,
     Jpeg,
@@ -38,6 +43,76 @@ impl FromStr for ImageFormat {
     }
 }
 
+/// A style as the renderer loads it: its native JSON, serialized once, and
+/// the hash pooled maps and cached tiles are keyed by
+#[derive(Debug, Clone)]
+pub struct RenderStyle {
+    json: Arc<str>,
+    hash: u64,
+    /// Parsed on first use, shared by clones
+    parsed: Arc<OnceLock<Value>>,
+}
+
+impl RenderStyle {
+    pub fn new(json: impl Into<Arc<str>>) -> Self {
+        let json = json.into();
+        Self {
+            hash: hash_style(&json),
+            json,
+            parsed: Arc::default(),
+        }
+    }
+
+    /// The parsed style, `null` if it is not valid JSON
+    pub fn parsed(&self) -> &Value {
+        self.parsed
+            .get_or_init(|| serde_json::from_str(&self.json).unwrap_or(Value::Null))
+    }
+
+    pub fn json(&self) -> &str {
+        &self.json
+    }
+
+    pub fn hash(&self) -> u64 {
+        self.hash
+    }
+}
+
+/// Encoder settings for rendered images
+#[derive(Debug, Clone, Copy, PartialEq, Serialize, Deserialize)]
+pub struct EncodeOptions {
+    pub png_compression: PngCompression,
+    pub png_filter: PngFilter,
+    /// Reduce PNGs to an 8-bit palette
+    pub png_palette: bool,
+    pub jpeg_quality: u8,
+}
+
+impl EncodeOptions {
+    /// Stable hash of the settings, so tiles encoded with different ones
+    /// are cached apart
+    pub fn hash(&self) -> u64 {
+        hash_style(&serde_json::to_string(self).unwrap_or_default())
+    }
+}
+
+impl Default for EncodeOptions {
+    fn default() -> Self {
+        Self::from(&RenderConfig::default())
+    }
+}
+
+impl From<&RenderConfig> for EncodeOptions {
+    fn from(config: &RenderConfig) -> Self {
+        Self {
+            png_compression: config.png_compression,
+            png_filter: config.png_filter,
+            png_palette: config.png_palette,
+            jpeg_quality: config.jpeg_quality.clamp(1, 100),
+        }
+    }
+}
+
 /// Static image type (center, bbox, or auto)
 #[derive(Debug, Clone)]
 pub enum StaticType {
@@ -152,9 +227,8 @@ pub struct StaticQueryParams {
 pub struct RenderOptions {
     /// Style ID for navigation
     pub style_id: String,
-    /// Style JSON content (kept for future use)
-    #[allow(dead_code)]
-    pub style_json: String,
+    /// Style to render
+    pub style: RenderStyle,
     /// Image width in pixels
     pub width: u32,
     /// Image height in pixels
@@ -187,7 +261,7 @@ impl RenderOptions {
     /// Create options for a raster tile
     pub fn for_tile(
         style_id: String,
-        style_json: String,
+        style: RenderStyle,
         z: u8,
         x: u32,
         y: u32,
@@ -207,7 +281,7 @@ impl RenderOptions {
 
         Self {
             style_id,
-            style_json,
+            style,
             width: tile_size,
             height: tile_size,
             scale,
@@ -226,7 +300,7 @@ impl RenderOptions {
     #[allow(clippy::too_many_arguments)]
     pub fn for_static(
         style_id: String,
-        style_json: String,
+        style: RenderStyle,
         static_type: StaticType,
         width: u32,
         height: u32,
@@ -367,7 +441,7 @@ impl RenderOptions {
 
         Ok(Self {
             style_id,
-            style_json,
+            style,
             width,
             height,
             scale,
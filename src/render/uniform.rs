@@ -0,0 +1,112 @@
+//! Shared encodings of single-colour tiles
+//!
+//! Large parts of a map render to tiles of one colour (open ocean, empty land
+//! at high zoom). Those encode to the same bytes every time, so each colour,
+//! size and format is encoded once and the result reused.
+
+use std::collections::HashMap;
+use std::sync::Mutex;
+
+use bytes::Bytes;
+
+use super::native::RenderedImage;
+use super::types::ImageFormat;
+use crate::error::Result;
+
+/// Distinct encodings kept; tiles of further colours are encoded as usual
+const MAX_ENCODINGS: usize = 1024;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+struct UniformKey {
+    color: [u8; 4],
+    width: u32,
+    height: u32,
+    format: ImageFormat,
+}
+
+#[derive(Default)]
+pub struct UniformTiles {
+    encoded: Mutex<HashMap<UniformKey, Bytes>>,
+}
+
+impl UniformTiles {
+    /// Encode `image` with `encode`, or return the earlier encoding of an
+    /// image of the same colour and size if it is a single colour
+    pub fn encode(
+        &self,
+        image: RenderedImage,
+        format: ImageFormat,
+        encode: impl FnOnce(RenderedImage) -> Result<Vec<u8>>,
+    ) -> Result<Bytes> {
+        let Some(color) = image.uniform_color() else {
+            return encode(image).map(Bytes::from);
+        };
+
+        let key = UniformKey {
+            color,
+            width: image.width(),
+            height: image.height(),
+            format,
+        };
+        if let Some(data) = self.lock().get(&key) {
+            super::metrics::metrics().uniform_tiles.add(1, &[]);
+            return Ok(data.clone());
+        }
+
+        let data = Bytes::from(encode(image)?);
+        let mut encoded = self.lock();
+        if encoded.len() < MAX_ENCODINGS {
+            encoded.insert(key, data.clone());
+        }
+        Ok(data)
+    }
+
+    /// Number of encodings kept
+    #[allow(dead_code)]
+    pub fn len(&self) -> usize {
+        self.lock().len()
+    }
+
+    fn lock(&self) -> std::sync::MutexGuard<'_, HashMap<UniformKey, Bytes>> {
+        self.encoded.lock().unwrap_or_else(|e| e.into_inner())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::cell::Cell;
+
+    #[test]
+    fn test_uniform_tiles_are_encoded_once() {
+        let tiles = UniformTiles::default();
+        let encodes = Cell::new(0);
+        let encode = |image: RenderedImage| {
+            encodes.set(encodes.get() + 1);
+            Ok(image.data()[..4].to_vec())
+        };
+        let uniform = |color: [u8; 4]| RenderedImage::from_rgba(4, 4, color.repeat(16));
+
+        let ocean = tiles
+            .encode(uniform([170, 211, 223, 255]), ImageFormat::Png, encode)
+            .unwrap();
+        let again = tiles
+            .encode(uniform([170, 211, 223, 255]), ImageFormat::Png, encode)
+            .unwrap();
+        assert_eq!(ocean, again);
+        assert_eq!(encodes.get(), 1);
+
+        // Other colours, formats and non-uniform images are encoded
+        tiles
+            .encode(uniform([242, 239, 233, 255]), ImageFormat::Png, encode)
+            .unwrap();
+        tiles
+            .encode(uniform([170, 211, 223, 255]), ImageFormat::Webp, encode)
+            .unwrap();
+        let mut mixed = uniform([170, 211, 223, 255]);
+        mixed.data_mut()[60] = 0;
+        tiles.encode(mixed, ImageFormat::Png, encode).unwrap();
+        assert_eq!(encodes.get(), 4);
+        assert_eq!(tiles.len(), 3);
+    }
+}
@@ -0,0 +1,350 @@
+//! Per-request style variants
+//!
+//! A variant is a base style with a few edits: layers shown or hidden,
+//! paint or layout properties and filters changed, GeoJSON sources pointed
+//! elsewhere. Pooled maps with the base style loaded switch between its
+//! variants by undoing the edits of one and applying those of the next,
+//! keeping the parsed style and its loaded tiles, rather than loading a
+//! rewritten style JSON from scratch. Variants may also add sources and
+//! layers, such as the overlays of a static image, which are removed again
+//! when the map switches away.
+
+use serde::{Deserialize, Serialize};
+use serde_json::Value;
+
+use super::native::{hash_style, NativeMap};
+use crate::error::{Result, TileServerError};
+
+/// An edit of a loaded style
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+#[serde(tag = "type", rename_all = "snake_case")]
+pub enum StyleEdit {
+    /// Show or hide a layer
+    Visibility { layer: String, visible: bool },
+    /// Set a paint or layout property of a layer; `null` restores its default
+    Property {
+        layer: String,
+        name: String,
+        value: Value,
+    },
+    /// Replace the filter of a layer; `null` removes it
+    Filter { layer: String, filter: Value },
+    /// Point a GeoJSON source at another URL
+    SourceUrl { source: String, url: String },
+    /// Add a source, defined as in a style's `sources`
+    AddSource { source: String, definition: Value },
+    /// Remove a source no layer uses
+    RemoveSource { source: String },
+    /// Add a layer, defined as in a style's `layers`, below `before` or on top
+    AddLayer {
+        layer: Value,
+        before: Option<String>,
+    },
+    /// Remove a layer
+    RemoveLayer { layer: String },
+}
+
+/// Edits of a base style, with the edits that restore it
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct StyleVariant {
+    edits: Vec<StyleEdit>,
+    undo: Vec<StyleEdit>,
+    hash: u64,
+}
+
+impl StyleVariant {
+    /// A variant of `base`, the parsed base style. Fails if an edit names a
+    /// layer or source the style lacks, a GeoJSON source with inline data
+    /// that could not be restored, or adds one it already has. Removals
+    /// can't be undone and fail too.
+    pub fn new(base: &Value, edits: Vec<StyleEdit>) -> Result<Self> {
+        let undo = edits
+            .iter()
+            .rev()
+            .map(|edit| restore(base, edit))
+            .collect::<Result<_>>()?;
+        let hash = hash_style(&serde_json::to_string(&edits).unwrap_or_default());
+        Ok(Self { edits, undo, hash })
+    }
+
+    /// Identifies the edits, across variants of the same base style
+    pub fn hash(&self) -> u64 {
+        self.hash
+    }
+
+    /// Apply the edits to a map with the base style loaded
+    pub fn apply(&self, map: &mut NativeMap) -> Result<()> {
+        self.edits.iter().try_for_each(|edit| map.edit_style(edit))
+    }
+
+    /// Restore the base style on a map the edits were applied to
+    pub fn undo(&self, map: &mut NativeMap) -> Result<()> {
+        self.undo.iter().try_for_each(|edit| map.edit_style(edit))
+    }
+}
+
+/// The edit that sets back what `edit` changes in `base`
+fn restore(base: &Value, edit: &StyleEdit) -> Result<StyleEdit> {
+    Ok(match edit {
+        StyleEdit::Visibility { layer, .. } => {
+            let visibility = &find_layer(base, layer)?["layout"]["visibility"];
+            StyleEdit::Visibility {
+                layer: layer.clone(),
+                visible: visibility.as_str() != Some("none"),
+            }
+        }
+        StyleEdit::Property { layer, name, .. } => {
+            let style_layer = find_layer(base, layer)?;
+            let value = ["paint", "layout"]
+                .iter()
+                .find_map(|group| style_layer[group].get(name))
+                .cloned()
+                .unwrap_or(Value::Null);
+            StyleEdit::Property {
+                layer: layer.clone(),
+                name: name.clone(),
+                value,
+            }
+        }
+        StyleEdit::Filter { layer, .. } => StyleEdit::Filter {
+            layer: layer.clone(),
+            filter: find_layer(base, layer)?["filter"].clone(),
+        },
+        StyleEdit::SourceUrl { source, .. } => {
+            let style_source = base["sources"].get(source).ok_or_else(|| {
+                TileServerError::RenderError(format!("Style has no source '{}'", source))
+            })?;
+            let url = match (style_source["type"].as_str(), &style_source["data"]) {
+                (Some("geojson"), Value::String(url)) => url.clone(),
+                _ => {
+                    return Err(TileServerError::RenderError(format!(
+                        "Source '{}' has no GeoJSON URL to change",
+                        source
+                    )))
+                }
+            };
+            StyleEdit::SourceUrl {
+                source: source.clone(),
+                url,
+            }
+        }
+        StyleEdit::AddSource { source, .. } => {
+            if base["sources"].get(source).is_some() {
+                return Err(TileServerError::RenderError(format!(
+                    "Style already has a source '{}'",
+                    source
+                )));
+            }
+            StyleEdit::RemoveSource {
+                source: source.clone(),
+            }
+        }
+        StyleEdit::AddLayer { layer, .. } => {
+            let id = layer["id"]
+                .as_str()
+                .ok_or_else(|| TileServerError::RenderError("Added layer has no id".to_string()))?;
+            if find_layer(base, id).is_ok() {
+                return Err(TileServerError::RenderError(format!(
+                    "Style already has a layer '{}'",
+                    id
+                )));
+            }
+            StyleEdit::RemoveLayer {
+                layer: id.to_string(),
+            }
+        }
+        StyleEdit::RemoveSource { .. } | StyleEdit::RemoveLayer { .. } => {
+            return Err(TileServerError::RenderError(
+                "Removed sources and layers can't be restored".to_string(),
+            ))
+        }
+    })
+}
+
+fn find_layer<'a>(base: &'a Value, id: &str) -> Result<&'a Value> {
+    base["layers"]
+        .as_array()
+        .and_then(|layers| layers.iter().find(|layer| layer["id"] == id))
+        .ok_or_else(|| TileServerError::RenderError(format!("Style has no layer '{}'", id)))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use serde_json::json;
+
+    fn base() -> Value {
+        json!({
+            "version": 8,
+            "sources": {
+                "places": {"type": "geojson", "data": "https://example.com/places.geojson"},
+                "roads": {"type": "vector", "url": "https://example.com/roads.json"}
+            },
+            "layers": [
+                {"id": "water", "type": "fill", "paint": {"fill-color": "#aad3df"}},
+                {
+                    "id": "labels",
+                    "type": "symbol",
+                    "layout": {"visibility": "none", "text-field": "{name}"},
+                    "filter": ["==", "class", "city"]
+                }
+            ]
+        })
+    }
+
+    #[test]
+    fn test_undo_restores_base_values_in_reverse() {
+        let variant = StyleVariant::new(
+            &base(),
+            vec![
+                StyleEdit::Visibility {
+                    layer: "labels".to_string(),
+                    visible: true,
+                },
+                StyleEdit::Property {
+                    layer: "water".to_string(),
+                    name: "fill-color".to_string(),
+                    value: json!("#000000"),
+                },
+                StyleEdit::Property {
+                    layer: "labels".to_string(),
+                    name: "text-field".to_string(),
+                    value: json!("{name:fr}"),
+                },
+                StyleEdit::Property {
+                    layer: "water".to_string(),
+                    name: "fill-opacity".to_string(),
+                    value: json!(0.5),
+                },
+                StyleEdit::Filter {
+                    layer: "water".to_string(),
+                    filter: json!(["has", "name"]),
+                },
+                StyleEdit::SourceUrl {
+                    source: "places".to_string(),
+                    url: "https://example.com/other.geojson".to_string(),
+                },
+            ],
+        )
+        .unwrap();
+
+        assert_eq!(
+            variant.undo,
+            vec![
+                StyleEdit::SourceUrl {
+                    source: "places".to_string(),
+                    url: "https://example.com/places.geojson".to_string(),
+                },
+                StyleEdit::Filter {
+                    layer: "water".to_string(),
+                    filter: Value::Null,
+                },
+                StyleEdit::Property {
+                    layer: "water".to_string(),
+                    name: "fill-opacity".to_string(),
+                    value: Value::Null,
+                },
+                StyleEdit::Property {
+                    layer: "labels".to_string(),
+                    name: "text-field".to_string(),
+                    value: json!("{name}"),
+                },
+                StyleEdit::Property {
+                    layer: "water".to_string(),
+                    name: "fill-color".to_string(),
+                    value: json!("#aad3df"),
+                },
+                StyleEdit::Visibility {
+                    layer: "labels".to_string(),
+                    visible: false,
+                },
+            ]
+        );
+    }
+
+    #[test]
+    fn test_variant_rejects_edits_it_cannot_undo() {
+        let hide = |layer: &str| StyleEdit::Visibility {
+            layer: layer.to_string(),
+            visible: false,
+        };
+        let move_source = |source: &str| StyleEdit::SourceUrl {
+            source: source.to_string(),
+            url: "https://example.com/other".to_string(),
+        };
+
+        assert!(StyleVariant::new(&base(), vec![hide("missing")]).is_err());
+        assert!(StyleVariant::new(&base(), vec![move_source("missing")]).is_err());
+        // Tiled sources can't change their URL in place
+        assert!(StyleVariant::new(&base(), vec![move_source("roads")]).is_err());
+    }
+
+    #[test]
+    fn test_additions_are_removed_in_reverse() {
+        let variant = StyleVariant::new(
+            &base(),
+            vec![
+                StyleEdit::AddSource {
+                    source: "route".to_string(),
+                    definition: json!({"type": "geojson", "data": {"type": "FeatureCollection", "features": []}}),
+                },
+                StyleEdit::AddLayer {
+                    layer: json!({"id": "route-line", "type": "line", "source": "route"}),
+                    before: Some("labels".to_string()),
+                },
+            ],
+        )
+        .unwrap();
+
+        assert_eq!(
+            variant.undo,
+            vec![
+                StyleEdit::RemoveLayer {
+                    layer: "route-line".to_string(),
+                },
+                StyleEdit::RemoveSource {
+                    source: "route".to_string(),
+                },
+            ]
+        );
+
+        // Additions must not shadow the style, and removals can't be undone
+        let add_layer = |id: &str| StyleEdit::AddLayer {
+            layer: json!({"id": id, "type": "fill", "source": "roads"}),
+            before: None,
+        };
+        assert!(StyleVariant::new(&base(), vec![add_layer("water")]).is_err());
+        assert!(StyleVariant::new(
+            &base(),
+            vec![StyleEdit::AddSource {
+                source: "roads".to_string(),
+                definition: json!({"type": "vector"}),
+            }]
+        )
+        .is_err());
+        assert!(StyleVariant::new(
+            &base(),
+            vec![StyleEdit::RemoveLayer {
+                layer: "water".to_string(),
+            }]
+        )
+        .is_err());
+    }
+
+    #[test]
+    fn test_variant_hash_identifies_edits() {
+        let variant = |visible| {
+            StyleVariant::new(
+                &base(),
+                vec![StyleEdit::Visibility {
+                    layer: "water".to_string(),
+                    visible,
+                }],
+            )
+            .unwrap()
+        };
+
+        assert_eq!(variant(false).hash(), variant(false).hash());
+        assert_ne!(variant(false).hash(), variant(true).hash());
+    }
+}
@@ -0,0 +1,486 @@
+//! Bulk pre-rendering of raster tiles (`tileserver-rs seed`)
+//!
+//! Walks a bounding box and zoom range one metatile at a time, keeping as
+//! many renders in flight as the render pool runs at once, and writes the
+//! tiles into an MBTiles archive or the render cache. Tiles that are already
+//! there are skipped, so an interrupted seed continues where it stopped.
+
+use std::collections::HashSet;
+use std::path::Path;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use anyhow::Context;
+use bytes::Bytes;
+use futures::StreamExt;
+use rusqlite::{params, Connection};
+use tokio::sync::mpsc;
+
+use crate::cli::SeedArgs;
+use crate::error::TileServerError;
+use crate::render::{ImageFormat, Priority, RenderStyle, Renderer};
+use crate::AppState;
+
+/// Web Mercator latitude limit
+const MAX_LAT: f64 = 85.051_128_779_806_59;
+const PROGRESS_INTERVAL: Duration = Duration::from_secs(5);
+/// Tiles written to MBTiles per transaction, at most
+const WRITE_BATCH: usize = 512;
+
+/// A rendered tile on its way to the archive
+type Tile = (u8, u32, u32, Bytes);
+type Writer = tokio::task::JoinHandle<anyhow::Result<()>>;
+
+pub async fn run(state: AppState, args: SeedArgs) -> anyhow::Result<()> {
+    let renderer = state
+        .renderer
+        .clone()
+        .context("Rendering is unavailable; configure styles and the native renderer")?;
+    let style = state
+        .styles
+        .get(&args.style)
+        .with_context(|| format!("Unknown style '{}'", args.style))?;
+    let render_style = state
+        .render_styles
+        .get(&style.id)
+        .cloned()
+        .context("Style was not prepared for rendering")?;
+    let format: ImageFormat = args
+        .format
+        .parse()
+        .map_err(|_| anyhow::anyhow!("Unknown tile format '{}'", args.format))?;
+    if args.min_zoom > args.max_zoom || args.max_zoom > 30 {
+        anyhow::bail!("Zoom range must satisfy min_zoom <= max_zoom <= 30");
+    }
+
+    let bbox = args.bbox.unwrap_or([-180.0, -MAX_LAT, 180.0, MAX_LAT]);
+    let zooms = args.min_zoom..=args.max_zoom;
+    let total: u64 = zooms.clone().map(|z| TileRange::new(bbox, z).len()).sum();
+
+    let (existing, writer) = match &args.output {
+        Some(path) => {
+            let archive = MbTilesWriter::open(path, &style.name, format, bbox, &zooms)?;
+            let existing = archive.existing()?;
+            (existing, Some(archive.spawn()))
+        }
+        None => {
+            // Tiles only in memory would be gone when the command exits
+            if renderer.pool().config().cache_dir.is_none() {
+                anyhow::bail!("Seeding without --output needs render.cache_dir");
+            }
+            (HashSet::new(), None)
+        }
+    };
+    let (sender, writer) = writer.unzip();
+
+    let pool = renderer.pool().stats();
+    let concurrency = args
+        .concurrency
+        .unwrap_or(pool.threads * renderer.pool().config().maps_per_thread)
+        .max(1);
+    tracing::info!(
+        "Seeding style '{}' z{}-{}, {} tiles ({} already present), {} metatiles at a time",
+        args.style,
+        args.min_zoom,
+        args.max_zoom,
+        total,
+        existing.len(),
+        concurrency
+    );
+
+    let seed = Seed {
+        renderer,
+        style: render_style,
+        scale: args.scale,
+        format,
+        existing,
+        sender,
+        progress: Progress::default(),
+    };
+    let started = Instant::now();
+    let reporter = tokio::spawn(seed.progress.clone().report(total, started));
+
+    let blocks = zooms.flat_map(|z| TileRange::new(bbox, z).blocks(seed.renderer.metatile()));
+    futures::stream::iter(blocks)
+        .for_each_concurrent(concurrency, |block| seed.render_block(block))
+        .await;
+
+    let Seed {
+        sender, progress, ..
+    } = seed;
+    // Let the writer commit everything before reporting
+    drop(sender);
+    if let Some(writer) = writer {
+        writer.await.context("MBTiles writer failed")??;
+    }
+    reporter.abort();
+
+    let elapsed = started.elapsed().as_secs_f64();
+    let rendered = progress.rendered.load(Ordering::Relaxed);
+    let failed = progress.failed.load(Ordering::Relaxed);
+    tracing::info!(
+        "Seeded {} tiles in {:.1}s ({:.1} tiles/s), {} skipped, {} failed",
+        rendered,
+        elapsed,
+        rendered as f64 / elapsed.max(f64::EPSILON),
+        progress.skipped.load(Ordering::Relaxed),
+        failed
+    );
+    if failed > 0 {
+        anyhow::bail!("{} tiles failed to render", failed);
+    }
+    Ok(())
+}
+
+struct Seed {
+    renderer: Arc<Renderer>,
+    style: RenderStyle,
+    scale: u8,
+    format: ImageFormat,
+    /// Tiles already in the archive
+    existing: HashSet<(u8, u32, u32)>,
+    /// Where rendered tiles go, if not the render cache
+    sender: Option<mpsc::Sender<Tile>>,
+    progress: Progress,
+}
+
+impl Seed {
+    /// Render the tiles of one block that are missing. One render usually
+    /// covers the whole block; it takes more where the renderer shrinks its
+    /// metatiles (at low zooms or high scales).
+    async fn render_block(&self, block: Vec<(u8, u32, u32)>) {
+        let wanted: HashSet<_> = block.iter().copied().collect();
+        let mut done = HashSet::new();
+        for tile @ (z, x, y) in block {
+            if done.contains(&tile) {
+                continue;
+            }
+            if self.is_seeded(tile).await {
+                self.progress.skipped.fetch_add(1, Ordering::Relaxed);
+                continue;
+            }
+
+            let rendered = loop {
+                let rendered = self
+                    .renderer
+                    .render_tiles(
+                        &self.style,
+                        z,
+                        x,
+                        y,
+                        self.scale,
+                        self.format,
+                        Priority::Bulk,
+                    )
+                    .await;
+                // Other renders have the pool's attention; back off
+                match rendered {
+                    Err(TileServerError::Overloaded { retry_after }) => {
+                        tokio::time::sleep(Duration::from_secs(retry_after)).await
+                    }
+                    rendered => break rendered,
+                }
+            };
+            let tiles = match rendered {
+                Ok(tiles) => tiles,
+                Err(e) => {
+                    tracing::warn!("Failed to render tile {}/{}/{}: {}", z, x, y, e);
+                    self.progress.failed.fetch_add(1, Ordering::Relaxed);
+                    continue;
+                }
+            };
+
+            // Siblings outside the bbox or already in the archive are dropped
+            for ((x, y), data) in tiles.iter() {
+                let sibling = (z, *x, *y);
+                if !wanted.contains(&sibling)
+                    || self.existing.contains(&sibling)
+                    || !done.insert(sibling)
+                {
+                    continue;
+                }
+                self.progress.rendered.fetch_add(1, Ordering::Relaxed);
+                if let Some(sender) = &self.sender {
+                    if sender.send((z, *x, *y, data.clone())).await.is_err() {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    async fn is_seeded(&self, (z, x, y): (u8, u32, u32)) -> bool {
+        match self.sender {
+            Some(_) => self.existing.contains(&(z, x, y)),
+            None => {
+                self.renderer
+                    .is_cached(&self.style, z, x, y, self.scale, self.format)
+                    .await
+            }
+        }
+    }
+}
+
+#[derive(Clone, Default)]
+struct Progress {
+    rendered: Arc<AtomicU64>,
+    skipped: Arc<AtomicU64>,
+    failed: Arc<AtomicU64>,
+}
+
+impl Progress {
+    /// Log progress and throughput until aborted
+    async fn report(self, total: u64, started: Instant) {
+        let mut interval = tokio::time::interval(PROGRESS_INTERVAL);
+        interval.tick().await;
+        loop {
+            interval.tick().await;
+            let rendered = self.rendered.load(Ordering::Relaxed);
+            let done = rendered
+                + self.skipped.load(Ordering::Relaxed)
+                + self.failed.load(Ordering::Relaxed);
+            let rate = rendered as f64 / started.elapsed().as_secs_f64();
+            let eta = (total.saturating_sub(done)) as f64 / rate.max(f64::EPSILON);
+            tracing::info!(
+                "{}/{} tiles ({:.1}%), {:.1} tiles/s, ETA {:.0}s",
+                done,
+                total,
+                done as f64 * 100.0 / total.max(1) as f64,
+                rate,
+                eta
+            );
+        }
+    }
+}
+
+/// Tiles of one zoom level inside a bounding box
+#[derive(Debug, Clone, Copy, PartialEq)]
+struct TileRange {
+    z: u8,
+    min_x: u32,
+    min_y: u32,
+    max_x: u32,
+    max_y: u32,
+}
+
+impl TileRange {
+    fn new([min_lon, min_lat, max_lon, max_lat]: [f64; 4], z: u8) -> Self {
+        let n = (1u64 << z) as f64;
+        let last = (1u64 << z) - 1;
+        let x = |lon: f64| (((lon.clamp(-180.0, 180.0) + 180.0) / 360.0 * n) as u64).min(last);
+        let y = |lat: f64| {
+            let lat = lat.clamp(-MAX_LAT, MAX_LAT).to_radians();
+            let y = (1.0 - lat.tan().asinh() / std::f64::consts::PI) / 2.0 * n;
+            (y.max(0.0) as u64).min(last)
+        };
+        Self {
+            z,
+            min_x: x(min_lon) as u32,
+            max_x: x(max_lon) as u32,
+            min_y: y(max_lat) as u32,
+            max_y: y(min_lat) as u32,
+        }
+    }
+
+    fn len(&self) -> u64 {
+        (self.max_x - self.min_x + 1) as u64 * (self.max_y - self.min_y + 1) as u64
+    }
+
+    /// The range's tiles grouped by `metatile`-aligned blocks, row by row
+    fn blocks(self, metatile: u32) -> impl Iterator<Item = Vec<(u8, u32, u32)>> {
+        let size = metatile.max(1);
+        let (z, range) = (self.z, self);
+        let rows = (range.min_y / size..=range.max_y / size).map(move |row| row * size);
+        rows.flat_map(move |block_y| {
+            (range.min_x / size..=range.max_x / size).map(move |column| {
+                let block_x = column * size;
+                let ys = block_y.max(range.min_y)..=(block_y + size - 1).min(range.max_y);
+                ys.flat_map(|y| {
+                    (block_x.max(range.min_x)..=(block_x + size - 1).min(range.max_x))
+                        .map(move |x| (z, x, y))
+                })
+                .collect()
+            })
+        })
+    }
+}
+
+/// An MBTiles archive being seeded
+struct MbTilesWriter {
+    conn: Connection,
+}
+
+impl MbTilesWriter {
+    /// Open or create the archive and record its metadata
+    fn open(
+        path: &Path,
+        name: &str,
+        format: ImageFormat,
+        bbox: [f64; 4],
+        zooms: &std::ops::RangeInclusive<u8>,
+    ) -> anyhow::Result<Self> {
+        let conn = Connection::open(path)
+            .with_context(|| format!("Failed to open MBTiles archive {}", path.display()))?;
+        conn.execute_batch(
+            "PRAGMA journal_mode = WAL;
+             PRAGMA synchronous = NORMAL;
+             CREATE TABLE IF NOT EXISTS metadata (name TEXT, value TEXT);
+             CREATE UNIQUE INDEX IF NOT EXISTS name ON metadata (name);
+             CREATE TABLE IF NOT EXISTS tiles (
+                 zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER, tile_data BLOB
+             );
+             CREATE UNIQUE INDEX IF NOT EXISTS tile_index
+                 ON tiles (zoom_level, tile_column, tile_row);",
+        )?;
+
+        let format = match format {
+            ImageFormat::Png => "png",
+            ImageFormat::Jpeg => "jpg",
+            ImageFormat::Webp => "webp",
+        };
+        let bounds = bbox.map(|v| v.to_string()).join(",");
+        let metadata = [
+            ("name", name.to_string()),
+            ("format", format.to_string()),
+            ("type", "baselayer".to_string()),
+            ("bounds", bounds),
+            ("minzoom", zooms.start().to_string()),
+            ("maxzoom", zooms.end().to_string()),
+        ];
+        for (name, value) in metadata {
+            conn.execute(
+                "INSERT OR REPLACE INTO metadata (name, value) VALUES (?1, ?2)",
+                params![name, value],
+            )?;
+        }
+        Ok(Self { conn })
+    }
+
+    /// Tiles already in the archive, in XYZ coordinates
+    fn existing(&self) -> anyhow::Result<HashSet<(u8, u32, u32)>> {
+        let mut stmt = self
+            .conn
+            .prepare("SELECT zoom_level, tile_column, tile_row FROM tiles")?;
+        let tiles = stmt
+            .query_map([], |row| {
+                let z: u8 = row.get(0)?;
+                let x: u32 = row.get(1)?;
+                let row: u32 = row.get(2)?;
+                Ok((z, x, flip_y(z, row)))
+            })?
+            .collect::<Result<_, _>>()?;
+        Ok(tiles)
+    }
+
+    /// Write tiles from a channel until it closes, a transaction per batch
+    fn spawn(mut self) -> (mpsc::Sender<Tile>, Writer) {
+        let (sender, mut receiver) = mpsc::channel::<Tile>(WRITE_BATCH * 4);
+        let writer = tokio::task::spawn_blocking(move || {
+            let mut batch = Vec::with_capacity(WRITE_BATCH);
+            while let Some(tile) = receiver.blocking_recv() {
+                batch.push(tile);
+                while batch.len() < WRITE_BATCH {
+                    match receiver.try_recv() {
+                        Ok(tile) => batch.push(tile),
+                        Err(_) => break,
+                    }
+                }
+                self.write(&batch)?;
+                batch.clear();
+            }
+            Ok(())
+        });
+        (sender, writer)
+    }
+
+    fn write(&mut self, tiles: &[Tile]) -> anyhow::Result<()> {
+        let tx = self.conn.transaction()?;
+        {
+            let mut stmt = tx.prepare_cached(
+                "INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data)
+                 VALUES (?1, ?2, ?3, ?4)",
+            )?;
+            for (z, x, y, data) in tiles {
+                stmt.execute(params![z, x, flip_y(*z, *y), data.as_ref()])?;
+            }
+        }
+        tx.commit()?;
+        Ok(())
+    }
+}
+
+/// Convert between XYZ and TMS (MBTiles) rows
+fn flip_y(z: u8, y: u32) -> u32 {
+    ((1u64 << z) - 1 - y as u64) as u32
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_tile_range() {
+        let world = TileRange::new([-180.0, -MAX_LAT, 180.0, MAX_LAT], 2);
+        assert_eq!(
+            (world.min_x, world.max_x, world.min_y, world.max_y),
+            (0, 3, 0, 3)
+        );
+        assert_eq!(world.len(), 16);
+
+        // Berlin at z10
+        let berlin = TileRange::new([13.3, 52.45, 13.5, 52.55], 10);
+        assert_eq!((berlin.min_x, berlin.max_x), (549, 550));
+        assert_eq!((berlin.min_y, berlin.max_y), (335, 336));
+    }
+
+    #[test]
+    fn test_blocks_follow_metatiles() {
+        let range = TileRange {
+            z: 5,
+            min_x: 3,
+            max_x: 8,
+            min_y: 1,
+            max_y: 2,
+        };
+        let blocks: Vec<_> = range.blocks(4).collect();
+
+        // Columns 0-3, 4-7 and 8-11 of rows 0-3, clipped to the range
+        assert_eq!(blocks.len(), 3);
+        assert_eq!(blocks[0], [(5, 3, 1), (5, 3, 2)]);
+        assert_eq!(blocks[1].len(), 8);
+        assert_eq!(blocks[2], [(5, 8, 1), (5, 8, 2)]);
+        let tiles: usize = blocks.iter().map(Vec::len).sum();
+        assert_eq!(tiles as u64, range.len());
+    }
+
+    #[test]
+    fn test_mbtiles_resume() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("seed.mbtiles");
+        let bbox = [-180.0, -MAX_LAT, 180.0, MAX_LAT];
+
+        let mut archive =
+            MbTilesWriter::open(&path, "test", ImageFormat::Png, bbox, &(0..=2)).unwrap();
+        archive
+            .write(&[
+                (0, 0, 0, Bytes::from_static(b"a")),
+                (2, 1, 0, Bytes::from_static(b"b")),
+            ])
+            .unwrap();
+        drop(archive);
+
+        let archive = MbTilesWriter::open(&path, "test", ImageFormat::Png, bbox, &(0..=2)).unwrap();
+        let existing = archive.existing().unwrap();
+        assert_eq!(existing, HashSet::from([(0, 0, 0), (2, 1, 0)]));
+
+        // Rows are stored TMS-style
+        let row: u32 = archive
+            .conn
+            .query_row("SELECT tile_row FROM tiles WHERE zoom_level = 2", [], |r| {
+                r.get(0)
+            })
+            .unwrap();
+        assert_eq!(row, 3);
+    }
+}